@@ -0,0 +1,155 @@
+#include <acpi.h>
+#include <mem.h>
+#include <mem/vmm.h>
+
+PRIVATE const acpi_rsdp_t* rsdp = NULL;
+PRIVATE const acpi_sdt_header_t* rsdt = NULL;
+
+PRIVATE bool acpi_checksum_ok ( const void* p, uint32_t length )
+{
+    const uint8_t* b = ( const uint8_t* ) p;
+    uint8_t sum = 0;
+
+    while ( length-- )
+        sum += *b++;
+    return sum == 0;
+}
+
+/* Make a physical range readable. The first 4MB are mapped already, the
+ * rest goes in the MMIO window */
+PRIVATE const void* acpi_map ( uint32_t phys, uint32_t size )
+{
+    if ( phys + size <= KERNEL_LOW_MAPPED_SIZE )
+        return ( const void* ) KERNEL_PHYS_TO_VIRT ( phys );
+    return ( const void* ) vmm_map_physical ( phys, size, PTE_PAGE_WRITE );
+}
+
+/* Map a whole table, given its physical address */
+PRIVATE const acpi_sdt_header_t* acpi_map_table ( uint32_t phys )
+{
+    const acpi_sdt_header_t* h;
+
+    h = ( const acpi_sdt_header_t* ) acpi_map ( phys, sizeof ( acpi_sdt_header_t ) );
+    if ( !h )
+        return NULL;
+
+    /* The header told us how long it is. Map all of it, unless it fit in the
+     * page we just mapped */
+    if ( ( phys & ~PAGE_MASK ) + h->length > PAGE_SIZE )
+        h = ( const acpi_sdt_header_t* ) acpi_map ( phys, h->length );
+
+    if ( !h || !acpi_checksum_ok ( h, h->length ) )
+        return NULL;
+    return h;
+}
+
+PRIVATE const acpi_rsdp_t* acpi_scan_rsdp ( uint32_t start, uint32_t end )
+{
+    const acpi_rsdp_t* p;
+
+    for ( ; start < end; start += 16 ) {
+        p = ( const acpi_rsdp_t* ) KERNEL_PHYS_TO_VIRT ( start );
+        if ( !memcmp ( p->signature, ACPI_RSDP_SIGNATURE, 8 ) &&
+             acpi_checksum_ok ( p, sizeof ( acpi_rsdp_t ) ) )
+            return p;
+    }
+    return NULL;
+}
+
+PRIVATE bool acpi_init ( void )
+{
+    uint32_t ebda;
+
+    if ( rsdt )
+        return true;
+
+    ebda = *( const uint16_t* ) KERNEL_PHYS_TO_VIRT ( BDA_EBDA_SEGMENT ) << 4;
+    if ( ebda )
+        rsdp = acpi_scan_rsdp ( ebda, ebda + 1024 );
+    if ( !rsdp )
+        rsdp = acpi_scan_rsdp ( BIOS_AREA_START, BIOS_AREA_END );
+    if ( !rsdp )
+        return false;
+
+    rsdt = acpi_map_table ( rsdp->rsdt_address );
+    return rsdt != NULL;
+}
+
+const acpi_sdt_header_t* acpi_find_table ( const char* signature )
+{
+    const uint32_t* entries;
+    const acpi_sdt_header_t* h;
+    uint32_t i, n;
+
+    if ( !acpi_init () )
+        return NULL;
+
+    /* The RSDT's body is an array of physical addresses */
+    entries = ( const uint32_t* ) ( rsdt + 1 );
+    n = ( rsdt->length - sizeof ( acpi_sdt_header_t ) ) / sizeof ( uint32_t );
+
+    for ( i = 0; i < n; i++ ) {
+        h = acpi_map_table ( entries[i] );
+        if ( h && !memcmp ( h->signature, signature, 4 ) )
+            return h;
+    }
+    return NULL;
+}
+
+bool acpi_parse_madt ( apic_config_t* config )
+{
+    const acpi_madt_t* madt;
+    const acpi_madt_entry_t* e;
+    const uint8_t* end;
+    const acpi_madt_lapic_t* lapic;
+    const acpi_madt_ioapic_t* ioapic;
+    const acpi_madt_iso_t* iso;
+    const acpi_madt_lapic_override_t* override;
+
+    madt = ( const acpi_madt_t* ) acpi_find_table ( ACPI_MADT_SIGNATURE );
+    if ( !madt )
+        return false;
+
+    config->lapic_address = madt->lapic_address;
+
+    e = ( const acpi_madt_entry_t* ) ( madt + 1 );
+    end = ( const uint8_t* ) madt + madt->header.length;
+    for ( ; ( const uint8_t* ) e < end && e->length;
+            e = ( const acpi_madt_entry_t* ) ( ( const uint8_t* ) e + e->length ) ) {
+        switch ( e->type ) {
+        case ACPI_MADT_LAPIC:
+            lapic = ( const acpi_madt_lapic_t* ) e;
+            if ( ( lapic->flags & ACPI_MADT_LAPIC_ENABLED ) &&
+                 config->num_cpus < MAX_CPUS )
+                config->cpu_apic_ids[config->num_cpus++] = lapic->apic_id;
+            break;
+        case ACPI_MADT_IOAPIC:
+            ioapic = ( const acpi_madt_ioapic_t* ) e;
+            if ( config->num_ioapics < MAX_IOAPICS ) {
+                config->ioapics[config->num_ioapics].address = ioapic->address;
+                config->ioapics[config->num_ioapics].id = ioapic->id;
+                config->ioapics[config->num_ioapics].gsi_base = ioapic->gsi_base;
+                config->num_ioapics++;
+            }
+            break;
+        case ACPI_MADT_ISO:
+            iso = ( const acpi_madt_iso_t* ) e;
+            if ( iso->bus == 0 && iso->source < ISA_IRQS ) {
+                config->isa_gsi[iso->source] = iso->gsi;
+                config->isa_flags[iso->source] = iso->flags;
+            }
+            break;
+        case ACPI_MADT_LAPIC_OVERRIDE:
+            override = ( const acpi_madt_lapic_override_t* ) e;
+            if ( !override->address_high )
+                config->lapic_address = override->address_low;
+            break;
+        default:
+            break;
+        }
+    }
+
+    /* The MADT doesn't say, but machines that need the IMCR predate ACPI */
+    config->has_imcr = false;
+    return config->num_cpus > 0 && config->num_ioapics > 0;
+}
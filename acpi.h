@@ -0,0 +1,109 @@
+#ifndef ACPI_H
+#define ACPI_H
+#include <stdinc.h>
+#include <apic.h>
+/*
+ * Just enough ACPI to find the MADT.
+ *
+ * The firmware leaves a Root System Description Pointer (RSDP) somewhere in
+ * the first KB of the EBDA or in the BIOS area (0xE0000-0xFFFFF), on a 16 byte
+ * boundary, starting with "RSD PTR ". It points to the RSDT, which lists the
+ * physical addresses of all the other tables. Every table starts with the
+ * same header, and every table (and the RSDP) has a checksum: all its bytes
+ * add up to 0.
+ *
+ * The MADT ("APIC") lists the interrupt controllers: one entry per LAPIC
+ * (that is, per CPU), per I/O APIC, and per ISA IRQ that isn't wired to the
+ * GSI of the same number.
+ *
+ * We only use the RSDT: we're 32-bit, and the XSDT only adds 64-bit pointers.
+ */
+
+#define ACPI_RSDP_SIGNATURE  "RSD PTR "
+#define ACPI_MADT_SIGNATURE  "APIC"
+
+/* Where the BIOS Data Area keeps the EBDA's segment */
+#define BDA_EBDA_SEGMENT     0x40E
+
+#define BIOS_AREA_START      0xE0000
+#define BIOS_AREA_END        0x100000
+
+typedef struct {
+    char     signature[8];
+    uint8_t  checksum;
+    char     oem_id[6];
+    uint8_t  revision;
+    uint32_t rsdt_address;
+} __attribute__((packed)) acpi_rsdp_t;
+
+typedef struct {
+    char     signature[4];
+    uint32_t length;          /* Of the whole table, header included */
+    uint8_t  revision;
+    uint8_t  checksum;
+    char     oem_id[6];
+    char     oem_table_id[8];
+    uint32_t oem_revision;
+    uint32_t creator_id;
+    uint32_t creator_revision;
+} __attribute__((packed)) acpi_sdt_header_t;
+
+typedef struct {
+    acpi_sdt_header_t header;
+    uint32_t lapic_address;
+    uint32_t flags;
+} __attribute__((packed)) acpi_madt_t;
+
+#define ACPI_MADT_PCAT_COMPAT   1 /* There are 8259s too */
+
+/* The MADT's entries, which follow it */
+#define ACPI_MADT_LAPIC          0
+#define ACPI_MADT_IOAPIC         1
+#define ACPI_MADT_ISO            2
+#define ACPI_MADT_LAPIC_OVERRIDE 5
+
+typedef struct {
+    uint8_t type;
+    uint8_t length;
+} __attribute__((packed)) acpi_madt_entry_t;
+
+typedef struct {
+    acpi_madt_entry_t entry;
+    uint8_t  acpi_id;
+    uint8_t  apic_id;
+    uint32_t flags;
+} __attribute__((packed)) acpi_madt_lapic_t;
+
+#define ACPI_MADT_LAPIC_ENABLED 1
+
+typedef struct {
+    acpi_madt_entry_t entry;
+    uint8_t  id;
+    uint8_t  reserved;
+    uint32_t address;
+    uint32_t gsi_base;
+} __attribute__((packed)) acpi_madt_ioapic_t;
+
+typedef struct {
+    acpi_madt_entry_t entry;
+    uint8_t  bus;             /* Always 0, ISA */
+    uint8_t  source;          /* The ISA IRQ */
+    uint32_t gsi;
+    uint16_t flags;           /* IRQ_POLARITY_* | IRQ_TRIGGER_* */
+} __attribute__((packed)) acpi_madt_iso_t;
+
+typedef struct {
+    acpi_madt_entry_t entry;
+    uint16_t reserved;
+    uint32_t address_low;
+    uint32_t address_high;
+} __attribute__((packed)) acpi_madt_lapic_override_t;
+
+/* Find the table with the given signature. Returns a pointer to its mapped
+ * header, or NULL. Must be called after init_vmm */
+const acpi_sdt_header_t* acpi_find_table ( const char* signature );
+
+/* Fill in config from the MADT. Returns false if there's no MADT */
+bool acpi_parse_madt ( apic_config_t* config );
+
+#endif
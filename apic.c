@@ -0,0 +1,285 @@
+#include <apic.h>
+#include <acpi.h>
+#include <mptable.h>
+#include <irq.h>
+#include <idt.h>
+#include <mem.h>
+#include <mem/vmm.h>
+#include <screen.h>
+#include <spinlock.h>
+#include <x86/x86.h>
+
+extern void irq_spurious ();
+
+PRIVATE apic_config_t config;
+PRIVATE volatile uint32_t* lapic = NULL;
+PRIVATE volatile uint32_t* ioapics[MAX_IOAPICS];
+PRIVATE uint32_t ioapic_pins[MAX_IOAPICS];
+
+/* Every access to an I/O APIC register is two: select it in IOREGSEL, then
+ * read or write IOWIN. Another CPU selecting something else in between
+ * would have us touch the wrong register, so each I/O APIC has a lock */
+PRIVATE spinlock_t ioapic_locks[MAX_IOAPICS];
+PRIVATE bool enabled = false;
+
+uint32_t lapic_read ( uint32_t reg )
+{
+    return lapic[reg / sizeof ( uint32_t )];
+}
+
+void lapic_write ( uint32_t reg, uint32_t value )
+{
+    lapic[reg / sizeof ( uint32_t )] = value;
+}
+
+uint8_t lapic_id ( void )
+{
+    return lapic_read ( LAPIC_ID ) >> 24;
+}
+
+void lapic_eoi ( void )
+{
+    lapic_write ( LAPIC_EOI, 0 );
+}
+
+PRIVATE uint32_t ioapic_read ( uint32_t n, uint32_t reg )
+{
+    uint32_t flags, value;
+
+    flags = spin_lock_irqsave ( &ioapic_locks[n] );
+    ioapics[n][IOAPIC_IOREGSEL / sizeof ( uint32_t )] = reg;
+    value = ioapics[n][IOAPIC_IOWIN / sizeof ( uint32_t )];
+    spin_unlock_irqrestore ( &ioapic_locks[n], flags );
+    return value;
+}
+
+PRIVATE void ioapic_write ( uint32_t n, uint32_t reg, uint32_t value )
+{
+    uint32_t flags;
+
+    flags = spin_lock_irqsave ( &ioapic_locks[n] );
+    ioapics[n][IOAPIC_IOREGSEL / sizeof ( uint32_t )] = reg;
+    ioapics[n][IOAPIC_IOWIN / sizeof ( uint32_t )] = value;
+    spin_unlock_irqrestore ( &ioapic_locks[n], flags );
+}
+
+/* Clear and then set bits in a register, all under the lock */
+PRIVATE void ioapic_modify ( uint32_t n, uint32_t reg, uint32_t clear, uint32_t set )
+{
+    uint32_t flags, value;
+
+    flags = spin_lock_irqsave ( &ioapic_locks[n] );
+    ioapics[n][IOAPIC_IOREGSEL / sizeof ( uint32_t )] = reg;
+    value = ioapics[n][IOAPIC_IOWIN / sizeof ( uint32_t )];
+    ioapics[n][IOAPIC_IOWIN / sizeof ( uint32_t )] = ( value & ~clear ) | set;
+    spin_unlock_irqrestore ( &ioapic_locks[n], flags );
+}
+
+/* Find which I/O APIC, and which of its pins, gsi is. Returns false if none
+ * has it */
+PRIVATE bool ioapic_lookup ( uint32_t gsi, uint32_t* n, uint32_t* pin )
+{
+    uint32_t i;
+
+    for ( i = 0; i < config.num_ioapics; i++ ) {
+        if ( gsi >= config.ioapics[i].gsi_base &&
+             gsi < config.ioapics[i].gsi_base + ioapic_pins[i] ) {
+            *n = i;
+            *pin = gsi - config.ioapics[i].gsi_base;
+            return true;
+        }
+    }
+    return false;
+}
+
+/* Point gsi at vector, on the CPU with APIC ID dest. It starts out masked */
+PRIVATE void ioapic_route ( uint32_t gsi, uint8_t vector, uint16_t flags, uint8_t dest )
+{
+    uint32_t n, pin, low;
+
+    if ( !ioapic_lookup ( gsi, &n, &pin ) )
+        return;
+
+    low = vector | IOAPIC_REDIR_MASKED;
+    if ( ( flags & IRQ_POLARITY_MASK ) == IRQ_POLARITY_LOW )
+        low |= IOAPIC_REDIR_POLARITY_LOW;
+    if ( ( flags & IRQ_TRIGGER_MASK ) == IRQ_TRIGGER_LEVEL )
+        low |= IOAPIC_REDIR_TRIGGER_LEVEL;
+
+    ioapic_write ( n, IOAPIC_REG_REDTBL ( pin ) + 1, ( uint32_t ) dest << IOAPIC_REDIR_DEST_SHIFT );
+    ioapic_write ( n, IOAPIC_REG_REDTBL ( pin ), low );
+}
+
+void ioapic_mask ( uint32_t gsi )
+{
+    uint32_t n, pin;
+
+    if ( !ioapic_lookup ( gsi, &n, &pin ) )
+        return;
+
+    ioapic_modify ( n, IOAPIC_REG_REDTBL ( pin ), 0, IOAPIC_REDIR_MASKED );
+}
+
+void ioapic_unmask ( uint32_t gsi )
+{
+    uint32_t n, pin;
+
+    if ( !ioapic_lookup ( gsi, &n, &pin ) )
+        return;
+
+    ioapic_modify ( n, IOAPIC_REG_REDTBL ( pin ), IOAPIC_REDIR_MASKED, 0 );
+}
+
+void ioapic_set_affinity ( uint32_t gsi, uint8_t apic_id )
+{
+    uint32_t n, pin;
+
+    if ( !ioapic_lookup ( gsi, &n, &pin ) )
+        return;
+
+    ioapic_write ( n, IOAPIC_REG_REDTBL ( pin ) + 1, ( uint32_t ) apic_id << IOAPIC_REDIR_DEST_SHIFT );
+}
+
+void lapic_init_cpu ( void )
+{
+    uint64_t base;
+
+    base = rdmsr ( MSR_IA32_APIC_BASE );
+    wrmsr ( MSR_IA32_APIC_BASE, base | APIC_BASE_ENABLE );
+
+    /* Accept every priority, and send our spurious interrupts somewhere
+     * harmless */
+    lapic_write ( LAPIC_TPR, 0 );
+    lapic_write ( LAPIC_SVR, LAPIC_SVR_ENABLE | APIC_SPURIOUS_VECTOR );
+
+    /* The PIC used to come in through LINT0, but the I/O APIC does its job
+     * now. LINT1 is NMI */
+    lapic_write ( LAPIC_LVT_LINT0, LAPIC_LVT_MASKED );
+    lapic_write ( LAPIC_LVT_LINT1, LAPIC_LVT_NMI );
+    lapic_write ( LAPIC_LVT_ERROR, LAPIC_LVT_MASKED );
+
+    /* Clear anything left over */
+    lapic_write ( LAPIC_ESR, 0 );
+    lapic_eoi ();
+}
+
+void lapic_send_ipi ( uint8_t apic_id, uint32_t icr )
+{
+    uint32_t flags;
+
+    flags = irq_save ();
+    lapic_write ( LAPIC_ICR_HIGH, ( uint32_t ) apic_id << LAPIC_ICR_DEST_SHIFT );
+    lapic_write ( LAPIC_ICR_LOW, icr );
+    while ( lapic_read ( LAPIC_ICR_LOW ) & LAPIC_ICR_PENDING )
+        ;
+    irq_restore ( flags );
+}
+
+bool init_apic ( void )
+{
+    uint32_t edx, i, j, flags, gsi;
+    uint8_t bsp;
+
+    cpuid ( 1, NULL, NULL, NULL, &edx );
+    if ( !( edx & CPUID_FEAT_EDX_APIC ) || !( edx & CPUID_FEAT_EDX_MSR ) )
+        return false;
+
+    memset ( &config, 0, sizeof ( config ) );
+    for ( i = 0; i < ISA_IRQS; i++ )
+        config.isa_gsi[i] = i;
+
+    if ( !acpi_parse_madt ( &config ) ) {
+        memset ( &config, 0, sizeof ( config ) );
+        for ( i = 0; i < ISA_IRQS; i++ )
+            config.isa_gsi[i] = i;
+        if ( !mp_parse_tables ( &config ) )
+            return false;
+    }
+
+    lapic = ( volatile uint32_t* ) vmm_map_physical ( config.lapic_address, PAGE_SIZE,
+                                                      PTE_PAGE_WRITE | PTE_PAGE_NOT_CACHEABLE );
+    if ( !lapic )
+        return false;
+
+    for ( i = 0; i < config.num_ioapics; i++ ) {
+        ioapics[i] = ( volatile uint32_t* ) vmm_map_physical ( config.ioapics[i].address, PAGE_SIZE,
+                                                               PTE_PAGE_WRITE | PTE_PAGE_NOT_CACHEABLE );
+        if ( !ioapics[i] )
+            return false;
+        spin_lock_init ( &ioapic_locks[i], "I/O APIC" );
+        ioapic_pins[i] = ( ( ioapic_read ( i, IOAPIC_REG_VERSION ) >> 16 ) & 0xFF ) + 1;
+
+        /* Nothing gets through until we say so */
+        for ( j = 0; j < ioapic_pins[i]; j++ )
+            ioapic_write ( i, IOAPIC_REG_REDTBL ( j ), IOAPIC_REDIR_MASKED );
+    }
+
+    flags = irq_save ();
+
+    idt_set_gate ( APIC_SPURIOUS_VECTOR, ( uint32_t ) irq_spurious, IDT_SELECTOR,
+                   IDT_32BIT_INTERRUPT_GATE );
+
+    /* Silence the PIC, and on machines that have one, tell the IMCR to let
+     * interrupts through to the APIC instead */
+    irq_disable_pic ();
+    if ( config.has_imcr ) {
+        outb ( IMCR_SELECT_PORT, IMCR_SELECT );
+        outb ( IMCR_DATA_PORT, IMCR_APIC );
+    }
+
+    lapic_init_cpu ();
+    bsp = lapic_id ();
+
+    /* The tables usually list the boot CPU first, but nothing says they
+     * must. CPU 0 is whoever is running this */
+    for ( i = 1; i < config.num_cpus; i++ ) {
+        if ( config.cpu_apic_ids[i] == bsp ) {
+            config.cpu_apic_ids[i] = config.cpu_apic_ids[0];
+            config.cpu_apic_ids[0] = bsp;
+            break;
+        }
+    }
+
+    /* The ISA IRQs keep the vectors they had on the PIC, wherever they're
+     * wired. The cascade (IRQ2) is gone */
+    for ( i = 0; i < ISA_IRQS; i++ ) {
+        if ( i == 2 )
+            continue;
+        ioapic_route ( config.isa_gsi[i], IRQ_0 + i, config.isa_flags[i], bsp );
+    }
+
+    /* The first few GSIs past the ISA ones get the vectors after them, unless
+     * an ISA IRQ already took them. PCI interrupts are active low and level
+     * triggered */
+    for ( gsi = ISA_IRQS; gsi < ISA_IRQS + NUM_EXTRA_IRQS; gsi++ ) {
+        for ( i = 0; i < ISA_IRQS; i++ )
+            if ( config.isa_gsi[i] == gsi )
+                break;
+        if ( i == ISA_IRQS )
+            ioapic_route ( gsi, IRQ_0 + gsi, IRQ_POLARITY_LOW | IRQ_TRIGGER_LEVEL, bsp );
+    }
+
+    enabled = true;
+    irq_use_apic ();
+    irq_restore ( flags );
+
+    screen_puts ( "APIC: " );
+    screen_put_int ( config.num_cpus );
+    screen_puts ( " CPU(s), " );
+    screen_put_int ( config.num_ioapics );
+    screen_puts ( " I/O APIC(s), LAPIC at " );
+    screen_put_hex ( config.lapic_address );
+    screen_putc ( '\n' );
+
+    return true;
+}
+
+bool apic_enabled ( void )
+{
+    return enabled;
+}
+
+const apic_config_t* apic_get_config ( void )
+{
+    return &config;
+}
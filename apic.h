@@ -0,0 +1,159 @@
+#ifndef APIC_H
+#define APIC_H
+#include <stdinc.h>
+/*
+ * The APIC: the 8259 PIC's replacement.
+ *
+ * Every CPU has a Local APIC (LAPIC), which is what actually interrupts it.
+ * It has a timer of its own, sends and receives interrupts to and from the
+ * other CPUs (IPIs), and is acknowledged with a single memory write instead
+ * of one or two slow outb's.
+ *
+ * Devices are wired to one or more I/O APICs. Each has a redirection table,
+ * with an entry per input pin (24 on the usual one), that says which vector
+ * to send when that pin fires, and to which CPU. The pins are numbered
+ * machine-wide as Global System Interrupts (GSIs). The 16 ISA IRQs usually
+ * land on the GSI of the same number, except when the firmware says otherwise
+ * (an "interrupt source override"). IRQ0, the PIT, is on GSI 2 pretty much
+ * everywhere.
+ *
+ * How many CPUs and I/O APICs there are, and where, we learn from the
+ * firmware: the ACPI MADT (see acpi.h), or the older MP tables (see
+ * mptable.h). Both fill in an apic_config_t.
+ *
+ * If there's no APIC, or no table describes it, we stay with the PIC.
+ * Either way, the ISA IRQs keep their vectors (IRQ_0 to IRQ_15), and with the
+ * APIC, GSIs 16 to 23 (PCI interrupts, usually) get IRQ_16 to IRQ_23.
+ */
+
+#define MAX_CPUS     8
+#define MAX_IOAPICS  4
+#define ISA_IRQS     16
+
+/* The interrupt source override flags, which both ACPI and the MP tables
+ * use. "Conforms" means whatever the bus does: for ISA, active high and edge
+ * triggered */
+#define IRQ_POLARITY_MASK      0x03
+#define IRQ_POLARITY_CONFORMS  0x00
+#define IRQ_POLARITY_HIGH      0x01
+#define IRQ_POLARITY_LOW       0x03
+#define IRQ_TRIGGER_MASK       0x0C
+#define IRQ_TRIGGER_CONFORMS   0x00
+#define IRQ_TRIGGER_EDGE       0x04
+#define IRQ_TRIGGER_LEVEL      0x0C
+
+typedef struct {
+    uint32_t address;         /* Physical */
+    uint8_t  id;
+    uint32_t gsi_base;        /* The GSI of its first pin */
+} ioapic_config_t;
+
+typedef struct {
+    uint32_t lapic_address;   /* Physical */
+    uint32_t num_cpus;
+    uint8_t  cpu_apic_ids[MAX_CPUS];
+    uint32_t num_ioapics;
+    ioapic_config_t ioapics[MAX_IOAPICS];
+    uint32_t isa_gsi[ISA_IRQS];   /* Which GSI each ISA IRQ is wired to */
+    uint16_t isa_flags[ISA_IRQS]; /* IRQ_POLARITY_* | IRQ_TRIGGER_* */
+    bool     has_imcr;            /* Must the IMCR be told to use the APIC? */
+} apic_config_t;
+
+/* The LAPIC's registers, as offsets into its MMIO page */
+#define LAPIC_ID               0x020
+#define LAPIC_VERSION          0x030
+#define LAPIC_TPR              0x080 /* Task Priority */
+#define LAPIC_EOI              0x0B0
+#define LAPIC_LDR              0x0D0 /* Logical Destination */
+#define LAPIC_DFR              0x0E0 /* Destination Format */
+#define LAPIC_SVR              0x0F0 /* Spurious interrupt Vector */
+#define LAPIC_ESR              0x280 /* Error Status */
+#define LAPIC_ICR_LOW          0x300 /* Interrupt Command */
+#define LAPIC_ICR_HIGH         0x310
+#define LAPIC_LVT_TIMER        0x320
+#define LAPIC_LVT_LINT0        0x350
+#define LAPIC_LVT_LINT1        0x360
+#define LAPIC_LVT_ERROR        0x370
+#define LAPIC_TIMER_INITIAL    0x380
+#define LAPIC_TIMER_CURRENT    0x390
+#define LAPIC_TIMER_DIVIDE     0x3E0
+
+#define LAPIC_SVR_ENABLE       0x100
+
+/* The low half of the ICR: vector, delivery mode and how it's triggered.
+ * Writing it sends the IPI to the APIC ID in the top byte of the high half */
+#define LAPIC_ICR_FIXED        0x000
+#define LAPIC_ICR_INIT         0x500
+#define LAPIC_ICR_STARTUP      0x600 /* The vector is the start page number */
+#define LAPIC_ICR_PENDING      0x1000 /* Delivery status: not sent yet */
+#define LAPIC_ICR_ASSERT       0x4000
+#define LAPIC_ICR_LEVEL        0x8000
+#define LAPIC_ICR_DEST_SHIFT   24
+#define LAPIC_LVT_MASKED       0x10000
+#define LAPIC_LVT_NMI          0x400 /* Delivery mode 100 */
+
+/* IA32_APIC_BASE */
+#define MSR_IA32_APIC_BASE     0x1B
+#define APIC_BASE_BSP          0x100
+#define APIC_BASE_ENABLE       0x800
+#define APIC_BASE_ADDRESS      0xFFFFF000
+
+#define CPUID_FEAT_EDX_APIC    ( 1 << 9 )
+
+/* The I/O APIC is accessed through a window: write the register number to
+ * IOREGSEL, then read or write it at IOWIN */
+#define IOAPIC_IOREGSEL        0x00
+#define IOAPIC_IOWIN           0x10
+#define IOAPIC_REG_ID          0x00
+#define IOAPIC_REG_VERSION     0x01
+#define IOAPIC_REG_REDTBL(n)   ( 0x10 + 2 * ( n ) )
+
+/* A redirection table entry. The destination APIC ID is in the top byte of
+ * its high half */
+#define IOAPIC_REDIR_POLARITY_LOW   ( 1 << 13 )
+#define IOAPIC_REDIR_TRIGGER_LEVEL  ( 1 << 15 )
+#define IOAPIC_REDIR_MASKED         ( 1 << 16 )
+#define IOAPIC_REDIR_DEST_SHIFT     24
+
+/* The Interrupt Mode Configuration Register, on machines old enough to route
+ * the PIC around the APIC */
+#define IMCR_SELECT_PORT       0x22
+#define IMCR_DATA_PORT         0x23
+#define IMCR_SELECT            0x70
+#define IMCR_APIC              0x01
+
+/* Where the LAPIC sends interrupts it has to give up on. Doesn't need an EOI */
+#define APIC_SPURIOUS_VECTOR   0xFF
+
+/* Find and set up the APICs, switching interrupt delivery over from the PIC.
+ * Must be called after init_vmm (the APICs are memory mapped). Returns
+ * whether we're on the APIC now */
+bool init_apic ( void );
+
+bool apic_enabled ( void );
+
+/* cpu_apic_ids[0] is always the boot CPU's */
+const apic_config_t* apic_get_config ( void );
+
+/* Enable the LAPIC of the CPU we're running on. init_apic does it for the
+ * boot CPU; the others do it themselves when they start (see smp.h) */
+void lapic_init_cpu ( void );
+
+/* Send an IPI (icr is LAPIC_ICR_*, or'ed with the vector) to the CPU with
+ * the given APIC ID, and wait for the LAPIC to have sent it */
+void lapic_send_ipi ( uint8_t apic_id, uint32_t icr );
+
+/* The LAPIC of the CPU we're running on */
+uint32_t lapic_read ( uint32_t reg );
+void lapic_write ( uint32_t reg, uint32_t value );
+uint8_t lapic_id ( void );
+void lapic_eoi ( void );
+
+/* Mask or unmask a GSI at its I/O APIC */
+void ioapic_mask ( uint32_t gsi );
+void ioapic_unmask ( uint32_t gsi );
+
+/* Deliver gsi to the CPU with the given APIC ID */
+void ioapic_set_affinity ( uint32_t gsi, uint8_t apic_id );
+
+#endif
@@ -0,0 +1,192 @@
+#include <async.h>
+#include <internal_timer.h>
+#include <preempt.h>
+#include <smp.h>
+#include <apic.h>
+#include <x86/x86.h>
+
+/* A CPU's ready queue. Anyone pushes onto it, and only the CPU takes from
+ * it, all at once, so it can be a plain stack */
+typedef struct {
+    task_t* volatile ready;
+    bool running;                 /* In async_run */
+} __attribute__ ( ( aligned ( 64 ) ) ) async_cpu_t;
+
+PRIVATE async_cpu_t queues[MAX_CPUS];
+
+PRIVATE void task_timeout ( uint32_t data )
+{
+    task_t* t = ( task_t* ) data;
+
+    t->timed_out = true;
+    task_wake ( t );
+}
+
+void task_init ( task_t* t, task_func_t func )
+{
+    t->next = NULL;
+    t->func = func;
+    t->line = 0;
+    t->cpu = 0;
+    t->done = false;
+    t->timed_out = false;
+    t->queued = 0;
+    t->wait.next = t->wait.prev = NULL;
+    ktimer_init ( &t->timer, &task_timeout, ( uint32_t ) t );
+}
+
+void task_start ( task_t* t, uint32_t cpu )
+{
+    t->line = 0;
+    t->cpu = cpu;
+    t->done = false;
+    t->timed_out = false;
+    task_wake ( t );
+}
+
+void task_wake ( task_t* t )
+{
+    async_cpu_t* q = &queues[t->cpu];
+    task_t* head;
+
+    if ( t->done || atomic_xchg ( &t->queued, 1 ) )
+        return;
+
+    do {
+        head = q->ready;
+        t->next = head;
+    } while ( atomic_cmpxchg ( ( volatile uint32_t* ) &q->ready, ( uint32_t ) head,
+                               ( uint32_t ) t ) != ( uint32_t ) head );
+
+    /* If it wasn't empty, whoever made it so has already done this */
+    if ( !head && t->cpu != smp_processor_id () )
+        smp_send_resched ( t->cpu );
+}
+
+void task_set_timeout ( task_t* t, uint32_t ms )
+{
+    uint64_t ticks;
+
+    /* Rounded up, like thread_sleep */
+    ticks = div_u64_rem ( ( uint64_t ) ms * timer_get_frequency () + 999, 1000, NULL );
+    if ( !ticks )
+        ticks = 1;
+
+    t->timed_out = false;
+    ktimer_mod ( &t->timer, timer_get_ticks () + ticks );
+}
+
+/* Events */
+
+void async_event_init ( async_event_t* ev, const char* name )
+{
+    spin_lock_init ( &ev->lock, name );
+    list_init ( &ev->waiters );
+}
+
+void async_event_signal ( async_event_t* ev )
+{
+    task_t* t;
+    uint32_t flags;
+
+    /* The condition has to be true before we look */
+    mb ();
+    if ( list_empty ( &ev->waiters ) )
+        return;
+
+    flags = spin_lock_irqsave ( &ev->lock );
+    while ( !list_empty ( &ev->waiters ) ) {
+        t = LIST_ENTRY ( ev->waiters.next, task_t, wait );
+        list_del ( &t->wait );
+        task_wake ( t );
+    }
+    spin_unlock_irqrestore ( &ev->lock, flags );
+}
+
+void async_wait ( async_event_t* ev, task_t* t )
+{
+    uint32_t flags;
+
+    flags = spin_lock_irqsave ( &ev->lock );
+    if ( !list_linked ( &t->wait ) )
+        list_add_tail ( &ev->waiters, &t->wait );
+    spin_unlock_irqrestore ( &ev->lock, flags );
+
+    /* The unlock is only a store, and the check of the condition that
+     * follows could pass it */
+    mb ();
+}
+
+void async_unwait ( async_event_t* ev, task_t* t )
+{
+    uint32_t flags;
+
+    /* Only we put it there, so if it's not there now, it won't be */
+    if ( !list_linked ( &t->wait ) )
+        return;
+
+    flags = spin_lock_irqsave ( &ev->lock );
+    if ( list_linked ( &t->wait ) )
+        list_del ( &t->wait );
+    spin_unlock_irqrestore ( &ev->lock, flags );
+}
+
+/* The executor */
+
+PRIVATE void poll_task ( task_t* t )
+{
+    if ( t->done )
+        return;
+    if ( t->func ( t ) == TASK_DONE ) {
+        ktimer_del ( &t->timer );
+        t->done = true;
+    }
+}
+
+bool async_run ( void )
+{
+    async_cpu_t* q;
+    task_t* t;
+    task_t* next;
+    task_t* list;
+    uint32_t rounds;
+
+    q = &queues[smp_processor_id ()];
+    if ( !q->ready || q->running )
+        return false;
+
+    /* Preempted, we could end up carrying on on another CPU, running this
+     * one's tasks */
+    q->running = true;
+    preempt_disable ();
+
+    for ( rounds = 0; q->ready && rounds < ASYNC_MAX_ROUNDS; rounds++ ) {
+        /* Pushed onto a stack, so the last one woken comes first. Turn it
+         * around */
+        t = ( task_t* ) atomic_xchg ( ( volatile uint32_t* ) &q->ready, 0 );
+        for ( list = NULL; t; t = next ) {
+            next = t->next;
+            t->next = list;
+            list = t;
+        }
+
+        __asm volatile ( "sti" );
+        for ( t = list; t; t = next ) {
+            /* Once it's not queued, it can be woken again, and t->next
+             * overwritten */
+            next = t->next;
+            atomic_xchg ( &t->queued, 0 );
+            poll_task ( t );
+        }
+        __asm volatile ( "cli" );
+    }
+
+    preempt_enable ();
+    q->running = false;
+    return true;
+}
+
+bool async_pending ( void )
+{
+    return queues[smp_processor_id ()].ready != NULL;
+}
@@ -0,0 +1,166 @@
+#ifndef ASYNC_H
+#define ASYNC_H
+#include <stdinc.h>
+#include <list.h>
+#include <spinlock.h>
+#include <ktimer.h>
+/*
+ * Asynchronous tasks: for I/O that takes several steps, each waiting for an
+ * interrupt or a timeout, without a thread (and its stack) per operation.
+ *
+ * A task is a function that the executor calls ("polls") whenever there may
+ * be something for it to do. It runs until it has to wait, and then returns
+ * TASK_PENDING; it's polled again once whatever it waits for has happened.
+ * The macros below let it be written as straight-line code anyway:
+ *
+ *      PRIVATE task_status_t read_sector ( task_t* t )
+ *      {
+ *          disk_op_t* op = TASK_CONTAINER ( t, disk_op_t, task );
+ *
+ *          TASK_BEGIN ( t );
+ *          disk_send_command ( op );
+ *          TASK_AWAIT_EVENT ( t, &disk_irq, disk_ready () || task_timed_out ( t ) );
+ *          ...
+ *          TASK_END ( t );
+ *      }
+ *
+ * TASK_BEGIN is a switch on the line the task last stopped at, and each
+ * await is a case label, so polling the function again picks up right after
+ * the await that returned (Duff's device, or protothreads). What that
+ * costs: local variables don't survive an await, so whatever has to goes in
+ * the struct the task_t is part of, and there can be no switch statements
+ * of the task's own around an await. A task_t is a few dozen bytes, so
+ * thousands of operations can be in flight at once.
+ *
+ * Tasks are woken (task_wake) by:
+ *  -> async events (async_event_t), which are what wait queues are to
+ *     threads. TASK_AWAIT_EVENT puts the task in the event's list before it
+ *     checks the condition, and async_event_signal, called once the
+ *     condition is true (from an interrupt handler, say), wakes everyone in
+ *     it, so no wakeup is lost.
+ *  -> their own timer: task_set_timeout arms it, and task_timed_out says
+ *     whether it has expired. TASK_SLEEP is built on it.
+ *
+ * Each CPU has a ready queue, and each task belongs to a CPU (the one it was
+ * started on), so it never runs on two at once and stays in one cache.
+ * Waking a task puts it in its CPU's queue, from anywhere, without locking
+ * anything, and interrupts that CPU (smp_send_resched) if it's another one
+ * and the queue was empty. The queue is run on the way out of interrupts,
+ * after the softirqs, and by cpu_idle: with interrupts enabled, and
+ * preemption disabled. So
+ * tasks must not block, or take long: like softirqs, they hold up whatever
+ * thread they interrupted. Just like do_softirq, async_run only goes around
+ * ASYNC_MAX_ROUNDS times, and leaves the rest for later.
+ */
+
+#define ASYNC_MAX_ROUNDS 10
+
+typedef enum {
+    TASK_PENDING,
+    TASK_DONE
+} task_status_t;
+
+typedef struct task task_t;
+typedef task_status_t ( *task_func_t ) ( task_t* t );
+
+struct task {
+    task_t* next;                  /* In the ready queue */
+    task_func_t func;
+    uint16_t line;                 /* Where to pick up, for TASK_BEGIN */
+    uint8_t cpu;
+    volatile bool done;
+    volatile bool timed_out;
+    volatile uint32_t queued;      /* In the ready queue */
+    list_node_t wait;              /* In an async event's list */
+    ktimer_t timer;
+};
+
+/* A list of tasks waiting for something */
+typedef struct {
+    spinlock_t lock;
+    list_node_t waiters;
+} async_event_t;
+
+#define ASYNC_EVENT_INIT(ev, name) \
+    { SPINLOCK_INIT ( name ), { &( ev ).waiters, &( ev ).waiters } }
+
+#define TASK_CONTAINER(t, type, member) LIST_ENTRY ( t, type, member )
+
+/* Where the task gets back to after each wakeup */
+#define TASK_BEGIN(t)      switch ( ( t )->line ) { case 0:
+
+#define TASK_END(t)        } ( t )->line = 0; return TASK_DONE
+
+/* Where the next poll picks up. The case label is only ever jumped to, so
+ * that the compiler doesn't take it for a forgotten break */
+#define TASK_RESUME_HERE(t)                                                   \
+    ( t )->line = __LINE__; if ( 0 ) { case __LINE__:; }
+
+/* Return until cond is true. Whatever makes it true has to wake the task */
+#define TASK_AWAIT(t, cond) do {                                              \
+    TASK_RESUME_HERE ( t )                                                    \
+    if ( !( cond ) )                                                          \
+        return TASK_PENDING;                                                  \
+} while ( 0 )
+
+/* Return until cond is true, being woken by async_event_signal(ev) */
+#define TASK_AWAIT_EVENT(t, ev, cond) do {                                    \
+    TASK_RESUME_HERE ( t )                                                    \
+    if ( !( cond ) ) {                                                        \
+        async_wait ( ( ev ), ( t ) );                                         \
+        if ( !( cond ) )                                                      \
+            return TASK_PENDING;                                              \
+    }                                                                         \
+    async_unwait ( ( ev ), ( t ) );                                           \
+} while ( 0 )
+
+/* Let the other tasks run before going on */
+#define TASK_YIELD(t) do {                                                    \
+    ( t )->line = __LINE__;                                                   \
+    task_wake ( t );                                                          \
+    return TASK_PENDING;                                                      \
+    case __LINE__:;                                                           \
+} while ( 0 )
+
+#define TASK_SLEEP(t, ms) do {                                                \
+    task_set_timeout ( ( t ), ( ms ) );                                       \
+    TASK_AWAIT ( ( t ), task_timed_out ( t ) );                               \
+} while ( 0 )
+
+void task_init ( task_t* t, task_func_t func );
+
+/* Start t on cpu: it's polled for the first time from there */
+void task_start ( task_t* t, uint32_t cpu );
+
+/* Whether t has returned TASK_DONE */
+#define task_done(t) ( ( t )->done )
+
+/* Have t polled soon. Can be called from anywhere, interrupt handlers
+ * included, as often as need be: it's queued only once */
+void task_wake ( task_t* t );
+
+/* Wake t after ms milliseconds, or not, if the timeout is set again or the
+ * task is done first */
+void task_set_timeout ( task_t* t, uint32_t ms );
+#define task_timed_out(t) ( ( t )->timed_out )
+
+void async_event_init ( async_event_t* ev, const char* name );
+/* Wake every task waiting on ev. Can be called from interrupt handlers */
+void async_event_signal ( async_event_t* ev );
+
+/* What TASK_AWAIT_EVENT is made of. A task waits on one event at a time, and
+ * the await takes it off the event's list whichever way the wait ends (a
+ * timeout, say) */
+void async_wait ( async_event_t* ev, task_t* t );
+void async_unwait ( async_event_t* ev, task_t* t );
+
+/* Run this CPU's ready tasks. Called with interrupts disabled, returns with
+ * interrupts disabled, but enables them while running the tasks. A thread
+ * waiting for tasks it woke on its own CPU can call it too, rather than wait
+ * for the next interrupt. Returns whether it ran any */
+bool async_run ( void );
+
+/* Whether this CPU has tasks waiting to run */
+bool async_pending ( void );
+
+#endif
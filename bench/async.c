@@ -0,0 +1,103 @@
+#include <bench/bench.h>
+#include <async.h>
+#include <sched.h>
+#include <screen.h>
+#include <smp.h>
+#include <apic.h>
+#include <x86/x86.h>
+
+/*
+ * Asynchronous task wakeups: BENCH_ASYNC_TASKS tasks, spread over the online
+ * CPUs, all waiting on one event. Each round, main signals the event and
+ * waits for every task to have been polled. Reports cycles per task woken
+ * and polled, and how many bytes each in-flight task takes.
+ */
+
+#define BENCH_ASYNC_TASKS  2048
+#define BENCH_ASYNC_ROUNDS 16
+
+typedef struct {
+    task_t task;
+    uint32_t seen;                /* Rounds we've been woken for */
+} bench_op_t;
+
+PRIVATE bench_op_t ops[BENCH_ASYNC_TASKS];
+PRIVATE async_event_t bench_event = ASYNC_EVENT_INIT ( bench_event, "bench" );
+PRIVATE volatile uint32_t generation;
+PRIVATE volatile uint32_t polls;
+
+PRIVATE task_status_t bench_task ( task_t* t )
+{
+    bench_op_t* op = TASK_CONTAINER ( t, bench_op_t, task );
+
+    TASK_BEGIN ( t );
+    while ( op->seen < BENCH_ASYNC_ROUNDS ) {
+        TASK_AWAIT_EVENT ( t, &bench_event, generation != op->seen );
+        op->seen++;
+        atomic_inc ( &polls );
+    }
+    TASK_END ( t );
+}
+
+/* Our own CPU's share would otherwise wait for the next tick */
+PRIVATE void run_own_tasks ( void )
+{
+    uint32_t flags;
+
+    flags = irq_save ();
+    async_run ();
+    irq_restore ( flags );
+    cpu_relax ();
+}
+
+PRIVATE uint32_t time_async ( void )
+{
+    uint64_t start, end;
+    uint32_t i, cpu = 0, round;
+
+    generation = 0;
+    polls = 0;
+    for ( i = 0; i < BENCH_ASYNC_TASKS; i++ ) {
+        ops[i].seen = 0;
+        task_init ( &ops[i].task, &bench_task );
+        do
+            cpu = ( cpu + 1 ) % MAX_CPUS;
+        while ( !cpu_online ( cpu ) );
+        task_start ( &ops[i].task, cpu );
+    }
+
+    start = rdtsc ();
+    for ( round = 1; round <= BENCH_ASYNC_ROUNDS; round++ ) {
+        generation = round;
+        async_event_signal ( &bench_event );
+        while ( polls < round * BENCH_ASYNC_TASKS )
+            run_own_tasks ();
+    }
+    end = rdtsc ();
+
+    /* Let them all finish before the next run takes them over */
+    for ( i = 0; i < BENCH_ASYNC_TASKS; i++ )
+        while ( !task_done ( &ops[i].task ) )
+            run_own_tasks ();
+
+    return bench_cycles_per_op ( start, end, BENCH_ASYNC_ROUNDS * BENCH_ASYNC_TASKS );
+}
+
+void bench_async ( void )
+{
+    uint32_t run, best = 0xFFFFFFFF, t;
+
+    for ( run = 0; run < BENCH_RUNS; run++ ) {
+        t = time_async ();
+        if ( t < best )
+            best = t;
+    }
+
+    screen_puts ( "  async task wakeups, " );
+    screen_put_int ( BENCH_ASYNC_TASKS );
+    screen_puts ( " in flight, " );
+    screen_put_int ( sizeof ( task_t ) );
+    screen_puts ( " bytes each: " );
+    screen_put_int ( best );
+    screen_puts ( " cycles per wakeup\n" );
+}
@@ -0,0 +1,26 @@
+#include <bench/bench.h>
+#include <screen.h>
+#include <x86/x86.h>
+
+void bench_report ( const char* name, uint32_t cycles )
+{
+    screen_puts ( "  " );
+    screen_puts ( name );
+    screen_puts ( ": " );
+    screen_put_int ( cycles );
+    screen_puts ( " cycles\n" );
+}
+
+uint32_t bench_cycles_per_op ( uint64_t start, uint64_t end, uint32_t ops )
+{
+    return ( uint32_t ) div_u64_rem ( end - start, ops, NULL );
+}
+
+void run_benchmarks ( void )
+{
+    screen_puts ( "Running benchmarks...\n" );
+    bench_irq_entry ();
+    bench_spawn ();
+    bench_async ();
+    bench_syscall ();
+}
@@ -0,0 +1,31 @@
+#ifndef BENCH_H
+#define BENCH_H
+#include <stdinc.h>
+/*
+ * Microbenchmarks. They aren't built by default: uncomment BENCHMARK_FLAGS
+ * and BENCH_SOURCES in the makefile, and kernel_main runs them all once the
+ * machine is set up, printing their results.
+ *
+ * Everything is measured in TSC cycles. Each benchmark runs its loop a few
+ * times and reports the best run, which is the one least disturbed by
+ * interrupts and cold caches.
+ */
+
+/* How many times each benchmark runs its loop */
+#define BENCH_RUNS 5
+
+void run_benchmarks ( void );
+
+/* Print "name: N cycles" for the given cycles per operation */
+void bench_report ( const char* name, uint32_t cycles );
+
+/* Cycles per operation, given the TSC before and after ops operations */
+uint32_t bench_cycles_per_op ( uint64_t start, uint64_t end, uint32_t ops );
+
+/* The benchmarks */
+void bench_irq_entry ( void );
+void bench_spawn ( void );
+void bench_async ( void );
+void bench_syscall ( void );
+
+#endif
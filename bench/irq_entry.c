@@ -0,0 +1,87 @@
+#include <bench/bench.h>
+#include <idt.h>
+#include <x86/x86.h>
+
+/*
+ * The round trip through an interrupt: int, the entry stub, and iret.
+ * bench_full_stub is irq_common_stub as it was before it was slimmed down (a
+ * whole registers_t, and every segment register reloaded twice), calling an
+ * empty C function. The other is the real thing: an IRQ stub and
+ * irq_common_stub from irq_s.s, and irq_handler with an empty handler
+ * registered, EOI and all. So the difference understates what slimming the
+ * stub saved, by however long irq_handler takes.
+ */
+
+#define BENCH_FULL_VECTOR 0x40
+#define BENCH_REAL_VECTOR 58 /* irq26 in irq_s.s */
+#define BENCH_ROUNDS      10000
+
+extern void bench_full_stub ();
+extern void irq26 ();
+
+/* What bench_full_stub calls */
+void bench_irq_target ( void );
+
+void bench_irq_target ( void )
+{
+}
+
+/* What irq_handler calls */
+PRIVATE void bench_irq_handler ( registers_t* regs )
+{
+    UNUSED ( regs );
+}
+
+PRIVATE uint32_t time_full ( void )
+{
+    uint64_t start, end;
+    uint32_t i;
+
+    start = rdtsc ();
+    for ( i = 0; i < BENCH_ROUNDS; i++ )
+        __asm volatile ( "int $0x40" : : : "memory" );
+    end = rdtsc ();
+    return bench_cycles_per_op ( start, end, BENCH_ROUNDS );
+}
+
+PRIVATE uint32_t time_real ( void )
+{
+    uint64_t start, end;
+    uint32_t i;
+
+    start = rdtsc ();
+    for ( i = 0; i < BENCH_ROUNDS; i++ )
+        __asm volatile ( "int $58" : : : "memory" );
+    end = rdtsc ();
+    return bench_cycles_per_op ( start, end, BENCH_ROUNDS );
+}
+
+void bench_irq_entry ( void )
+{
+    uint32_t flags, run, full, real, t;
+
+    idt_set_gate ( BENCH_FULL_VECTOR, ( uint32_t ) bench_full_stub, IDT_SELECTOR,
+                   IDT_32BIT_INTERRUPT_GATE );
+    register_interrupt_handler ( BENCH_REAL_VECTOR, &bench_irq_handler );
+    idt_set_gate ( BENCH_REAL_VECTOR, ( uint32_t ) irq26, IDT_SELECTOR,
+                   IDT_32BIT_INTERRUPT_GATE );
+
+    full = real = 0xFFFFFFFF;
+    flags = irq_save ();
+    for ( run = 0; run < BENCH_RUNS; run++ ) {
+        t = time_full ();
+        if ( t < full )
+            full = t;
+        t = time_real ();
+        if ( t < real )
+            real = t;
+    }
+    irq_restore ( flags );
+
+    bench_report ( "interrupt round trip, full stub", full );
+    bench_report ( "interrupt round trip, irq_common_stub", real );
+
+    idt_set_gate ( BENCH_FULL_VECTOR, 0, 0, 0 );
+    idt_set_gate ( BENCH_REAL_VECTOR, 0, 0, 0 );
+    register_interrupt_handler ( BENCH_REAL_VECTOR, NULL );
+}
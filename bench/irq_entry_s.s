@@ -0,0 +1,37 @@
+; The old-style stub bench/irq_entry.c compares the real irq_common_stub
+; with.
+
+extern bench_irq_target
+
+global bench_full_stub:function bench_full_stub.end-bench_full_stub
+
+; The old irq_common_stub, behind an IRQ stub of the old kind
+bench_full_stub:
+    cli
+    push byte 0
+    push byte 0x40
+
+    pusha
+    mov ax, ds
+    push eax
+
+    mov ax, 0x10
+    mov ds, ax
+    mov es, ax
+    mov fs, ax
+    mov ss, ax               ; gs is the per-CPU segment now, and stays
+
+    push esp
+    call bench_irq_target
+    add esp, 4
+
+    pop ebx
+    mov ds, bx
+    mov es, bx
+    mov fs, bx
+    mov ss, bx
+
+    popa
+    add esp, 8
+    iret
+.end:
@@ -0,0 +1,91 @@
+#include <bench/bench.h>
+#include <sched.h>
+#include <screen.h>
+#include <smp.h>
+#include <x86/x86.h>
+
+/*
+ * Scheduler throughput: how long BENCH_SPAWN_TASKS short threads take to get
+ * created, run and exit, with main creating them and every CPU allowed to
+ * run threads stealing them. No more than BENCH_SPAWN_IN_FLIGHT at a time, so
+ * that there are always free slots.
+ *
+ * It runs with 1 CPU, then 2, and so on up to however many are online (see
+ * sched_set_cpus), so try it under qemu -smp N. Each reports its cycles per
+ * task, and how much faster that is than with 1 CPU.
+ */
+
+#define BENCH_SPAWN_TASKS     2000
+#define BENCH_SPAWN_IN_FLIGHT 48
+#define BENCH_SPAWN_WORK      20000 /* Loops each task spins for */
+
+PRIVATE volatile uint32_t tasks_done;
+
+PRIVATE void spawn_task ( uint32_t arg )
+{
+    volatile uint32_t i;
+
+    UNUSED ( arg );
+    for ( i = 0; i < BENCH_SPAWN_WORK; i++ )
+        ;
+    atomic_inc ( &tasks_done );
+}
+
+PRIVATE uint32_t time_spawn ( void )
+{
+    uint64_t start, end;
+    uint32_t spawned = 0;
+
+    tasks_done = 0;
+    start = rdtsc ();
+    while ( spawned < BENCH_SPAWN_TASKS ) {
+        /* Slots only free up once the tasks are off their CPUs, so
+         * thread_create may fail even below the limit */
+        if ( spawned - tasks_done >= BENCH_SPAWN_IN_FLIGHT ||
+             !thread_create ( "spawn", &spawn_task, 0, THREAD_PRIO_NORMAL ) ) {
+            thread_yield ();
+            continue;
+        }
+        spawned++;
+    }
+    while ( tasks_done < BENCH_SPAWN_TASKS )
+        thread_yield ();
+    end = rdtsc ();
+
+    return bench_cycles_per_op ( start, end, BENCH_SPAWN_TASKS );
+}
+
+void bench_spawn ( void )
+{
+    uint32_t cpus, run, best, t, one_cpu = 0, speedup, n;
+
+    cpus = num_online_cpus ();
+    for ( n = 1; n <= cpus; n++ ) {
+        sched_set_cpus ( n );
+
+        best = 0xFFFFFFFF;
+        for ( run = 0; run < BENCH_RUNS; run++ ) {
+            t = time_spawn ();
+            if ( t < best )
+                best = t;
+        }
+        if ( n == 1 )
+            one_cpu = best;
+
+        /* In hundredths */
+        speedup = ( uint32_t ) div_u64_rem ( ( uint64_t ) one_cpu * 100, best, NULL );
+
+        screen_puts ( "  spawning threads, " );
+        screen_put_int ( n );
+        screen_puts ( " CPU(s): " );
+        screen_put_int ( best );
+        screen_puts ( " cycles per thread, x" );
+        screen_put_int ( speedup / 100 );
+        screen_putc ( '.' );
+        screen_putc ( '0' + speedup / 10 % 10 );
+        screen_putc ( '0' + speedup % 10 );
+        screen_putc ( '\n' );
+    }
+
+    sched_set_cpus ( MAX_CPUS );
+}
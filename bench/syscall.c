@@ -0,0 +1,96 @@
+#include <bench/bench.h>
+#include <syscall.h>
+#include <vdso.h>
+#include <user/time.h>
+#include <screen.h>
+#include <string.h>
+#include <mem/pmm.h>
+#include <mem/vmm.h>
+#include <x86/x86.h>
+
+/*
+ * The null system call: SYS_GETPID from ring 3, through int 0x80 and through
+ * sysenter. And for comparison, reading the clock from ring 3 with no system
+ * call, through user_clock_ns in the vDSO (see vdso.h). The user side is in
+ * bench/syscall_s.s: it does BENCH_SYSCALL_ROUNDS of each, timing them
+ * itself, and leaves the cycle counts in its data page.
+ */
+
+#define BENCH_SYSCALL_ROUNDS 10000
+
+/* Where the user side lives. Keep in sync with bench/syscall_s.s */
+#define BENCH_USER_CODE      0x40000000
+#define BENCH_USER_DATA      0x40001000
+#define BENCH_USER_STACK     0x40002000
+#define BENCH_USER_PAGES     3
+
+typedef struct {
+    uint32_t int80_rounds;
+    uint32_t sysenter_rounds;
+    uint64_t int80_cycles;
+    uint64_t sysenter_cycles;
+    uint32_t clock_fn;
+    uint32_t clock_rounds;
+    uint64_t clock_cycles;
+} bench_user_data_t;
+
+extern uint8_t bench_user_start[];
+extern uint8_t bench_user_end[];
+
+PRIVATE bool user_pages_mapped = false;
+
+PRIVATE bool map_user_pages ( void )
+{
+    uint32_t i, frame;
+
+    if ( user_pages_mapped )
+        return true;
+    for ( i = 0; i < BENCH_USER_PAGES; i++ ) {
+        frame = pmm_alloc_block ();
+        if ( !frame )
+            return false;
+        vmm_map_page_flags ( frame, BENCH_USER_CODE + i * PAGE_SIZE,
+                             PTE_PAGE_WRITE | PTE_PAGE_USER );
+    }
+    memcpy ( ( void* ) BENCH_USER_CODE, bench_user_start,
+             bench_user_end - bench_user_start );
+    user_pages_mapped = true;
+    return true;
+}
+
+void bench_syscall ( void )
+{
+    bench_user_data_t* data = ( bench_user_data_t* ) BENCH_USER_DATA;
+    uint32_t run, int80, sysenter, clock, best_int80 = 0xFFFFFFFF, best_sysenter = 0xFFFFFFFF;
+    uint32_t best_clock = 0xFFFFFFFF;
+
+    if ( !map_user_pages () ) {
+        screen_puts ( "  null syscall: no memory\n" );
+        return;
+    }
+
+    for ( run = 0; run < BENCH_RUNS; run++ ) {
+        data->int80_rounds = BENCH_SYSCALL_ROUNDS;
+        data->sysenter_rounds = syscall_have_sysenter () ? BENCH_SYSCALL_ROUNDS : 0;
+        data->clock_fn = vdso_symbol ( ( uint32_t ) &user_clock_ns );
+        data->clock_rounds = BENCH_SYSCALL_ROUNDS;
+        user_run ( BENCH_USER_CODE, BENCH_USER_STACK + PAGE_SIZE );
+
+        int80 = bench_cycles_per_op ( 0, data->int80_cycles, BENCH_SYSCALL_ROUNDS );
+        if ( int80 < best_int80 )
+            best_int80 = int80;
+        if ( data->sysenter_rounds ) {
+            sysenter = bench_cycles_per_op ( 0, data->sysenter_cycles, BENCH_SYSCALL_ROUNDS );
+            if ( sysenter < best_sysenter )
+                best_sysenter = sysenter;
+        }
+        clock = bench_cycles_per_op ( 0, data->clock_cycles, BENCH_SYSCALL_ROUNDS );
+        if ( clock < best_clock )
+            best_clock = clock;
+    }
+
+    bench_report ( "null syscall, int 0x80", best_int80 );
+    if ( syscall_have_sysenter () )
+        bench_report ( "null syscall, sysenter", best_sysenter );
+    bench_report ( "clock read, vDSO", best_clock );
+}
@@ -0,0 +1,81 @@
+; The user-mode half of bench/syscall.c. It's copied to BENCH_USER_CODE and
+; run in ring 3 from there, so it must not refer to its own addresses: only
+; to the data page, which is at a fixed one.
+
+%define BENCH_USER_DATA 0x40001000
+%define SYS_EXIT        0
+%define SYS_GETPID      1
+
+; The data page
+%define INT80_ROUNDS    BENCH_USER_DATA
+%define SYSENTER_ROUNDS BENCH_USER_DATA+4
+%define INT80_CYCLES    BENCH_USER_DATA+8
+%define SYSENTER_CYCLES BENCH_USER_DATA+16
+%define CLOCK_FN        BENCH_USER_DATA+24
+%define CLOCK_ROUNDS    BENCH_USER_DATA+28
+%define CLOCK_CYCLES    BENCH_USER_DATA+32
+
+global bench_user_start
+global bench_user_end
+
+bench_user_start:
+    rdtsc
+    mov [INT80_CYCLES], eax
+    mov [INT80_CYCLES+4], edx
+    mov edi, [INT80_ROUNDS]
+.int80_loop:
+    mov eax, SYS_GETPID
+    int 0x80
+    dec edi
+    jnz .int80_loop
+    rdtsc
+    sub eax, [INT80_CYCLES]
+    sbb edx, [INT80_CYCLES+4]
+    mov [INT80_CYCLES], eax
+    mov [INT80_CYCLES+4], edx
+
+    ; 0 rounds if there's no sysenter
+    mov edi, [SYSENTER_ROUNDS]
+    test edi, edi
+    jz .done
+    rdtsc
+    mov [SYSENTER_CYCLES], eax
+    mov [SYSENTER_CYCLES+4], edx
+.sysenter_loop:
+    mov eax, SYS_GETPID
+    call .sysenter
+    dec edi
+    jnz .sysenter_loop
+    rdtsc
+    sub eax, [SYSENTER_CYCLES]
+    sbb edx, [SYSENTER_CYCLES+4]
+    mov [SYSENTER_CYCLES], eax
+    mov [SYSENTER_CYCLES+4], edx
+
+.done:
+    ; user_clock_ns, from the vDSO: a cdecl call, which leaves edi alone
+    rdtsc
+    mov [CLOCK_CYCLES], eax
+    mov [CLOCK_CYCLES+4], edx
+    mov edi, [CLOCK_ROUNDS]
+.clock_loop:
+    call [CLOCK_FN]
+    dec edi
+    jnz .clock_loop
+    rdtsc
+    sub eax, [CLOCK_CYCLES]
+    sbb edx, [CLOCK_CYCLES+4]
+    mov [CLOCK_CYCLES], eax
+    mov [CLOCK_CYCLES+4], edx
+
+
+    mov eax, SYS_EXIT
+    xor ebx, ebx
+    int 0x80
+
+; sysexit comes back to edx, with ecx for esp: straight back to our caller
+.sysenter:
+    pop edx
+    mov ecx, esp
+    sysenter
+bench_user_end:
@@ -0,0 +1,147 @@
+#include <clocksource.h>
+#include <internal_timer.h>
+#include <x86/x86.h>
+#include <screen.h>
+
+PRIVATE uint64_t tsc_read ( void );
+PRIVATE uint64_t ticks_read ( void );
+
+PRIVATE clocksource_t tsc_clocksource = {
+    "tsc", &tsc_read, 0, 0, 0, true
+};
+
+PRIVATE clocksource_t ticks_clocksource = {
+    "pit", &ticks_read, 0, 0, 0, false
+};
+
+PRIVATE clocksource_t* clock = NULL;
+PRIVATE uint32_t tsc_hz = 0;
+
+/* The count when the clocksource was picked, which is our time zero */
+PRIVATE uint64_t clock_base = 0;
+
+PRIVATE uint64_t tsc_read ( void )
+{
+    return rdtsc ();
+}
+
+PRIVATE uint64_t ticks_read ( void )
+{
+    return timer_get_ticks ();
+}
+
+void clocks_calc_mult_shift ( uint32_t* mult, uint32_t* shift,
+                              uint32_t from_hz, uint32_t to_hz )
+{
+    uint64_t tmp;
+    uint32_t sft;
+
+    for ( sft = 32; ; sft-- ) {
+        /* Rounded to the nearest */
+        tmp = ( ( uint64_t ) to_hz << sft ) + from_hz / 2;
+        tmp = div_u64_rem ( tmp, from_hz, NULL );
+        if ( ( tmp >> 32 ) == 0 || sft == 0 )
+            break;
+    }
+
+    *mult = ( uint32_t ) tmp;
+    *shift = sft;
+}
+
+/* Count TSC cycles while PIT channel 2 counts down CALIBRATE_MS. Returns the
+ * TSC's frequency, or 0 if it didn't work out */
+PRIVATE uint32_t calibrate_tsc ( void )
+{
+    uint32_t flags;
+    uint64_t start, end, hz;
+    bool ok;
+
+    flags = irq_save ();
+    start = rdtsc ();
+    ok = pit_busy_wait ( CALIBRATE_MS );
+    end = rdtsc ();
+    irq_restore ( flags );
+
+    if ( !ok || end <= start )
+        return 0;
+
+    /* cycles * 1000 / CALIBRATE_MS. cycles is at most a few hundred
+     * million, so the product fits in 64 bits */
+    hz = div_u64_rem ( ( end - start ) * 1000, CALIBRATE_MS, NULL );
+    if ( hz >> 32 )
+        return 0;
+
+    return ( uint32_t ) hz;
+}
+
+PRIVATE void clocksource_select ( clocksource_t* cs, uint32_t freq_hz )
+{
+    cs->freq_hz = freq_hz;
+    clocks_calc_mult_shift ( &cs->mult, &cs->shift, freq_hz, NSEC_PER_SEC );
+    clock_base = cs->read ();
+    clock = cs;
+}
+
+void init_clocksource ( void )
+{
+    uint32_t edx, max_leaf;
+
+    cpuid ( 1, NULL, NULL, NULL, &edx );
+    if ( edx & CPUID_FEAT_EDX_TSC )
+        tsc_hz = calibrate_tsc ();
+
+    if ( tsc_hz ) {
+        clocksource_select ( &tsc_clocksource, tsc_hz );
+    } else {
+        clocksource_select ( &ticks_clocksource, timer_get_frequency () );
+    }
+
+    screen_puts ( "Clocksource: " );
+    screen_puts ( clock->name );
+    screen_puts ( ", " );
+    screen_put_int ( clock->freq_hz / 1000 );
+    screen_puts ( " kHz" );
+
+    if ( clock == &tsc_clocksource ) {
+        cpuid ( 0x80000000, &max_leaf, NULL, NULL, NULL );
+        edx = 0;
+        if ( max_leaf >= CPUID_LEAF_POWER_MGMT )
+            cpuid ( CPUID_LEAF_POWER_MGMT, NULL, NULL, NULL, &edx );
+        if ( !( edx & CPUID_PM_EDX_INVARIANT_TSC ) )
+            screen_puts ( " (not invariant!)" );
+    }
+    screen_putc ( '\n' );
+}
+
+uint64_t ktime_get_ns ( void )
+{
+    uint64_t count;
+
+    return ktime_get_ns_count ( &count );
+}
+
+uint64_t ktime_get_ns_count ( uint64_t* count )
+{
+    if ( !clock ) {
+        *count = 0;
+        return 0;
+    }
+
+    *count = clock->read ();
+    return mul_u64_u32_shr ( *count - clock_base, clock->mult, clock->shift );
+}
+
+const clocksource_t* clocksource_get ( void )
+{
+    return clock;
+}
+
+bool clocksource_is_continuous ( void )
+{
+    return clock && clock->continuous;
+}
+
+uint32_t tsc_get_hz ( void )
+{
+    return tsc_hz;
+}
@@ -0,0 +1,73 @@
+#ifndef CLOCKSOURCE_H
+#define CLOCKSOURCE_H
+#include <stdinc.h>
+/*
+ * Keeping time.
+ *
+ * A clocksource is anything that counts up at a known, steady rate: the
+ * TSC, or failing that, the timer ticks themselves. ktime_get_ns() reads the
+ * best one we have and converts its count into nanoseconds since boot, in 64
+ * bits (that's 584 years' worth).
+ *
+ * The conversion has to be cheap and can't use the FPU, so instead of
+ *
+ *      ns = cycles * 1000000000 / freq
+ *
+ * we do
+ *
+ *      ns = ( cycles * mult ) >> shift
+ *
+ * where mult / 2^shift is as close to 10^9 / freq as 32 bits of mult allow.
+ * mult and shift are worked out once, when the clocksource is registered.
+ * The multiplication is 64x32 bits with a 96-bit result (see
+ * mul_u64_u32_shr), so it doesn't overflow however long it's been.
+ *
+ * The TSC's frequency isn't reported anywhere we can rely on, so
+ * init_clocksource() measures it: it lets PIT channel 2 count down a known
+ * interval (see pit_busy_wait) while watching how far the TSC gets. If there's no TSC, or the
+ * measurement makes no sense, we fall back to counting timer ticks, which
+ * only gives us the resolution of one tick.
+ */
+
+#define NSEC_PER_SEC  1000000000
+#define NSEC_PER_MSEC 1000000
+#define NSEC_PER_USEC 1000
+
+
+typedef struct {
+    const char* name;
+    uint64_t ( *read ) ( void ); /* The current count */
+    uint32_t freq_hz;            /* How fast it counts */
+    uint32_t mult;               /* ns = ( count * mult ) >> shift */
+    uint32_t shift;
+    bool continuous;             /* Keeps counting with the tick stopped */
+} clocksource_t;
+
+/* Measure the TSC and pick the clocksource. Must be called after
+ * init_timer */
+void init_clocksource ( void );
+
+/* Nanoseconds since the clocksource was picked */
+uint64_t ktime_get_ns ( void );
+
+/* The same, also storing in *count the clocksource count it worked the time
+ * out from (see vdso.h) */
+uint64_t ktime_get_ns_count ( uint64_t* count );
+
+/* The clocksource in use */
+const clocksource_t* clocksource_get ( void );
+
+/* The TSC's frequency, or 0 if we don't have a usable TSC */
+uint32_t tsc_get_hz ( void );
+
+/* Whether we can tell the time without the timer ticking (see
+ * timer_nohz_enter in internal_timer.h) */
+bool clocksource_is_continuous ( void );
+
+/* Work out the mult and shift that turn a count of a from_hz clock into a
+ * count of a to_hz one: to = ( from * mult ) >> shift. The shift is as large
+ * as it can be (at most 32) while mult still fits in 32 bits */
+void clocks_calc_mult_shift ( uint32_t* mult, uint32_t* shift,
+                              uint32_t from_hz, uint32_t to_hz );
+
+#endif
@@ -1,7 +1,18 @@
 #include <elf.h>
 #include <string.h>
+#include <rcu.h>
+#include <mutex.h>
 
-PRIVATE elf_symbols_t kernel_elf_symbols;
+/* The kernel's symbols. Looked up from wherever something needs a name for
+ * an address, and replaced hardly ever, so it's RCU protected (see rcu.h):
+ * a new set is built in the spare slot and published, and the old one is
+ * the spare once a grace period has passed */
+PRIVATE elf_symbols_t symbol_tables[2];
+PRIVATE elf_symbols_t* kernel_elf_symbols = NULL;
+
+/* Keeps builders apart. They wait for grace periods, so it's one that
+ * sleeps */
+PRIVATE mutex_t symbols_lock = MUTEX_INIT ( symbols_lock, "kernel symbols" );
 
 /*
  * This function grabs a pointer to the array of section headers.
@@ -15,23 +26,36 @@ void build_elf_symbols_from_multiboot ( multiboot_t* mb )
 {
     uint32_t i;
     elf_section_header_t* sh = ( elf_section_header_t* ) mb->addr;
+    elf_symbols_t* symbols;
 
     /* .shstrtab has the names of the sections,
      * and sh is an array of sections, which themselves contain
      * an index to .shstrtab (for their names)
      */
     uint32_t shstrtab = sh[mb->shndx].addr;
+
+    mutex_lock ( &symbols_lock );
+    symbols = kernel_elf_symbols == &symbol_tables[0] ? &symbol_tables[1] : &symbol_tables[0];
+    memset ( symbols, 0, sizeof ( elf_symbols_t ) );
+
     for ( i = 0; i < mb->num; i++ ) {
         const char *name = ( const char* ) ( shstrtab + sh[i].name_offset_in_shstrtab );
         if ( !strcmp ( name, ".strtab" ) ) {
-            kernel_elf_symbols.strtab = ( const char * ) sh[i].addr;
-            kernel_elf_symbols.strtab_size = sh[i].size;
+            symbols->strtab = ( const char * ) sh[i].addr;
+            symbols->strtab_size = sh[i].size;
         }
         if ( !strcmp ( name, ".symtab" ) ) {
-            kernel_elf_symbols.symtab = ( elf_symbol_t* ) sh[i].addr;
-            kernel_elf_symbols.symtab_size = sh[i].size;
+            symbols->symtab = ( elf_symbol_t* ) sh[i].addr;
+            symbols->symtab_size = sh[i].size;
         }
     }
+
+    rcu_assign_pointer ( kernel_elf_symbols, symbols );
+
+    /* The old set becomes the spare once nobody can be using it */
+    synchronize_rcu ();
+
+    mutex_unlock ( &symbols_lock );
 }
 
 /*
@@ -60,5 +84,14 @@ const char* elf_lookup_symbol_function ( uint32_t addr, elf_symbols_t* elf )
 
 const char* kernel_elf_lookup_symbol_function ( uint32_t addr )
 {
-    return elf_lookup_symbol_function(addr, &kernel_elf_symbols);
+    elf_symbols_t* symbols;
+    const char* name = NULL;
+
+    /* The names themselves are in the ELF sections, which stay put */
+    rcu_read_lock ();
+    symbols = rcu_dereference ( kernel_elf_symbols );
+    if ( symbols )
+        name = elf_lookup_symbol_function ( addr, symbols );
+    rcu_read_unlock ();
+    return name;
 }
@@ -46,7 +46,10 @@ typedef struct
 } elf_symbols_t;
 
  
-/* Builds as the set of elf symbols from a multiboot scructure */
+/* Builds as the set of elf symbols from a multiboot scructure. It replaces
+ * the kernel's symbols the RCU way (see rcu.h), so it must come after
+ * init_gdt, and lookups never take a lock. It waits for a grace period, so
+ * it may sleep: not from interrupt handlers, or with a spinlock held */
 void build_elf_symbols_from_multiboot (multiboot_t* mb);
 
 /* Locate a symbol (only functions) in the following elf symbols
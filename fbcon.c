@@ -0,0 +1,183 @@
+#include <fbcon.h>
+#include <screen.h>
+#include <mem.h>
+#include <mem/vmm.h>
+
+/* One slot of the glyph cache: the whole font, rendered in one fg/bg pair */
+typedef struct {
+    bool     valid;
+    uint8_t  colors;     /* The attribute byte rendered here (fg | bg << 4) */
+    uint32_t last_used;  /* Value of glyph_cache_clock when last looked up */
+    uint32_t pixels[FONT_GLYPHS][FBCON_GLYPH_H][FBCON_GLYPH_W];
+} glyph_cache_slot_t;
+
+/* The 16 VGA text colors, as 0xRRGGBB */
+PRIVATE const uint32_t vga_palette[16] = {
+    0x000000, 0x0000AA, 0x00AA00, 0x00AAAA, 0xAA0000, 0xAA00AA, 0xAA5500, 0xAAAAAA,
+    0x555555, 0x5555FF, 0x55FF55, 0x55FFFF, 0xFF5555, 0xFF55FF, 0xFFFF55, 0xFFFFFF
+};
+
+PRIVATE glyph_cache_slot_t glyph_cache[FBCON_CACHE_SLOTS];
+PRIVATE uint32_t glyph_cache_clock = 0;
+
+/* What screen.c writes to, and what we last drew */
+PRIVATE uint16_t shadow[FBCON_MAX_COLS * FBCON_MAX_ROWS];
+PRIVATE uint16_t front[FBCON_MAX_COLS * FBCON_MAX_ROWS];
+
+PRIVATE vbe_mode_info_t mode;
+PRIVATE uint32_t cols = 0, rows = 0;
+
+/* The VGA palette in the framebuffer's pixel format */
+PRIVATE uint32_t palette[16];
+
+/* Where the framebuffer is mapped. NULL until init_fbcon() */
+PRIVATE uint8_t* fb = NULL;
+
+/* Converts 0xRRGGBB to the framebuffer's pixel format */
+PRIVATE uint32_t pack_color ( uint32_t rgb )
+{
+    uint32_t r = ( rgb >> 16 ) & 0xFF;
+    uint32_t g = ( rgb >> 8 ) & 0xFF;
+    uint32_t b = rgb & 0xFF;
+
+    return ( ( r >> ( 8 - mode.red_mask ) ) << mode.red_position ) |
+           ( ( g >> ( 8 - mode.green_mask ) ) << mode.green_position ) |
+           ( ( b >> ( 8 - mode.blue_mask ) ) << mode.blue_position );
+}
+
+PRIVATE void glyph_cache_render ( glyph_cache_slot_t* slot, uint8_t colors )
+{
+    uint32_t fg = palette[colors & 0x0F];
+    uint32_t bg = palette[colors >> 4];
+    uint32_t c, x, y;
+    uint8_t bits;
+
+    for ( c = 0; c < FONT_GLYPHS; c++ )
+        for ( y = 0; y < FBCON_GLYPH_H; y++ ) {
+            bits = font8x8[c][y / 2];
+            for ( x = 0; x < FBCON_GLYPH_W; x++ )
+                slot->pixels[c][y][x] = ( ( bits >> x ) & 1 ) ? fg : bg;
+        }
+
+    slot->colors = colors;
+    slot->valid = true;
+}
+
+/* Finds the slot with the given colors, rendering it over the least recently
+ * used slot if there's none */
+PRIVATE glyph_cache_slot_t* glyph_cache_get ( uint8_t colors )
+{
+    glyph_cache_slot_t* victim = &glyph_cache[0];
+    int i;
+
+    glyph_cache_clock++;
+    for ( i = 0; i < FBCON_CACHE_SLOTS; i++ ) {
+        if ( glyph_cache[i].valid && glyph_cache[i].colors == colors ) {
+            glyph_cache[i].last_used = glyph_cache_clock;
+            return &glyph_cache[i];
+        }
+
+        if ( victim->valid && ( !glyph_cache[i].valid || glyph_cache[i].last_used < victim->last_used ) )
+            victim = &glyph_cache[i];
+    }
+
+    glyph_cache_render ( victim, colors );
+    victim->last_used = glyph_cache_clock;
+    return victim;
+}
+
+/* Copies count 32-bit pixels. rep movsl lets the CPU issue wide stores, which
+ * the write-combining buffers then merge into full bursts. */
+PRIVATE void fb_copy ( void* dst, const void* src, uint32_t count )
+{
+    __asm volatile ( "rep movsl" : "+D" ( dst ), "+S" ( src ), "+c" ( count ) : : "memory" );
+}
+
+PRIVATE void draw_cell ( uint32_t x, uint32_t y )
+{
+    uint16_t cell = shadow[y * cols + x];
+    glyph_cache_slot_t* slot = glyph_cache_get ( cell >> 8 );
+    uint8_t c = cell & ( FONT_GLYPHS - 1 );
+    uint8_t* dst = fb + y * FBCON_GLYPH_H * mode.pitch + x * FBCON_GLYPH_W * sizeof ( uint32_t );
+    uint32_t i;
+
+    for ( i = 0; i < FBCON_GLYPH_H; i++, dst += mode.pitch )
+        fb_copy ( dst, slot->pixels[c][i], FBCON_GLYPH_W );
+
+    front[y * cols + x] = cell;
+}
+
+bool fbcon_probe ( multiboot_t* mboot_ptr )
+{
+    multiboot_t* mb;
+    vbe_mode_info_t* info;
+    int i;
+
+    /* GRUB gives us physical addresses, but puts all of this in low memory,
+     * which we have mapped */
+    if ( ( uint32_t ) mboot_ptr + sizeof ( multiboot_t ) > KERNEL_LOW_MAPPED_SIZE )
+        return false;
+    mb = ( multiboot_t* ) KERNEL_PHYS_TO_VIRT ( ( uint32_t ) mboot_ptr );
+
+    if ( ! ( mb->flags & MULTIBOOT_FLAG_VBE ) ||
+         mb->vbe_mode_info + sizeof ( vbe_mode_info_t ) > KERNEL_LOW_MAPPED_SIZE )
+        return false;
+    info = ( vbe_mode_info_t* ) KERNEL_PHYS_TO_VIRT ( mb->vbe_mode_info );
+
+    /* We only draw 32-bit direct color pixels to a linear framebuffer */
+    if ( ! ( info->attributes & VBE_MODE_ATTR_LINEAR_FB ) ||
+         info->memory_model != VBE_MEMORY_MODEL_DIRECT || info->bpp != 32 )
+        return false;
+
+    memcpy ( &mode, info, sizeof ( vbe_mode_info_t ) );
+
+    cols = mode.width / FBCON_GLYPH_W;
+    rows = mode.height / FBCON_GLYPH_H;
+    if ( cols > FBCON_MAX_COLS ) cols = FBCON_MAX_COLS;
+    if ( rows > FBCON_MAX_ROWS ) rows = FBCON_MAX_ROWS;
+
+    for ( i = 0; i < 16; i++ )
+        palette[i] = pack_color ( vga_palette[i] );
+
+    screen_use_buffer ( shadow, cols, rows );
+    return true;
+}
+
+void init_fbcon ( void )
+{
+    uint32_t x, y;
+
+    if ( !cols )
+        return;
+
+    /* Without a PAT, PTE_PAGE_WRITECOMBINING is just write-through, which
+     * still beats caching a framebuffer write-back */
+    vmm_init_write_combining ();
+    fb = ( uint8_t* ) vmm_map_physical ( mode.framebuffer, mode.pitch * mode.height,
+                                         PTE_PAGE_WRITE | PTE_PAGE_WRITECOMBINING );
+    if ( !fb )
+        return;
+
+    for ( y = 0; y < rows; y++ )
+        for ( x = 0; x < cols; x++ )
+            draw_cell ( x, y );
+}
+
+void fbcon_update_cell ( uint32_t x, uint32_t y )
+{
+    if ( fb )
+        draw_cell ( x, y );
+}
+
+void fbcon_refresh ( void )
+{
+    uint32_t x, y;
+
+    if ( !fb )
+        return;
+
+    for ( y = 0; y < rows; y++ )
+        for ( x = 0; x < cols; x++ )
+            if ( shadow[y * cols + x] != front[y * cols + x] )
+                draw_cell ( x, y );
+}
@@ -0,0 +1,74 @@
+#ifndef FBCON_H
+#define FBCON_H
+#include <stdinc.h>
+#include <multiboot.h>
+#include <font.h>
+/*
+ * The framebuffer console draws the very same text console that screen.c
+ * maintains, but on a VBE linear framebuffer instead of the 80x25 VGA text
+ * mode.
+ *
+ * HOW IT WORKS
+ *
+ * screen.c keeps working with 16-bit cells (character | fg << 8 | bg << 12),
+ * just like in VGA text memory. When the framebuffer console is active, those
+ * cells live in a RAM shadow buffer that we own, instead of at 0xB8000. All of
+ * the cursor handling and scrolling happens in that buffer, which is cheap
+ * since it's plain cached RAM. screen.c then tells us which cell changed
+ * (fbcon_update_cell) or that many of them might have (fbcon_refresh), and we
+ * draw them.
+ *
+ * Drawing a character naively means testing a font bit, picking the fg or bg
+ * color and writing a pixel, for each of its 8x16 pixels. Instead, we keep a
+ * glyph cache: for a given fg/bg pair, the whole font is pre-rendered once into
+ * ready-to-copy pixels. Drawing a character is then 16 copies of a 32-byte
+ * glyph row, done with string moves. The cache has a few slots (color pairs),
+ * and the least recently used one is re-rendered when a new pair shows up.
+ *
+ * We never read from the framebuffer. It is mapped write-combining (see
+ * PTE_PAGE_WRITECOMBINING in vmm.h), which makes writes fast and reads
+ * painfully slow. To refresh, we compare the shadow buffer against a copy of
+ * what we last drew (the front buffer) and only redraw the cells that differ.
+ *
+ * BOOTING
+ *
+ * The bootloader sets the video mode. Asking for one takes a multiboot header
+ * flag that GRUB legacy (the one in floppy.img) refuses, so we only ask when
+ * start.s is assembled with FBCON_REQUEST_MODE (see makefile.real). GRUB 2 on
+ * QEMU's -vga std then gives us a 32-bit linear framebuffer.
+ *
+ * fbcon_probe() is called first thing and only reads the multiboot info. If
+ * there's a usable mode, it points screen.c at the shadow buffer, so nothing
+ * printed during boot is lost. The framebuffer itself can only be mapped once
+ * the VMM is up, which is what init_fbcon() does, drawing everything that was
+ * printed so far.
+ */
+
+/* Glyphs are drawn 8x16: the 8x8 font with every row doubled */
+#define FBCON_GLYPH_W      FONT_WIDTH
+#define FBCON_GLYPH_H      (FONT_HEIGHT * 2)
+
+/* The largest console we support (1280x1024 in 8x16 cells) */
+#define FBCON_MAX_COLS     160
+#define FBCON_MAX_ROWS     64
+
+/* How many fg/bg pairs are kept pre-rendered at once */
+#define FBCON_CACHE_SLOTS  4
+
+/* Looks for a usable VBE mode in the multiboot info and, if there's one,
+ * redirects screen.c to the shadow buffer. mboot_ptr is the physical address
+ * GRUB handed to kernel_main. Returns whether the framebuffer console will
+ * be used. */
+bool fbcon_probe ( multiboot_t* mboot_ptr );
+
+/* Maps the framebuffer and draws the console. Needs the VMM to be up. Does
+ * nothing if fbcon_probe didn't find a usable mode. */
+void init_fbcon ( void );
+
+/* Called by screen.c when the cell at (x, y) of the shadow buffer changed */
+void fbcon_update_cell ( uint32_t x, uint32_t y );
+
+/* Called by screen.c when any number of cells might have changed */
+void fbcon_refresh ( void );
+
+#endif
@@ -0,0 +1,13 @@
+#ifndef FONT_H
+#define FONT_H
+#include <stdinc.h>
+
+/* The bitmap font used by the framebuffer console (see fbcon.h).
+ * It covers 7-bit ASCII only, one byte per glyph row. */
+#define FONT_GLYPHS  128
+#define FONT_WIDTH   8
+#define FONT_HEIGHT  8
+
+extern const uint8_t font8x8[FONT_GLYPHS][FONT_HEIGHT];
+
+#endif
@@ -0,0 +1,333 @@
+#include <fpu.h>
+#include <sched.h>
+#include <idt.h>
+#include <preempt.h>
+#include <percpu.h>
+#include <smp.h>
+#include <kpanic.h>
+#include <screen.h>
+#include <x86/x86.h>
+
+#define CR0_MP              ( 1 << 1 ) /* wait/fwait trap on TS too */
+#define CR0_EM              ( 1 << 2 ) /* No FPU: emulate it */
+#define CR0_TS              ( 1 << 3 )
+#define CR0_NE              ( 1 << 5 ) /* x87 errors as #MF, not through the PIC */
+
+#define CR4_OSFXSR          ( 1 << 9 )
+#define CR4_OSXMMEXCPT      ( 1 << 10 )
+#define CR4_OSXSAVE         ( 1 << 18 )
+
+/* Reported by CPUID leaf 1 */
+#define CPUID_FEAT_EDX_FPU  ( 1 << 0 )
+#define CPUID_FEAT_EDX_FXSR ( 1 << 24 )
+#define CPUID_FEAT_EDX_SSE  ( 1 << 25 )
+#define CPUID_FEAT_ECX_XSAVE ( 1 << 26 )
+#define CPUID_FEAT_ECX_AVX  ( 1 << 28 )
+
+/* CPUID leaf 0xD: what xsave saves, and how much room it needs */
+#define CPUID_LEAF_XSAVE    0xD
+#define CPUID_XSAVE_EAX_XSAVEOPT ( 1 << 0 ) /* In subleaf 1 */
+
+/* XCR0 bits: the state components xsave takes care of */
+#define XSTATE_X87          ( 1 << 0 )
+#define XSTATE_SSE          ( 1 << 1 )
+#define XSTATE_AVX          ( 1 << 2 )
+
+#define MXCSR_DEFAULT       0x1F80 /* Every exception masked */
+
+#define FPU_TRAP_VECTOR     7
+
+/* How we save and restore */
+#define FPU_FNSAVE          0
+#define FPU_FXSAVE          1
+#define FPU_XSAVE           2
+#define FPU_XSAVEOPT        3
+
+PRIVATE const char* method_names[] = { "fnsave", "fxsave", "xsave", "xsaveopt" };
+
+PRIVATE uint32_t method = FPU_FNSAVE;
+PRIVATE bool have_fpu = false;
+PRIVATE bool have_sse = false;
+PRIVATE uint32_t xcr0 = 0;
+
+/* What a thread's FPU looks like the first time it uses it */
+PRIVATE fpu_state_t init_state;
+
+PRIVATE uint32_t read_cr0 ( void )
+{
+    uint32_t cr0;
+
+    __asm volatile ( "mov %%cr0, %0" : "=r" ( cr0 ) );
+    return cr0;
+}
+
+PRIVATE void write_cr0 ( uint32_t cr0 )
+{
+    __asm volatile ( "mov %0, %%cr0" : : "r" ( cr0 ) : "memory" );
+}
+
+PRIVATE void clts ( void )
+{
+    __asm volatile ( "clts" : : : "memory" );
+}
+
+PRIVATE void stts ( void )
+{
+    write_cr0 ( read_cr0 () | CR0_TS );
+}
+
+PRIVATE void xsetbv ( uint32_t reg, uint64_t value )
+{
+    __asm volatile ( "xsetbv" : : "c" ( reg ), "a" ( ( uint32_t ) value ),
+                     "d" ( ( uint32_t ) ( value >> 32 ) ) );
+}
+
+/* TS must be clear for both */
+PRIVATE void fpu_save ( fpu_state_t* s )
+{
+    switch ( method ) {
+    case FPU_XSAVEOPT:
+        __asm volatile ( "xsaveopt %0" : "=m" ( *s ) : "a" ( 0xFFFFFFFF ), "d" ( 0xFFFFFFFF ) );
+        break;
+    case FPU_XSAVE:
+        __asm volatile ( "xsave %0" : "=m" ( *s ) : "a" ( 0xFFFFFFFF ), "d" ( 0xFFFFFFFF ) );
+        break;
+    case FPU_FXSAVE:
+        __asm volatile ( "fxsave %0" : "=m" ( *s ) );
+        break;
+    default:
+        /* This one reinitializes the FPU too: the registers aren't
+         * anyone's any more */
+        __asm volatile ( "fnsave %0; fwait" : "=m" ( *s ) );
+        this_cpu_write ( fpu_owner, NULL );
+        break;
+    }
+}
+
+PRIVATE void fpu_restore ( const fpu_state_t* s )
+{
+    switch ( method ) {
+    case FPU_XSAVEOPT:
+    case FPU_XSAVE:
+        __asm volatile ( "xrstor %0" : : "m" ( *s ), "a" ( 0xFFFFFFFF ), "d" ( 0xFFFFFFFF ) );
+        break;
+    case FPU_FXSAVE:
+        __asm volatile ( "fxrstor %0" : : "m" ( *s ) );
+        break;
+    default:
+        __asm volatile ( "frstor %0" : : "m" ( *s ) );
+        break;
+    }
+}
+
+/* Clean registers: what fninit leaves, and the default MXCSR */
+PRIVATE void fpu_reset ( void )
+{
+    uint32_t mxcsr = MXCSR_DEFAULT;
+
+    __asm volatile ( "fninit" );
+    if ( have_sse )
+        __asm volatile ( "ldmxcsr %0" : : "m" ( mxcsr ) );
+}
+
+/* #NM: the running thread wants the FPU */
+PRIVATE void fpu_trap ( registers_t* regs )
+{
+    thread_t* self;
+    uint32_t cpu;
+
+    UNUSED ( regs );
+    if ( this_cpu_read ( fpu_in_use ) != FPU_IDLE )
+        kpanic ( "#NM with the FPU in use" );
+
+    clts ();
+    this_cpu_write ( fpu_in_use, FPU_THREAD );
+
+    /* Before init_sched there's only main, and the registers are its */
+    self = thread_current ();
+    if ( !self )
+        return;
+
+    cpu = smp_processor_id ();
+    if ( this_cpu_read ( fpu_owner ) == self && self->fpu_cpu == cpu )
+        return;
+
+    fpu_restore ( self->fpu_used ? &self->fpu : &init_state );
+    self->fpu_used = true;
+    self->fpu_cpu = cpu;
+    this_cpu_write ( fpu_owner, self );
+}
+
+void fpu_switch_out ( thread_t* prev )
+{
+    if ( this_cpu_read ( fpu_in_use ) != FPU_THREAD )
+        return;
+
+    /* Still in the registers after the save, unless that was fnsave */
+    this_cpu_write ( fpu_owner, prev );
+    prev->fpu_cpu = smp_processor_id ();
+    prev->fpu_used = true;
+    fpu_save ( &prev->fpu );
+
+    stts ();
+    this_cpu_write ( fpu_in_use, FPU_IDLE );
+}
+
+void fpu_thread_init ( thread_t* t )
+{
+    t->fpu_used = false;
+    t->fpu_cpu = FPU_NO_CPU;
+}
+
+bool kernel_fpu_usable ( void )
+{
+    return have_fpu && this_cpu_read ( fpu_in_use ) != FPU_KERNEL;
+}
+
+void kernel_fpu_begin ( void )
+{
+    thread_t* self;
+    uint32_t flags;
+
+    if ( !have_fpu )
+        kpanic ( "kernel_fpu_begin: no FPU" );
+
+    preempt_disable ();
+    flags = irq_save ();
+    switch ( this_cpu_read ( fpu_in_use ) ) {
+    case FPU_KERNEL:
+        kpanic ( "kernel_fpu_begin: nested" );
+        break;
+    case FPU_THREAD:
+        self = thread_current ();
+        if ( self ) {
+            fpu_save ( &self->fpu );
+            self->fpu_used = true;
+        }
+        break;
+    default:
+        clts ();
+        break;
+    }
+
+    /* Whoever they belonged to, they're ours now */
+    this_cpu_write ( fpu_owner, NULL );
+    this_cpu_write ( fpu_in_use, FPU_KERNEL );
+    irq_restore ( flags );
+
+    fpu_reset ();
+}
+
+void kernel_fpu_end ( void )
+{
+    uint32_t flags;
+
+    flags = irq_save ();
+    stts ();
+    this_cpu_write ( fpu_in_use, FPU_IDLE );
+    irq_restore ( flags );
+    preempt_enable ();
+}
+
+/* The same setup on every CPU: FPU and SSE on, TS set */
+PRIVATE void fpu_setup_cpu ( void )
+{
+    uint32_t cr0, cr4;
+
+    cr0 = read_cr0 ();
+    cr0 &= ~( CR0_EM | CR0_TS );
+    cr0 |= CR0_MP | CR0_NE;
+    write_cr0 ( cr0 );
+
+    if ( method != FPU_FNSAVE ) {
+        __asm volatile ( "mov %%cr4, %0" : "=r" ( cr4 ) );
+        cr4 |= CR4_OSFXSR | CR4_OSXMMEXCPT;
+        if ( xcr0 )
+            cr4 |= CR4_OSXSAVE;
+        __asm volatile ( "mov %0, %%cr4" : : "r" ( cr4 ) );
+        if ( xcr0 )
+            xsetbv ( 0, xcr0 );
+    }
+
+    fpu_reset ();
+    stts ();
+    this_cpu_write ( fpu_in_use, FPU_IDLE );
+    this_cpu_write ( fpu_owner, NULL );
+}
+
+void fpu_init_cpu ( void )
+{
+    if ( have_fpu )
+        fpu_setup_cpu ();
+}
+
+/* Which state components xsave should take care of, and whether they fit
+ * in an fpu_state_t. Returns 0 if we're better off with fxsave */
+PRIVATE uint32_t pick_xstate ( uint32_t ecx )
+{
+    uint32_t supported, size, want, cr4, flags;
+
+    cpuid_count ( CPUID_LEAF_XSAVE, 0, &supported, NULL, NULL, NULL );
+    want = XSTATE_X87 | XSTATE_SSE;
+    if ( ( ecx & CPUID_FEAT_ECX_AVX ) && ( supported & XSTATE_AVX ) )
+        want |= XSTATE_AVX;
+    if ( ( supported & want ) != want )
+        return 0;
+
+    /* The size CPUID reports is for what's enabled in XCR0 right now */
+    flags = irq_save ();
+    __asm volatile ( "mov %%cr4, %0" : "=r" ( cr4 ) );
+    __asm volatile ( "mov %0, %%cr4" : : "r" ( cr4 | CR4_OSXSAVE ) );
+    xsetbv ( 0, want );
+    cpuid_count ( CPUID_LEAF_XSAVE, 0, NULL, &size, NULL, NULL );
+    if ( size > sizeof ( fpu_state_t ) ) {
+        want &= ~XSTATE_AVX;
+        xsetbv ( 0, want );
+        cpuid_count ( CPUID_LEAF_XSAVE, 0, NULL, &size, NULL, NULL );
+    }
+    irq_restore ( flags );
+
+    return size <= sizeof ( fpu_state_t ) ? want : 0;
+}
+
+void init_fpu ( void )
+{
+    uint32_t ecx, edx, eax;
+
+    cpuid ( 1, NULL, NULL, &ecx, &edx );
+    if ( !( edx & CPUID_FEAT_EDX_FPU ) ) {
+        screen_puts ( "FPU: none\n" );
+        return;
+    }
+    have_fpu = true;
+
+    if ( edx & CPUID_FEAT_EDX_FXSR ) {
+        method = FPU_FXSAVE;
+        have_sse = ( edx & CPUID_FEAT_EDX_SSE ) != 0;
+    }
+    if ( have_sse && ( ecx & CPUID_FEAT_ECX_XSAVE ) ) {
+        xcr0 = pick_xstate ( ecx );
+        if ( xcr0 ) {
+            cpuid_count ( CPUID_LEAF_XSAVE, 1, &eax, NULL, NULL, NULL );
+            method = ( eax & CPUID_XSAVE_EAX_XSAVEOPT ) ? FPU_XSAVEOPT : FPU_XSAVE;
+        }
+    }
+
+    fpu_setup_cpu ();
+
+    /* The clean state, in the format fpu_restore wants. xsave leaves the
+     * components still in their initial state marked as such, and xrstor
+     * then just initializes them */
+    clts ();
+    fpu_reset ();
+    fpu_save ( &init_state );
+    stts ();
+
+    register_interrupt_handler ( FPU_TRAP_VECTOR, &fpu_trap );
+
+    screen_puts ( "FPU: " );
+    screen_puts ( method_names[method] );
+    if ( xcr0 & XSTATE_AVX )
+        screen_puts ( ", with AVX" );
+    screen_putc ( '\n' );
+}
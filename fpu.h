@@ -0,0 +1,65 @@
+#ifndef FPU_H
+#define FPU_H
+#include <stdinc.h>
+/*
+ * The FPU and SSE registers, and who they belong to.
+ *
+ * Each thread has its own FPU state (x87, SSE, and AVX where there's room),
+ * saved in its thread_t with the best of fnsave, fxsave and xsave the CPU
+ * has. Most threads never touch the FPU, though, so switching threads
+ * doesn't touch it either, unless the one switched away from used it:
+ *
+ *  -> CR0.TS is set whenever the registers aren't known to be the running
+ *     thread's. The first FPU instruction the thread executes then traps
+ *     (#NM, vector 7), and the handler clears TS and loads the thread's
+ *     state, or a clean one the first time. It skips the load if the
+ *     registers still hold the thread's state from the last time it ran
+ *     here (this CPU's fpu_owner, untouched since).
+ *  -> On a switch, if the FPU was used (TS is clear), its state is saved in
+ *     the thread being switched away from, and TS set again. Saving then,
+ *     and not when someone else wants the FPU, means the state is always in
+ *     memory when the thread is off its CPU, so it can move to another one.
+ *
+ * The kernel may use the FPU and SIMD registers itself (for a fast memcpy,
+ * say), between kernel_fpu_begin() and kernel_fpu_end(). begin saves the
+ * running thread's state if it's live, and leaves the registers clean; end
+ * sets TS, so the thread reloads its state the next time it needs it. In
+ * between, preemption is disabled, so no blocking. The sections don't nest:
+ * interrupt handlers must check kernel_fpu_usable() first, since they may
+ * have interrupted one. Outside them, interrupt handlers must not touch the
+ * FPU at all.
+ */
+
+/* Big enough for x87, SSE and AVX in the xsave format. If the CPU's xsave
+ * area is bigger than this with AVX in it, we leave AVX off */
+#define FPU_AREA_SIZE 1024
+
+#define FPU_NO_CPU    0xFFFFFFFF
+
+/* fpu_in_use (see percpu.h) */
+#define FPU_IDLE      0 /* CR0.TS set */
+#define FPU_THREAD    1 /* The running thread's */
+#define FPU_KERNEL    2 /* In a kernel_fpu_begin section */
+
+typedef struct {
+    uint8_t area[FPU_AREA_SIZE];
+} __attribute__ ( ( aligned ( 64 ) ) ) fpu_state_t;
+
+struct thread;
+
+void init_fpu ( void );
+/* Called by every AP */
+void fpu_init_cpu ( void );
+
+/* A new thread's state: clean, and not in anyone's registers */
+void fpu_thread_init ( struct thread* t );
+
+/* Called by schedule, with interrupts disabled, just before it switches
+ * away from prev */
+void fpu_switch_out ( struct thread* prev );
+
+void kernel_fpu_begin ( void );
+void kernel_fpu_end ( void );
+bool kernel_fpu_usable ( void );
+
+#endif
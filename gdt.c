@@ -1,49 +1,82 @@
 #include <gdt.h>
-
-#define NUM_ENTRIES 3
+#include <smp.h>
+#include <percpu.h>
+#include <mem.h>
 
 extern void gdt_set (uint32_t);
-PRIVATE void gdt_set_gate (int32_t,uint32_t,uint32_t,uint8_t,uint8_t);
+PRIVATE void gdt_set_gate (gdt_entry_t*,int32_t,uint32_t,uint32_t,uint8_t,uint8_t);
 
-/* GDT Entries */
-gdt_entry_t gdt_entries [NUM_ENTRIES];
+/* GDT Entries, one table per CPU */
+gdt_entry_t gdt_entries [MAX_CPUS][GDT_ENTRIES];
 
-/* Our GDT Pointer (remember the x86 needs a special structure to store the
+/* Our GDT Pointers (remember the x86 needs a special structure to store the
    location of the GDT entries */
-gdt_ptr_t gdt_ptr;
+gdt_ptr_t gdt_ptr [MAX_CPUS];
+
+/* And the TSS each GDT points to */
+tss_t tss [MAX_CPUS];
 
 void init_gdt ()
 {
-  gdt_ptr.limit = sizeof (gdt_entry_t) * NUM_ENTRIES - 1;
+  gdt_init_cpu (0);
+}
+
+void gdt_init_cpu (uint32_t cpu)
+{
+  gdt_entry_t* entries = gdt_entries[cpu];
+
+  gdt_ptr[cpu].limit = sizeof (gdt_entry_t) * GDT_ENTRIES - 1;
+
+  gdt_ptr[cpu].base = (uint32_t) entries;
 
-  gdt_ptr.base = (uint32_t) &gdt_entries;       
+  init_percpu (cpu);
 
-  gdt_set_gate (0, 0, 0, 0, 0);                                                     /* Null segment. */
-  gdt_set_gate (1, FLATMODEL_BASE, FLATMODEL_LIMIT, CODE_SELECTOR, FLATMODEL_GRAN); /* Code segment. */
-  gdt_set_gate (2, FLATMODEL_BASE, FLATMODEL_LIMIT, DATA_SELECTOR, FLATMODEL_GRAN); /* Data segment. */
+  memset (&tss[cpu], 0, sizeof (tss_t));
+  tss[cpu].ss0        = GDT_KERNEL_DATA_SELECTOR;
+  tss[cpu].iomap_base = sizeof (tss_t);
 
-  gdt_set ((uint32_t) &gdt_ptr);
+  gdt_set_gate (entries, GDT_NULL_ENTRY, 0, 0, 0, 0);                                                     /* Null segment. */
+  gdt_set_gate (entries, GDT_KERNEL_CODE_ENTRY, FLATMODEL_BASE, FLATMODEL_LIMIT, CODE_SELECTOR, FLATMODEL_GRAN); /* Code segment. */
+  gdt_set_gate (entries, GDT_KERNEL_DATA_ENTRY, FLATMODEL_BASE, FLATMODEL_LIMIT, DATA_SELECTOR, FLATMODEL_GRAN); /* Data segment. */
+  gdt_set_gate (entries, GDT_USER_CODE_ENTRY, FLATMODEL_BASE, FLATMODEL_LIMIT, USER_CODE_SELECTOR, FLATMODEL_GRAN); /* User code segment. */
+  gdt_set_gate (entries, GDT_USER_DATA_ENTRY, FLATMODEL_BASE, FLATMODEL_LIMIT, USER_DATA_SELECTOR, FLATMODEL_GRAN); /* User data segment. */
+  gdt_set_gate (entries, GDT_TSS_ENTRY, (uint32_t) &tss[cpu], sizeof (tss_t) - 1, TSS_SELECTOR, TSS_GRAN); /* TSS. */
+  gdt_set_gate (entries, GDT_PERCPU_ENTRY, (uint32_t) per_cpu (cpu), sizeof (per_cpu_t) - 1, DATA_SELECTOR, PERCPU_GRAN); /* Per-CPU data. */
+
+  gdt_set ((uint32_t) &gdt_ptr[cpu]);
+  __asm volatile ("ltr %w0" : : "r" (GDT_TSS_SELECTOR));
+  __asm volatile ("mov %w0, %%gs" : : "r" (GDT_PERCPU_SELECTOR));
+}
+
+void gdt_set_kernel_stack (uint32_t esp0)
+{
+  tss[this_cpu_read (cpu)].esp0 = esp0;
+}
+
+uint32_t* gdt_kernel_stack_slot (uint32_t cpu)
+{
+  return &tss[cpu].esp0;
 }
 
-PRIVATE void gdt_set_gate(int32_t num, uint32_t base, uint32_t limit, uint8_t access, uint8_t gran)
+PRIVATE void gdt_set_gate(gdt_entry_t* entries, int32_t num, uint32_t base, uint32_t limit, uint8_t access, uint8_t gran)
 {
     /* Make sure that granularity has only the right bits set */
     gran &= 0xF0;
 
     /* Split the base address in the required fields */
-    gdt_entries[num].base_low    = (base & 0xFFFF);
-    gdt_entries[num].base_middle = (base >> 16) & 0xFF;
-    gdt_entries[num].base_high   = (base >> 24) & 0xFF;
+    entries[num].base_low    = (base & 0xFFFF);
+    entries[num].base_middle = (base >> 16) & 0xFF;
+    entries[num].base_high   = (base >> 24) & 0xFF;
 
     /* Split the limit address in the required fields.
        Note that limit_low is in the granularity field. */
-    gdt_entries[num].limit_low   = (limit & 0xFFFF);
-    gdt_entries[num].granularity = (limit >> 16) & 0x0F;
+    entries[num].limit_low   = (limit & 0xFFFF);
+    entries[num].granularity = (limit >> 16) & 0x0F;
     
     /* Set granularity options */
-    gdt_entries[num].granularity |= gran;
+    entries[num].granularity |= gran;
     
     /* Set access flags */
-    gdt_entries[num].access      = access;
+    entries[num].access      = access;
 
 }
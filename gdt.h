@@ -2,8 +2,23 @@
 #define GDT_H
 #include <stdinc.h>
 
+/* Sets up the GDT (and TSS) of the boot CPU, and loads them */
 void init_gdt ();
 
+/* Same thing, for the CPU we're running on, which the SMP code numbered cpu
+ * (see smp.h). Also sets up cpu's per-CPU area and points GS at it. Each CPU has its own GDT, because each has its own TSS, and
+ * a TSS descriptor can only be loaded by one CPU at a time (ltr marks it busy)
+ */
+void gdt_init_cpu ( uint32_t cpu );
+
+/* Set the stack the running CPU switches to when an interrupt (or sysenter)
+ * takes it from ring 3 to ring 0: the TSS's esp0. Each thread that goes to
+ * ring 3 has its own, which the scheduler puts here when it runs it */
+void gdt_set_kernel_stack ( uint32_t esp0 );
+
+/* Where cpu's TSS keeps esp0 */
+uint32_t* gdt_kernel_stack_slot ( uint32_t cpu );
+
 /*
  * In a segment system, each segment is described by a BASE address, of 32 bits,
  * and a 20-bit LIMIT address. The 12 bit difference is not a problem because
@@ -73,6 +88,12 @@ typedef struct
 #define CODE_SELECTOR 0x9A
 #define DATA_SELECTOR 0x92
 
+/* The same, in ring 3 */
+/* User code: 1  011 1 1 0   1  0 --> 0xFA*/
+/* User data: 1  011 1 0 0   1  0 --> 0xF2*/
+#define USER_CODE_SELECTOR 0xFA
+#define USER_DATA_SELECTOR 0xF2
+
 /*                   G D 0 A SegLen */
 /* Flat-Model Priv:  1 1 0 1   1111 --> 0xCF*/
 #define FLATMODEL_GRAN  0xCF
@@ -81,6 +102,67 @@ typedef struct
 
 
 
+/*
+ * The layout of every CPU's GDT. Entries 3 and 4 are kept for the user code
+ * and data segments, which must come in that order right after the kernel's
+ * for SYSENTER/SYSEXIT to find them. Selectors are entry * 8 (plus the RPL).
+ */
+#define GDT_NULL_ENTRY        0
+#define GDT_KERNEL_CODE_ENTRY 1
+#define GDT_KERNEL_DATA_ENTRY 2
+#define GDT_USER_CODE_ENTRY   3
+#define GDT_USER_DATA_ENTRY   4
+#define GDT_TSS_ENTRY         5
+#define GDT_PERCPU_ENTRY      6 /* GS, see percpu.h */
+#define GDT_ENTRIES           7
+
+#define GDT_KERNEL_CODE_SELECTOR ( GDT_KERNEL_CODE_ENTRY * 8 )
+#define GDT_KERNEL_DATA_SELECTOR ( GDT_KERNEL_DATA_ENTRY * 8 )
+#define GDT_USER_CODE_SELECTOR   ( GDT_USER_CODE_ENTRY * 8 | 3 )
+#define GDT_USER_DATA_SELECTOR   ( GDT_USER_DATA_ENTRY * 8 | 3 )
+#define GDT_TSS_SELECTOR         ( GDT_TSS_ENTRY * 8 )
+#define GDT_PERCPU_SELECTOR      ( GDT_PERCPU_ENTRY * 8 )
+
+/*
+ * The Task State Segment. We don't do hardware task switching, so all the
+ * CPU ever reads from it is ss0:esp0, the stack to switch to when an
+ * interrupt comes in from ring 3, and the I/O permission bitmap, which we
+ * don't have (iomap_base points past the end).
+ *
+ * Every field is naturally aligned, so it needs no packing to come out the
+ * 104 bytes the CPU expects, and gdt_kernel_stack_slot can hand out a plain
+ * pointer to esp0.
+ */
+typedef struct
+{
+    uint32_t prev_tss;
+    uint32_t esp0;
+    uint32_t ss0;
+    uint32_t esp1;
+    uint32_t ss1;
+    uint32_t esp2;
+    uint32_t ss2;
+    uint32_t cr3;
+    uint32_t eip;
+    uint32_t eflags;
+    uint32_t eax, ecx, edx, ebx;
+    uint32_t esp, ebp, esi, edi;
+    uint32_t es, cs, ss, ds, fs, gs;
+    uint32_t ldt;
+    uint16_t trap;
+    uint16_t iomap_base;
+} tss_t;
+
+/*       Pr   R 0 Type */
+/* TSS:  1  000 0 1001 --> 0x89 (32 bit TSS, available) */
+#define TSS_SELECTOR 0x89
+/* Byte granularity, and the D bit means nothing for a TSS */
+#define TSS_GRAN     0x00
+
+/* The per-CPU segment is a data segment exactly as big as a per_cpu_t, so
+ * bytes (G=0), and 32 bit (D=1) */
+#define PERCPU_GRAN  0x40
+
 /* This struct describes a GDT pointer. It points to the start of
    our array of GDT entries, and is in the format required by the
    lgdt instruction. */
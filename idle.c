@@ -0,0 +1,196 @@
+#include <idle.h>
+#include <internal_timer.h>
+#include <softirq.h>
+#include <rcu.h>
+#include <async.h>
+#include <smp.h>
+#include <apic.h>
+#include <seqlock.h>
+#include <keyboard.h>
+#include <screen.h>
+#include <x86/x86.h>
+
+/* Reported in ECX by CPUID leaf 1 */
+#define CPUID_FEAT_ECX_MONITOR ( 1 << 3 )
+
+/* One cache line per CPU: the one mwait watches. Only its own CPU writes to
+ * it, except for wakeup */
+typedef struct {
+    seqcount_t seq;               /* Around the next three */
+    uint64_t start;               /* When the CPU came up */
+    uint64_t idle;                /* Idle cycles, up to since */
+    uint64_t since;               /* When it went idle, 0 if it's busy */
+    volatile uint32_t polling;    /* In mwait, watching wakeup */
+    volatile uint32_t wakeup;
+} __attribute__ ( ( aligned ( 64 ) ) ) idle_cpu_t;
+
+PRIVATE idle_cpu_t idle_state[MAX_CPUS];
+PRIVATE bool use_mwait = false;
+PRIVATE bool counting = false;
+
+PRIVATE void idle_begin ( idle_cpu_t* s )
+{
+    if ( !counting )
+        return;
+    write_seqcount_begin ( &s->seq );
+    s->since = rdtsc ();
+    write_seqcount_end ( &s->seq );
+}
+
+PRIVATE void idle_end ( idle_cpu_t* s )
+{
+    uint64_t now;
+
+    if ( !s->since )
+        return;
+    now = rdtsc ();
+    write_seqcount_begin ( &s->seq );
+    s->idle += now - s->since;
+    s->since = 0;
+    write_seqcount_end ( &s->seq );
+}
+
+void idle_irq_enter ( void )
+{
+    idle_end ( &idle_state[smp_processor_id ()] );
+}
+
+PRIVATE void mwait_idle ( idle_cpu_t* s )
+{
+    /* Whoever sees polling set writes wakeup instead of sending an IPI. If
+     * that happened before the monitor was armed, mwait wouldn't notice, so
+     * look first. One that didn't see it sent the IPI, which mwait does
+     * notice, even if it's been pending since before the sti */
+    s->polling = 1;
+    __asm volatile ( "monitor" : : "a" ( &s->wakeup ), "c" ( 0 ), "d" ( 0 ) );
+    if ( !s->wakeup )
+        __asm volatile ( "sti; mwait; cli" : : "a" ( 0 ), "c" ( 0 ) : "memory" );
+    s->polling = 0;
+    s->wakeup = 0;
+}
+
+void cpu_idle ( void )
+{
+    idle_cpu_t* s;
+    bool ran;
+
+    /* Leftovers from a do_softirq or an async_run that ran out of rounds.
+     * They may well be what the caller is waiting for. If neither could run
+     * (we're inside one of them already), halt until the next tick rather
+     * than spin: timer_nohz_enter leaves it running while softirqs wait */
+    if ( softirq_pending () || async_pending () ) {
+        ran = do_softirq ();
+        ran = async_run () || ran;
+        if ( ran )
+            return;
+    }
+
+    s = &idle_state[smp_processor_id ()];
+    timer_nohz_enter ();
+    rcu_idle_enter ();
+    idle_begin ( s );
+    if ( use_mwait )
+        mwait_idle ( s );
+    else
+        __asm volatile ( "sti; hlt; cli" );
+
+    /* If it wasn't an interrupt that woke us, nothing has counted it yet */
+    idle_end ( s );
+    rcu_idle_exit ();
+    timer_nohz_exit ();
+}
+
+bool idle_wake_cpu ( uint32_t cpu )
+{
+    idle_cpu_t* s = &idle_state[cpu];
+
+    if ( !s->polling )
+        return false;
+    s->wakeup = 1;
+    return true;
+}
+
+void idle_get_stats ( uint32_t cpu, uint64_t* idle, uint64_t* total )
+{
+    idle_cpu_t* s = &idle_state[cpu];
+    uint64_t start, since, now;
+    uint32_t seq;
+
+    if ( !counting ) {
+        *idle = *total = 0;
+        return;
+    }
+
+    do {
+        seq = read_seqcount_begin ( &s->seq );
+        start = s->start;
+        *idle = s->idle;
+        since = s->since;
+        now = rdtsc ();
+    } while ( read_seqcount_retry ( &s->seq, seq ) );
+
+    if ( since )
+        *idle += now - since;
+    *total = now - start;
+}
+
+/* Tenths of a percent, without 64-bit division */
+PRIVATE uint32_t permille ( uint64_t part, uint64_t whole )
+{
+    while ( whole >= ( 1 << 22 ) ) {
+        part >>= 1;
+        whole >>= 1;
+    }
+    return whole ? ( uint32_t ) part * 1000 / ( uint32_t ) whole : 0;
+}
+
+void idle_report ( void )
+{
+    uint64_t idle, total;
+    uint32_t cpu, busy;
+
+    screen_puts ( "CPU usage since boot (" );
+    screen_puts ( use_mwait ? "mwait" : "hlt" );
+    screen_puts ( ")\n" );
+
+    for ( cpu = 0; cpu < MAX_CPUS; cpu++ ) {
+        if ( !cpu_online ( cpu ) )
+            continue;
+        idle_get_stats ( cpu, &idle, &total );
+        busy = 1000 - permille ( idle, total );
+        screen_puts ( "CPU " );
+        screen_put_int ( cpu );
+        screen_puts ( ": " );
+        screen_put_int ( busy / 10 );
+        screen_putc ( '.' );
+        screen_put_int ( busy % 10 );
+        screen_puts ( "% busy\n" );
+    }
+}
+
+PRIVATE void report_key ( const key_event_t* ev )
+{
+    if ( ev->vk == VK_PAUSE && IS_KEY_DOWN ( ev->state ) )
+        idle_report ();
+}
+
+void idle_init_cpu ( void )
+{
+    if ( counting )
+        idle_state[smp_processor_id ()].start = rdtsc ();
+}
+
+void init_idle ( void )
+{
+    uint32_t ecx, edx;
+
+    cpuid ( 1, NULL, NULL, &ecx, &edx );
+    use_mwait = ( ecx & CPUID_FEAT_ECX_MONITOR ) != 0;
+    screen_puts ( use_mwait ? "Idle: mwait\n" : "Idle: hlt\n" );
+
+    if ( !( edx & CPUID_FEAT_EDX_TSC ) )
+        return;
+    counting = true;
+    idle_init_cpu ();
+    keyboard_register_callback ( &report_key );
+}
@@ -0,0 +1,46 @@
+#ifndef IDLE_H
+#define IDLE_H
+#include <stdinc.h>
+/*
+ * What the CPU does when there's nothing to do: sleep until an interrupt.
+ *
+ * Whoever decides there's nothing to do has to check that with interrupts
+ * disabled, and then call cpu_idle(). Otherwise, an interrupt could come in
+ * between the check and the sleep, and we'd sleep with work pending. cpu_idle
+ * enables interrupts and sleeps in one go (sti only takes effect after the
+ * next instruction, so nothing can sneak in before the hlt or mwait), and
+ * returns with interrupts disabled again, after the interrupt that woke us
+ * up was handled.
+ *
+ * Where CPUID says the CPU has MONITOR/MWAIT, we sleep with those instead of
+ * hlt. The CPU then also wakes up when something writes to a word it's
+ * watching, so idle_wake_cpu() can wake an idle CPU with a plain store
+ * instead of an IPI (smp_send_resched tries it first).
+ *
+ * While we sleep, the timer tick is stopped (see timer_nohz_enter).
+ *
+ * Each CPU also counts, with the TSC, how long it has spent idle: from going
+ * to sleep to the first interrupt after (irq_handler calls idle_irq_enter),
+ * or to waking up for any other reason. idle_report() prints how busy each
+ * CPU has been since it came up, and so does pressing Pause. Nothing is
+ * counted on CPUs without a TSC.
+ */
+
+void init_idle ( void );
+/* Called by every AP, before it first idles */
+void idle_init_cpu ( void );
+
+void cpu_idle ( void );
+
+/* Wake cpu from cpu_idle without an IPI, if it's sleeping in mwait. Returns
+ * whether it was */
+bool idle_wake_cpu ( uint32_t cpu );
+
+/* Interrupts must be disabled */
+void idle_irq_enter ( void );
+
+/* TSC cycles cpu has spent idle, and in all, since it came up */
+void idle_get_stats ( uint32_t cpu, uint64_t* idle, uint64_t* total );
+void idle_report ( void );
+
+#endif
@@ -2,6 +2,10 @@
 #include <stdinc.h>
 #include <mem.h>
 #include <screen.h>
+#include <irqstat.h>
+#include <kpanic.h>
+#include <spinlock.h>
+#include <rcu.h>
 
 /* These extern directives let us access the addresses of our ASM ISR handlers. */
 extern void isr0 ();
@@ -42,8 +46,6 @@ extern void idt_set(uint32_t);
 
 PRIVATE void div_by_zero(registers_t* regs);
 
-#define NUM_IDTS 256
-
 
 idt_entry_t idt_entries [NUM_IDTS];
 
@@ -51,6 +53,10 @@ idt_ptr_t idt_ptr;
 
 interrupt_handler_t interrupt_handlers [NUM_IDTS];
 
+/* Taken by whoever changes interrupt_handlers. The handlers only read it,
+   through rcu_dereference, and don't need it (see rcu.h) */
+PRIVATE spinlock_t handlers_lock = SPINLOCK_INIT("interrupt_handlers");
+
 /* Initialisation routine - zeroes all the interrupt service routines, and
    initialises the IDT. */
 void init_idt ()
@@ -107,6 +113,11 @@ void init_idt ()
   idt_set ((uint32_t)&idt_ptr);
 }
 
+void idt_load ()
+{
+  idt_set ((uint32_t)&idt_ptr);
+}
+
 void idt_set_gate (uint8_t num, uint32_t base, uint16_t sel, uint8_t flags)
 {
   idt_entries[num].base_lo  = base & 0xFFFF;
@@ -114,34 +125,60 @@ void idt_set_gate (uint8_t num, uint32_t base, uint16_t sel, uint8_t flags)
 
   idt_entries[num].selector = sel;
   idt_entries[num].always0  = 0;
-  
-  /* We must uncomment the OR below when we get to using user-mode.
-     It sets the interrupt gate's privilege level to 3. */
-  idt_entries[num].flags    = flags /* | 0x60 */;
+
+  /* The gate's privilege level is in there too: only the system call gate
+     has IDT_DPL_USER */
+  idt_entries[num].flags    = flags;
 }
 
 void idt_handler (registers_t* regs)
 {
-  if (interrupt_handlers [regs->int_no]) {
-    interrupt_handlers [regs->int_no] (regs);
+  interrupt_handler_t handler;
+  uint64_t start;
+
+  handler = rcu_dereference (interrupt_handlers [regs->int_no]);
+  if (handler) {
+    start = irqstat_start();
+    handler (regs);
+    irqstat_handler_done(regs->int_no, start);
   } else {
     screen_puts ("Unhandled interrupt: ");
     screen_put_int(regs->int_no);
     screen_putc(' ');    
     screen_put_hex(regs->err_code);
     screen_putc('\n');    
-    for(;;);
+    kpanic ("Unhandled interrupt");
   }
 }
 
 void register_interrupt_handler (uint8_t n, interrupt_handler_t h)
 {
-  interrupt_handlers [n] = h;
+  uint32_t flags;
+  interrupt_handler_t old;
+
+  /* Two handlers for one vector is a bug. The second one would silently
+     take over, so better to find out now. IRQ lines can be shared, but
+     through request_irq (see irq.h) */
+  flags = spin_lock_irqsave (&handlers_lock);
+  old = interrupt_handlers [n];
+  if (h && old && old != h)
+    kpanic ("register_interrupt_handler: vector already taken");
+  rcu_assign_pointer (interrupt_handlers [n], h);
+  spin_unlock_irqrestore (&handlers_lock, flags);
+
+  /* Once a handler is gone, the caller may well tear down what it uses.
+     Make sure it's not still running somewhere */
+  if (old && !h)
+    synchronize_rcu ();
+}
+
+interrupt_handler_t get_interrupt_handler (uint8_t n)
+{
+  return rcu_dereference (interrupt_handlers [n]);
 }
 
 PRIVATE void div_by_zero(registers_t* regs)
 {
   UNUSED(regs);
-  screen_puts ("Division by zero!\n");
-  __asm("hlt");
+  kpanic ("Division by zero");
 }
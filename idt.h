@@ -5,6 +5,10 @@
 
 void init_idt ();
 
+/* Load the IDT init_idt built on the CPU we're running on. Every CPU shares
+ * the same one */
+void idt_load ();
+
 /*
  * The IDT holds entries stating what to do when an interrupt happens.
  * Each of these entries must hold a BASE address, a SELECTOR and some specific
@@ -61,6 +65,12 @@ typedef struct
 #define IDT_32BIT_INTERRUPT_GATE 0x8E
 #define IDT_32BIT_TRAP_GATE      0x8F 
 
+/* OR'd into either, lets ring 3 raise the interrupt with int (the system
+   call gate, see syscall.h). Otherwise that's a #GP */
+#define IDT_DPL_USER             0x60
+
+#define NUM_IDTS 256
+
 /* A pointer structure used for informing the CPU about our IDT. */
 typedef struct
 {
@@ -81,9 +91,21 @@ typedef struct
    to a structure containing register values. */
 typedef void (*interrupt_handler_t)(registers_t *);
 
-/* Allows us to register an interrupt handler. */
+/* The handlers, by vector. Use register_interrupt_handler to change them,
+   and rcu_dereference to read them (see rcu.h) */
+extern interrupt_handler_t interrupt_handlers [NUM_IDTS];
+
+/* Allows us to register an interrupt handler, or to remove it (with h ==
+ * NULL). There can only be one per vector: registering a different one on
+ * top panics. Removing one waits until it isn't running on any CPU, so it
+ * mustn't be done from interrupt handlers. Handlers for the vectors of IRQ
+ * lines are called with regs == NULL, but drivers should use request_irq
+ * instead (see irq.h). */
 void register_interrupt_handler (uint8_t n, interrupt_handler_t h);
 
+/* The handler registered for interrupt n, NULL if none */
+interrupt_handler_t get_interrupt_handler (uint8_t n);
+
 /* Allows us to setup an interrupt gate for use. Only after setting it up can
  * we get interrupts. It is here for stuff like the IRQ/PIC module to be able
  * to register its gates.
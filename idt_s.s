@@ -73,30 +73,46 @@ global isr_common_stub:function isr_common_stub.end-isr_common_stub
 ; This is our common ISR stub. It saves the processor state, sets
 ; up for kernel mode segments, calls the C-level fault handler,
 ; and finally restores the stack frame.
+;
+; The segments only need setting up if we came from user mode: if the kernel
+; was interrupted, they're the kernel's already. ds still gets pushed either
+; way, since it's part of registers_t.
 isr_common_stub:
     pusha                    ; Pushes edi,esi,ebp,esp,ebx,edx,ecx,eax
 
     mov ax, ds               ; Lower 16-bits of eax = ds.
     push eax                 ; Save the data segment descriptor
 
+    test byte [esp+48], 3    ; The RPL of the interrupted cs (registers_t.cs)
+    jz .kernel_entry
+
     mov ax, 0x10             ; Load the kernel data segment descriptor
     mov ds, ax
     mov es, ax
     mov fs, ax
+    mov ax, 0x30             ; And this CPU's per-CPU segment (see percpu.h)
     mov gs, ax
-    mov ss, ax
+    cld
 
+.kernel_entry:
     push esp    	     ; Push a pointer to the current top of stack - this becomes the registers_t* parameter.
     call idt_handler         ; Call into our C code.
     add esp, 4		     ; Remove the registers_t* parameter.
 
+    test byte [esp+48], 3
+    jz .kernel_exit
+
     pop ebx                  ; Reload the original data segment descriptor
     mov ds, bx
     mov es, bx
     mov fs, bx
     mov gs, bx
-    mov ss, bx
+    jmp .restore
+
+.kernel_exit:
+    add esp, 4               ; Nothing to reload, just drop the saved ds
 
+.restore:
     popa                     ; Pops edi,esi,ebp...
     add esp, 8               ; Cleans up the pushed error code and pushed ISR number
     iret                     ; pops 5 things at once: CS, EIP, EFLAGS, SS, and ESP
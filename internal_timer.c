@@ -1,59 +1,309 @@
 #include <internal_timer.h>
+#include <clocksource.h>
 #include <idt.h>
 #include <irq.h>
+#include <percpu.h>
 #include <screen.h>
+#include <smp.h>
+#include <softirq.h>
+#include <x86/x86.h>
+#include <ktimer.h>
+#include <sched.h>
+#include <seqlock.h>
+#include <rcu.h>
+#include <vdso.h>
 
-/* FIXME: Maybe 64? */
-PRIVATE uint32_t num_ticks = 0;
+/* Comment this out to keep the timer ticking even when idle */
+#define TIMER_NOHZ
+
+/* 64 bits, so that it doesn't wrap after 49 days at 1 kHz. Only the timer
+ * code writes it, and everyone else reads it through timer_get_ticks */
+PRIVATE uint64_t num_ticks = 0;
 PRIVATE uint32_t sysfrequency_hz = PIT_DEFAULT_FREQ;
 
+/* While the tick is stopped, num_ticks stands still at stop_ticks, and the
+ * ticks since then are worked out from the clocksource */
+PRIVATE bool tick_stopped = false;
+PRIVATE uint64_t stop_ticks = 0;
+PRIVATE uint64_t stop_ns = 0;
+
+/* Guards the four above. They're only written with interrupts disabled, on
+ * the CPU that takes the tick, so that's the only writer */
+PRIVATE seqcount_t tick_seq = SEQCOUNT_INIT;
+PRIVATE uint32_t ns_per_tick = 0;
+PRIVATE uint32_t nohz_stops = 0;
+
+PRIVATE void pit_set_periodic ( uint32_t frequency_hz );
+PRIVATE void pit_set_oneshot ( uint32_t ticks );
+PRIVATE void pit_stop ( void );
+
+PRIVATE clock_event_t pit_clock_event = {
+    "pit",
+    &pit_set_periodic,
+    &pit_set_oneshot,
+    &pit_stop,
+    0, /* Set by init_timer */
+    IRQ_0,
+    false
+};
+
+PRIVATE clock_event_t* tick_device = &pit_clock_event;
+
 PRIVATE void timer_callback ( registers_t* regs );
+PRIVATE void timer_softirq ( void );
+PRIVATE void second_passed ( uint32_t data );
+
+PRIVATE ktimer_t second_timer = KTIMER_INIT ( &second_passed, 0 );
+
+/* Send a 16-bit count to PIT channel 0, in the given mode */
+PRIVATE void pit_program ( uint8_t command, uint32_t count )
+{
+    uint8_t l, h;
+
+    /* Send the command byte. */
+    outb ( PIT_COMMAND_DATA_PORT, command );
 
+    /* Split the count in lower and higher bytes, and send them */
+    l = ( uint8_t ) ( count & 0xFF );
+    h = ( uint8_t ) ( ( count >> 8 ) & 0xFF );
+
+    outb ( PIT_CHANNEL0_DATA_PORT, l );
+    outb ( PIT_CHANNEL0_DATA_PORT, h );
+}
+
+PRIVATE void pit_set_periodic ( uint32_t frequency_hz )
+{
+    /* The value to send to the PIT is the one to divide 1193180
+     * It must also fit in 16 bits, otherwise it goes boo-boo...
+     */
+    pit_program ( PIT_MASK_TIMER, PIT_DEFAULT_FREQ / frequency_hz );
+}
+
+PRIVATE void pit_set_oneshot ( uint32_t ticks )
+{
+    /* Mode 0 counts down once, raising IRQ0 when it gets to 0, and then
+     * stays quiet until it's reprogrammed */
+    pit_program ( PIT_MASK_ONESHOT, ticks * ( PIT_DEFAULT_FREQ / sysfrequency_hz ) );
+}
+
+PRIVATE void pit_stop ( void )
+{
+    irq_mask ( IRQ_NO ( IRQ_0 ) );
+}
+
+bool pit_busy_wait ( uint32_t ms )
+{
+    uint32_t count, loops;
+    uint8_t control;
+
+    count = PIT_DEFAULT_FREQ / ( 1000 / ms );
+
+    /* Gate on, speaker off */
+    control = inb ( PIT_CH2_CONTROL_PORT );
+    outb ( PIT_CH2_CONTROL_PORT, ( control & ~PIT_CH2_SPEAKER ) | PIT_CH2_GATE );
+
+    /* Mode 0 (interrupt on terminal count): OUT goes high when the count
+     * runs out. It starts counting as soon as the count is written */
+    outb ( PIT_COMMAND_DATA_PORT, PIT_MASK_CHANNEL2 | PIT_MASK_ACCESS_LOHIBYTES |
+                                  PIT_MASK_MODE_0 | PIT_MASK_BINARY );
+    outb ( PIT_CHANNEL2_DATA_PORT, count & 0xFF );
+    outb ( PIT_CHANNEL2_DATA_PORT, ( count >> 8 ) & 0xFF );
+
+    for ( loops = 0; !( inb ( PIT_CH2_CONTROL_PORT ) & PIT_CH2_OUT ); loops++ )
+        ;
+
+    outb ( PIT_CH2_CONTROL_PORT, control );
+
+    /* If OUT was already high, something's off */
+    return loops != 0;
+}
+
+/* How many ticks there would have been by now, had the tick not stopped */
+PRIVATE uint64_t nohz_ticks_now ( void )
+{
+    return stop_ticks + div_u64_rem ( ktime_get_ns () - stop_ns, ns_per_tick, NULL );
+}
+
+/* The top half: count the tick and publish it for ring 3 (see vdso.h), charge
+ * it to whichever thread was running, nudge RCU along, and leave the rest to
+ * timer_softirq. The other CPUs' ticks only do the charging and RCU */
 PRIVATE void timer_callback ( registers_t* regs )
 {
     UNUSED ( regs );
-    num_ticks++;
-    if ( num_ticks % 1000 == 0 ) {
-        screen_puts ( "One second has passed!\n" );
+    if ( smp_processor_id () != 0 ) {
+        sched_tick ();
+        rcu_tick ();
+        return;
     }
 
-    if ( 0 ) {
-        screen_puts ( "Tick: " );
-        screen_put_int ( num_ticks );
-        screen_putc ( '\n' );
+    if ( tick_stopped )
+        timer_nohz_exit ();
+    else {
+        write_seqcount_begin ( &tick_seq );
+        num_ticks++;
+        write_seqcount_end ( &tick_seq );
     }
+    vdso_update_time ( num_ticks, sysfrequency_hz );
+    sched_tick ();
+    rcu_tick ();
+    raise_softirq ( SOFTIRQ_TIMER );
+}
 
+/* Runs with interrupts enabled. If it's been held up, it may have several
+ * ticks to catch up on, which ktimer_run does */
+PRIVATE void timer_softirq ( void )
+{
+    ktimer_run ( timer_get_ticks () );
+}
+
+PRIVATE void second_passed ( uint32_t data )
+{
+    UNUSED ( data );
+    screen_puts ( "One second has passed!\n" );
+    ktimer_mod ( &second_timer, second_timer.expires + sysfrequency_hz );
+}
+
+/* The next tick at which the timer softirq has something to do */
+PRIVATE uint64_t timer_next_event ( void )
+{
+    return ktimer_next_expiry ();
 }
 
 void init_timer ( uint32_t frequency_hz );
 
-double get_time_elapsed_since_boot ( void )
+uint64_t timer_get_ticks ( void )
+{
+    uint32_t seq;
+    uint64_t ticks, since_ns;
+    bool stopped;
+
+    /* A 64-bit read is two loads, and the tick might land between them */
+    do {
+        seq = read_seqcount_begin ( &tick_seq );
+        stopped = tick_stopped;
+        ticks = stopped ? stop_ticks : num_ticks;
+        since_ns = stop_ns;
+    } while ( read_seqcount_retry ( &tick_seq, seq ) );
+
+    if ( stopped )
+        ticks += div_u64_rem ( ktime_get_ns () - since_ns, ns_per_tick, NULL );
+    return ticks;
+}
+
+uint32_t timer_get_frequency ( void )
+{
+    return sysfrequency_hz;
+}
+
+void timer_set_clock_event ( clock_event_t* dev )
+{
+    uint32_t flags;
+
+    flags = irq_save ();
+    if ( tick_stopped )
+        timer_nohz_exit ();
+    tick_device->stop ();
+    tick_device = dev;
+    register_interrupt_handler ( dev->vector, &timer_callback );
+    dev->set_periodic ( sysfrequency_hz );
+    irq_restore ( flags );
+
+    screen_puts ( "Timer: ticking with the " );
+    screen_puts ( dev->name );
+    screen_putc ( '\n' );
+}
+
+bool timer_init_cpu ( void )
+{
+    if ( !tick_device->per_cpu )
+        return false;
+    tick_device->set_periodic ( sysfrequency_hz );
+    return true;
+}
+
+void timer_nohz_enter ( void )
+{
+#ifdef TIMER_NOHZ
+    uint64_t next, delta;
+
+    /* Softirqs left over from a do_softirq that ran out of rounds run on
+     * this CPU's next interrupt exit. Make sure there is one */
+    if ( softirq_pending () )
+        return;
+
+    /* The other CPUs' ticks don't keep time, so they can just stop */
+    if ( smp_processor_id () != 0 ) {
+        if ( tick_device->per_cpu && !this_cpu_read ( tick_stopped ) &&
+             !rcu_needs_cpu () ) {
+            tick_device->stop ();
+            this_cpu_write ( tick_stopped, 1 );
+        }
+        return;
+    }
+
+    if ( tick_stopped || !clocksource_is_continuous () )
+        return;
+
+    /* If there's something to do on the very next tick, there's nothing
+     * to gain. A grace period needs the tick to end */
+    next = timer_next_event ();
+    if ( next <= num_ticks + 1 || rcu_needs_cpu () )
+        return;
+
+    delta = next - num_ticks;
+    if ( delta > tick_device->max_oneshot_ticks )
+        delta = tick_device->max_oneshot_ticks;
+
+    write_seqcount_begin ( &tick_seq );
+    stop_ticks = num_ticks;
+    stop_ns = ktime_get_ns ();
+    tick_stopped = true;
+    write_seqcount_end ( &tick_seq );
+    nohz_stops++;
+    tick_device->set_oneshot ( ( uint32_t ) delta );
+#endif
+}
+
+void timer_nohz_exit ( void )
+{
+    uint32_t flags;
+
+    flags = irq_save ();
+    if ( smp_processor_id () != 0 ) {
+        if ( this_cpu_read ( tick_stopped ) ) {
+            this_cpu_write ( tick_stopped, 0 );
+            tick_device->set_periodic ( sysfrequency_hz );
+        }
+    } else if ( tick_stopped ) {
+        write_seqcount_begin ( &tick_seq );
+        num_ticks = nohz_ticks_now ();
+        tick_stopped = false;
+        write_seqcount_end ( &tick_seq );
+        tick_device->set_periodic ( sysfrequency_hz );
+
+        /* Whatever came due while we slept */
+        raise_softirq ( SOFTIRQ_TIMER );
+    }
+    irq_restore ( flags );
+}
+
+uint32_t timer_nohz_stops ( void )
 {
-    return ( ( double ) num_ticks ) / sysfrequency_hz;
+    return nohz_stops;
 }
 
 void init_timer ( uint32_t frequency )
 {
-    uint32_t divisor;
-    uint8_t l, h;
-    
     sysfrequency_hz = frequency;
-    
-    /* Start by registering the new interrupt handler */
-    register_interrupt_handler ( IRQ_0, &timer_callback );
+    ns_per_tick = NSEC_PER_SEC / frequency;
+    pit_clock_event.max_oneshot_ticks = 0xFFFF / ( PIT_DEFAULT_FREQ / frequency );
 
-    /* The value to send to the PIT is the one to divide 1193180
-     * It must also fit in 16 bits, otherwise it goes boo-boo...
-     */
-    divisor = PIT_DEFAULT_FREQ / frequency;
+    init_ktimers ( num_ticks );
+    ktimer_mod ( &second_timer, num_ticks + frequency );
 
-    /* Send the command byte. */
-    outb ( PIT_COMMAND_DATA_PORT, PIT_MASK_TIMER );
-
-    /* Split the divisor in lower and higher bytes, and send them */
-    l = ( uint8_t ) ( divisor & 0xFF );
-    h = ( uint8_t ) ( ( divisor >> 8 ) & 0xFF );
+    /* Start by registering the new interrupt handler */
+    open_softirq ( SOFTIRQ_TIMER, &timer_softirq );
+    register_interrupt_handler ( IRQ_0, &timer_callback );
 
-    outb ( PIT_CHANNEL0_DATA_PORT, l );
-    outb ( PIT_CHANNEL0_DATA_PORT, h );
+    tick_device->set_periodic ( frequency );
 }
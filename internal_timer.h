@@ -24,10 +24,11 @@
  * http://wiki.osdev.org/PIT#Operating_Modes .
  * 
  * The basic idea, though, is that:
- *  -> Mode 0, only available to channel 0, waits for software (the OS)
- *     to set the counter limit. Then, as the PIC ticks, it is decremented
- *     each time. When it gets to 0, the line out is put at 1 until the PIT
- *     is reset (example: a new value is written)
+ *  -> Mode 0 waits for software (the OS) to set the counter limit.
+ *     Then, as the PIC ticks, it is decremented each time. When it gets
+ *     to 0, the line out is put at 1 until the PIT is reset (example: a
+ *     new value is written). On channel 0 that's a single IRQ0, which is
+ *     what we use when idle (see below)
  *  -> Mode 1 can't be used with channel 0 so we'll skip the explanation
  *  -> Mode 2 operates as a "Rate Generator". We set an interval value
  *     and the PIC generates us pulses with that interval
@@ -94,9 +95,78 @@
 /* The flags that our timer will use to setup the PIT correctly for us */
 #define PIT_MASK_TIMER (PIT_MASK_CHANNEL0 | PIT_MASK_ACCESS_LOHIBYTES | PIT_MASK_MODE_3 | PIT_MASK_BINARY)
 
+/* PIT channel 2 isn't wired to an IRQ, but to the speaker, and its gate and
+ * output go through the speaker/channel 2 control port. That makes it a good
+ * stopwatch for calibrating other clocks (see pit_busy_wait) */
+#define PIT_CH2_CONTROL_PORT    0x61
+#define PIT_CH2_GATE            0x01 /* Channel 2 counts while this is set */
+#define PIT_CH2_SPEAKER         0x02 /* Connects channel 2 to the speaker */
+#define PIT_CH2_OUT             0x20 /* Channel 2's output */
+
+/* How long we calibrate other clocks for. At most 54ms, the longest a 16-bit
+ * count lasts */
+#define CALIBRATE_MS            50
+
+/* And the ones for a single interrupt, when the tick is stopped */
+#define PIT_MASK_ONESHOT (PIT_MASK_CHANNEL0 | PIT_MASK_ACCESS_LOHIBYTES | PIT_MASK_MODE_0 | PIT_MASK_BINARY)
+
+/*
+ * Ticking 1000 times a second is a waste when there's nothing to do, so when
+ * the CPU goes idle (see cpu_idle), timer_nohz_enter() stops the tick: it
+ * asks the timer for a single interrupt when the next thing is due instead
+ * (in mode 0, for the PIT). Whatever wakes us up, timer_nohz_exit() works out
+ * from the clocksource how many ticks we've missed and restarts the tick.
+ * Meanwhile, timer_get_ticks() keeps counting as if nothing had happened.
+ *
+ * This needs a clocksource that runs on its own (the TSC), so with only the
+ * tick to keep time, the tick never stops.
+ *
+ * The device that ticks is a clock_event_t, so that something other than the
+ * PIT can take over (see timer_set_clock_event, and lapic_timer.h).
+ *
+ * The boot CPU's tick is the one that counts time and runs the ktimers. If
+ * the device is per_cpu (each CPU has one of its own, like the LAPIC timer),
+ * the other CPUs tick too, once they've called timer_init_cpu(), but only
+ * for the scheduler and RCU. Theirs stop altogether while they're idle:
+ * there's nothing for them to wake up for that doesn't interrupt them anyway.
+ */
+typedef struct {
+    const char* name;
+    void ( *set_periodic ) ( uint32_t frequency_hz );
+    void ( *set_oneshot ) ( uint32_t ticks ); /* One interrupt, ticks from now */
+    void ( *stop ) ( void );                  /* No more interrupts */
+    uint32_t max_oneshot_ticks;
+    uint8_t vector;                           /* The interrupt it raises */
+    bool per_cpu;                             /* Each CPU has one */
+} clock_event_t;
+
 
 
 void init_timer(uint32_t frequency_hz);
-double get_time_elapsed_since_boot(void);
+
+/* How many ticks there have been since init_timer, and how many there are per
+ * second. For time in actual units, see ktime_get_ns() in clocksource.h.
+ * timer_get_ticks takes no lock and leaves interrupts alone, so any CPU can
+ * call it from anywhere (see seqlock.h) */
+uint64_t timer_get_ticks(void);
+uint32_t timer_get_frequency(void);
+
+/* Tick with dev from now on */
+void timer_set_clock_event(clock_event_t* dev);
+
+/* For the other CPUs, once they're up: start their own tick, if the device
+ * is per_cpu. Returns whether it is */
+bool timer_init_cpu(void);
+
+/* Spin for ms milliseconds (at most 54), timed by PIT channel 2. Interrupts
+ * must be disabled. Returns false if the PIT didn't seem to count */
+bool pit_busy_wait(uint32_t ms);
+
+/* Stop the tick until the next timer event. Interrupts must be disabled */
+void timer_nohz_enter(void);
+/* Restart the tick if it was stopped */
+void timer_nohz_exit(void);
+/* How many times the tick has been stopped */
+uint32_t timer_nohz_stops(void);
 
 #endif
@@ -1,6 +1,16 @@
 #include <irq.h>
 #include <x86.h>
 #include <idt.h>
+#include <softirq.h>
+#include <apic.h>
+#include <smp.h>
+#include <irqstat.h>
+#include <sched.h>
+#include <spinlock.h>
+#include <wait.h>
+#include <rcu.h>
+#include <idle.h>
+#include <async.h>
 
 /* Our external IRQ handlers */
 extern void irq0 ();
@@ -19,6 +29,29 @@ extern void irq12();
 extern void irq13();
 extern void irq14();
 extern void irq15();
+extern void irq16();
+extern void irq17();
+extern void irq18();
+extern void irq19();
+extern void irq20();
+extern void irq21();
+extern void irq22();
+extern void irq23();
+
+/* Whether the APIC has taken over from the PIC */
+PRIVATE bool using_apic = false;
+
+/* The handlers of each IRQ line, how many of them have a thread_fn pending,
+ * and how many interrupts nobody claimed. irq_handler walks the action lists
+ * without disabling anything on the other CPUs, so they're changed the RCU
+ * way (see rcu.h) */
+PRIVATE irq_action_t* actions[NUM_IRQS];
+PRIVATE uint8_t threads_pending[NUM_IRQS];
+PRIVATE uint32_t unhandled[NUM_IRQS];
+
+/* Taken to change the first two, and mask or unmask lines because of them.
+ * The threads run on any CPU */
+PRIVATE spinlock_t irq_lock = SPINLOCK_INIT("irq");
 
 /* Currently a stubbed implementation since we don't really have to do IO waits */
 PRIVATE /*STUB*/ void io_wait(void) {}
@@ -97,13 +130,300 @@ void init_irq(void)
     idt_set_gate (IRQ_13,       (uint32_t)irq13, IDT_SELECTOR, IDT_32BIT_INTERRUPT_GATE );
     idt_set_gate (IRQ_14,       (uint32_t)irq14, IDT_SELECTOR, IDT_32BIT_INTERRUPT_GATE );
     idt_set_gate (IRQ_15/*47*/, (uint32_t)irq15, IDT_SELECTOR, IDT_32BIT_INTERRUPT_GATE );
-    
+
+    /* Only the APIC sends these, but there's no harm in having them */
+    idt_set_gate (IRQ_16,       (uint32_t)irq16, IDT_SELECTOR, IDT_32BIT_INTERRUPT_GATE );
+    idt_set_gate (IRQ_17,       (uint32_t)irq17, IDT_SELECTOR, IDT_32BIT_INTERRUPT_GATE );
+    idt_set_gate (IRQ_18,       (uint32_t)irq18, IDT_SELECTOR, IDT_32BIT_INTERRUPT_GATE );
+    idt_set_gate (IRQ_19,       (uint32_t)irq19, IDT_SELECTOR, IDT_32BIT_INTERRUPT_GATE );
+    idt_set_gate (IRQ_20,       (uint32_t)irq20, IDT_SELECTOR, IDT_32BIT_INTERRUPT_GATE );
+    idt_set_gate (IRQ_21,       (uint32_t)irq21, IDT_SELECTOR, IDT_32BIT_INTERRUPT_GATE );
+    idt_set_gate (IRQ_22,       (uint32_t)irq22, IDT_SELECTOR, IDT_32BIT_INTERRUPT_GATE );
+    idt_set_gate (IRQ_23/*55*/, (uint32_t)irq23, IDT_SELECTOR, IDT_32BIT_INTERRUPT_GATE );
+}
+
+/* The GSI an IRQ is wired to, on the APIC */
+PRIVATE uint32_t irq_to_gsi(uint8_t irq)
+{
+    if (irq < ISA_IRQS)
+        return apic_get_config()->isa_gsi[irq];
+    return irq;
+}
+
+void irq_mask(uint8_t irq)
+{
+    uint16_t port;
+    uint32_t flags;
+
+    if (using_apic) {
+        ioapic_mask(irq_to_gsi(irq));
+        return;
+    }
+    if (irq >= ISA_IRQS)
+        return;
+
+    port = irq < 8 ? PIC1_DATA_PORT : PIC2_DATA_PORT;
+    flags = irq_save();
+    outb(port, inb(port) | (1 << (irq & 7)));
+    irq_restore(flags);
+}
+
+void irq_unmask(uint8_t irq)
+{
+    uint16_t port;
+    uint32_t flags;
+
+    if (using_apic) {
+        ioapic_unmask(irq_to_gsi(irq));
+        return;
+    }
+    if (irq >= ISA_IRQS)
+        return;
+
+    port = irq < 8 ? PIC1_DATA_PORT : PIC2_DATA_PORT;
+    flags = irq_save();
+    outb(port, inb(port) & ~(1 << (irq & 7)));
+    irq_restore(flags);
 }
 
-/* This gets called from our ASM interrupt handler stub. */
-void irq_handler(registers_t* regs)
+bool irq_set_affinity(uint8_t irq, uint32_t cpu)
 {
-   idt_handler(regs);
+    const apic_config_t* config;
+
+    if (!using_apic || !cpu_online(cpu))
+        return false;
+
+    config = apic_get_config();
+
+    ioapic_set_affinity(irq_to_gsi(irq), config->cpu_apic_ids[cpu]);
+    return true;
+}
+
+void irq_disable_pic(void)
+{
+    outb(PIC1_DATA_PORT, 0xFF);
+    outb(PIC2_DATA_PORT, 0xFF);
+}
+
+void irq_use_apic(void)
+{
+    uint8_t irq;
+
+    using_apic = true;
+    for (irq = 0; irq < NUM_IRQS; irq++)
+        if ((get_interrupt_handler(IRQ_0 + irq) || actions[irq]) && !threads_pending[irq])
+            irq_unmask(irq);
+}
+
+/* The thread of a threaded action. It runs the thread_fn each time the
+ * handler asks for it, with the line masked, and then, once all of the line's
+ * thread_fns are done, lets it through again */
+PRIVATE void irq_thread(uint32_t data)
+{
+    irq_action_t* action = (irq_action_t*) data;
+    uint32_t flags;
+
+    for (;;) {
+        flags = irq_save();
+        while (!action->thread_pending && !action->thread_stop)
+            thread_block();
+        irq_restore(flags);
+
+        if (action->thread_pending) {
+            action->thread_fn(action->data);
+
+            flags = spin_lock_irqsave(&irq_lock);
+            action->thread_pending = false;
+            if (--threads_pending[action->irq] == 0 && actions[action->irq])
+                irq_unmask(action->irq);
+            spin_unlock_irqrestore(&irq_lock, flags);
+        }
+
+        if (action->thread_stop) {
+            action->thread = NULL;
+            complete(action->thread_exited);
+            return;
+        }
+    }
+}
+
+/* Interrupts are disabled already */
+PRIVATE void wake_thread(irq_action_t* action)
+{
+    if (action->thread_pending)
+        return;
+
+    spin_lock(&irq_lock);
+    action->thread_pending = true;
+    if (threads_pending[action->irq]++ == 0)
+        irq_mask(action->irq);
+    spin_unlock(&irq_lock);
+    thread_wake(action->thread);
+}
+
+/* Ask each of the line's actions whether the interrupt is theirs. Returns
+ * whether any of them said it was */
+PRIVATE bool run_actions(uint8_t irq)
+{
+    irq_action_t* action;
+    irq_return_t ret;
+    bool handled = false;
+
+    for (action = rcu_dereference(actions[irq]); action;
+         action = rcu_dereference(action->next)) {
+        ret = action->handler ? action->handler(action->data) : IRQ_WAKE_THREAD;
+        if (ret == IRQ_NONE)
+            continue;
+
+        handled = true;
+        action->count++;
+        if (ret == IRQ_WAKE_THREAD && action->thread_fn)
+            wake_thread(action);
+    }
+    return handled;
+}
+
+bool request_irq(uint8_t irq, irq_action_t* action)
+{
+    irq_action_t** p;
+    uint32_t flags;
+
+    if (irq >= NUM_IRQS || (!action->handler && !action->thread_fn))
+        return false;
+
+    flags = spin_lock_irqsave(&irq_lock);
+    if (actions[irq] && (!(actions[irq]->flags & IRQF_SHARED) || !(action->flags & IRQF_SHARED))) {
+        spin_unlock_irqrestore(&irq_lock, flags);
+        return false;
+    }
+
+    action->next = NULL;
+    action->irq = irq;
+    action->thread_pending = false;
+    action->thread_stop = false;
+    action->count = 0;
+
+    /* It blocks straight away, waiting for its first interrupt */
+    action->thread = NULL;
+    action->thread_exited = NULL;
+    if (action->thread_fn) {
+        action->thread = thread_create(action->name, &irq_thread, (uint32_t) action,
+                                       THREAD_PRIO_HIGHEST);
+        if (!action->thread) {
+            spin_unlock_irqrestore(&irq_lock, flags);
+            return false;
+        }
+    }
+
+    /* Published last, once it's all set up */
+    for (p = &actions[irq]; *p; p = &(*p)->next)
+        ;
+    rcu_assign_pointer(*p, action);
+
+    if (actions[irq] == action && !threads_pending[irq])
+        irq_unmask(irq);
+    spin_unlock_irqrestore(&irq_lock, flags);
+    return true;
+}
+
+void free_irq(uint8_t irq, irq_action_t* action)
+{
+    irq_action_t** p;
+    completion_t exited;
+    uint32_t flags;
+
+    if (irq >= NUM_IRQS)
+        return;
+
+    flags = spin_lock_irqsave(&irq_lock);
+    /* Readers already past it still see the rest of the list through its
+     * next, which stays as it is */
+    for (p = &actions[irq]; *p; p = &(*p)->next) {
+        if (*p == action) {
+            rcu_assign_pointer(*p, action->next);
+            break;
+        }
+    }
+    if (!actions[irq])
+        irq_mask(irq);
+    spin_unlock_irqrestore(&irq_lock, flags);
+
+    /* Its thread_fn may still be pending. Let it finish, and then the
+     * thread, since it's about to lose its action */
+    if (action->thread) {
+        completion_init(&exited, "irq thread exit");
+        action->thread_exited = &exited;
+        action->thread_stop = true;
+        thread_wake(action->thread);
+        wait_for_completion(&exited);
+    }
+
+    /* And its handler may still be running on another CPU. Once this
+     * returns, the caller can reuse action */
+    synchronize_rcu();
+}
+
+const irq_action_t* irq_get_actions(uint8_t irq)
+{
+    return irq < NUM_IRQS ? actions[irq] : NULL;
+}
+
+uint32_t irq_unhandled_count(uint8_t irq)
+{
+    return irq < NUM_IRQS ? unhandled[irq] : 0;
+}
+
+/* This gets called from our ASM interrupt handler stub, with the vector
+ * that fired. It goes straight to the handlers, rather than through
+ * idt_handler: first the one registered for the vector, if any (which gets
+ * no registers_t, see irq_common_stub), and then the line's actions */
+void irq_handler(uint32_t vector)
+{
+   interrupt_handler_t handler;
+   uint64_t start;
+   uint32_t irq;
+   bool handled = false;
+   bool was_idle;
+
+   /* First thing, before we read anything RCU protects */
+   was_idle = rcu_irq_enter();
+   idle_irq_enter();
+
+   this_cpu_inc(irqs);
+   start = irqstat_start();
+   handler = rcu_dereference(interrupt_handlers[vector]);
+   if (handler) {
+       handler(NULL);
+       handled = true;
+   }
+
+   irq = IRQ_NO(vector);
+   if (irq < NUM_IRQS) {
+       if (run_actions(irq))
+           handled = true;
+       if (!handled)
+           unhandled[irq]++;
+   }
+   irqstat_handler_done(vector, start);
+
+   if (using_apic)
+       lapic_eoi();
+   else
+       PIC_eoi(IRQ_NO(vector));
+
+   /* Interrupts have been off all along */
+   irqstat_irqs_off_done(vector, start);
+
+   /* The hardware is taken care of, now for whatever the handler deferred
+    * (see softirq.h). This enables interrupts for a while. */
+   do_softirq();
+
+   /* Then this CPU's asynchronous tasks (see async.h) */
+   async_run();
+
+   /* And if that made some thread more important than the one we
+    * interrupted, or its time is up, switch to it */
+   sched_preempt();
 
-   PIC_eoi(IRQ_NO(regs->int_no));
+   rcu_irq_exit(was_idle);
 }
@@ -48,14 +48,123 @@
 #define IRQ_14 46
 #define IRQ_15 47
 
+/* These only exist with the APIC (see apic.h) */
+#define IRQ_16 48
+#define IRQ_17 49
+#define IRQ_18 50
+#define IRQ_19 51
+#define IRQ_20 52
+#define IRQ_21 53
+#define IRQ_22 54
+#define IRQ_23 55
+
+#define NUM_EXTRA_IRQS 8
+#define NUM_IRQS       (16 + NUM_EXTRA_IRQS)
+
 /* Gets the IRQ number from an interrupt number. Example: for IRQ_0 returns 0,
  * and for IRQ_15 returns 15
  * 
  * FIXME: This currently assumes that the IRQs are remapped in the range 32-39
- * and 40-47, but if that changes, IRQ_NO changes as well
+ * and 40-47 (and 48-55 with the APIC), but if that changes, IRQ_NO changes as
+ * well
  */
 #define IRQ_NO(x) ((x)-IRQ_0)
 
 void init_irq(void);
 
+/*
+ * IRQ handlers
+ *
+ * An IRQ line can have several handlers (irq_action_t), chained in the
+ * order they were requested. That's what level-triggered PCI devices sharing
+ * a line need: when the line fires, every handler is asked in turn, and each
+ * one checks its own device and returns whether it was the one interrupting:
+ *  -> IRQ_NONE: not mine.
+ *  -> IRQ_HANDLED: mine, and taken care of.
+ *  -> IRQ_WAKE_THREAD: mine, and the rest of the work is for its thread_fn.
+ * Every action on a shared line has to have IRQF_SHARED, and has to be able
+ * to tell whether its device is the one interrupting.
+ *
+ * A threaded handler has a thread_fn, which runs in a kernel thread of its
+ * own (at THREAD_PRIO_HIGHEST, see sched.h), so that a slow driver doesn't
+ * hold up everyone else. Until it's done, the line stays masked: a
+ * level-triggered device would otherwise keep interrupting, since nothing
+ * has quietened it yet. If a threaded action has no handler, it's as if it
+ * had one that always returned IRQ_WAKE_THREAD (which is only any good on
+ * lines that aren't shared). A thread_fn is never run again before it has
+ * finished. Threaded actions can only be requested once the scheduler is
+ * running.
+ *
+ * If no action claims an interrupt, it's counted as unhandled (see
+ * irq_unhandled_count), which usually means a device that nobody drives is
+ * holding the line.
+ *
+ * The actions belong to the caller, who must keep them around until they're
+ * freed with free_irq.
+ */
+
+#define IRQ_NONE        0
+#define IRQ_HANDLED     1
+#define IRQ_WAKE_THREAD 2
+
+typedef uint32_t irq_return_t;
+
+/* Action flags */
+#define IRQF_SHARED     0x1
+
+typedef struct irq_action {
+    struct irq_action* next;
+    irq_return_t (*handler)(uint32_t data);  /* Runs in the interrupt */
+    void (*thread_fn)(uint32_t data);        /* Runs later, if not NULL */
+    uint32_t data;
+    uint32_t flags;                          /* IRQF_* */
+    const char* name;
+
+    /* Used by irq.c */
+    uint8_t irq;
+    volatile bool thread_pending;
+    volatile bool thread_stop;
+    struct thread* volatile thread;
+    struct completion* thread_exited;        /* free_irq waits on it */
+    uint32_t count;                          /* How many it has claimed */
+} irq_action_t;
+
+/* For statically declared actions */
+#define IRQ_ACTION_INIT(handler, thread_fn, data, flags, name) \
+    { NULL, handler, thread_fn, data, flags, name, 0, false, false, NULL, NULL, 0 }
+
+/* Add action to the IRQ's handlers (by number, 0 to NUM_IRQS-1), unmasking
+ * it if it's the first one. Returns false if the line is taken and either
+ * side isn't IRQF_SHARED */
+bool request_irq(uint8_t irq, irq_action_t* action);
+
+/* Remove action from the IRQ's handlers, masking it if it was the last one.
+ * If it's threaded, waits for its thread_fn if it's pending, and stops its
+ * thread. Then waits for a grace period (see rcu.h), so that its handler
+ * isn't running anywhere either. Mustn't be called from the thread_fn itself,
+ * nor from interrupt handlers */
+void free_irq(uint8_t irq, irq_action_t* action);
+
+/* The first of the IRQ's handlers, NULL if none. Follow next for the rest */
+const irq_action_t* irq_get_actions(uint8_t irq);
+
+/* How many times the IRQ fired without any handler claiming it */
+uint32_t irq_unhandled_count(uint8_t irq);
+
+/* Stop or start an IRQ (by number, 0 to NUM_IRQS-1) from reaching us. The
+ * IRQs that have a handler when the APIC takes over stay unmasked, and
+ * request_irq unmasks the ones that get a handler later. Lines with a
+ * thread_fn pending are masked and unmasked by irq.c as well */
+void irq_mask(uint8_t irq);
+void irq_unmask(uint8_t irq);
+
+/* Send an IRQ to the given CPU (see smp.h), which must be online. Only
+ * possible with the APIC, returns false otherwise */
+bool irq_set_affinity(uint8_t irq, uint32_t cpu);
+
+/* For init_apic: mask everything at the PIC, and then send EOIs to the LAPIC
+ * instead of the PIC from now on */
+void irq_disable_pic(void);
+void irq_use_apic(void);
+
 #endif
@@ -1,12 +1,14 @@
 ; This macro creates a stub for an IRQ - the first parameter is
 ; the IRQ number, the second is the ISR number it is remapped to.
 ;
+; Interrupt gates have already disabled interrupts, so there's no cli. The
+; vector goes in eax (which gets saved first), since "push byte" would sign
+; extend anything past 127.
 %macro IRQ 2
   global irq%1
   irq%1:
-    cli
-    push byte 0
-    push byte %2
+    push eax
+    mov eax, %2
     jmp irq_common_stub
 %endmacro
 
@@ -26,41 +28,83 @@ IRQ  12,    44
 IRQ  13,    45
 IRQ  14,    46
 IRQ  15,    47
+IRQ  16,    48
+IRQ  17,    49
+IRQ  18,    50
+IRQ  19,    51
+IRQ  20,    52
+IRQ  21,    53
+IRQ  22,    54
+IRQ  23,    55
+
+; The LAPIC timer. It isn't wired to any pin, but it's handled just the same
+IRQ  24,    56
+
+; The reschedule IPI (see smp.h). Same again
+IRQ  25,    57
+
+; Nothing raises this one but bench/irq_entry.c, which times the real entry
+; path with it
+IRQ  26,    58
+
+; The LAPIC's spurious interrupt. There's nothing to do, not even an EOI
+global irq_spurious:function irq_spurious.end-irq_spurious
+irq_spurious:
+    iret
+.end:
         
-; C function in idt.c
+; C function in irq.c
 extern irq_handler
 
 global irq_common_stub:function irq_common_stub.end-irq_common_stub
 
-; This is our common IRQ stub. It saves the processor state, sets
-; up for kernel mode segments, calls the C-level fault handler,
-; and finally restores the stack frame.
-; It's exactly like isr_common_stub, except it calls irq_handler instead of idt_handler
+; This is our common IRQ stub. Unlike isr_common_stub, it doesn't build a
+; registers_t: IRQ handlers don't look at the interrupted state, so it only
+; saves what the C code may clobber (eax, ecx and edx; eflags is restored by
+; iret), and passes irq_handler the vector.
+;
+; If we interrupted the kernel, the kernel's segments are loaded already and
+; it leaves them alone. Only when coming from user mode does it save the
+; user's and load ours. fs isn't used by the kernel; gs is the per-CPU
+; segment, which is the same selector on every CPU (each has its own GDT).
 irq_common_stub:
-    pusha                    ; Pushes edi,esi,ebp,esp,ebx,edx,ecx,eax
+    push ecx
+    push edx
+
+    ; The stack is now edx, ecx, eax, and then what the CPU pushed: eip, cs
+    ; and eflags (and esp and ss, from user mode)
+    test byte [esp+16], 3    ; The RPL of the interrupted cs
+    jnz .from_user
 
-    mov ax, ds               ; Lower 16-bits of eax = ds.
-    push eax                 ; Save the data segment descriptor
+    push eax                 ; The vector, irq_handler's parameter
+    call irq_handler
+    add esp, 4
 
-    mov ax, 0x10             ; Load the kernel data segment descriptor
-    mov ds, ax
-    mov es, ax
-    mov fs, ax
-    mov gs, ax
-    mov ss, ax
+    pop edx
+    pop ecx
+    pop eax
+    iret
 
-    push esp    	     ; Push a pointer to the current top of stack - this becomes the registers_t* parameter.
-    call irq_handler         ; Call into our C code.
-    add esp, 4		     ; Remove the registers_t* parameter.
+.from_user:
+    push ds
+    push es
+    push gs
+    mov cx, 0x10             ; The kernel data segment
+    mov ds, cx
+    mov es, cx
+    mov cx, 0x30             ; This CPU's per-CPU segment (see percpu.h)
+    mov gs, cx
+    cld                      ; Our C code expects the direction flag clear
 
-    pop ebx                  ; Reload the original data segment descriptor
-    mov ds, bx
-    mov es, bx
-    mov fs, bx
-    mov gs, bx
-    mov ss, bx
+    push eax
+    call irq_handler
+    add esp, 4
 
-    popa                     ; Pops edi,esi,ebp...
-    add esp, 8               ; Cleans up the pushed error code and pushed ISR number
-    iret                     ; pops 5 things at once: CS, EIP, EFLAGS, SS, and ESP
+    pop gs
+    pop es
+    pop ds
+    pop edx
+    pop ecx
+    pop eax
+    iret
 .end:
@@ -0,0 +1,207 @@
+#include <irqstat.h>
+#include <irq.h>
+#include <lapic_timer.h>
+#include <keyboard.h>
+#include <clocksource.h>
+#include <mem.h>
+#include <screen.h>
+#include <smp.h>
+#include <apic.h>
+#include <x86/x86.h>
+
+/* Each CPU only ever adds to its own, so the interrupt path needs neither
+ * locks nor atomics. Readers add them up */
+PRIVATE irqstat_t stats[MAX_CPUS][NUM_IDTS];
+PRIVATE bool enabled = false;
+
+/* The index of the highest set bit of n, which mustn't be 0 */
+PRIVATE uint32_t highest_bit ( uint32_t n )
+{
+    uint32_t bit;
+
+    __asm ( "bsrl %1, %0" : "=r" ( bit ) : "rm" ( n ) );
+    return bit;
+}
+
+PRIVATE void hist_add ( irqstat_hist_t* h, uint64_t start )
+{
+    uint64_t delta;
+    uint32_t cycles, bucket;
+
+    delta = rdtsc () - start;
+    cycles = ( delta >> 32 ) ? 0xFFFFFFFF : ( uint32_t ) delta;
+
+    bucket = cycles ? highest_bit ( cycles ) : 0;
+    if ( bucket >= IRQSTAT_BUCKETS )
+        bucket = IRQSTAT_BUCKETS - 1;
+
+    h->count++;
+    h->total += cycles;
+    h->buckets[bucket]++;
+    if ( cycles > h->max )
+        h->max = cycles;
+}
+
+uint64_t irqstat_start ( void )
+{
+    return enabled ? rdtsc () : 0;
+}
+
+void irqstat_handler_done ( uint8_t vector, uint64_t start )
+{
+    if ( enabled )
+        hist_add ( &stats[smp_processor_id ()][vector].handler, start );
+}
+
+void irqstat_irqs_off_done ( uint8_t vector, uint64_t start )
+{
+    if ( enabled )
+        hist_add ( &stats[smp_processor_id ()][vector].irqs_off, start );
+}
+
+PRIVATE void hist_sum ( irqstat_hist_t* sum, const irqstat_hist_t* h )
+{
+    uint32_t i;
+
+    sum->count += h->count;
+    sum->total += h->total;
+    for ( i = 0; i < IRQSTAT_BUCKETS; i++ )
+        sum->buckets[i] += h->buckets[i];
+    if ( h->max > sum->max )
+        sum->max = h->max;
+}
+
+const irqstat_t* irqstat_get_cpu ( uint32_t cpu, uint8_t vector )
+{
+    return &stats[cpu][vector];
+}
+
+void irqstat_get ( uint8_t vector, irqstat_t* sum )
+{
+    uint32_t cpu;
+
+    memset ( sum, 0, sizeof ( *sum ) );
+    for ( cpu = 0; cpu < MAX_CPUS; cpu++ ) {
+        hist_sum ( &sum->handler, &stats[cpu][vector].handler );
+        hist_sum ( &sum->irqs_off, &stats[cpu][vector].irqs_off );
+    }
+}
+
+uint32_t irqstat_percentile ( const irqstat_hist_t* h, uint32_t per_mille )
+{
+    uint32_t i, seen, wanted;
+
+    if ( !h->count )
+        return 0;
+
+    /* Rounded up, so that the 99th percentile of 10 intervals is the
+     * longest one */
+    wanted = ( uint32_t ) div_u64_rem ( ( uint64_t ) h->count * per_mille + 999, 1000, NULL );
+
+    for ( i = 0, seen = 0; i < IRQSTAT_BUCKETS - 1; i++ ) {
+        seen += h->buckets[i];
+        if ( seen >= wanted )
+            break;
+    }
+
+    /* The top of the bucket, unless max says it's less than that */
+    if ( i == IRQSTAT_BUCKETS - 1 || ( ( 2u << i ) - 1 ) > h->max )
+        return h->max;
+    return ( 2u << i ) - 1;
+}
+
+/* Print n right-aligned in width columns */
+PRIVATE void put_padded ( uint32_t n, uint32_t width )
+{
+    uint32_t digits, m;
+
+    for ( digits = 1, m = n; m >= 10; m /= 10 )
+        digits++;
+    for ( ; digits < width; digits++ )
+        screen_putc ( ' ' );
+
+    /* screen_put_int takes an int32_t, so print the big ones in two
+     * halves */
+    if ( n > 0x7FFFFFFF ) {
+        screen_put_int ( n / 10 );
+        screen_putc ( '0' + n % 10 );
+    } else
+        screen_put_int ( n );
+}
+
+PRIVATE void put_vector_name ( uint32_t vector )
+{
+    if ( vector < IRQ_0 ) {
+        screen_puts ( " exc " );
+        put_padded ( vector, 2 );
+    } else if ( vector < IRQ_0 + NUM_IRQS ) {
+        screen_puts ( " IRQ " );
+        put_padded ( IRQ_NO ( vector ), 2 );
+    } else if ( vector == LAPIC_TIMER_VECTOR )
+        screen_puts ( " LAPIC " );
+    else if ( vector == IPI_RESCHED_VECTOR )
+        screen_puts ( " IPI   " );
+    else
+        screen_puts ( "       " );
+}
+
+void irqstat_report ( void )
+{
+    irqstat_t sum;
+    const irqstat_hist_t* h = &sum.handler;
+    const irqstat_hist_t* off = &sum.irqs_off;
+    uint32_t i;
+
+    screen_puts ( "Interrupts (TSC cycles, " );
+    screen_put_int ( tsc_get_hz () / 1000000 );
+    screen_puts ( " per us)\n" );
+    screen_puts ( "vec           count     avg     p50     p99      max   off p99  off max\n" );
+
+    for ( i = 0; i < NUM_IDTS; i++ ) {
+        irqstat_get ( i, &sum );
+        if ( !h->count && !off->count )
+            continue;
+
+        put_padded ( i, 3 );
+        put_vector_name ( i );
+        put_padded ( h->count, 9 );
+        put_padded ( h->count ? ( uint32_t ) div_u64_rem ( h->total, h->count, NULL ) : 0, 8 );
+        put_padded ( irqstat_percentile ( h, 500 ), 8 );
+        put_padded ( irqstat_percentile ( h, 990 ), 8 );
+        put_padded ( h->max, 9 );
+        put_padded ( irqstat_percentile ( off, 990 ), 10 );
+        put_padded ( off->max, 9 );
+        if ( i >= IRQ_0 && IRQ_NO ( i ) < NUM_IRQS && irq_get_actions ( IRQ_NO ( i ) ) ) {
+            screen_putc ( ' ' );
+            screen_puts ( irq_get_actions ( IRQ_NO ( i ) )->name );
+        }
+        screen_putc ( '\n' );
+    }
+}
+
+void irqstat_reset ( void )
+{
+    uint32_t flags;
+
+    flags = irq_save ();
+    memset ( stats, 0, sizeof ( stats ) );
+    irq_restore ( flags );
+}
+
+PRIVATE void report_key ( const key_event_t* ev )
+{
+    if ( ev->vk == VK_PRINTSCREEN && IS_KEY_DOWN ( ev->state ) )
+        irqstat_report ();
+}
+
+void init_irqstat ( void )
+{
+    uint32_t edx;
+
+    cpuid ( 1, NULL, NULL, NULL, &edx );
+    if ( !( edx & CPUID_FEAT_EDX_TSC ) )
+        return;
+
+    enabled = true;
+    keyboard_register_callback ( &report_key );
+}
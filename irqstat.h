@@ -0,0 +1,71 @@
+#ifndef IRQSTAT_H
+#define IRQSTAT_H
+#include <stdinc.h>
+#include <idt.h>
+/*
+ * Interrupt statistics: how often each vector fires, and how long it keeps
+ * the CPU, measured with the TSC.
+ *
+ * For every vector we keep two histograms of cycle counts:
+ *  -> handler: the time spent in the handler registered for it, as timed by
+ *     idt_handler (irq_handler, for IRQs). This is what to look at when a
+ *     handler is slow.
+ *  -> irqs_off: for IRQs, the time from irq_handler being entered to it
+ *     being done with the hardware (handler and EOI), which is all spent with
+ *     interrupts disabled. Everything else waits that long, so this is what
+ *     to look at when something shows jitter.
+ *
+ * The histograms have one bucket per power of two: bucket n counts the
+ * durations from 2^n to 2^(n+1)-1 cycles, and the last one everything
+ * longer. That's coarse, but cheap enough for the interrupt path, and a
+ * percentile read from it is off by at most a factor of 2 (we report the
+ * bucket's upper bound, so it's never an underestimate).
+ *
+ * Each CPU keeps its own histograms, which only it writes, so counting takes
+ * no locks or atomics. irqstat_get() and irqstat_report() add them up; since
+ * the other CPUs may be counting meanwhile, the sum is only a snapshot, and
+ * a 64-bit total being added to as it's read may come out slightly off.
+ *
+ * irqstat_report() prints it all, a bit like Linux's /proc/interrupts. It can
+ * also be had by pressing Print Screen.
+ *
+ * Nothing is counted before init_irqstat(), or on CPUs without a TSC.
+ */
+
+#define IRQSTAT_BUCKETS 24
+
+typedef struct {
+    uint32_t count;
+    uint32_t max;
+    uint64_t total;
+    uint32_t buckets[IRQSTAT_BUCKETS];
+} irqstat_hist_t;
+
+typedef struct {
+    irqstat_hist_t handler;
+    irqstat_hist_t irqs_off;
+} irqstat_t;
+
+void init_irqstat ( void );
+
+/* For the interrupt path: irqstat_start() takes the time an interval starts
+ * at, and the others account for the interval from then to now */
+uint64_t irqstat_start ( void );
+void irqstat_handler_done ( uint8_t vector, uint64_t start );
+void irqstat_irqs_off_done ( uint8_t vector, uint64_t start );
+
+/* One CPU's statistics for vector, and every CPU's added up in sum */
+const irqstat_t* irqstat_get_cpu ( uint32_t cpu, uint8_t vector );
+void irqstat_get ( uint8_t vector, irqstat_t* sum );
+
+/* The duration (in cycles) that per_mille thousandths of the intervals in h
+ * didn't go over. For example, 990 gives the 99th percentile */
+uint32_t irqstat_percentile ( const irqstat_hist_t* h, uint32_t per_mille );
+
+/* Print a line for each vector that has fired, on any CPU */
+void irqstat_report ( void );
+
+/* Start counting from scratch */
+void irqstat_reset ( void );
+
+#endif
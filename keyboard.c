@@ -3,172 +3,408 @@
 #include <irq.h>
 #include <x86/x86.h>
 #include <screen.h>
+#include <string.h>
+#include <softirq.h>
+#include <spinlock.h>
+#include <mutex.h>
+#include <wait.h>
+#include <rcu.h>
 
 #define SHOW_KEYPRESSES
 
-PRIVATE keyboard_map_t* system_map;
+/* What a scancode decodes to, for a given set of modifiers and prefix */
+typedef struct {
+    uint16_t vk;
+    uint16_t codepoint;
+} key_decode_t;
 
-/* Given a VK, we access the respective index (for VK_1 we access index 3)
- * to get that key's state (or set it) */
-PRIVATE uint8_t  key_states[LAST_VK+1] = {0};
+/* The states of the scancode decoder. The first two double as the index of
+ * the decode table plane */
+#define KBD_STATE_NORMAL  KEY_PLANE_NONE
+#define KBD_STATE_E0      KEY_PLANE_E0
+#define KBD_STATE_E1      2 /* Seen E1, waiting for 1D/9D */
+#define KBD_STATE_E1_LAST 3 /* Seen E1 1D, waiting for 45/C5 */
+
+/* The character a key types under the modifiers mods. AltGr wins if the key
+ * has an AltGr character, and Caps Lock undoes shift on the keys it affects */
+#define KEY_CHAR(mods, plain, shifted, altgr, caps)                         \
+    ( ( ( (mods) & KEY_MOD_ALTGR ) && (altgr) ) ? (altgr) :                 \
+      ( ( ( (mods) & KEY_MOD_SHIFT ) != 0 ) !=                              \
+        ( (caps) && ( (mods) & KEY_MOD_CAPS ) ) ) ? (shifted) : (plain) )
+
+#define KEY(code, vk, plain, shifted, altgr, caps) \
+    { vk, KEY_CHAR(MODS, plain, shifted, altgr, caps) },
+#define KEY_PLANE_BREAK } , {
 
-/*
- * This table has the ASCII character that represents each VK.
- * For instance, to check what ASCII character VK_A represents (that's 'a'),
- * we'd do vk_ascii[VK_A], and we'd get the 'a'. It's the way the OS
- * uses to map VKs to printable characters.
- * 
- * Do note that this table is partially filled during the initialization
- * routine, meaning that the intialization you see directly below
- * is only partial too.
- */
-PRIVATE uint8_t  vk_ascii[LAST_VK+1] = {
-    0,  27, '1', '2', '3', '4', '5', '6', '7', '8',	/* 9 */
-    '9', '0', '-', '=', '\b',	/* Backspace */
-    '\t',			/* Tab */
-    'q', 'w', 'e', 'r',	/* 19 */
-    't', 'y', 'u', 'i', 'o', 'p', '[', ']', '\n',	/* Enter key */
-    0,			/* 29   - Control */
-    'a', 's', 'd', 'f', 'g', 'h', 'j', 'k', 'l', ';',	/* 39 */
-    '\'', '`',   0,		/* Left shift */
-    '\\', 'z', 'x', 'c', 'v', 'b', 'n',			/* 49 */
-    'm', ',', '.', '/',   0,				/* Right shift */
-    '*',
-    0,	/* Alt */
-    ' ',	/* Space bar */
-    0,	/* Caps lock */
-    0,	/* 59 - F1 key ... > */
-    0,   0,   0,   0,   0,   0,   0,   0,
-    0,	/* < ... F10 */
-    0,	/* 69 - Num lock*/
-    0,	/* Scroll Lock */
-    0,	/* Home key */
-    0,	/* Up Arrow */
-    0,	/* Page Up */
-    '-',
-    0,	/* Left Arrow */
-    0,
-    0,	/* Right Arrow */
-    '+',
-    0,	/* 79 - End key*/
-    0,	/* Down Arrow */
-    0,	/* Page Down */
-    0,	/* Insert Key */
-    0,	/* Delete Key */
-    0,   0,   0,
-    0,	/* F11 Key */
-    0,	/* F12 Key */
-    0,	/* All other keys are undefined */
+/* The en-US decode tables, one per combination of modifiers, generated from
+ * keymap_en_US.def */
+PRIVATE const key_decode_t en_US_decode_table[KEY_MOD_COMBOS][KEY_PLANES][KEY_SCANCODES] = {
+#define MODS 0
+    { {
+#include <keymap_en_US.def>
+    } },
+#undef MODS
+#define MODS 1
+    { {
+#include <keymap_en_US.def>
+    } },
+#undef MODS
+#define MODS 2
+    { {
+#include <keymap_en_US.def>
+    } },
+#undef MODS
+#define MODS 3
+    { {
+#include <keymap_en_US.def>
+    } },
+#undef MODS
+#define MODS 4
+    { {
+#include <keymap_en_US.def>
+    } },
+#undef MODS
+#define MODS 5
+    { {
+#include <keymap_en_US.def>
+    } },
+#undef MODS
+#define MODS 6
+    { {
+#include <keymap_en_US.def>
+    } },
+#undef MODS
+#define MODS 7
+    { {
+#include <keymap_en_US.def>
+    } }
+#undef MODS
 };
 
+#undef KEY
+#undef KEY_PLANE_BREAK
+
+/* The table actually used to decode: en-US with the system map on top. It's
+ * read for every key and changed hardly ever, so it's RCU protected (see
+ * rcu.h): keyboard_set_map builds the new one in the spare slot, publishes
+ * it, and waits for a grace period before the old one can be the spare */
+typedef key_decode_t decode_table_t[KEY_MOD_COMBOS][KEY_PLANES][KEY_SCANCODES];
+PRIVATE decode_table_t decode_tables[2];
+PRIVATE decode_table_t* decode_table = NULL;
+
+PRIVATE const keyboard_map_t* system_map;
+
+/* Keeps keyboard_set_maps apart. They wait for grace periods, so it's one
+ * that sleeps */
+PRIVATE mutex_t map_lock = MUTEX_INIT ( map_lock, "keyboard map" );
+
+/* The scancodes the IRQ handler has read but keyboard_tasklet hasn't decoded
+ * yet. Free-running, like the event ring below */
+#define KEY_RAW_RING_SIZE 16
+PRIVATE byte raw_ring[KEY_RAW_RING_SIZE];
+PRIVATE volatile uint32_t raw_head = 0;
+PRIVATE volatile uint32_t raw_tail = 0;
+PRIVATE uint32_t raw_dropped = 0;
+
+PRIVATE void keyboard_tasklet ( uint32_t data );
+PRIVATE tasklet_t decode_tasklet = TASKLET_INIT ( &keyboard_tasklet, 0 );
+
+PRIVATE irq_return_t keyboard_handler ( uint32_t data );
+PRIVATE irq_action_t keyboard_action = IRQ_ACTION_INIT ( &keyboard_handler, NULL, 0, 0, "keyboard" );
+
+/* Decoder state, only touched by keyboard_tasklet */
+PRIVATE uint8_t kbd_state = KBD_STATE_NORMAL;
+PRIVATE uint8_t key_mods = 0;
+
+/* The event ring. keyboard_tasklet only ever moves ring_head, and the consumer
+ * only ever moves ring_tail. They're free-running: the slot for index i is
+ * i % KEY_EVENT_RING_SIZE, and head - tail is how many events are queued. */
+PRIVATE key_event_t ring[KEY_EVENT_RING_SIZE];
+PRIVATE volatile uint32_t ring_head = 0;
+PRIVATE volatile uint32_t ring_tail = 0;
+PRIVATE uint32_t ring_dropped = 0;
+
+/* The threads sleeping in keyboard_wait_event */
+PRIVATE wait_queue_t event_wait = WAIT_QUEUE_INIT ( event_wait, "keyboard events" );
+
+PRIVATE keyboard_callback_t callbacks[MAX_KEYBOARD_CALLBACKS];
+PRIVATE uint32_t num_callbacks = 0;
 
-#define ALT_PRESSED()    IS_KEY_DOWN(key_states[VK_ALT])
-#define CTRL_PRESSED()   IS_KEY_DOWN(key_states[VK_CTRL])
-#define LSHIFT_PRESSED() IS_KEY_DOWN(key_states[VK_LSHIFT])
-#define CAPS_ON()        IS_KEY_DOWN(key_states[VK_CAPS])
+/* Read on every event, changed hardly ever. Callbacks run with it held for
+ * reading, so they mustn't register more callbacks */
+PRIVATE rwlock_t callbacks_lock = RWLOCK_INIT ( "keyboard callbacks" );
+
+/* Given a VK, we access the respective index (for VK_1 we access index 2)
+ * to get that key's state (or set it) */
+PRIVATE uint8_t  key_states[LAST_VK+1] = {0};
+
+#define ALT_PRESSED()    ( IS_KEY_DOWN(key_states[VK_ALT]) || \
+                           IS_KEY_DOWN(key_states[VK_ALTGR]) )
+#define CTRL_PRESSED()   ( IS_KEY_DOWN(key_states[VK_CTRL]) || \
+                           IS_KEY_DOWN(key_states[VK_RCTRL]) )
+#define SHIFT_PRESSED()  ( IS_KEY_DOWN(key_states[VK_LSHIFT]) || \
+                           IS_KEY_DOWN(key_states[VK_RSHIFT]) )
+#define CAPS_ON()        ( key_mods & KEY_MOD_CAPS )
 
 #define KEY_RELEASED(x) ( ((x) & KEY_RELEASED_MASK) == KEY_RELEASED_MASK )
 
 #define SET_KEY_DOWN(x) ( (x) |= KEY_DOWN_STATE )
 #define SET_KEY_UP(x)   ( (x) &= ~KEY_DOWN_STATE )
 
-/* Handles the keyboard interrupt */
-void keyboard_handler ( registers_t* r )
+/* Called only by keyboard_tasklet */
+PRIVATE void ring_push ( const key_event_t* ev )
 {
-    byte scancode;
-    uint16_t vk_code;
+    if ( ring_head - ring_tail == KEY_EVENT_RING_SIZE ) {
+        ring_dropped++;
+        return;
+    }
 
-    UNUSED(r);
-    /* Read from the keyboard's data buffer */
-    scancode = inb ( KEYB_DATA_PORT );
+    ring[ring_head % KEY_EVENT_RING_SIZE] = *ev;
+
+    /* The event must be in the ring before the consumer can see it */
+    barrier();
+    ring_head++;
+
+    wake_up ( &event_wait );
+}
+
+/* Called only by the consumer */
+PRIVATE bool ring_pop ( key_event_t* ev )
+{
+    if ( ring_tail == ring_head )
+        return false;
+
+    *ev = ring[ring_tail % KEY_EVENT_RING_SIZE];
+
+    /* We must be done reading the slot before the producer can reuse it */
+    barrier();
+    ring_tail++;
+    return true;
+}
+
+/* Track the modifiers after vk changed state. was_down is its state before */
+PRIVATE void update_mods ( uint16_t vk, bool released, bool was_down )
+{
+    switch ( vk ) {
+    case VK_CAPS:
+        /* Caps Lock toggles on press, and typematic repeats don't count */
+        if ( !released && !was_down )
+            key_mods ^= KEY_MOD_CAPS;
+        return;
+    case VK_LSHIFT:
+    case VK_RSHIFT:
+    case VK_ALTGR:
+        break;
+    default:
+        return;
+    }
+
+    key_mods &= KEY_MOD_CAPS;
+    if ( SHIFT_PRESSED () )
+        key_mods |= KEY_MOD_SHIFT;
+    if ( IS_KEY_DOWN ( key_states[VK_ALTGR] ) )
+        key_mods |= KEY_MOD_ALTGR;
+}
+
+/* Decodes one scancode, pushing an event if it completes a key */
+PRIVATE void keyboard_decode ( byte scancode )
+{
+    bool released, was_down;
+    decode_table_t* table;
+    const key_decode_t* d;
+    key_event_t ev;
 
     /* If the top bit of the byte we read from the keyboard is
     *  set, that means that a key has just been released */
-    if ( KEY_RELEASED ( scancode ) ) {
-        scancode &= ~KEY_RELEASED_MASK;
-        vk_code = system_map->vk_code[scancode];
-        SET_KEY_UP ( key_states[vk_code] );
-        #ifdef SHOW_KEYPRESSES
-        screen_puts("Key released: '");
-        if (vk_code) {
-            if ( vk_ascii[vk_code] )
-                screen_putc(vk_ascii[vk_code]);
-            else {
-                screen_put_int(vk_code);
-                screen_puts(" [NO ASCII]");
-            }
-        } else {
-                screen_put_int(scancode);
-                screen_puts(" [NOT TRANSLATED]");
+    released = KEY_RELEASED ( scancode );
+
+    switch ( kbd_state ) {
+    case KBD_STATE_E1:
+        kbd_state = KBD_STATE_E1_LAST;
+        return;
+    case KBD_STATE_E1_LAST:
+        /* E1 1D 45 is Pause's make code and E1 9D C5 its break code */
+        kbd_state = KBD_STATE_NORMAL;
+        ev.vk = VK_PAUSE;
+        ev.codepoint = 0;
+        break;
+    default:
+        if ( scancode == KEY_NEED_NEXT_KEY ) {
+            kbd_state = KBD_STATE_E0;
+            return;
         }
-        screen_puts("'\n");
-        #endif
-    } else if ( scancode == KEY_NEED_NEXT_KEY ) {
-        /* Not dealing with this yet. Includes right alt, etc.. */
+        if ( scancode == KEY_PREFIX_PAUSE ) {
+            kbd_state = KBD_STATE_E1;
+            return;
+        }
+
+        rcu_read_lock ();
+        table = rcu_dereference ( decode_table );
+        d = &( *table )[key_mods][kbd_state][scancode & ~KEY_RELEASED_MASK];
+        ev.vk = d->vk;
+        ev.codepoint = d->codepoint;
+        rcu_read_unlock ();
+
+        /* Unknown extended keys and the fake shifts are dropped */
+        if ( kbd_state == KBD_STATE_E0 && ev.vk == VK_NONE ) {
+            kbd_state = KBD_STATE_NORMAL;
+            return;
+        }
+
+        kbd_state = KBD_STATE_NORMAL;
+        break;
+    }
+
+    was_down = IS_KEY_DOWN ( key_states[ev.vk] );
+    if ( released )
+        SET_KEY_UP ( key_states[ev.vk] );
+    else
+        SET_KEY_DOWN ( key_states[ev.vk] );
+    update_mods ( ev.vk, released, was_down );
+
+    ev.state = get_key_state ( ev.vk );
+    ev.scancode = scancode & ~KEY_RELEASED_MASK;
+    ring_push ( &ev );
+}
+
+/* The bottom half: decode whatever the IRQ handler has queued */
+PRIVATE void keyboard_tasklet ( uint32_t data )
+{
+    byte scancode;
+
+    UNUSED(data);
+    while ( raw_tail != raw_head ) {
+        scancode = raw_ring[raw_tail % KEY_RAW_RING_SIZE];
+        barrier();
+        raw_tail++;
+        keyboard_decode ( scancode );
+    }
+}
+
+/* Handles the keyboard interrupt. All it does is get the scancode out of the
+ * controller and queue it for keyboard_tasklet */
+PRIVATE irq_return_t keyboard_handler ( uint32_t data )
+{
+    byte scancode;
+
+    UNUSED(data);
+    /* Read from the keyboard's data buffer */
+    scancode = inb ( KEYB_DATA_PORT );
+
+    if ( raw_head - raw_tail == KEY_RAW_RING_SIZE ) {
+        raw_dropped++;
     } else {
-        vk_code = system_map->vk_code[scancode];
-        SET_KEY_DOWN ( key_states[vk_code] );
-        #ifdef SHOW_KEYPRESSES
+        raw_ring[raw_head % KEY_RAW_RING_SIZE] = scancode;
+        barrier();
+        raw_head++;
+    }
+
+    tasklet_schedule ( &decode_tasklet );
+    return IRQ_HANDLED;
+}
+
+#ifdef SHOW_KEYPRESSES
+PRIVATE void show_keypress ( const key_event_t* ev )
+{
+    if ( IS_KEY_DOWN ( ev->state ) )
         screen_puts("Key pressed : '");
-        if (vk_code) {
-            if ( vk_ascii[vk_code] )
-                screen_putc(vk_ascii[vk_code]);
-            else {
-                screen_put_int(vk_code);
-                screen_puts(" [NO ASCII]");
-            }
-        } else {
-                screen_put_int(scancode);
-                screen_puts(" [NOT TRANSLATED]");
+    else
+        screen_puts("Key released: '");
+
+    if (ev->vk) {
+        if ( ev->codepoint >= 128 ) {
+            screen_puts("U+");
+            screen_put_hex(ev->codepoint);
+        } else if ( ev->codepoint )
+            screen_putc(ev->codepoint);
+        else {
+            screen_put_int(ev->vk);
+            screen_puts(" [NO CHARACTER]");
         }
-        screen_puts("'\n");
-        #endif
+    } else {
+            screen_put_int(ev->scancode);
+            screen_puts(" [NOT TRANSLATED]");
     }
-
+    screen_puts("'\n");
 }
+#endif
 
-PRIVATE keyboard_map_t en_US_keymap = {
+const keyboard_map_t en_US_keymap = {
     "en-US",
+    NULL,
+    0
+};
 
-    {0} /* To be initialized 0 to 128 later... */
+/* The keys that differ from en-US. These were manually found by debugging */
+PRIVATE const keymap_overlay_t pt_PT_overlay[] = {
+    /* plane, code, vk,               plain, shifted, altgr,  caps */
+    { 0, 0x03, VK_2,             '2',   '"',     '@',    false },
+    { 0, 0x04, VK_3,             '3',   '#',     0xA3,   false }, /* £ */
+    { 0, 0x05, VK_4,             '4',   '$',     0xA7,   false }, /* § */
+    { 0, 0x06, VK_5,             '5',   '%',     0x20AC, false }, /* € */
+    { 0, 0x07, VK_6,             '6',   '&',     0,      false },
+    { 0, 0x08, VK_7,             '7',   '/',     '{',    false },
+    { 0, 0x09, VK_8,             '8',   '(',     '[',    false },
+    { 0, 0x0A, VK_9,             '9',   ')',     ']',    false },
+    { 0, 0x0B, VK_0,             '0',   '=',     '}',    false },
+    { 0, 0x0C, VK_UPPERCOMMA,    '\'',  '?',     0,      false },
+    { 0, 0x0D, VK_PLUS,          '+',   '*',     0,      false },
+    { 0, 0x27, VK_SEMICOLON,     0xE7,  0xC7,    0,      true  }, /* ç Ç */
+    { 0, 0x28, VK_ORDINAL,       0xBA,  0xAA,    0,      false }, /* º ª */
+    { 0, 0x29, VK_APOSTROPHE,    '\\',  '|',     0,      false },
+    { 0, 0x2B, VK_BACKSLASH,     '~',   '^',     0,      false },
+    { 0, 0x33, VK_COMMA,         ',',   ';',     0,      false },
+    { 0, 0x34, VK_DOT,           '.',   ':',     0,      false },
+    { 0, 0x35, VK_MINUS,         '-',   '_',     0,      false },
+    { 0, 0x56, VK_102ND,         '<',   '>',     0,      false }
 };
 
-PRIVATE keyboard_map_t pt_PT_keymap = {
+const keyboard_map_t pt_PT_keymap = {
     "pt-PT",
-
-    {0} /* To be initialized 0 to 128 later... */
+    pt_PT_overlay,
+    sizeof ( pt_PT_overlay ) / sizeof ( pt_PT_overlay[0] )
 };
 
+void keyboard_set_map ( const keyboard_map_t* map )
+{
+    uint32_t i, mods;
+    const keymap_overlay_t* o;
+    decode_table_t* table;
+    key_decode_t* d;
+
+    mutex_lock ( &map_lock );
+
+    /* Nobody's reading the spare one. The decoder only ever sees a whole
+     * table, the old one or this one */
+    table = decode_table == &decode_tables[0] ? &decode_tables[1] : &decode_tables[0];
+    memcpy ( table, en_US_decode_table, sizeof ( decode_table_t ) );
+    for ( i = 0; i < map->overlay_size; i++ ) {
+        o = &map->overlay[i];
+        for ( mods = 0; mods < KEY_MOD_COMBOS; mods++ ) {
+            d = &( *table )[mods][o->plane][o->scancode];
+            d->vk = o->vk;
+            d->codepoint = KEY_CHAR ( mods, o->plain, o->shifted, o->altgr,
+                                      o->caps );
+        }
+    }
+    rcu_assign_pointer ( decode_table, table );
+    rcu_assign_pointer ( system_map, map );
+
+    /* The old table becomes the spare once nobody can be using it */
+    synchronize_rcu ();
+
+    mutex_unlock ( &map_lock );
+}
+
 void init_keyboard ( void )
 {
-    int i;
-    
-    /* Create the VK codes for the US mapping. Given the way we built the OS,
-     * we have that the index is the VK itself. Allowing us to initialize them
-     * all in this for loop
-     */
-    for ( i = 0; i < 128; i ++ )
-        en_US_keymap.vk_code[i] = i;
-    
-    /* The pt_PT keymap will be built by changing the en_US one, so we start
-     * by building it as if it were the en_US */
-    for ( i = 0; i < 128; i ++ )
-        pt_PT_keymap.vk_code[i] = i;
-    
-    /* Now for the changes. These keycodes were manually found by debugging */
-    pt_PT_keymap.vk_code[53] = VK_MINUS;
-    pt_PT_keymap.vk_code[13] = VK_PLUS;
-    pt_PT_keymap.vk_code[12] = VK_UPPERCOMMA;
-    
-    /* Part of the vk_ascii table is not fully initialized on start. In
-     * particular, the characters which cannot be directly typed on a US keyboard
-     * are not stored there. We have to initialize them here
-     */
-    vk_ascii[VK_PLUS] = '+';
-    
     /* Set the system map and register our interrupt handler */
-    system_map = &pt_PT_keymap;
-    register_interrupt_handler ( IRQ_1, &keyboard_handler );
+    keyboard_set_map ( &pt_PT_keymap );
+    request_irq ( IRQ_NO ( IRQ_1 ), &keyboard_action );
+
+    #ifdef SHOW_KEYPRESSES
+    keyboard_register_callback ( &show_keypress );
+    #endif
 }
 
 uint16_t get_key_state(uint16_t scancode) {
@@ -179,7 +415,7 @@ uint16_t get_key_state(uint16_t scancode) {
     if ( CTRL_PRESSED() )
         flags |= CTRL_FLAG;
         
-    if ( LSHIFT_PRESSED() )
+    if ( SHIFT_PRESSED() )
         flags |= SHIFT_FLAG;
         
     if ( CAPS_ON() )
@@ -187,3 +423,50 @@ uint16_t get_key_state(uint16_t scancode) {
         
     return flags;
 }
+
+bool keyboard_poll_event ( key_event_t* ev )
+{
+    return ring_pop ( ev );
+}
+
+void keyboard_wait_event ( void )
+{
+    wait_event ( &event_wait, ring_tail != ring_head );
+}
+
+void keyboard_read_event ( key_event_t* ev )
+{
+    while ( !ring_pop ( ev ) )
+        keyboard_wait_event ();
+}
+
+bool keyboard_register_callback ( keyboard_callback_t cb )
+{
+    bool ok = false;
+
+    write_lock ( &callbacks_lock );
+    if ( num_callbacks < MAX_KEYBOARD_CALLBACKS ) {
+        callbacks[num_callbacks++] = cb;
+        ok = true;
+    }
+    write_unlock ( &callbacks_lock );
+    return ok;
+}
+
+void keyboard_dispatch_events ( void )
+{
+    key_event_t ev;
+    uint32_t i;
+
+    while ( ring_pop ( &ev ) ) {
+        read_lock ( &callbacks_lock );
+        for ( i = 0; i < num_callbacks; i++ )
+            callbacks[i] ( &ev );
+        read_unlock ( &callbacks_lock );
+    }
+}
+
+uint32_t keyboard_dropped_events ( void )
+{
+    return ring_dropped + raw_dropped;
+}
@@ -2,29 +2,29 @@
 #define KEYBOARD_H
 #include <stdinc.h>
 /*
- * This is the first iteration of our very simple keyboard model.
+ * This is the second iteration of our very simple keyboard model.
  *
- * The OS, as of the time being, has several keyboard maps.
- * A keyboard map, defined in the structure keyboard_map_t,
- * has a name (for instance, pt-PT, en-US, pt-pT no dead keys, etc),
- * as well as a table of vks.
+ * The keyboard sends us scancodes (Scan Code Set 1). Most keys send a single
+ * byte when pressed, and the same byte with KEY_RELEASED_MASK set when
+ * released. Extended keys (right Alt/Ctrl, the arrows, the keypad's Enter and
+ * slash, etc) send 0xE0 first, and Pause sends the six bytes
+ * E1 1D 45 E1 9D C5 with no release at all.
  *
- * What the table of vks does is convert scancodes (received from the keyboard)
- * onto VK (Virtual Key) values. If we receive scancode 5, we access
- * vk_code[5] to retrieve the respective VK.
+ * Scancodes are translated into VK (Virtual Key) values, which tell us which
+ * key it was, and a codepoint, which tells us what character it types given
+ * the modifiers (Shift, Caps Lock and AltGr). The VKs were setup in such a way
+ * that their numbers match the scancodes of the en-US layout: single byte keys
+ * have their own scancode as VK, and 0xE0-prefixed keys have 0x80 | scancode
+ * (see VK_E0). The few keys that exist in other layouts but not in en-US get
+ * VKs from 256 onwards.
  *
- * For instance, if a keyboard_map intends to map scancode 10 to the letter A,
- * one only needs to make sure tht vk_code[10] = VK_A.
- *
- * The VKs were setup in such a way that their numbers match the scancodes
- * of the en-US layout when in "Scan Code Set 1". This is useful because
- * one can then build the en-US vk_code array by simply mapping each
- * index to itself. That is, vk_code[i] = i, in the case of the en-US layout.
- *
- * Other layouts will have to map vk_codes differently.
- *
- * In the future, an API for loading keyboard maps and initializing them
- * might be used. Right now, it's all done in  init_keyboard()
+ * Decoding is a small state machine (which prefix, if any, we've just seen)
+ * and a table lookup: decode_table[modifiers][prefix][scancode] holds both the
+ * VK and the codepoint, so a key costs a single lookup no matter the layout or
+ * the modifiers. The en-US tables are generated at compile time from
+ * keymap_en_US.def. A keyboard map (keyboard_map_t) is an overlay: a list of
+ * the keys that differ from en-US. keyboard_set_map() applies it on top of the
+ * en-US tables once, so decoding never looks at the overlay.
  *
  * We also provide a get_key_state function which returns a 16-bit
  * value that gives us the state of the requested key (given by a VK),
@@ -35,8 +35,26 @@
  *
  * if ( IS_KEY_DOWN(get_key_state(VK_A) ) )
  *
- * FIXME: Soon we should implement some kind of callback mechanism
- * for keypresses, etc
+ * Polling is not how most code wants to get its input, though. The interrupt
+ * handler only reads the scancode and queues it for a tasklet (see softirq.h),
+ * which decodes it with interrupts enabled. Every time a key is pressed or
+ * released, the tasklet pushes a key_event_t onto a ring buffer. Anything
+ * slow, like printing, happens later still, outside of both.
+ *
+ * The ring has a single producer (the tasklet) and a single consumer, so
+ * it needs no locks. Events can be consumed in two ways, and only one of them
+ * should be used:
+ *  -> keyboard_read_event() returns the next event, sleeping (on a wait
+ *     queue, see wait.h) until there is one, and keyboard_poll_event()
+ *     doesn't sleep.
+ *  -> Callbacks registered with keyboard_register_callback() are called with
+ *     each event whenever keyboard_dispatch_events() is called. For now,
+ *     kernel_main's idle loop does it. A callback mustn't register
+ *     another one: it would wait forever for itself to finish.
+ *
+ * If the ring fills up because nobody is consuming it, new events are
+ * dropped (and counted, see keyboard_dropped_events()). So are scancodes the
+ * tasklet doesn't get to in time.
  */
 
 
@@ -45,7 +63,8 @@
 #define KEYB_COMMAND_PORT KEYB_STATUS_PORT
 
 #define KEY_RELEASED_MASK 0x80
-#define KEY_NEED_NEXT_KEY 0xE0
+#define KEY_NEED_NEXT_KEY 0xE0 /* Prefix of the extended keys */
+#define KEY_PREFIX_PAUSE  0xE1 /* Prefix of the Pause sequence */
 
 #define KEY_DOWN_STATE    1
 #define ALT_FLAG          512
@@ -54,18 +73,88 @@
 #define CAPS_FLAG         4096
 #define IS_KEY_DOWN(x) (((x) & KEY_DOWN_STATE) == KEY_DOWN_STATE )
 
-/* 128 keyboard_map being used */
+/* The modifiers that change which character a key types. Every combination
+ * of them has its own decode table */
+#define KEY_MOD_SHIFT     1
+#define KEY_MOD_CAPS      2
+#define KEY_MOD_ALTGR     4
+#define KEY_MOD_COMBOS    8
+
+/* The decode tables have one plane per prefix */
+#define KEY_PLANE_NONE    0
+#define KEY_PLANE_E0      1
+#define KEY_PLANES        2
+#define KEY_SCANCODES     128
+
+/* One key that a keyboard map changes with respect to en-US */
+typedef struct {
+    uint8_t  plane;    /* KEY_PLANE_NONE or KEY_PLANE_E0 */
+    uint8_t  scancode;
+    uint16_t vk;
+    uint16_t plain;    /* The codepoints it types without modifiers, */
+    uint16_t shifted;  /* with shift, */
+    uint16_t altgr;    /* and with AltGr (0 if AltGr doesn't matter) */
+    bool     caps;     /* Whether Caps Lock acts as shift on it */
+} keymap_overlay_t;
+
 typedef struct _keyboard_map_t {
     const char name[32]; /* pt-PT, en-US, etc */
-    uint16_t   vk_code[128];
+    const keymap_overlay_t* overlay;
+    uint32_t overlay_size;
 } keyboard_map_t;
 
+/* How many events the ring can hold. Must be a power of two */
+#define KEY_EVENT_RING_SIZE 64
+
+/* One key press or release */
+typedef struct {
+    uint16_t vk;       /* The translated VK, 0 if the scancode has none */
+    uint16_t state;    /* get_key_state(vk) right after the event */
+    uint16_t codepoint;/* The character it types (Unicode), 0 if none */
+    uint8_t  scancode; /* The raw scancode, without KEY_RELEASED_MASK */
+} key_event_t;
+
+typedef void ( *keyboard_callback_t ) ( const key_event_t* ev );
+
+/* How many callbacks can be registered at once */
+#define MAX_KEYBOARD_CALLBACKS 4
+
 void init_keyboard ( void );
 uint16_t get_key_state ( uint16_t scancode );
 
+/* The built-in keyboard maps. pt-PT is the default */
+extern const keyboard_map_t en_US_keymap;
+extern const keyboard_map_t pt_PT_keymap;
+
+/* Switch to another keyboard map. May sleep, so not from interrupt
+ * handlers */
+void keyboard_set_map ( const keyboard_map_t* map );
+
+/* Sleep until there's an event and return it. Must be called with
+ * interrupts enabled. */
+void keyboard_read_event ( key_event_t* ev );
+
+/* Return the next event if there's one, without sleeping */
+bool keyboard_poll_event ( key_event_t* ev );
+
+/* Sleep until there's an event, without consuming it. Must be called with
+ * interrupts enabled. */
+void keyboard_wait_event ( void );
 
-/* #define VK_ FIXME: WHAT'S HERE? */
-#define VK_27 1 /* what 's 27? */
+/* Register a function to be called with every event. Returns false if
+ * there's no room for more callbacks. */
+bool keyboard_register_callback ( keyboard_callback_t cb );
+
+/* Hand every pending event to the registered callbacks. Never call this from
+ * an interrupt handler. */
+void keyboard_dispatch_events ( void );
+
+/* How many events were lost because the ring was full */
+uint32_t keyboard_dropped_events ( void );
+
+
+#define VK_NONE 0
+#define VK_ESCAPE 1
 #define VK_1 2
 #define VK_2 3
 #define VK_3 4
@@ -119,45 +208,69 @@ uint16_t get_key_state ( uint16_t scancode );
 #define VK_DOT 52
 #define VK_FORWARDSLASH 53
 #define VK_RSHIFT 54
-#define VK_ALT 55
-#define VK_SPAE 56
-#define VK_CAPS 57
-#define VK_F1 58
-#define VK_F2 59
-#define VK_F3 60
-#define VK_F4 61
-#define VK_F5 62
-#define VK_F6 63
-#define VK_F7 64
-#define VK_F8 65
-#define VK_F9 66
-#define VK_F10 67
-#define VK_NUMLOCK 68
-#define VK_SCROLLLOCK 69
-#define VK_HOME 70
-#define VK_UP 71
-#define VK_PAGEUP 72
-#define VK_KPMINUS 73
-#define VK_LEFT 74
-/* #define VK_ FIXME: WHAT'S HERE? */
-#define VK_RIGHT 76
-#define VK_KPPLUS 77
-#define VK_END 78
-#define VK_DOWN 79
-#define VK_PAGEDOWN 80
-#define VK_INSERT 81
-#define VK_DELETE 82
-/* #define VK_ FIXME: WHAT'S HERE? */
-/* #define VK_ FIXME: WHAT'S HERE? */
-/* #define VK_ FIXME: WHAT'S HERE? */
-#define VK_F11 86
-#define VK_F12 87
+#define VK_KPASTERISK 55
+#define VK_ALT 56
+#define VK_SPACE 57
+#define VK_CAPS 58
+#define VK_F1 59
+#define VK_F2 60
+#define VK_F3 61
+#define VK_F4 62
+#define VK_F5 63
+#define VK_F6 64
+#define VK_F7 65
+#define VK_F8 66
+#define VK_F9 67
+#define VK_F10 68
+#define VK_NUMLOCK 69
+#define VK_SCROLLLOCK 70
+#define VK_KP7 71
+#define VK_KP8 72
+#define VK_KP9 73
+#define VK_KPMINUS 74
+#define VK_KP4 75
+#define VK_KP5 76
+#define VK_KP6 77
+#define VK_KPPLUS 78
+#define VK_KP1 79
+#define VK_KP2 80
+#define VK_KP3 81
+#define VK_KP0 82
+#define VK_KPDOT 83
+#define VK_SYSRQ 84
+/* 85 is unused */
+#define VK_102ND 86 /* The extra key next to left shift on ISO keyboards */
+#define VK_F11 87
+#define VK_F12 88
+
+/* The 0xE0-prefixed keys */
+#define VK_E0(x) (0x80 | (x))
+#define VK_KPENTER VK_E0(0x1C)
+#define VK_RCTRL VK_E0(0x1D)
+#define VK_KPSLASH VK_E0(0x35)
+#define VK_PRINTSCREEN VK_E0(0x37)
+#define VK_ALTGR VK_E0(0x38) /* Right alt */
+#define VK_HOME VK_E0(0x47)
+#define VK_UP VK_E0(0x48)
+#define VK_PAGEUP VK_E0(0x49)
+#define VK_LEFT VK_E0(0x4B)
+#define VK_RIGHT VK_E0(0x4D)
+#define VK_END VK_E0(0x4F)
+#define VK_DOWN VK_E0(0x50)
+#define VK_PAGEDOWN VK_E0(0x51)
+#define VK_INSERT VK_E0(0x52)
+#define VK_DELETE VK_E0(0x53)
+#define VK_LWIN VK_E0(0x5B)
+#define VK_RWIN VK_E0(0x5C)
+#define VK_MENU VK_E0(0x5D)
 
 /* These keys do not exist as direct mappings in the US keyboard,
  * they have no scancode (or it's a more-than-one-byte scancode)
  * and are usually the keys that are triggered by shift, ctrl or alt, etc
  */
-#define VK_PLUS 256
-#define LAST_VK VK_PLUS
+#define VK_PAUSE 256
+#define VK_PLUS 257
+#define VK_ORDINAL 258 /* The º/ª key on Portuguese keyboards */
+#define LAST_VK VK_ORDINAL
 
 #endif
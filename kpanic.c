@@ -8,12 +8,15 @@ PRIVATE void print_stack_trace ();
 void kpanic (const char* msg)
 {
   __asm("cli");
+  screen_bust_lock ();
   screen_puts ("!!!-> System panic: ");
   screen_puts ( msg );
   screen_putc('\n');
   print_stack_trace ();
   screen_puts ("!!!->\n");
-  for (;;) ;
+  /* With interrupts disabled, only an NMI wakes us, and then we halt again */
+  for (;;)
+    __asm volatile ("hlt");
 }
 
 void print_stack_trace ()
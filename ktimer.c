@@ -0,0 +1,222 @@
+#include <ktimer.h>
+#include <spinlock.h>
+#include <x86/x86.h>
+
+/* How far ahead ktimer_next_expiry says to look when there are no timers */
+#define KTIMER_NO_EXPIRY ( ( uint64_t ) 1 << 32 )
+
+PRIVATE list_node_t tv1[KTIMER_TVR_SIZE];
+PRIVATE list_node_t tvn[KTIMER_TVN_LEVELS][KTIMER_TVN_SIZE];
+
+/* The next tick to run the timers of */
+PRIVATE uint64_t timer_ticks = 0;
+
+/* The timers that have expired and are being run, so that ktimer_del works on
+ * them too */
+PRIVATE list_node_t expired;
+
+/* Taken around everything above. Timers are armed from any CPU */
+PRIVATE spinlock_t ktimer_lock = SPINLOCK_INIT ( "ktimer" );
+
+/* Which tvn slot the current tick falls in, at level n */
+#define TVN_INDEX(ticks, n) \
+    ( ( uint32_t ) ( ( ticks ) >> ( KTIMER_TVR_BITS + ( n ) * KTIMER_TVN_BITS ) ) \
+      & KTIMER_TVN_MASK )
+
+/* Put t in the slot its expiry time belongs in. Interrupts must be off */
+PRIVATE void internal_add_timer ( ktimer_t* t )
+{
+    uint64_t expires, idx;
+    list_node_t* vec;
+    uint32_t level;
+
+    expires = t->expires;
+    idx = expires - timer_ticks;
+
+    if ( ( int64_t ) idx < 0 ) {
+        /* Already expired: run it on the next tick */
+        vec = &tv1[timer_ticks & KTIMER_TVR_MASK];
+    } else if ( idx < KTIMER_TVR_SIZE ) {
+        vec = &tv1[expires & KTIMER_TVR_MASK];
+    } else {
+        /* Too far out for tv5, park it as far as tv5 goes. It'll be looked
+         * at again when that slot is cascaded */
+        if ( idx >> 32 ) {
+            idx = 0xFFFFFFFF;
+            expires = timer_ticks + idx;
+        }
+
+        for ( level = 0; level < KTIMER_TVN_LEVELS - 1; level++ )
+            if ( idx < ( ( uint64_t ) 1 << ( KTIMER_TVR_BITS +
+                                             ( level + 1 ) * KTIMER_TVN_BITS ) ) )
+                break;
+        vec = &tvn[level][TVN_INDEX ( expires, level )];
+    }
+
+    list_add_tail ( vec, &t->entry );
+}
+
+/* Spread the timers in slot index of level over the levels below it.
+ * Returns index, so that we know whether the level above has to cascade
+ * too (it has, when this level has gone all the way around) */
+PRIVATE uint32_t cascade ( uint32_t level, uint32_t index )
+{
+    list_node_t list;
+    ktimer_t* t;
+
+    list_init ( &list );
+    list_splice_tail ( &list, &tvn[level][index] );
+
+    while ( !list_empty ( &list ) ) {
+        t = LIST_ENTRY ( list.next, ktimer_t, entry );
+        list_del ( &t->entry );
+        internal_add_timer ( t );
+    }
+
+    return index;
+}
+
+void init_ktimers ( uint64_t now )
+{
+    uint32_t i, level;
+
+    for ( i = 0; i < KTIMER_TVR_SIZE; i++ )
+        list_init ( &tv1[i] );
+    for ( level = 0; level < KTIMER_TVN_LEVELS; level++ )
+        for ( i = 0; i < KTIMER_TVN_SIZE; i++ )
+            list_init ( &tvn[level][i] );
+    list_init ( &expired );
+
+    timer_ticks = now;
+}
+
+void ktimer_init ( ktimer_t* t, void ( *func ) ( uint32_t ), uint32_t data )
+{
+    t->entry.next = NULL;
+    t->entry.prev = NULL;
+    t->expires = 0;
+    t->func = func;
+    t->data = data;
+}
+
+bool ktimer_pending ( const ktimer_t* t )
+{
+    return list_linked ( &t->entry );
+}
+
+bool ktimer_mod ( ktimer_t* t, uint64_t expires )
+{
+    uint32_t flags;
+    bool was_pending;
+
+    flags = spin_lock_irqsave ( &ktimer_lock );
+    was_pending = ktimer_pending ( t );
+    if ( was_pending )
+        list_del ( &t->entry );
+    t->expires = expires;
+    internal_add_timer ( t );
+    spin_unlock_irqrestore ( &ktimer_lock, flags );
+
+    return was_pending;
+}
+
+void ktimer_add ( ktimer_t* t )
+{
+    uint32_t flags;
+
+    flags = spin_lock_irqsave ( &ktimer_lock );
+    internal_add_timer ( t );
+    spin_unlock_irqrestore ( &ktimer_lock, flags );
+}
+
+bool ktimer_del ( ktimer_t* t )
+{
+    uint32_t flags;
+    bool was_pending;
+
+    flags = spin_lock_irqsave ( &ktimer_lock );
+    was_pending = ktimer_pending ( t );
+    if ( was_pending )
+        list_del ( &t->entry );
+    spin_unlock_irqrestore ( &ktimer_lock, flags );
+
+    return was_pending;
+}
+
+void ktimer_run ( uint64_t now )
+{
+    uint32_t flags, index, level;
+    ktimer_t* t;
+    void ( *func ) ( uint32_t );
+    uint32_t data;
+
+    flags = spin_lock_irqsave ( &ktimer_lock );
+    while ( timer_ticks <= now ) {
+        index = ( uint32_t ) timer_ticks & KTIMER_TVR_MASK;
+
+        /* tv1 has gone around, so it's time to refill it from tv2. And if
+         * tv2 has gone around too, refill it from tv3 first, etc */
+        if ( index == 0 )
+            for ( level = 0; level < KTIMER_TVN_LEVELS; level++ )
+                if ( cascade ( level, TVN_INDEX ( timer_ticks, level ) ) != 0 )
+                    break;
+
+        timer_ticks++;
+        list_splice_tail ( &expired, &tv1[index] );
+
+        /* Run this tick's batch. Each timer is taken off the list before its
+         * function is called, with interrupts enabled and the lock dropped,
+         * so it can rearm itself or any other */
+        while ( !list_empty ( &expired ) ) {
+            t = LIST_ENTRY ( expired.next, ktimer_t, entry );
+            list_del ( &t->entry );
+            func = t->func;
+            data = t->data;
+
+            spin_unlock_irqrestore ( &ktimer_lock, flags );
+            func ( data );
+            flags = spin_lock_irqsave ( &ktimer_lock );
+        }
+    }
+    spin_unlock_irqrestore ( &ktimer_lock, flags );
+}
+
+uint64_t ktimer_next_expiry ( void )
+{
+    uint32_t flags, i, level, shift;
+    uint64_t next, slot, when;
+
+    flags = spin_lock_irqsave ( &ktimer_lock );
+    next = timer_ticks + KTIMER_NO_EXPIRY;
+
+    /* tv1 is exact: slot i holds the timers for timer_ticks + i */
+    for ( i = 0; i < KTIMER_TVR_SIZE; i++ ) {
+        if ( !list_empty ( &tv1[( timer_ticks + i ) & KTIMER_TVR_MASK] ) ) {
+            next = timer_ticks + i;
+            break;
+        }
+    }
+
+    /* For the other levels, we only know when the slot gets cascaded. That
+     * is when we have to be awake, even if its timers expire later, and it
+     * may well be before the first timer in tv1 */
+    for ( level = 0; level < KTIMER_TVN_LEVELS; level++ ) {
+        shift = KTIMER_TVR_BITS + level * KTIMER_TVN_BITS;
+        slot = timer_ticks >> shift;
+        for ( i = 0; i <= KTIMER_TVN_SIZE; i++ ) {
+            /* The current slot is only still to be cascaded if we're right
+             * at its start */
+            when = ( slot + i ) << shift;
+            if ( when < timer_ticks )
+                continue;
+            if ( !list_empty ( &tvn[level][( slot + i ) & KTIMER_TVN_MASK] ) ) {
+                if ( when < next )
+                    next = when;
+                break;
+            }
+        }
+    }
+
+    spin_unlock_irqrestore ( &ktimer_lock, flags );
+    return next;
+}
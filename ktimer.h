@@ -0,0 +1,75 @@
+#ifndef KTIMER_H
+#define KTIMER_H
+#include <stdinc.h>
+#include <list.h>
+/*
+ * Kernel timers: call a function when the timer tick count gets somewhere.
+ *
+ * A timer is a ktimer_t, which whoever wants it provides (no allocation
+ * here). Set it up once with ktimer_init, then arm it with ktimer_mod (which
+ * also moves it, if it's already armed) and disarm it with ktimer_del. When
+ * it expires, it's disarmed and its function is called from the timer
+ * softirq, with interrupts enabled. It may rearm itself from there.
+ *
+ * Expiry times are absolute, in ticks (see timer_get_ticks).
+ *
+ * The timers are kept in a hierarchical timing wheel, so that arming and
+ * disarming them is O(1) however many there are. The wheel has five levels:
+ *
+ *  -> tv1 has 256 slots, one per tick, for the timers that expire in the next
+ *     256 ticks. Every tick, the timers in its slot are run.
+ *  -> tv2 has 64 slots, of 256 ticks each, for the next 2^14 ticks. Every
+ *     time tv1 goes around, the next slot of tv2 is "cascaded": its timers
+ *     are spread over tv1, where they now fit.
+ *  -> tv3, tv4 and tv5 do the same, for the next 2^20, 2^26 and 2^32 ticks.
+ *     Timers further out than that sit at the very end of tv5 and get
+ *     cascaded around until they fit.
+ *
+ * A timer is cascaded at most once per level, so that's amortized O(1) too.
+ *
+ * The wheel is shared by every CPU, and a spinlock keeps them out of each
+ * other's way: timers can be armed and disarmed from any of them.
+ */
+
+typedef struct ktimer {
+    list_node_t entry;
+    uint64_t expires;                  /* In ticks */
+    void ( *func ) ( uint32_t data );
+    uint32_t data;
+} ktimer_t;
+
+#define KTIMER_TVR_BITS  8
+#define KTIMER_TVN_BITS  6
+#define KTIMER_TVR_SIZE  ( 1 << KTIMER_TVR_BITS )
+#define KTIMER_TVN_SIZE  ( 1 << KTIMER_TVN_BITS )
+#define KTIMER_TVR_MASK  ( KTIMER_TVR_SIZE - 1 )
+#define KTIMER_TVN_MASK  ( KTIMER_TVN_SIZE - 1 )
+#define KTIMER_TVN_LEVELS 4 /* tv2 to tv5 */
+
+/* For statically declared timers */
+#define KTIMER_INIT(func, data) { { NULL, NULL }, 0, func, data }
+
+void init_ktimers ( uint64_t now );
+
+void ktimer_init ( ktimer_t* t, void ( *func ) ( uint32_t ), uint32_t data );
+
+/* Arm t to expire at expires. If it was armed already, it's moved. Returns
+ * whether it was armed */
+bool ktimer_mod ( ktimer_t* t, uint64_t expires );
+
+/* Same as ktimer_mod, for when t is known not to be armed */
+void ktimer_add ( ktimer_t* t );
+
+/* Disarm t. Returns whether it was armed */
+bool ktimer_del ( ktimer_t* t );
+
+bool ktimer_pending ( const ktimer_t* t );
+
+/* Run every timer that has expired by tick now. Called by the timer softirq */
+void ktimer_run ( uint64_t now );
+
+/* The earliest tick at which ktimer_run may have something to do. It may be
+ * early (a cascade, not a timer), but never late */
+uint64_t ktimer_next_expiry ( void );
+
+#endif
@@ -0,0 +1,128 @@
+#include <lapic_timer.h>
+#include <apic.h>
+#include <clocksource.h>
+#include <internal_timer.h>
+#include <idt.h>
+#include <screen.h>
+#include <x86/x86.h>
+
+extern void irq24 ();
+
+PRIVATE void lapic_timer_set_periodic ( uint32_t frequency_hz );
+PRIVATE void lapic_timer_set_oneshot ( uint32_t ticks );
+PRIVATE void lapic_timer_stop ( void );
+
+PRIVATE clock_event_t lapic_clock_event = {
+    "lapic",
+    &lapic_timer_set_periodic,
+    &lapic_timer_set_oneshot,
+    &lapic_timer_stop,
+    0, /* Set by init_lapic_timer */
+    LAPIC_TIMER_VECTOR,
+    true
+};
+
+PRIVATE uint32_t lapic_hz = 0;
+
+/* How far the counter, or the TSC in deadline mode, goes in one tick */
+PRIVATE uint32_t counts_per_tick = 0;
+PRIVATE uint32_t tsc_per_tick = 0;
+PRIVATE bool use_deadline = false;
+
+PRIVATE void lapic_timer_set_periodic ( uint32_t frequency_hz )
+{
+    /* The divider too, for the other CPUs' first time. Then the LVT: writing
+     * the initial count is what starts it */
+    lapic_write ( LAPIC_TIMER_DIVIDE, LAPIC_TIMER_DIVIDE_BY_16 );
+    lapic_write ( LAPIC_LVT_TIMER, LAPIC_TIMER_VECTOR | LAPIC_TIMER_PERIODIC );
+    lapic_write ( LAPIC_TIMER_INITIAL, lapic_hz / frequency_hz );
+}
+
+PRIVATE void lapic_timer_set_oneshot ( uint32_t ticks )
+{
+    if ( use_deadline ) {
+        lapic_write ( LAPIC_LVT_TIMER, LAPIC_TIMER_VECTOR | LAPIC_TIMER_TSC_DEADLINE );
+        /* The LVT write has to land before the WRMSR, or the deadline may
+         * be taken in the old mode */
+        __asm volatile ( "mfence" : : : "memory" );
+        wrmsr ( MSR_IA32_TSC_DEADLINE, rdtsc () + ( uint64_t ) ticks * tsc_per_tick );
+    } else {
+        lapic_write ( LAPIC_LVT_TIMER, LAPIC_TIMER_VECTOR | LAPIC_TIMER_ONESHOT );
+        lapic_write ( LAPIC_TIMER_INITIAL, ticks * counts_per_tick );
+    }
+}
+
+PRIVATE void lapic_timer_stop ( void )
+{
+    lapic_write ( LAPIC_LVT_TIMER, LAPIC_TIMER_VECTOR | LAPIC_LVT_MASKED );
+    lapic_write ( LAPIC_TIMER_INITIAL, 0 );
+}
+
+/* Count down from the top for CALIBRATE_MS, timed by the PIT. Returns the
+ * counter's rate, or 0 if it didn't work out */
+PRIVATE uint32_t lapic_timer_calibrate ( void )
+{
+    uint32_t flags, elapsed;
+    bool ok;
+
+    lapic_write ( LAPIC_TIMER_DIVIDE, LAPIC_TIMER_DIVIDE_BY_16 );
+    lapic_write ( LAPIC_LVT_TIMER, LAPIC_TIMER_VECTOR | LAPIC_LVT_MASKED );
+
+    flags = irq_save ();
+    lapic_write ( LAPIC_TIMER_INITIAL, 0xFFFFFFFF );
+    ok = pit_busy_wait ( CALIBRATE_MS );
+    elapsed = 0xFFFFFFFF - lapic_read ( LAPIC_TIMER_CURRENT );
+    irq_restore ( flags );
+
+    lapic_write ( LAPIC_TIMER_INITIAL, 0 );
+
+    /* Even a 4 GHz bus divided by 16 only gets to 12.5 million in 50ms, so
+     * this doesn't overflow */
+    if ( !ok || !elapsed )
+        return 0;
+    return elapsed * ( 1000 / CALIBRATE_MS );
+}
+
+bool init_lapic_timer ( void )
+{
+    uint32_t ecx, frequency;
+
+    if ( !apic_enabled () )
+        return false;
+
+    lapic_hz = lapic_timer_calibrate ();
+    frequency = timer_get_frequency ();
+    if ( lapic_hz < frequency )
+        return false;
+
+    counts_per_tick = lapic_hz / frequency;
+    lapic_clock_event.max_oneshot_ticks = 0xFFFFFFFF / counts_per_tick;
+
+    /* The deadline is in TSC cycles, so we need to know how fast it goes,
+     * and for it not to change underneath us */
+    cpuid ( 1, NULL, NULL, &ecx, NULL );
+    if ( ( ecx & CPUID_FEAT_ECX_TSC_DEADLINE ) && tsc_get_hz () &&
+         clocksource_is_continuous () ) {
+        use_deadline = true;
+        tsc_per_tick = tsc_get_hz () / frequency;
+        lapic_clock_event.max_oneshot_ticks = 0xFFFFFFFF;
+    }
+
+    idt_set_gate ( LAPIC_TIMER_VECTOR, ( uint32_t ) irq24, IDT_SELECTOR,
+                   IDT_32BIT_INTERRUPT_GATE );
+
+    screen_puts ( "LAPIC timer: " );
+    screen_put_int ( lapic_hz / 1000 );
+    screen_puts ( " kHz" );
+    if ( use_deadline )
+        screen_puts ( ", TSC-deadline one-shots" );
+    screen_putc ( '\n' );
+
+    timer_set_clock_event ( &lapic_clock_event );
+    return true;
+}
+
+uint32_t lapic_timer_get_hz ( void )
+{
+    return lapic_hz;
+}
@@ -0,0 +1,48 @@
+#ifndef LAPIC_TIMER_H
+#define LAPIC_TIMER_H
+#include <stdinc.h>
+/*
+ * Every CPU's LAPIC has a timer of its own, which makes it a better tick
+ * source than the PIT: each core gets its interrupts locally, instead of
+ * all of them hanging off IRQ0 on whichever CPU the I/O APIC picked.
+ *
+ * It counts down from an initial count at the bus (or core crystal) clock,
+ * divided by a power of two, and raises the vector in its LVT entry when it
+ * gets to 0. It can do so once (one-shot) or reload and go again (periodic).
+ * Nothing tells us how fast the bus clock is, so init_lapic_timer() measures
+ * it against PIT channel 2, like init_clocksource() does for the TSC.
+ *
+ * Newer CPUs also have a TSC-deadline mode, where instead of a count we write
+ * the TSC value to fire at to IA32_TSC_DEADLINE. That's what we use for
+ * one-shots when we can, since it needs no conversion and doesn't run out
+ * after 32 bits of bus clock. It can't do periodic, so the regular tick still
+ * uses the counter.
+ *
+ * The timer is one of the clock_event_t devices internal_timer.c can tick
+ * with, and it takes over from the PIT as soon as it's calibrated.
+ */
+
+/* The LVT timer entry's mode, in bits 17-18 */
+#define LAPIC_TIMER_ONESHOT       0x00000
+#define LAPIC_TIMER_PERIODIC      0x20000
+#define LAPIC_TIMER_TSC_DEADLINE  0x40000
+
+/* What goes in the divide configuration register (bits 0, 1 and 3) */
+#define LAPIC_TIMER_DIVIDE_BY_16  0x3
+#define LAPIC_TIMER_DIVISOR       16
+
+#define CPUID_FEAT_ECX_TSC_DEADLINE ( 1 << 24 )
+#define MSR_IA32_TSC_DEADLINE     0x6E0
+
+/* Right after the APIC's IRQs */
+#define LAPIC_TIMER_VECTOR        56
+
+/* Calibrate the BSP's LAPIC timer and tick with it from now on. Must be
+ * called after init_apic and init_clocksource. Returns false if there's no
+ * APIC, or the timer didn't seem to count */
+bool init_lapic_timer ( void );
+
+/* The timer's input clock (after the divider), in Hz */
+uint32_t lapic_timer_get_hz ( void );
+
+#endif
@@ -0,0 +1,55 @@
+#include <list.h>
+
+void list_init ( list_node_t* head )
+{
+    head->next = head;
+    head->prev = head;
+}
+
+bool list_empty ( const list_node_t* head )
+{
+    return head->next == head;
+}
+
+PRIVATE void list_insert ( list_node_t* prev, list_node_t* next, list_node_t* node )
+{
+    node->prev = prev;
+    node->next = next;
+    prev->next = node;
+    next->prev = node;
+}
+
+void list_add_head ( list_node_t* head, list_node_t* node )
+{
+    list_insert ( head, head->next, node );
+}
+
+void list_add_tail ( list_node_t* head, list_node_t* node )
+{
+    list_insert ( head->prev, head, node );
+}
+
+void list_del ( list_node_t* node )
+{
+    node->prev->next = node->next;
+    node->next->prev = node->prev;
+    node->next = NULL;
+    node->prev = NULL;
+}
+
+bool list_linked ( const list_node_t* node )
+{
+    return node->next != NULL;
+}
+
+void list_splice_tail ( list_node_t* to, list_node_t* from )
+{
+    if ( list_empty ( from ) )
+        return;
+
+    from->next->prev = to->prev;
+    to->prev->next = from->next;
+    from->prev->next = to;
+    to->prev = from->prev;
+    list_init ( from );
+}
@@ -0,0 +1,50 @@
+#ifndef LIST_H
+#define LIST_H
+#include <stdinc.h>
+/*
+ * Intrusive doubly-linked lists.
+ *
+ * Instead of the list holding pointers to things, the things hold a
+ * list_node_t, and the list links those together. That way, adding or
+ * removing something never allocates memory, and something can be removed
+ * in O(1) knowing nothing but itself.
+ *
+ * A list is a list_node_t too, the head, which is linked in a circle with the
+ * nodes. An empty list is a head that points at itself. To get back from a
+ * node to whatever holds it, use LIST_ENTRY:
+ *
+ *   typedef struct { int x; list_node_t node; } thing_t;
+ *   thing_t* t = LIST_ENTRY ( head.next, thing_t, node );
+ */
+
+typedef struct list_node {
+    struct list_node* next;
+    struct list_node* prev;
+} list_node_t;
+
+/* We don't have stddef.h */
+#define OFFSET_OF(type, member) ( ( uint32_t ) &( ( type* ) 0 )->member )
+
+#define LIST_ENTRY(ptr, type, member) \
+    ( ( type* ) ( ( uint8_t* ) ( ptr ) - OFFSET_OF ( type, member ) ) )
+
+/* Make head an empty list */
+void list_init ( list_node_t* head );
+
+bool list_empty ( const list_node_t* head );
+
+void list_add_head ( list_node_t* head, list_node_t* node );
+void list_add_tail ( list_node_t* head, list_node_t* node );
+
+/* Remove node from whatever list it's in. Its pointers are set to NULL, so
+ * list_linked() can tell that it's not in a list anymore */
+void list_del ( list_node_t* node );
+
+/* Whether node is in a list. Only for nodes that start out zeroed (or
+ * removed with list_del) */
+bool list_linked ( const list_node_t* node );
+
+/* Move all nodes of from to the end of to, leaving from empty */
+void list_splice_tail ( list_node_t* to, list_node_t* from );
+
+#endif
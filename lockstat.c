@@ -0,0 +1,174 @@
+#include <lockstat.h>
+#include <keyboard.h>
+#include <clocksource.h>
+#include <elf.h>
+#include <screen.h>
+#include <x86/x86.h>
+
+/* How many locks the report sorts. The rest are left out */
+#define LOCKSTAT_REPORT_MAX 64
+
+PRIVATE lock_stat_t* volatile stats = NULL;
+
+PRIVATE uint32_t cycles_since ( uint64_t start, uint64_t now )
+{
+    uint64_t delta = now - start;
+
+    return ( delta >> 32 ) ? 0xFFFFFFFF : ( uint32_t ) delta;
+}
+
+/* Add s to the list, the first time its lock is taken. Locks are taken from
+ * anywhere, so the list can't have a lock of its own */
+PRIVATE void lockstat_register ( lock_stat_t* s, uint32_t site )
+{
+    lock_stat_t* head;
+
+    if ( s->registered || atomic_xchg ( &s->registered, true ) )
+        return;
+
+    s->site = site;
+    do {
+        head = stats;
+        s->next = head;
+    } while ( atomic_cmpxchg ( ( volatile uint32_t* ) &stats, ( uint32_t ) head,
+                               ( uint32_t ) s ) != ( uint32_t ) head );
+}
+
+void lockstat_acquired ( lock_stat_t* s, uint64_t start, bool contended, uint32_t site )
+{
+    uint64_t now = rdtsc ();
+    uint32_t wait = cycles_since ( start, now );
+
+    lockstat_register ( s, site );
+
+    s->acquired++;
+    if ( contended )
+        s->contended++;
+    s->wait_total += wait;
+    if ( wait > s->wait_max ) {
+        s->wait_max = wait;
+        s->wait_max_site = site;
+    }
+    s->hold_start = now;
+}
+
+void lockstat_released ( lock_stat_t* s )
+{
+    uint32_t hold = cycles_since ( s->hold_start, rdtsc () );
+
+    s->hold_total += hold;
+    if ( hold > s->hold_max )
+        s->hold_max = hold;
+}
+
+void lockstat_read_acquired ( lock_stat_t* s, bool contended, uint32_t site )
+{
+    lockstat_register ( s, site );
+
+    /* Other readers may be doing the same */
+    atomic_inc ( &s->acquired );
+    if ( contended )
+        atomic_inc ( &s->contended );
+}
+
+/* Print n right-aligned in width columns */
+PRIVATE void put_padded ( uint32_t n, uint32_t width )
+{
+    uint32_t digits, m;
+
+    for ( digits = 1, m = n; m >= 10; m /= 10 )
+        digits++;
+    for ( ; digits < width; digits++ )
+        screen_putc ( ' ' );
+
+    if ( n > 0x7FFFFFFF ) {
+        screen_put_int ( n / 10 );
+        screen_putc ( '0' + n % 10 );
+    } else
+        screen_put_int ( n );
+}
+
+PRIVATE void put_site ( uint32_t site )
+{
+    const char* name;
+
+    name = site ? kernel_elf_lookup_symbol_function ( site ) : NULL;
+    screen_putc ( ' ' );
+    if ( name )
+        screen_puts ( name );
+    else
+        screen_put_hex ( site );
+}
+
+PRIVATE uint32_t avg ( uint64_t total, uint32_t n )
+{
+    return n ? ( uint32_t ) div_u64_rem ( total, n, NULL ) : 0;
+}
+
+void lockstat_report ( void )
+{
+    lock_stat_t* sorted[LOCKSTAT_REPORT_MAX];
+    lock_stat_t* s;
+    const char* name;
+    uint32_t n = 0, i, j;
+
+    /* Worst total wait first */
+    for ( s = stats; s && n < LOCKSTAT_REPORT_MAX; s = s->next ) {
+        for ( i = n; i > 0 && sorted[i - 1]->wait_total < s->wait_total; i-- )
+            sorted[i] = sorted[i - 1];
+        sorted[i] = s;
+        n++;
+    }
+
+    screen_puts ( "Locks (TSC cycles, " );
+    screen_put_int ( tsc_get_hz () / 1000000 );
+    screen_puts ( " per us)\n" );
+    screen_puts ( "name            acquired contended wait avg wait max hold avg hold max\n" );
+
+    for ( j = 0; j < n; j++ ) {
+        s = sorted[j];
+        name = s->name ? s->name : "?";
+        screen_puts ( name );
+        for ( i = 0; name[i]; i++ )
+            ;
+        for ( ; i < 12; i++ )
+            screen_putc ( ' ' );
+        put_padded ( s->acquired, 12 );
+        put_padded ( s->contended, 10 );
+        put_padded ( avg ( s->wait_total, s->acquired ), 9 );
+        put_padded ( s->wait_max, 9 );
+        put_padded ( avg ( s->hold_total, s->acquired ), 9 );
+        put_padded ( s->hold_max, 9 );
+        screen_puts ( "\n   first taken in" );
+        put_site ( s->site );
+        if ( s->wait_max_site ) {
+            screen_puts ( ", longest wait in" );
+            put_site ( s->wait_max_site );
+        }
+        screen_putc ( '\n' );
+    }
+}
+
+void lockstat_reset ( void )
+{
+    lock_stat_t* s;
+
+    /* Whoever holds a lock right now still has its hold_start */
+    for ( s = stats; s; s = s->next ) {
+        s->acquired = s->contended = 0;
+        s->wait_total = s->hold_total = 0;
+        s->wait_max = s->hold_max = 0;
+        s->wait_max_site = 0;
+    }
+}
+
+PRIVATE void report_key ( const key_event_t* ev )
+{
+    if ( ev->vk == VK_SCROLLLOCK && IS_KEY_DOWN ( ev->state ) )
+        lockstat_report ();
+}
+
+void init_lockstat ( void )
+{
+    keyboard_register_callback ( &report_key );
+}
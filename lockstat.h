@@ -0,0 +1,68 @@
+#ifndef LOCKSTAT_H
+#define LOCKSTAT_H
+#include <stdinc.h>
+/*
+ * Lock statistics, for finding the locks CPUs fight over.
+ *
+ * Only built with -DLOCKSTAT (see makefile.real), since it takes two TSC
+ * reads and some bookkeeping on every lock and unlock. Each lock then has a
+ * lock_stat_t (see spinlock.h), which is added to a list the first time the
+ * lock is taken, and records:
+ *   - how many times it was taken, and how many of those it was already held
+ *     (contended)
+ *   - how long we waited for it, in TSC cycles: in total, and the worst wait,
+ *     with where that lock call was
+ *   - how long it was held: in total, and the longest
+ *   - where it was first taken from
+ *
+ * Call sites are return addresses, looked up in the kernel's ELF symbols to
+ * get the function they're in (see elf.h).
+ *
+ * lockstat_report() prints it all, worst total wait first. Scroll Lock calls
+ * it (see init_lockstat).
+ *
+ * The reader side of a reader-writer lock only counts acquisitions and
+ * contention: readers hold it together, and the other fields belong to
+ * whoever holds the lock alone.
+ */
+
+#ifdef LOCKSTAT
+
+typedef struct lock_stat {
+    struct lock_stat* next;     /* In the list of locks taken so far */
+    const char* name;
+    volatile uint32_t registered;
+    uint32_t site;              /* Where it was first taken from */
+    uint32_t acquired;
+    uint32_t contended;
+    uint64_t wait_total;        /* All in TSC cycles */
+    uint32_t wait_max;
+    uint32_t wait_max_site;
+    uint64_t hold_total;
+    uint32_t hold_max;
+    uint64_t hold_start;        /* When the current holder got it */
+} lock_stat_t;
+
+#define LOCK_STAT_INIT(name) { NULL, name, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0 }
+
+/* Called once a lock is taken, by whoever took it. start is when they
+ * started trying, site where from */
+void lockstat_acquired ( lock_stat_t* s, uint64_t start, bool contended, uint32_t site );
+
+/* Called right before the holder lets go */
+void lockstat_released ( lock_stat_t* s );
+
+/* A reader got a reader-writer lock */
+void lockstat_read_acquired ( lock_stat_t* s, bool contended, uint32_t site );
+
+/* Set up the report key. Must be called after init_keyboard */
+void init_lockstat ( void );
+
+void lockstat_report ( void );
+
+/* Forget everything recorded so far */
+void lockstat_reset ( void );
+
+#endif
+
+#endif
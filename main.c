@@ -2,14 +2,33 @@
 #include <screen.h>
 #include <gdt.h>
 #include <idt.h>
+#include <fpu.h>
+#include <syscall.h>
 #include <irq.h>
+#include <softirq.h>
+#include <rcu.h>
 #include <internal_timer.h>
+#include <clocksource.h>
+#include <vdso.h>
 #include <multiboot.h>
 #include <kpanic.h>
 #include <elf.h>
 #include <keyboard.h>
 #include <mem/pmm.h>
 #include <mem/vmm.h>
+#include <fbcon.h>
+#include <apic.h>
+#include <lapic_timer.h>
+#include <smp.h>
+#include <irqstat.h>
+#include <idle.h>
+#include <sched.h>
+#ifdef RUN_BENCHMARKS
+#include <bench/bench.h>
+#endif
+#ifdef LOCKSTAT
+#include <lockstat.h>
+#endif
 
 /*
  * Kernel entry point
@@ -18,7 +37,7 @@ int CDECL kernel_main ( multiboot_t* mboot_ptr )
 {
     /*build_elf_symbols_from_multiboot(mboot_ptr); -- we'll get this working again later.. */
     uint32_t* ptr;
-    UNUSED ( mboot_ptr );
+    fbcon_probe ( mboot_ptr );
     screen_clear();
     screen_puts ( "Hello World!\n" );
 
@@ -35,7 +54,12 @@ int CDECL kernel_main ( multiboot_t* mboot_ptr )
     init_idt();
     screen_puts ( "IDT Loaded.\n" );
 
+    init_fpu();
+    init_syscalls();
+
     init_irq();
+    init_softirq();
+    init_rcu();
 
     screen_puts ( "IRQ Started!\n" );
 
@@ -43,7 +67,14 @@ int CDECL kernel_main ( multiboot_t* mboot_ptr )
 
     screen_puts ( "Timer Started!\n" );
 
+    init_clocksource();
+
     init_keyboard();
+    init_irqstat();
+    init_idle();
+#ifdef LOCKSTAT
+    init_lockstat();
+#endif
    
     screen_put_hex ( ( uint32_t ) &kernel_main );
     screen_putc ( '\n' );
@@ -60,6 +91,15 @@ int CDECL kernel_main ( multiboot_t* mboot_ptr )
     screen_puts ( "\nOkay, PMM enabled!\n" );
     init_vmm();
     screen_puts ( "\nOkay, VMM enabled!\n" );
+    init_vdso();
+    init_fbcon();
+    init_sched();
+
+    if ( !init_apic() )
+        screen_puts ( "No APIC, staying with the PIC\n" );
+    else if ( !init_lapic_timer() )
+        screen_puts ( "No LAPIC timer, staying with the PIT\n" );
+    init_smp();
 
     screen_put_hex ( ( uint32_t ) &kernel_main );
     screen_putc ( '\n' );
@@ -74,6 +114,14 @@ int CDECL kernel_main ( multiboot_t* mboot_ptr )
     screen_puts ( "\n" );
 
     __asm ( "sti" );
-    for ( ;; ); /* NOTE: Never return from kernel, We'll segfault */
+
+#ifdef RUN_BENCHMARKS
+    run_benchmarks();
+#endif
+
+    for ( ;; ) { /* NOTE: Never return from kernel, We'll segfault */
+        keyboard_wait_event();
+        keyboard_dispatch_events();
+    }
     return 0xDEADBABA; /* Should be in $eax right now */
 }
@@ -12,3 +12,13 @@ void memset(void* dst, uint8_t val, uint32_t len)
         uint8_t* dst_ = (uint8_t*)dst;
         while (len--) *dst_++ = val;
 }
+int memcmp(const void* a, const void* b, uint32_t len)
+{
+        const uint8_t* a_ = (const uint8_t*)a;
+        const uint8_t* b_ = (const uint8_t*)b;
+
+        for ( ; len--; a_++, b_++ )
+                if ( *a_ != *b_ )
+                        return *a_ - *b_;
+        return 0;
+}
@@ -3,4 +3,5 @@
 #include <stdinc.h>
 void memcpy(void* dst, const void* src, uint32_t len);
 void memset(void* dst, uint8_t val, uint32_t len);
+int memcmp(const void* a, const void* b, uint32_t len);
 #endif
@@ -1,5 +1,6 @@
 #include "pmm.h"
 #include <kpanic.h>
+#include <spinlock.h>
 #include "vmm.h" /* The PMM uses the VMM after paging has been enabled */
 
 /* FIXME: Right now, the PMM's functionality when paging has been enabled
@@ -15,6 +16,10 @@ PRIVATE uint32_t pmm_stack_max = PMM_STACK_ADDR;
 
 PRIVATE bool pmm_paging_active = false;
 
+/* Every CPU allocates pages, so this is the lock most likely to be fought
+ * over: an MCS lock, where waiters don't all hammer the same cache line */
+PRIVATE mcs_lock_t pmm_lock = MCS_LOCK_INIT ( "pmm" );
+
 
 void init_pmm ( uint32_t start )
 {
@@ -29,13 +34,28 @@ uint32_t pmm_get_start_location ( void )
     return pmm_start_location;
 }
 
-uint32_t pmm_alloc_block ( void )
+/* Both need pmm_lock held */
+PRIVATE uint32_t alloc_blocks ( uint32_t n )
+{
+    /* Remember that pmm_curr_location is the last block handed out, so the
+     * new blocks start one block after it. */
+    if ( pmm_paging_active &&
+         pmm_curr_location + ( n + 1 ) * BLOCK_SIZE > pmm_start_location + PMM_IDENTITY_MAPPED_SIZE )
+        kpanic ( " Error:out of memory for larger allocation." );
+
+    /* Return the first block of the group, not the last one */
+    pmm_curr_location += ( n * BLOCK_SIZE );
+    return pmm_curr_location - ( n - 1 ) * BLOCK_SIZE;
+}
+
+PRIVATE uint32_t alloc_block ( void )
 {
     if ( pmm_paging_active ) {
         uint32_t* stack;
-        /* Quick sanity check. */
+        /* Nothing has been returned to us yet, so keep carving fresh blocks
+         * out of the identity-mapped window. */
         if ( pmm_stack_loc == PMM_STACK_ADDR )
-            kpanic ( "Error:out of memory." );
+            return alloc_blocks ( 1 );
 
         /* Pop a page off of the stack */
         pmm_stack_loc -= sizeof ( uint32_t );
@@ -46,25 +66,48 @@ uint32_t pmm_alloc_block ( void )
         return pmm_curr_location += BLOCK_SIZE;
 }
 
+uint32_t pmm_alloc_block ( void )
+{
+    mcs_node_t node;
+    uint32_t flags, b;
+
+    flags = mcs_lock_irqsave ( &pmm_lock, &node );
+    b = alloc_block ();
+    mcs_unlock_irqrestore ( &pmm_lock, &node, flags );
+    return b;
+}
+
 uint32_t pmm_alloc_blocks ( uint32_t n )
 {
-    if ( pmm_paging_active )
-        kpanic ( " Error:out of memory for larger allocation." );
+    mcs_node_t node;
+    uint32_t flags, b;
 
-    return pmm_curr_location += ( n * BLOCK_SIZE );
+    flags = mcs_lock_irqsave ( &pmm_lock, &node );
+    b = alloc_blocks ( n );
+    mcs_unlock_irqrestore ( &pmm_lock, &node, flags );
+    return b;
 }
 
 void pmm_free_block ( uint32_t b )
 {
+    mcs_node_t node;
+    uint32_t flags;
+
     /* We can't free anything below pmm_curr_location, because
      * those were used by the VMM before it took control. If we
      * free it, we might break page directories and page entries.
      * In summary: these pages probably contain essential data
      * to the VMMs functioning */
-    if ( b < pmm_curr_location ) return;
+    flags = mcs_lock_irqsave ( &pmm_lock, &node );
+    if ( b < pmm_curr_location ) {
+        mcs_unlock_irqrestore ( &pmm_lock, &node, flags );
+        return;
+    }
 
     /* If the stack is at its limit, we wil use the new page
-     * to enlarge the stack itself */
+     * to enlarge the stack itself. b is in the identity-mapped window,
+     * whose page table exists already, so vmm_map_page won't come back to
+     * us for one (which would deadlock) */
     if ( pmm_stack_max <= pmm_stack_loc ) {
         vmm_map_page(pmm_stack_max,b);
         /*map ( pmm_stack_max, p, PAGE_PRESENT | PAGE_WRITE );*/
@@ -76,6 +119,8 @@ void pmm_free_block ( uint32_t b )
         *stack = b;
         pmm_stack_loc += sizeof ( uint32_t );
     }
+
+    mcs_unlock_irqrestore ( &pmm_lock, &node, flags );
 }
 
 void pmm_notify_paging_enabled ( void )
@@ -23,6 +23,12 @@
 #define BLOCK_MASK PAGE_MASK
 #endif
 
+/* How much of the PMM's area, starting at its start location, the VMM
+ * identity-maps for us (see init_vmm). Blocks handed out after paging has
+ * been enabled must live inside this window, since the VMM uses their
+ * addresses as both physical and virtual ones. */
+#define PMM_IDENTITY_MAPPED_SIZE 0x400000
+
 /* Start the PMM at address start. It will grow up */
 void init_pmm ( uint32_t start );
 
@@ -30,8 +36,8 @@ void init_pmm ( uint32_t start );
 uint32_t pmm_alloc_block ( void );
 
 /* Get a group of free blocks/pages which are CONTIGUOUS
-   Note that currently you can only get a contiguous block when the VMM
-   hasn't taken over yet ('paging disabled') */
+   Note that once the VMM has taken over ('paging enabled'), contiguous blocks
+   can only come from what is left of the identity-mapped window */
 uint32_t pmm_alloc_blocks ( uint32_t n );
 
 /* Frees a block/page, returning it to the PMM */
@@ -3,6 +3,7 @@
 #include <string.h>
 #include <kpanic.h>
 #include <screen.h>
+#include <x86.h>
 
 /*
  * HOW THE VMM IS SETUP ON jOS
@@ -28,6 +29,9 @@
 
 PRIVATE page_directory* vmm_current_directory;
 
+/* Next free virtual address in the MMIO window */
+PRIVATE uint32_t vmm_mmio_next = VMM_MMIO_WINDOW_START;
+
 void page_table_entry_add_attrib ( page_table_entry* e, uint32_t attrib )
 {
     *e |= attrib;
@@ -209,6 +213,64 @@ void vmm_map_page ( uint32_t phys, uint32_t virt )
     page_directory_entry_set_pte_address ( page, phys );
 }
 
+void vmm_map_page_flags ( uint32_t phys, uint32_t virt, uint32_t flags )
+{
+    page_directory_entry* e;
+    page_table_entry* page;
+
+    /* Let vmm_map_page create the page table if needed */
+    vmm_map_page ( phys, virt );
+
+    e = vmm_page_directory_lookup_entry ( vmm_get_current_directory (), virt );
+    if ( flags & PTE_PAGE_USER )
+        page_directory_entry_add_attrib ( e, PDE_PAGE_USER );
+
+    page = vmm_page_table_lookup_entry ( ( page_table* ) PAGETABLE_GET_ADDRESS ( *e ), virt );
+    *page = ( phys & PTE_PAGE_FRAME ) | ( flags & ~PTE_PAGE_FRAME ) | PTE_PAGE_PRESENT;
+
+    /* The page might have been mapped before, with other attributes */
+    vmm_flush_tlb_entry ( virt );
+}
+
+uint32_t vmm_map_physical ( uint32_t phys, uint32_t size, uint32_t flags )
+{
+    uint32_t offset = phys & ~PAGE_MASK;
+    uint32_t start = vmm_mmio_next;
+    uint32_t virt;
+
+    /* Round the range out to whole pages */
+    phys &= PAGE_MASK;
+    size = ( size + offset + PAGE_SIZE - 1 ) & PAGE_MASK;
+
+    if ( size > VMM_MMIO_WINDOW_END - vmm_mmio_next )
+        return 0;
+
+    for ( virt = start; virt < start + size; virt += PAGE_SIZE, phys += PAGE_SIZE )
+        vmm_map_page_flags ( phys, virt, flags );
+
+    vmm_mmio_next += size;
+    return start + offset;
+}
+
+bool vmm_init_write_combining ( void )
+{
+    uint32_t edx;
+    uint64_t pat;
+
+    cpuid ( 1, NULL, NULL, NULL, &edx );
+    if ( ! ( edx & CPUID_FEAT_EDX_PAT ) )
+        return false;
+
+    /* Entry 1 (selected by PWT alone) goes from WT to WC. Nothing is mapped
+     * with PWT set before this runs, so there are no stale mappings to flush. */
+    pat = rdmsr ( MSR_IA32_PAT );
+    pat &= ~ ( ( uint64_t ) 0xFF << 8 );
+    pat |= ( uint64_t ) PAT_WC << 8;
+    wrmsr ( MSR_IA32_PAT, pat );
+
+    return true;
+}
+
 /* Used initially mainly for debugging, returns the physical address from a
  * virtual address, given the current page directory
  * Since it was built during a debugging phase, it deviates a bit from
@@ -261,7 +323,7 @@ void init_vmm ()
         vmm_map_page ( frame, virt );
 
     /* Identity map the PMM for 4MB */
-    for ( frame = pmm_get_start_location(), virt = pmm_get_start_location() ; virt < pmm_get_start_location() + 0x400000; virt += 4096, frame += 4096 )
+    for ( frame = pmm_get_start_location(), virt = pmm_get_start_location() ; virt < pmm_get_start_location() + PMM_IDENTITY_MAPPED_SIZE; virt += 4096, frame += 4096 )
         vmm_map_page ( frame, virt );
 
     vmm_switch_page_directory ( vmm_current_directory );
@@ -302,6 +302,7 @@
 #define PTE_PAGE_NOT_CACHEABLE 0x10       /* 00000000000000000000000000010000 */
 #define PTE_PAGE_ACCESSED      0x20       /* 00000000000000000000000000100000 */
 #define PTE_PAGE_DIRTY         0x40       /* 00000000000000000000000001000000 */
+#define PTE_PAGE_PAT           0x80       /* 00000000000000000000000010000000 */
 #define PTE_PAGE_RESERVED      0x180      /* 00000000000000000000000110000000 */
 #define PTE_PAGE_AVAIL         0xE00      /* 00000000000000000000111000000000 */
 #define PTE_PAGE_FRAME         0xFFFFF000 /* 11111111111111111111000000000000 */
@@ -320,6 +321,25 @@
 #define PDE_PAGE_AVAIL         0xE00      /* 00000000000000000000111000000000 */
 #define PDE_PAGE_FRAME         0xFFFFF000 /* 11111111111111111111000000000000 */
 
+/* The PWT, PCD and PAT bits of a PTE don't pick a caching mode directly. They
+ * form a 3-bit index (PAT:PCD:PWT) into the Page Attribute Table, an MSR with
+ * 8 memory types. Out of reset it holds WB, WT, UC-, UC twice over, so a plain
+ * PTE is write-back and PTE_PAGE_WRITETHROUGH is write-through.
+ *
+ * vmm_init_write_combining() turns entry 1 (PWT only) into Write-Combining,
+ * which is what we want for framebuffers: stores are buffered and sent out
+ * as whole bursts instead of one uncached bus transaction per pixel. After
+ * that, PTE_PAGE_WRITECOMBINING selects it.
+ */
+#define PTE_PAGE_WRITECOMBINING PTE_PAGE_WRITETHROUGH
+
+/* The memory type encodings used by the PAT */
+#define PAT_UC   0x00
+#define PAT_WC   0x01
+#define PAT_WT   0x04
+#define PAT_WB   0x06
+#define PAT_UCM  0x07
+
 /* Typedefs for a PTE and a PDE. They're just 32-bit values */
 typedef uint32_t page_table_entry;
 typedef uint32_t page_directory_entry;
@@ -442,6 +462,35 @@ void vmm_flush_tlb_entry ( uint32_t addr );
  * complex process which can be transparently done with it. */
 void vmm_map_page ( uint32_t phys, uint32_t virt );
 
+/* Exactly like vmm_map_page, but the PTE gets the PTE_PAGE_* attributes in
+ * flags (PTE_PAGE_PRESENT is always added). If PTE_PAGE_USER is asked for,
+ * the PDE is marked user-accessible too, otherwise the PTE bit is useless. */
+void vmm_map_page_flags ( uint32_t phys, uint32_t virt, uint32_t flags );
+
+/* start.s maps the first 4MB of physical memory at 0xC0000000, and init_vmm
+ * keeps that mapping. Anything the bootloader leaves for us down there
+ * (multiboot info, VBE info...) can be reached through this. */
+#define KERNEL_VIRTUAL_BASE    0xC0000000
+#define KERNEL_LOW_MAPPED_SIZE 0x400000
+#define KERNEL_PHYS_TO_VIRT(x) ((x) + KERNEL_VIRTUAL_BASE)
+
+/* Physical ranges which aren't RAM handed out by the PMM (framebuffers,
+ * device registers, firmware tables...) are mapped into this window, from
+ * the bottom up. Nothing is ever unmapped from it. */
+#define VMM_MMIO_WINDOW_START 0xE0000000
+#define VMM_MMIO_WINDOW_END   0xF0000000
+
+/* Maps size bytes starting at the physical address phys into the MMIO window,
+ * with the given PTE_PAGE_* flags, and returns the virtual address which
+ * corresponds to phys. phys need not be page-aligned. Returns 0 if the window
+ * is exhausted. */
+uint32_t vmm_map_physical ( uint32_t phys, uint32_t size, uint32_t flags );
+
+/* Reprograms the PAT so that PTE_PAGE_WRITECOMBINING really means
+ * write-combining. Returns false (and changes nothing) if the CPU has no PAT,
+ * in which case PTE_PAGE_WRITECOMBINING degrades to write-through. */
+bool vmm_init_write_combining ( void );
+
 /* The all mighty function to initialize the VMM. See vmm.c to know
  * what the VMM does when it starts up */
 void init_vmm ();
@@ -0,0 +1,150 @@
+#include <mptable.h>
+#include <acpi.h>
+#include <mem.h>
+#include <mem/vmm.h>
+
+#define MP_MAX_BUSES 256
+
+PRIVATE bool mp_checksum_ok ( const void* p, uint32_t length )
+{
+    const uint8_t* b = ( const uint8_t* ) p;
+    uint8_t sum = 0;
+
+    while ( length-- )
+        sum += *b++;
+    return sum == 0;
+}
+
+PRIVATE const mp_float_t* mp_scan ( uint32_t start, uint32_t end )
+{
+    const mp_float_t* p;
+
+    for ( ; start < end; start += 16 ) {
+        p = ( const mp_float_t* ) KERNEL_PHYS_TO_VIRT ( start );
+        if ( !memcmp ( p->signature, MP_FLOAT_SIGNATURE, 4 ) &&
+             mp_checksum_ok ( p, p->length * 16 ) )
+            return p;
+    }
+    return NULL;
+}
+
+PRIVATE const mp_float_t* mp_find ( void )
+{
+    const mp_float_t* p = NULL;
+    uint32_t ebda;
+
+    ebda = *( const uint16_t* ) KERNEL_PHYS_TO_VIRT ( BDA_EBDA_SEGMENT ) << 4;
+    if ( ebda )
+        p = mp_scan ( ebda, ebda + 1024 );
+    if ( !p )
+        p = mp_scan ( BASE_MEMORY_LAST_KB, BASE_MEMORY_LAST_KB + 1024 );
+    if ( !p )
+        p = mp_scan ( BIOS_ROM_START, BIOS_ROM_END );
+    return p;
+}
+
+/* One CPU, one I/O APIC, everything where it's supposed to be */
+PRIVATE bool mp_default_config ( apic_config_t* config )
+{
+    config->lapic_address = MP_DEFAULT_LAPIC;
+    config->num_cpus = 1;
+    config->cpu_apic_ids[0] = 0;
+    config->num_ioapics = 1;
+    config->ioapics[0].address = MP_DEFAULT_IOAPIC;
+    config->ioapics[0].id = 0;
+    config->ioapics[0].gsi_base = 0;
+    return true;
+}
+
+bool mp_parse_tables ( apic_config_t* config )
+{
+    const mp_float_t* fp;
+    const mp_config_t* table;
+    const uint8_t* e;
+    const mp_processor_t* cpu;
+    const mp_bus_t* bus;
+    const mp_ioapic_t* ioapic;
+    const mp_io_int_t* io_int;
+    bool isa_bus[MP_MAX_BUSES];
+    uint32_t i, j;
+
+    fp = mp_find ();
+    if ( !fp )
+        return false;
+
+    config->has_imcr = ( fp->features & MP_FEATURE_IMCR ) != 0;
+    if ( fp->default_config )
+        return mp_default_config ( config );
+
+    if ( fp->config_address + sizeof ( mp_config_t ) <= KERNEL_LOW_MAPPED_SIZE )
+        table = ( const mp_config_t* ) KERNEL_PHYS_TO_VIRT ( fp->config_address );
+    else
+        table = ( const mp_config_t* ) vmm_map_physical ( fp->config_address,
+                                                          PAGE_SIZE, PTE_PAGE_WRITE );
+    if ( !table || memcmp ( table->signature, MP_CONFIG_SIGNATURE, 4 ) ||
+         !mp_checksum_ok ( table, table->length ) )
+        return false;
+
+    config->lapic_address = table->lapic_address;
+    memset ( isa_bus, 0, sizeof ( isa_bus ) );
+
+    /* The buses come before the interrupt assignments that use them */
+    e = ( const uint8_t* ) ( table + 1 );
+    for ( i = 0; i < table->entry_count; i++ ) {
+        switch ( *e ) {
+        case MP_ENTRY_PROCESSOR:
+            cpu = ( const mp_processor_t* ) e;
+            if ( ( cpu->flags & MP_PROCESSOR_ENABLED ) && config->num_cpus < MAX_CPUS ) {
+                /* Keep the BSP first, like the MADT does */
+                if ( cpu->flags & MP_PROCESSOR_BSP ) {
+                    for ( j = config->num_cpus; j > 0; j-- )
+                        config->cpu_apic_ids[j] = config->cpu_apic_ids[j - 1];
+                    config->cpu_apic_ids[0] = cpu->apic_id;
+                } else
+                    config->cpu_apic_ids[config->num_cpus] = cpu->apic_id;
+                config->num_cpus++;
+            }
+            e += sizeof ( mp_processor_t );
+            break;
+        case MP_ENTRY_BUS:
+            bus = ( const mp_bus_t* ) e;
+            isa_bus[bus->bus_id] = !memcmp ( bus->bus_type, "ISA", 3 );
+            e += sizeof ( mp_bus_t );
+            break;
+        case MP_ENTRY_IOAPIC:
+            ioapic = ( const mp_ioapic_t* ) e;
+            if ( ( ioapic->flags & MP_IOAPIC_ENABLED ) && config->num_ioapics < MAX_IOAPICS ) {
+                config->ioapics[config->num_ioapics].address = ioapic->address;
+                config->ioapics[config->num_ioapics].id = ioapic->id;
+                /* The MP tables don't number the pins machine-wide. Give each
+                 * I/O APIC 24, which is what they have */
+                config->ioapics[config->num_ioapics].gsi_base = config->num_ioapics * 24;
+                config->num_ioapics++;
+            }
+            e += sizeof ( mp_ioapic_t );
+            break;
+        case MP_ENTRY_IO_INT:
+            io_int = ( const mp_io_int_t* ) e;
+            if ( io_int->int_type == MP_INT_TYPE_INT && isa_bus[io_int->src_bus] &&
+                 io_int->src_irq < ISA_IRQS ) {
+                for ( j = 0; j < config->num_ioapics; j++ ) {
+                    if ( config->ioapics[j].id == io_int->dst_ioapic ||
+                         io_int->dst_ioapic == 0xFF ) {
+                        config->isa_gsi[io_int->src_irq] =
+                            config->ioapics[j].gsi_base + io_int->dst_pin;
+                        config->isa_flags[io_int->src_irq] = io_int->flags;
+                        break;
+                    }
+                }
+            }
+            e += 8;
+            break;
+        default:
+            /* Local interrupt assignments, and anything newer */
+            e += 8;
+            break;
+        }
+    }
+
+    return config->num_cpus > 0 && config->num_ioapics > 0;
+}
@@ -0,0 +1,108 @@
+#ifndef MPTABLE_H
+#define MPTABLE_H
+#include <stdinc.h>
+#include <apic.h>
+/*
+ * The Intel MultiProcessor Specification tables, which came before ACPI and
+ * which firmware (QEMU's included) still provides.
+ *
+ * The MP Floating Pointer Structure ("_MP_") is in the first KB of the EBDA,
+ * the last KB of base memory, or the BIOS ROM (0xF0000-0xFFFFF), on a 16 byte
+ * boundary. It points to the configuration table ("PCMP"), which is a header
+ * followed by entries, one per processor, bus, I/O APIC and interrupt
+ * assignment. Or, if the floating pointer has a default configuration number,
+ * there's no table at all and the machine is one of a few standard ones.
+ */
+
+#define MP_FLOAT_SIGNATURE   "_MP_"
+#define MP_CONFIG_SIGNATURE  "PCMP"
+
+#define BASE_MEMORY_LAST_KB  0x9FC00
+#define BIOS_ROM_START       0xF0000
+#define BIOS_ROM_END         0x100000
+
+/* Where the LAPIC and I/O APIC are in the default configurations */
+#define MP_DEFAULT_LAPIC     0xFEE00000
+#define MP_DEFAULT_IOAPIC    0xFEC00000
+
+typedef struct {
+    char     signature[4];
+    uint32_t config_address;
+    uint8_t  length;          /* In 16 byte units */
+    uint8_t  revision;
+    uint8_t  checksum;
+    uint8_t  default_config;  /* Feature byte 1: if not 0, there's no table */
+    uint8_t  features;        /* Feature byte 2 */
+    uint8_t  reserved[3];
+} __attribute__((packed)) mp_float_t;
+
+#define MP_FEATURE_IMCR      0x80
+
+typedef struct {
+    char     signature[4];
+    uint16_t length;
+    uint8_t  revision;
+    uint8_t  checksum;
+    char     oem_id[8];
+    char     product_id[12];
+    uint32_t oem_table;
+    uint16_t oem_table_size;
+    uint16_t entry_count;
+    uint32_t lapic_address;
+    uint16_t ext_length;
+    uint8_t  ext_checksum;
+    uint8_t  reserved;
+} __attribute__((packed)) mp_config_t;
+
+/* The entries. Processors take 20 bytes, everything else 8 */
+#define MP_ENTRY_PROCESSOR   0
+#define MP_ENTRY_BUS         1
+#define MP_ENTRY_IOAPIC      2
+#define MP_ENTRY_IO_INT      3
+#define MP_ENTRY_LOCAL_INT   4
+
+typedef struct {
+    uint8_t  type;
+    uint8_t  apic_id;
+    uint8_t  apic_version;
+    uint8_t  flags;
+    uint32_t signature;
+    uint32_t features;
+    uint32_t reserved[2];
+} __attribute__((packed)) mp_processor_t;
+
+#define MP_PROCESSOR_ENABLED 1
+#define MP_PROCESSOR_BSP     2
+
+typedef struct {
+    uint8_t  type;
+    uint8_t  bus_id;
+    char     bus_type[6];     /* "ISA   ", "PCI   ", etc */
+} __attribute__((packed)) mp_bus_t;
+
+typedef struct {
+    uint8_t  type;
+    uint8_t  id;
+    uint8_t  version;
+    uint8_t  flags;
+    uint32_t address;
+} __attribute__((packed)) mp_ioapic_t;
+
+#define MP_IOAPIC_ENABLED    1
+
+typedef struct {
+    uint8_t  type;
+    uint8_t  int_type;        /* 0 is a plain vectored interrupt */
+    uint16_t flags;           /* IRQ_POLARITY_* | IRQ_TRIGGER_* */
+    uint8_t  src_bus;
+    uint8_t  src_irq;
+    uint8_t  dst_ioapic;      /* By ID, 0xFF meaning all of them */
+    uint8_t  dst_pin;
+} __attribute__((packed)) mp_io_int_t;
+
+#define MP_INT_TYPE_INT      0
+
+/* Fill in config from the MP tables. Returns false if there are none */
+bool mp_parse_tables ( apic_config_t* config );
+
+#endif
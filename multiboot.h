@@ -43,4 +43,47 @@ typedef struct
   uint32_t vbe_interface_len;
 } __attribute__((packed)) multiboot_t;
 
+/* The VBE Mode Info block, as returned by the VBE BIOS function 0x4F01.
+ * When MULTIBOOT_FLAG_VBE is set, multiboot_t.vbe_mode_info holds the physical
+ * address of one of these, describing the mode the bootloader left us in. */
+typedef struct
+{
+  uint16_t attributes;
+  uint8_t  window_a;
+  uint8_t  window_b;
+  uint16_t granularity;
+  uint16_t window_size;
+  uint16_t segment_a;
+  uint16_t segment_b;
+  uint32_t win_func_ptr;
+  uint16_t pitch;           /* Bytes per scanline */
+  uint16_t width;           /* In pixels */
+  uint16_t height;          /* In pixels */
+  uint8_t  w_char;
+  uint8_t  y_char;
+  uint8_t  planes;
+  uint8_t  bpp;             /* Bits per pixel */
+  uint8_t  banks;
+  uint8_t  memory_model;    /* See VBE_MEMORY_MODEL_* */
+  uint8_t  bank_size;
+  uint8_t  image_pages;
+  uint8_t  reserved0;
+  uint8_t  red_mask;        /* The size (in bits) and position of each color */
+  uint8_t  red_position;
+  uint8_t  green_mask;
+  uint8_t  green_position;
+  uint8_t  blue_mask;
+  uint8_t  blue_position;
+  uint8_t  reserved_mask;
+  uint8_t  reserved_position;
+  uint8_t  direct_color_attributes;
+  uint32_t framebuffer;     /* Physical address of the linear framebuffer */
+  uint32_t off_screen_mem_off;
+  uint16_t off_screen_mem_size;
+  uint8_t  reserved1[206];
+} __attribute__((packed)) vbe_mode_info_t;
+
+#define VBE_MODE_ATTR_LINEAR_FB   0x80 /* The mode has a linear framebuffer */
+#define VBE_MEMORY_MODEL_DIRECT   0x06 /* Direct color (as opposed to palettes) */
+
 #endif
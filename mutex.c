@@ -0,0 +1,101 @@
+#include <mutex.h>
+#include <sched.h>
+#include <x86/x86.h>
+
+/* Semaphores */
+
+void sem_init ( semaphore_t* s, const char* name, uint32_t n )
+{
+    s->count = n;
+    wait_queue_init ( &s->wait, name );
+}
+
+bool sem_trydown ( semaphore_t* s )
+{
+    uint32_t count;
+
+    do {
+        count = s->count;
+        if ( !count )
+            return false;
+    } while ( atomic_cmpxchg ( &s->count, count, count - 1 ) != count );
+    return true;
+}
+
+void sem_down ( semaphore_t* s )
+{
+    if ( sem_trydown ( s ) )
+        return;
+    wait_event ( &s->wait, sem_trydown ( s ) );
+}
+
+void sem_up ( semaphore_t* s )
+{
+    /* The increment is the barrier wait_queue_active needs */
+    atomic_inc ( &s->count );
+    if ( wait_queue_active ( &s->wait ) )
+        wake_up_one ( &s->wait );
+}
+
+/* Mutexes */
+
+void mutex_init ( mutex_t* m, const char* name )
+{
+    m->state = MUTEX_UNLOCKED;
+    m->owner = NULL;
+    wait_queue_init ( &m->wait, name );
+}
+
+bool mutex_trylock ( mutex_t* m )
+{
+    if ( atomic_cmpxchg ( &m->state, MUTEX_UNLOCKED, MUTEX_LOCKED ) != MUTEX_UNLOCKED )
+        return false;
+    m->owner = thread_current ();
+    return true;
+}
+
+/* Wait for the owner to unlock it, for as long as that's likely to be soon.
+ * Returns whether we got it */
+PRIVATE bool mutex_spin ( mutex_t* m )
+{
+    thread_t* owner;
+    uint32_t i;
+
+    for ( i = 0; i < MUTEX_SPIN_LOOPS; i++ ) {
+        if ( m->state == MUTEX_UNLOCKED &&
+             atomic_cmpxchg ( &m->state, MUTEX_UNLOCKED, MUTEX_LOCKED ) == MUTEX_UNLOCKED )
+            return true;
+
+        /* NULL if it has only just been locked, and the owner is running
+         * then too */
+        owner = m->owner;
+        if ( ( owner && !owner->on_cpu ) || sched_need_resched () )
+            return false;
+        cpu_relax ();
+    }
+    return false;
+}
+
+void mutex_lock ( mutex_t* m )
+{
+    if ( atomic_cmpxchg ( &m->state, MUTEX_UNLOCKED, MUTEX_LOCKED ) != MUTEX_UNLOCKED &&
+         !mutex_spin ( m ) ) {
+        /* Getting it this way leaves it CONTENDED, even if we were the last
+         * waiter. That only costs the unlock a look at an empty queue */
+        wait_event ( &m->wait,
+                     atomic_xchg ( &m->state, MUTEX_CONTENDED ) == MUTEX_UNLOCKED );
+    }
+    m->owner = thread_current ();
+}
+
+void mutex_unlock ( mutex_t* m )
+{
+    m->owner = NULL;
+    if ( atomic_xchg ( &m->state, MUTEX_UNLOCKED ) == MUTEX_CONTENDED )
+        wake_up_one ( &m->wait );
+}
+
+bool mutex_is_locked ( const mutex_t* m )
+{
+    return m->state != MUTEX_UNLOCKED;
+}
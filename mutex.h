@@ -0,0 +1,70 @@
+#ifndef MUTEX_H
+#define MUTEX_H
+#include <stdinc.h>
+#include <wait.h>
+/*
+ * Locks that sleep: for critical sections that may be long, or may block,
+ * in threads (never in interrupt handlers). Two kinds:
+ *
+ *   - semaphore_t, a counting semaphore. sem_down takes one of count units,
+ *     sleeping until there's one to take, and sem_up gives one back.
+ *
+ *   - mutex_t, a lock with an owner. Only the thread that locked it may
+ *     unlock it.
+ *
+ * Both take and give back with a single atomic operation when nobody has to
+ * wait: a compare-and-swap on the count, or the state. Only when that fails
+ * does the taker go to the wait queue (see wait.h), and the giver only
+ * wakes someone up if the queue isn't empty. So uncontended, neither goes
+ * near the scheduler.
+ *
+ * The mutex's state says whether anyone may be waiting, so that unlocking
+ * needn't even look at the queue: it's LOCKED when taken uncontended, and
+ * CONTENDED once someone has had to wait. A waiter sets it to CONTENDED each
+ * time it tries, so whoever unlocks knows to wake the next one (the mutex
+ * stays CONTENDED after that until it's unlocked, even if nobody's left).
+ *
+ * Before sleeping, mutex_lock spins for a while (at most MUTEX_SPIN_LOOPS
+ * times round), as long as the owner is running on another CPU: it's likely
+ * to unlock soon, and a sleep and a wakeup cost a lot more than that. It
+ * stops as soon as the owner is off its CPU, or someone else needs ours.
+ */
+
+#define MUTEX_UNLOCKED   0
+#define MUTEX_LOCKED     1
+#define MUTEX_CONTENDED  2 /* Locked, and there may be waiters */
+
+#define MUTEX_SPIN_LOOPS 1000
+
+typedef struct {
+    volatile uint32_t count;
+    wait_queue_t wait;
+} semaphore_t;
+
+#define SEMAPHORE_INIT(s, name, n) { n, WAIT_QUEUE_INIT ( ( s ).wait, name ) }
+
+typedef struct {
+    volatile uint32_t state;
+    struct thread* volatile owner;
+    wait_queue_t wait;
+} mutex_t;
+
+#define MUTEX_INIT(m, name) \
+    { MUTEX_UNLOCKED, NULL, WAIT_QUEUE_INIT ( ( m ).wait, name ) }
+
+void sem_init ( semaphore_t* s, const char* name, uint32_t n );
+void sem_down ( semaphore_t* s );
+/* Take a unit only if there's one. Returns whether we did. Can be called
+ * from interrupt handlers */
+bool sem_trydown ( semaphore_t* s );
+/* Can be called from interrupt handlers */
+void sem_up ( semaphore_t* s );
+
+void mutex_init ( mutex_t* m, const char* name );
+void mutex_lock ( mutex_t* m );
+/* Lock it only if it's not locked. Returns whether we did */
+bool mutex_trylock ( mutex_t* m );
+void mutex_unlock ( mutex_t* m );
+bool mutex_is_locked ( const mutex_t* m );
+
+#endif
@@ -0,0 +1,14 @@
+#include <percpu.h>
+#include <apic.h>
+#include <mem.h>
+
+per_cpu_t per_cpu_areas[MAX_CPUS];
+
+void init_percpu ( uint32_t cpu )
+{
+    per_cpu_t* p = per_cpu ( cpu );
+
+    memset ( p, 0, sizeof ( per_cpu_t ) );
+    p->self = p;
+    p->cpu = cpu;
+}
@@ -0,0 +1,111 @@
+#ifndef PERCPU_H
+#define PERCPU_H
+#include <stdinc.h>
+/*
+ * Per-CPU data.
+ *
+ * Each CPU has a per_cpu_t of its own, and a GDT entry whose base is that
+ * per_cpu_t (see gdt.h). GS holds that entry's selector, always, in the
+ * kernel. So %gs:offset is the field at offset in the running CPU's
+ * per_cpu_t, whichever CPU that is, without having to find out which first.
+ *
+ * The this_cpu_* macros each compile to a single instruction on a field of
+ * the running CPU's per_cpu_t. A single instruction can't be split by an
+ * interrupt, so there's no need to disable them, nor to lock anything:
+ * nobody else writes the field (but see per_cpu). A thread that gets
+ * preempted in between two of them could end up on another CPU, though: the
+ * scheduler moves threads around (see sched.h).
+ *
+ * Only fields of 1, 2 or 4 bytes (pointers included) can be used with them.
+ *
+ * The interrupt stubs must leave GS alone when interrupting the kernel, and
+ * load GDT_PERCPU_SELECTOR into it when coming from user mode. It's only valid
+ * after init_gdt.
+ */
+
+struct thread;
+struct tasklet;
+
+typedef struct per_cpu {
+    struct per_cpu* self;       /* Where this is, for this_cpu_ptr */
+    uint32_t cpu;               /* Our number (see smp.h) */
+    uint32_t irqs;              /* How many IRQs we've handled */
+    uint32_t preempt_count;     /* preempt_disable nesting (see preempt.h) */
+    uint32_t rcu_qs_gp;         /* The last grace period we've been through a
+                                 * quiescent state in (see rcu.h) */
+    uint32_t rcu_idle;          /* Set while idle, outside interrupts */
+    struct thread* current;     /* The thread running here (see sched.h) */
+    uint32_t tick_stopped;      /* Our own tick is stopped while idle (see
+                                 * internal_timer.c) */
+    uint32_t fpu_in_use;        /* Who the FPU registers are live for, with
+                                 * CR0.TS clear (see fpu.h) */
+    struct thread* fpu_owner;   /* Whose state they hold otherwise */
+    uint32_t softirq_pending;   /* Our raised softirqs (see softirq.h) */
+    uint32_t in_softirq;        /* Set while we're running them */
+    struct tasklet* tasklet_head; /* Our tasklets waiting to run */
+    struct tasklet* tasklet_tail;
+} __attribute__((aligned(64))) per_cpu_t; /* A cache line each, so CPUs
+                                           * don't fight over them */
+
+extern per_cpu_t per_cpu_areas[];
+
+/* Another CPU's area. Its fields may change under our feet */
+#define per_cpu(cpu) ( &per_cpu_areas[cpu] )
+
+/* Set up cpu's area. Called by gdt_init_cpu, before it loads GS */
+void init_percpu ( uint32_t cpu );
+
+#define PER_CPU_OFFSET(field) ( ( uint32_t ) &( ( per_cpu_t* ) 0 )->field )
+#define PER_CPU_TYPE(field)   __typeof__ ( ( ( per_cpu_t* ) 0 )->field )
+
+#define this_cpu_read(field) __extension__ ( {                               \
+    PER_CPU_TYPE ( field ) this_cpu_val__;                                    \
+    __asm volatile ( "mov %%gs:%c1, %0"                                       \
+                     : "=q" ( this_cpu_val__ ) : "i" ( PER_CPU_OFFSET ( field ) ) ); \
+    this_cpu_val__; } )
+
+#define this_cpu_write(field, val) do {                                       \
+    PER_CPU_TYPE ( field ) this_cpu_val__ = ( val );                          \
+    __asm volatile ( "mov %0, %%gs:%c1"                                       \
+                     : : "q" ( this_cpu_val__ ), "i" ( PER_CPU_OFFSET ( field ) ) \
+                     : "memory" );                                            \
+} while ( 0 )
+
+#define this_cpu_add(field, val) do {                                         \
+    PER_CPU_TYPE ( field ) this_cpu_val__ = ( val );                          \
+    __asm volatile ( "add %0, %%gs:%c1"                                       \
+                     : : "q" ( this_cpu_val__ ), "i" ( PER_CPU_OFFSET ( field ) ) \
+                     : "memory", "cc" );                                      \
+} while ( 0 )
+
+#define this_cpu_or(field, val) do {                                          \
+    PER_CPU_TYPE ( field ) this_cpu_val__ = ( val );                          \
+    __asm volatile ( "or %0, %%gs:%c1"                                        \
+                     : : "q" ( this_cpu_val__ ), "i" ( PER_CPU_OFFSET ( field ) ) \
+                     : "memory", "cc" );                                      \
+} while ( 0 )
+
+/* The size has to be spelled out when there's no register to tell. Only one
+ * of these survives compilation */
+#define this_cpu_inc(field) do {                                              \
+    if ( sizeof ( PER_CPU_TYPE ( field ) ) == 1 )                             \
+        __asm volatile ( "incb %%gs:%c0" : : "i" ( PER_CPU_OFFSET ( field ) ) : "memory", "cc" ); \
+    else if ( sizeof ( PER_CPU_TYPE ( field ) ) == 2 )                        \
+        __asm volatile ( "incw %%gs:%c0" : : "i" ( PER_CPU_OFFSET ( field ) ) : "memory", "cc" ); \
+    else                                                                      \
+        __asm volatile ( "incl %%gs:%c0" : : "i" ( PER_CPU_OFFSET ( field ) ) : "memory", "cc" ); \
+} while ( 0 )
+
+#define this_cpu_dec(field) do {                                              \
+    if ( sizeof ( PER_CPU_TYPE ( field ) ) == 1 )                             \
+        __asm volatile ( "decb %%gs:%c0" : : "i" ( PER_CPU_OFFSET ( field ) ) : "memory", "cc" ); \
+    else if ( sizeof ( PER_CPU_TYPE ( field ) ) == 2 )                        \
+        __asm volatile ( "decw %%gs:%c0" : : "i" ( PER_CPU_OFFSET ( field ) ) : "memory", "cc" ); \
+    else                                                                      \
+        __asm volatile ( "decl %%gs:%c0" : : "i" ( PER_CPU_OFFSET ( field ) ) : "memory", "cc" ); \
+} while ( 0 )
+
+/* The running CPU's area, to pass around or for what doesn't fit the above */
+#define this_cpu_ptr() this_cpu_read ( self )
+
+#endif
@@ -0,0 +1,35 @@
+#ifndef PREEMPT_H
+#define PREEMPT_H
+#include <stdinc.h>
+#include <percpu.h>
+#include <x86/x86.h>
+/*
+ * Keeping the running thread on its CPU, without disabling interrupts.
+ *
+ * preempt_disable() bumps the CPU's preempt_count, and sched_preempt won't
+ * switch threads while it's not 0. Interrupts still come in and their
+ * handlers still run, but whatever they make runnable waits until
+ * preempt_enable() and the next interrupt exit. They nest.
+ *
+ * The count is the CPU's, not the thread's: calling schedule() (or anything
+ * that blocks) in between would hand it to the next thread. Don't.
+ *
+ * Neither is an atomic operation: each is a single instruction on the
+ * running CPU's per_cpu_t (see percpu.h), plus a compiler barrier so that
+ * nothing in between gets moved out.
+ */
+
+#define preempt_disable() do {                                                \
+    this_cpu_inc ( preempt_count );                                           \
+    barrier ();                                                               \
+} while ( 0 )
+
+#define preempt_enable() do {                                                 \
+    barrier ();                                                               \
+    this_cpu_dec ( preempt_count );                                           \
+} while ( 0 )
+
+/* Whether the scheduler may switch threads on this CPU */
+#define preemptible() ( this_cpu_read ( preempt_count ) == 0 )
+
+#endif
@@ -0,0 +1,179 @@
+#include <rcu.h>
+#include <percpu.h>
+#include <smp.h>
+#include <softirq.h>
+#include <spinlock.h>
+#include <wait.h>
+#include <list.h>
+#include <x86/x86.h>
+
+/* The last grace period started. 0 is the one every CPU starts out in */
+PRIVATE volatile uint32_t rcu_gp = 0;
+
+/* The call_rcu callbacks: those waiting for a grace period to start, and the
+ * batch waiting for wait_gp to end */
+PRIVATE spinlock_t rcu_lock = SPINLOCK_INIT ( "rcu" );
+PRIVATE rcu_head_t* next_list = NULL;
+PRIVATE rcu_head_t** next_tail = &next_list;
+PRIVATE rcu_head_t* wait_list = NULL;
+PRIVATE uint32_t wait_gp = 0;
+
+PRIVATE void rcu_softirq ( void );
+
+void init_rcu ( void )
+{
+    open_softirq ( SOFTIRQ_RCU, &rcu_softirq );
+}
+
+/* Start a new grace period, returning its number. The atomic add is also
+ * what orders the updater's store to the pointer before its reads of the
+ * other CPUs' state */
+PRIVATE uint32_t rcu_start_gp ( void )
+{
+    return atomic_xadd ( &rcu_gp, 1 ) + 1;
+}
+
+/* We're in a quiescent state: whatever grace period has started by now, we've
+ * been through it */
+PRIVATE void rcu_note_qs ( void )
+{
+    this_cpu_write ( rcu_qs_gp, rcu_gp );
+}
+
+/* Whether every CPU has been through a quiescent state since gp started */
+PRIVATE bool rcu_gp_done ( uint32_t gp )
+{
+    per_cpu_t* p;
+    uint32_t cpu;
+
+    for ( cpu = 0; cpu < MAX_CPUS; cpu++ ) {
+        if ( !cpu_online ( cpu ) )
+            continue;
+        p = per_cpu ( cpu );
+        if ( *( volatile uint32_t* ) &p->rcu_idle )
+            continue;
+        if ( ( int32_t ) ( *( volatile uint32_t* ) &p->rcu_qs_gp - gp ) < 0 )
+            return false;
+    }
+    return true;
+}
+
+/* What synchronize_rcu waits on */
+typedef struct {
+    rcu_head_t head;
+    completion_t done;
+} rcu_synchronize_t;
+
+PRIVATE void wake_synchronize_rcu ( rcu_head_t* head )
+{
+    complete ( &LIST_ENTRY ( head, rcu_synchronize_t, head )->done );
+}
+
+void synchronize_rcu ( void )
+{
+    rcu_synchronize_t rs;
+
+    /* On our own, we're not in a read section (or we couldn't be calling
+     * this), so there's nobody to wait for. That's how it goes at boot,
+     * before there are ticks or other threads to wait with */
+    if ( num_online_cpus () == 1 ) {
+        rcu_note_qs ();
+        mb ();
+        return;
+    }
+
+    /* Otherwise it takes a few ticks for every CPU to get through a
+     * quiescent state: sleep through them, as a call_rcu callback */
+    completion_init ( &rs.done, "synchronize_rcu" );
+    call_rcu ( &rs.head, &wake_synchronize_rcu );
+    wait_for_completion ( &rs.done );
+}
+
+void call_rcu ( rcu_head_t* head, void ( *func ) ( rcu_head_t* head ) )
+{
+    uint32_t flags;
+
+    head->next = NULL;
+    head->func = func;
+
+    flags = spin_lock_irqsave ( &rcu_lock );
+    *next_tail = head;
+    next_tail = &head->next;
+    spin_unlock_irqrestore ( &rcu_lock, flags );
+}
+
+/* Runs on the CPU whose tick raised it (see softirq.h). Run the batch whose
+ * grace period is over and start one for the next */
+PRIVATE void rcu_softirq ( void )
+{
+    rcu_head_t* done = NULL;
+    rcu_head_t* h;
+    uint32_t flags;
+
+    flags = spin_lock_irqsave ( &rcu_lock );
+    if ( wait_list && rcu_gp_done ( wait_gp ) ) {
+        done = wait_list;
+        wait_list = NULL;
+    }
+    if ( !wait_list && next_list ) {
+        wait_list = next_list;
+        next_list = NULL;
+        next_tail = &next_list;
+        wait_gp = rcu_start_gp ();
+        if ( preemptible () )
+            rcu_note_qs ();
+    }
+    spin_unlock_irqrestore ( &rcu_lock, flags );
+
+    while ( done ) {
+        h = done;
+        done = h->next;
+        h->func ( h );
+    }
+}
+
+bool rcu_needs_cpu ( void )
+{
+    return next_list || wait_list || this_cpu_read ( rcu_qs_gp ) != rcu_gp;
+}
+
+void rcu_tick ( void )
+{
+    /* If what the tick interrupted isn't a reader, this CPU has been
+     * through a quiescent state. That's the one a CPU that's busy with a
+     * single thread, never switching, gets to report */
+    if ( preemptible () && !in_softirq () )
+        rcu_note_qs ();
+
+    if ( rcu_needs_cpu () )
+        raise_softirq ( SOFTIRQ_RCU );
+}
+
+void rcu_note_context_switch ( void )
+{
+    rcu_note_qs ();
+}
+
+void rcu_idle_enter ( void )
+{
+    atomic_xchg ( &this_cpu_ptr ()->rcu_idle, 1 );
+}
+
+void rcu_idle_exit ( void )
+{
+    atomic_xchg ( &this_cpu_ptr ()->rcu_idle, 0 );
+}
+
+bool rcu_irq_enter ( void )
+{
+    if ( !this_cpu_read ( rcu_idle ) )
+        return false;
+    rcu_idle_exit ();
+    return true;
+}
+
+void rcu_irq_exit ( bool was_idle )
+{
+    if ( was_idle )
+        rcu_idle_enter ();
+}
@@ -0,0 +1,107 @@
+#ifndef RCU_H
+#define RCU_H
+#include <stdinc.h>
+#include <preempt.h>
+#include <x86/x86.h>
+/*
+ * Read-copy-update: for data that's read all the time and hardly ever
+ * changed, reached through a pointer.
+ *
+ * Readers don't lock anything, nor write anything anyone else reads. They
+ * follow the pointer with rcu_dereference(), between rcu_read_lock() and
+ * rcu_read_unlock(), which only keep the thread from being preempted:
+ *
+ *      rcu_read_lock ();
+ *      t = rcu_dereference ( table );
+ *      ... use t ...
+ *      rcu_read_unlock ();
+ *
+ * Interrupt handlers run with preemption (and interrupts) disabled, so they
+ * can skip the rcu_read_lock. Nothing between the two may block.
+ *
+ * An updater never changes what readers may be looking at. It makes a new
+ * copy, changes that, and publishes it with rcu_assign_pointer(), which
+ * makes sure the copy is written before the pointer to it is. Readers that
+ * came before that may still be using the old copy, so it can't be reused
+ * until they're done: synchronize_rcu() waits until they are, or call_rcu()
+ * runs a function once they are (to free the old copy, say) without waiting.
+ * Updaters keep each other out with a lock of their own.
+ *
+ * How do we know they're done? Without counting them, which is the whole
+ * point. A CPU is in a quiescent state when it can't be in the middle of a
+ * read: switching threads, idle, or interrupted with preempt_count at 0.
+ * Once every CPU has been through one since the pointer was changed, every
+ * reader that could have seen the old copy has finished. That's a grace
+ * period.
+ *
+ * Grace periods are numbered. Starting one bumps rcu_gp, and each CPU notes
+ * the number it has seen in a quiescent state in its per_cpu_t (rcu_qs_gp),
+ * at context switches, and on its own tick, if that interrupted neither a
+ * reader nor a softirq. Idle CPUs can't be waited on, since they
+ * may not wake up for a long time, so they set rcu_idle instead and count
+ * as quiescent until an interrupt wakes them (rcu_irq_enter). Setting and
+ * clearing it are atomic operations, so the updater's store to the pointer
+ * and its read of rcu_idle can't pass the idle CPU's on the way out.
+ *
+ * call_rcu callbacks are batched: those queued while a grace period is in
+ * progress wait for the next one, all together, and are then run by
+ * SOFTIRQ_RCU, which the tick raises while there are callbacks waiting.
+ * synchronize_rcu is one of those callbacks, completing a completion (see
+ * wait.h) it sleeps on. With only one CPU up, it doesn't wait at all.
+ */
+
+typedef struct rcu_head {
+    struct rcu_head* next;
+    void ( *func ) ( struct rcu_head* head );
+} rcu_head_t;
+
+#define rcu_read_lock()   preempt_disable ()
+#define rcu_read_unlock() preempt_enable ()
+
+/* Read a pointer that's published with rcu_assign_pointer. x86 doesn't
+ * reorder a load with a later one that depends on it, so this only has to
+ * make sure it's loaded once */
+#define rcu_dereference(p) __extension__ ( {                                  \
+    __typeof__ ( p ) rcu_p__ = *( volatile __typeof__ ( p )* ) &( p );        \
+    barrier ();                                                               \
+    rcu_p__; } )
+
+/* Publish v in p, once everything it points to has been written. x86 keeps
+ * stores in order, so that's up to the compiler */
+#define rcu_assign_pointer(p, v) do {                                         \
+    barrier ();                                                               \
+    *( volatile __typeof__ ( p )* ) &( p ) = ( v );                           \
+} while ( 0 )
+
+void init_rcu ( void );
+
+/* Wait for a grace period: return once every reader that was running when it
+ * was called is done. It sleeps, unless only one CPU is up. Must not be
+ * called between rcu_read_lock and rcu_read_unlock, nor from interrupt
+ * handlers, nor with a spinlock held */
+void synchronize_rcu ( void );
+
+/* Run func(head) after a grace period, from a softirq. head is usually
+ * embedded in whatever func frees. Safe to call from interrupt handlers */
+void call_rcu ( rcu_head_t* head, void ( *func ) ( rcu_head_t* head ) );
+
+/* For the timer tick, on every CPU: notes the quiescent state, if the tick
+ * interrupted one. rcu_needs_cpu says whether a grace period or a callback
+ * is waiting on this CPU; if so, the tick raises SOFTIRQ_RCU, and can't be
+ * stopped */
+bool rcu_needs_cpu ( void );
+void rcu_tick ( void );
+
+/* For schedule(): switching threads is a quiescent state */
+void rcu_note_context_switch ( void );
+
+/* For the idle loops, around the halt. Interrupts must be disabled */
+void rcu_idle_enter ( void );
+void rcu_idle_exit ( void );
+
+/* For irq_handler, on the way in and on the very way out: an interrupt that
+ * wakes an idle CPU may have readers in it. Returns whether it did */
+bool rcu_irq_enter ( void );
+void rcu_irq_exit ( bool was_idle );
+
+#endif
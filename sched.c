@@ -0,0 +1,763 @@
+#include <sched.h>
+#include <idle.h>
+#include <gdt.h>
+#include <internal_timer.h>
+#include <kpanic.h>
+#include <percpu.h>
+#include <softirq.h>
+#include <smp.h>
+#include <rcu.h>
+#include <wsdeque.h>
+#include <mem/pmm.h>
+#include <x86/x86.h>
+
+extern void switch_context ( uint32_t* old_esp, uint32_t new_esp );
+extern void thread_entry ();
+
+/* Called by thread_entry */
+void thread_start ( void );
+
+/* A CPU's threads. Only that CPU touches them, with interrupts disabled,
+ * except for the tops of the deques (thieves), the wakeup list and
+ * need_resched (wakers) */
+typedef struct {
+    wsdeque_t queues[SCHED_PRIORITIES];
+    list_node_t expired[SCHED_PRIORITIES]; /* Out of timeslice */
+    thread_t* volatile wakeups;   /* Woken by other CPUs, not queued yet */
+    volatile bool need_resched;
+    thread_t* idle;
+    thread_t* prev;               /* Just switched away from, for schedule_tail */
+    uint32_t balance_ticks;       /* Since the last sched_balance */
+} __attribute__((aligned(64))) runqueue_t;
+
+PRIVATE thread_t threads[MAX_THREADS];
+PRIVATE runqueue_t runqueues[MAX_CPUS];
+
+PRIVATE volatile bool running = false;
+PRIVATE uint32_t timeslice_ticks = 1;
+PRIVATE uint32_t balance_ticks = 1;
+PRIVATE volatile uint32_t next_id = 0;
+
+/* Bit n set if CPU n runs threads, if sched_set_cpus lets it, and if it's
+ * idle (and hasn't been claimed by a waker yet) */
+PRIVATE volatile uint32_t sched_online = 0;
+PRIVATE volatile uint32_t sched_allowed = 0xFFFFFFFF;
+PRIVATE volatile uint32_t idle_cpus = 0;
+
+#define this_rq()     ( &runqueues[smp_processor_id ()] )
+#define this_thread() this_cpu_read ( current )
+
+PRIVATE bool cpu_takes_threads ( uint32_t cpu )
+{
+    return ( sched_online & sched_allowed & ( 1U << cpu ) ) != 0;
+}
+
+/* Put t at the bottom of its deque, where we'll pop it first */
+PRIVATE void rq_push ( runqueue_t* rq, thread_t* t )
+{
+    /* There are as many slots as threads, so this can't happen */
+    if ( !wsdeque_push ( &rq->queues[t->priority], t ) )
+        kpanic ( "sched: run queue overflow" );
+}
+
+/* Give the expired threads of priority prio another round, by putting them
+ * back in the deque. Returns false if there were none */
+PRIVATE bool rq_refill ( runqueue_t* rq, uint32_t prio )
+{
+    thread_t* t;
+
+    if ( list_empty ( &rq->expired[prio] ) )
+        return false;
+
+    while ( !list_empty ( &rq->expired[prio] ) ) {
+        t = LIST_ENTRY ( rq->expired[prio].next, thread_t, run_node );
+        list_del ( &t->run_node );
+        rq_push ( rq, t );
+    }
+    return true;
+}
+
+PRIVATE void rq_refill_all ( runqueue_t* rq )
+{
+    uint32_t prio;
+
+    for ( prio = 0; prio < SCHED_PRIORITIES; prio++ )
+        rq_refill ( rq, prio );
+}
+
+/* Queue the threads other CPUs have woken up for us */
+PRIVATE void rq_drain_wakeups ( runqueue_t* rq )
+{
+    thread_t* t;
+    thread_t* next;
+
+    if ( !rq->wakeups )
+        return;
+
+    t = ( thread_t* ) atomic_xchg ( ( volatile uint32_t* ) &rq->wakeups, 0 );
+    while ( t ) {
+        /* Once it's queued, it may be stolen, run, and woken again */
+        next = t->wake_next;
+        rq_push ( rq, t );
+        t = next;
+    }
+}
+
+/* The most important priority we have threads queued at, or
+ * SCHED_PRIORITIES if there are none */
+PRIVATE uint32_t rq_best_prio ( runqueue_t* rq )
+{
+    uint32_t prio;
+
+    for ( prio = 0; prio < SCHED_PRIORITIES; prio++ )
+        if ( wsdeque_size ( &rq->queues[prio] ) || !list_empty ( &rq->expired[prio] ) )
+            return prio;
+    return SCHED_PRIORITIES;
+}
+
+/* Take the most important thread we have queued, NULL if there's none */
+PRIVATE thread_t* rq_take ( runqueue_t* rq )
+{
+    thread_t* t;
+    uint32_t prio;
+
+    for ( prio = 0; prio < SCHED_PRIORITIES; prio++ ) {
+        t = wsdeque_pop ( &rq->queues[prio] );
+        if ( !t && rq_refill ( rq, prio ) )
+            t = wsdeque_pop ( &rq->queues[prio] );
+        if ( t )
+            return t;
+    }
+    return NULL;
+}
+
+/* Whether another CPU has threads we could steal. Only a hint */
+PRIVATE bool can_steal ( uint32_t self )
+{
+    uint32_t cpu, prio;
+
+    for ( cpu = 0; cpu < MAX_CPUS; cpu++ ) {
+        if ( cpu == self || !( sched_online & ( 1U << cpu ) ) )
+            continue;
+        for ( prio = 0; prio < SCHED_PRIORITIES; prio++ )
+            if ( wsdeque_size ( &runqueues[cpu].queues[prio] ) )
+                return true;
+    }
+    return false;
+}
+
+/* Steal the most important thread any other CPU has queued. Each one's
+ * oldest, from the top of its deque: the one least likely to still be in its
+ * cache */
+PRIVATE thread_t* steal_thread ( uint32_t self )
+{
+    thread_t* t;
+    uint32_t cpu, prio;
+
+    for ( prio = 0; prio < SCHED_PRIORITIES; prio++ ) {
+        for ( cpu = 0; cpu < MAX_CPUS; cpu++ ) {
+            if ( cpu == self || !( sched_online & ( 1U << cpu ) ) )
+                continue;
+            t = wsdeque_steal ( &runqueues[cpu].queues[prio] );
+            if ( t )
+                return t;
+        }
+    }
+    return NULL;
+}
+
+/* Take cpu off idle_cpus, if it's there. Only one waker gets to, so that
+ * they don't all pile their threads on the same idle CPU */
+PRIVATE bool claim_idle_cpu ( uint32_t cpu )
+{
+    uint32_t old;
+
+    do {
+        old = idle_cpus;
+        if ( !( old & ( 1U << cpu ) ) )
+            return false;
+    } while ( atomic_cmpxchg ( &idle_cpus, old, old & ~( 1U << cpu ) ) != old );
+    return true;
+}
+
+/* Wake up an idle CPU to steal from us, if there is one */
+PRIVATE void kick_idle_cpu ( uint32_t self )
+{
+    uint32_t mask, cpu;
+
+    mask = idle_cpus & sched_online & sched_allowed & ~( 1U << self );
+    for ( cpu = 0; mask; cpu++, mask >>= 1 ) {
+        if ( ( mask & 1 ) && claim_idle_cpu ( cpu ) ) {
+            smp_send_resched ( cpu );
+            return;
+        }
+    }
+}
+
+/* Queue t, which is RUNNABLE and off every CPU, where it'll run soonest: on
+ * the CPU it last ran on if that's idle, or else on ours. Interrupts must be
+ * disabled */
+PRIVATE void activate ( thread_t* t )
+{
+    runqueue_t* rq;
+    thread_t* curr;
+    thread_t* head;
+    uint32_t self, target;
+
+    self = smp_processor_id ();
+    if ( t->cpu != self && cpu_takes_threads ( t->cpu ) && claim_idle_cpu ( t->cpu ) )
+        target = t->cpu;
+    else if ( cpu_takes_threads ( self ) )
+        target = self;
+    else
+        target = 0;
+    rq = &runqueues[target];
+
+    if ( target == self ) {
+        rq_push ( rq, t );
+        curr = this_thread ();
+        if ( curr == rq->idle || t->priority < curr->priority )
+            rq->need_resched = true;
+        else
+            kick_idle_cpu ( self );
+        return;
+    }
+
+    do {
+        head = rq->wakeups;
+        t->wake_next = head;
+    } while ( atomic_cmpxchg ( ( volatile uint32_t* ) &rq->wakeups, ( uint32_t ) head,
+                               ( uint32_t ) t ) != ( uint32_t ) head );
+
+    /* If it's busy with something at least as important, it'll find t the
+     * next time it schedules */
+    curr = *( thread_t* volatile* ) &per_cpu ( target )->current;
+    if ( !curr || curr == rq->idle || t->priority < curr->priority ) {
+        rq->need_resched = true;
+        smp_send_resched ( target );
+    }
+}
+
+/* Put prev, which we've just switched away from while it could still run,
+ * back in our queues: at the bottom of the deque if it was preempted, so it
+ * goes first, or in the expired list if its time was up */
+PRIVATE void requeue ( runqueue_t* rq, thread_t* prev, uint32_t cpu )
+{
+    if ( !cpu_takes_threads ( cpu ) ) {
+        /* Where someone else can steal it */
+        rq_push ( rq, prev );
+        kick_idle_cpu ( cpu );
+    } else if ( prev->slice )
+        rq_push ( rq, prev );
+    else
+        list_add_tail ( &rq->expired[prev->priority], &prev->run_node );
+}
+
+/* Whatever has to be done once we're running on the new thread's stack, on
+ * the CPU that switched to it: we may not be where we were before */
+PRIVATE void schedule_tail ( void )
+{
+    runqueue_t* rq;
+    thread_t* prev;
+    uint32_t cpu, state;
+
+    cpu = smp_processor_id ();
+    rq = &runqueues[cpu];
+    prev = rq->prev;
+    if ( !prev )
+        return;
+    rq->prev = NULL;
+
+    /* Once on_cpu is clear, a waker may queue prev, and another CPU run it:
+     * look at it before then */
+    state = prev->state;
+    if ( state == THREAD_RUNNING && prev != rq->idle )
+        prev->state = THREAD_RUNNABLE;
+    barrier ();
+    prev->on_cpu = 0;
+    barrier ();
+
+    if ( state == THREAD_DEAD )
+        prev->state = THREAD_UNUSED;
+    else if ( state == THREAD_RUNNING && prev != rq->idle )
+        requeue ( rq, prev, cpu );
+}
+
+/* Who runs next on cpu: prev, if it still can and nothing more important is
+ * waiting, or else our most important thread, or someone else's, or idle */
+PRIVATE thread_t* pick_next ( runqueue_t* rq, thread_t* prev, uint32_t cpu )
+{
+    thread_t* t;
+    uint32_t best;
+    bool prev_can_run;
+
+    if ( !cpu_takes_threads ( cpu ) ) {
+        /* sched_set_cpus took us out. Whatever we have goes to the others */
+        rq_refill_all ( rq );
+        if ( rq_best_prio ( rq ) < SCHED_PRIORITIES )
+            kick_idle_cpu ( cpu );
+        return rq->idle;
+    }
+
+    prev_can_run = prev->state == THREAD_RUNNING && prev != rq->idle;
+    if ( prev_can_run ) {
+        best = rq_best_prio ( rq );
+        if ( best > prev->priority || ( best == prev->priority && prev->slice ) )
+            return prev;
+    }
+
+    t = rq_take ( rq );
+    if ( !t && prev_can_run )
+        return prev;
+    if ( !t )
+        t = steal_thread ( cpu );
+    return t ? t : rq->idle;
+}
+
+void schedule ( void )
+{
+    runqueue_t* rq;
+    thread_t* prev;
+    thread_t* next;
+    uint32_t flags, cpu;
+
+    flags = irq_save ();
+    cpu = smp_processor_id ();
+    rq = &runqueues[cpu];
+    rq->need_resched = false;
+    rq_drain_wakeups ( rq );
+
+    prev = this_thread ();
+    next = pick_next ( rq, prev, cpu );
+    if ( !next->slice )
+        next->slice = timeslice_ticks;
+
+    if ( next != prev ) {
+        if ( prev == rq->idle )
+            atomic_and ( &idle_cpus, ~( 1U << cpu ) );
+        next->state = THREAD_RUNNING;
+        next->cpu = cpu;
+        next->on_cpu = 1;
+        this_cpu_write ( current, next );
+        rq->prev = prev;
+        rcu_note_context_switch ();
+        fpu_switch_out ( prev );
+        if ( next->esp0 )
+            gdt_set_kernel_stack ( next->esp0 );
+        switch_context ( &prev->esp, next->esp );
+
+        /* We're prev again, someone switched back to us. Maybe on another
+         * CPU: rq and cpu are stale */
+        schedule_tail ();
+    }
+    irq_restore ( flags );
+}
+
+void thread_start ( void )
+{
+    thread_t* self;
+
+    schedule_tail ();
+    __asm volatile ( "sti" );
+    self = this_thread ();
+    self->func ( self->arg );
+    thread_exit ();
+}
+
+PRIVATE void sleep_timeout ( uint32_t data )
+{
+    thread_wake ( ( thread_t* ) data );
+}
+
+PRIVATE void copy_name ( char* dst, const char* src )
+{
+    uint32_t i;
+
+    for ( i = 0; i < THREAD_NAME_LEN - 1 && src[i]; i++ )
+        dst[i] = src[i];
+    dst[i] = '\0';
+}
+
+/* Lay out t's stack the way switch_context leaves it: the callee-saved
+ * registers, and the address to return to */
+PRIVATE void setup_stack ( thread_t* t )
+{
+    uint32_t* sp;
+
+    sp = ( uint32_t* ) ( t->stack + THREAD_STACK_SIZE );
+    *--sp = 0;                            /* thread_entry's return address */
+    *--sp = ( uint32_t ) thread_entry;
+    *--sp = 0;                            /* ebp */
+    *--sp = 0;                            /* ebx */
+    *--sp = 0;                            /* esi */
+    *--sp = 0;                            /* edi */
+    t->esp = ( uint32_t ) sp;
+}
+
+/* Claim a free slot for a new thread, and set it up. It's DEAD, which is to
+ * say neither free nor runnable, until the caller decides otherwise */
+PRIVATE thread_t* thread_alloc ( const char* name, uint32_t priority )
+{
+    thread_t* t = NULL;
+    uint32_t i;
+
+    for ( i = 0; i < MAX_THREADS; i++ ) {
+        if ( threads[i].state == THREAD_UNUSED &&
+             atomic_cmpxchg ( &threads[i].state, THREAD_UNUSED, THREAD_DEAD ) == THREAD_UNUSED ) {
+            t = &threads[i];
+            break;
+        }
+    }
+    if ( !t )
+        return NULL;
+
+    t->id = atomic_xadd ( &next_id, 1 );
+    t->priority = priority;
+    t->slice = 0;
+    t->runtime = 0;
+    t->cpu = smp_processor_id ();
+    t->on_cpu = 0;
+    t->wake_pending = 0;
+    t->wake_next = NULL;
+    t->esp0 = 0;
+    copy_name ( t->name, name );
+    fpu_thread_init ( t );
+    ktimer_init ( &t->sleep_timer, &sleep_timeout, ( uint32_t ) t );
+    return t;
+}
+
+thread_t* thread_create ( const char* name, thread_func_t func, uint32_t arg,
+                          uint32_t priority )
+{
+    thread_t* t;
+    uint32_t flags;
+
+    if ( !running || priority >= SCHED_PRIORITIES )
+        return NULL;
+
+    t = thread_alloc ( name, priority );
+    if ( !t )
+        return NULL;
+
+    /* Slots keep their stacks */
+    if ( !t->stack )
+        t->stack = pmm_alloc_blocks ( THREAD_STACK_PAGES );
+
+    t->func = func;
+    t->arg = arg;
+    setup_stack ( t );
+
+    flags = irq_save ();
+    t->cpu = smp_processor_id ();
+    t->state = THREAD_RUNNABLE;
+    activate ( t );
+    irq_restore ( flags );
+
+    return t;
+}
+
+thread_t* thread_current ( void )
+{
+    return this_thread ();
+}
+
+void thread_yield ( void )
+{
+    uint32_t flags;
+
+    flags = irq_save ();
+    this_thread ()->slice = 0;
+    schedule ();
+    irq_restore ( flags );
+}
+
+/* Take self off the CPU in state until it's woken up, unless it has been
+ * already (see thread_block). Interrupts must be disabled */
+PRIVATE void block_current ( thread_t* self, uint32_t state )
+{
+    atomic_xchg ( &self->state, state );
+    if ( self->wake_pending ) {
+        self->wake_pending = 0;
+
+        /* Unless a waker has seen the new state in the meantime, and is
+         * queueing us as we speak */
+        if ( atomic_cmpxchg ( &self->state, state, THREAD_RUNNING ) == state )
+            return;
+    }
+    schedule ();
+}
+
+void thread_sleep ( uint32_t ms )
+{
+    thread_t* self;
+    uint32_t flags;
+    uint64_t ticks, deadline;
+
+    /* Rounded up, since it's "at least" */
+    ticks = div_u64_rem ( ( uint64_t ) ms * timer_get_frequency () + 999, 1000, NULL );
+    if ( !ticks )
+        ticks = 1;
+
+    flags = irq_save ();
+    self = this_thread ();
+    deadline = timer_get_ticks () + ticks;
+
+    /* Wakeups can be spurious (see thread_block) */
+    while ( timer_get_ticks () < deadline ) {
+        ktimer_mod ( &self->sleep_timer, deadline );
+        block_current ( self, THREAD_SLEEPING );
+    }
+    ktimer_del ( &self->sleep_timer );
+    irq_restore ( flags );
+}
+
+void thread_exit ( void )
+{
+    thread_t* self;
+
+    irq_save ();
+    self = this_thread ();
+    ktimer_del ( &self->sleep_timer );
+    self->state = THREAD_DEAD;
+    schedule ();
+
+    /* Never gets here */
+    for ( ;; )
+        ;
+}
+
+void thread_block ( void )
+{
+    thread_t* self = this_thread ();
+
+    if ( !self ) {
+        cpu_idle ();
+        return;
+    }
+
+    block_current ( self, THREAD_BLOCKED );
+}
+
+/* Make t RUNNABLE and queue it, if it's blocked or sleeping */
+PRIVATE bool try_wake ( thread_t* t )
+{
+    if ( atomic_cmpxchg ( &t->state, THREAD_BLOCKED, THREAD_RUNNABLE ) != THREAD_BLOCKED &&
+         atomic_cmpxchg ( &t->state, THREAD_SLEEPING, THREAD_RUNNABLE ) != THREAD_SLEEPING )
+        return false;
+
+    ktimer_del ( &t->sleep_timer );
+
+    /* It may have only just blocked, and still be on its way off its CPU */
+    while ( t->on_cpu )
+        cpu_relax ();
+    activate ( t );
+    return true;
+}
+
+void thread_wake ( thread_t* t )
+{
+    uint32_t flags;
+
+    flags = irq_save ();
+    if ( !try_wake ( t ) ) {
+        /* It's running, or about to block. Either way, block_current will
+         * see this, or we'll see it blocked */
+        atomic_xchg ( &t->wake_pending, 1 );
+        try_wake ( t );
+    }
+    irq_restore ( flags );
+}
+
+/* Every SCHED_BALANCE_MS: give the expired threads their next round, where
+ * idle CPUs can steal them, and wake one up to do so. If we're idle
+ * ourselves, with the tick still going, look for threads to steal */
+PRIVATE void sched_balance ( runqueue_t* rq, uint32_t cpu )
+{
+    rq_refill_all ( rq );
+
+    if ( this_thread () == rq->idle ) {
+        if ( cpu_takes_threads ( cpu ) && can_steal ( cpu ) )
+            rq->need_resched = true;
+    } else if ( rq_best_prio ( rq ) < SCHED_PRIORITIES )
+        kick_idle_cpu ( cpu );
+}
+
+void sched_tick ( void )
+{
+    runqueue_t* rq;
+    thread_t* self = this_thread ();
+    uint32_t cpu;
+
+    if ( !self )
+        return;
+
+    cpu = smp_processor_id ();
+    rq = &runqueues[cpu];
+    self->runtime++;
+
+    if ( ++rq->balance_ticks >= balance_ticks ) {
+        rq->balance_ticks = 0;
+        sched_balance ( rq, cpu );
+    }
+
+    if ( self == rq->idle )
+        return;
+
+    if ( self->slice )
+        self->slice--;
+    if ( !self->slice )
+        rq->need_resched = true;
+}
+
+bool sched_need_resched ( void )
+{
+    return this_rq ()->need_resched;
+}
+
+void sched_preempt ( void )
+{
+    runqueue_t* rq = this_rq ();
+    thread_t* self = this_thread ();
+
+    /* The idle thread may be in the middle of cpu_idle, with the tick
+     * stopped. It schedules itself, on its way out */
+    if ( self && self != rq->idle && rq->need_resched && !in_softirq () &&
+         preemptible () )
+        schedule ();
+}
+
+bool sched_running ( void )
+{
+    return running;
+}
+
+void sched_set_cpus ( uint32_t n )
+{
+    uint32_t mask = 1, cpu, flags;
+
+    for ( cpu = 1; cpu < MAX_CPUS && n > 1; cpu++ ) {
+        if ( cpu_online ( cpu ) ) {
+            mask |= 1U << cpu;
+            n--;
+        }
+    }
+    sched_allowed = mask;
+
+    /* The ones left out give their threads away the next time they
+     * schedule. Make that now */
+    flags = irq_save ();
+    for ( cpu = 1; cpu < MAX_CPUS; cpu++ ) {
+        if ( ( sched_online & ( 1U << cpu ) ) && !( mask & ( 1U << cpu ) ) ) {
+            runqueues[cpu].need_resched = true;
+            smp_send_resched ( cpu );
+        }
+    }
+    irq_restore ( flags );
+}
+
+/* Whether there's anything for this CPU to do */
+PRIVATE bool cpu_has_work ( runqueue_t* rq, uint32_t cpu )
+{
+    if ( rq->need_resched || rq->wakeups )
+        return true;
+    if ( !cpu_takes_threads ( cpu ) )
+        return false;
+    return rq_best_prio ( rq ) < SCHED_PRIORITIES || can_steal ( cpu );
+}
+
+/* What each CPU's idle thread runs. Never blocks, so there's always
+ * something to switch to. Idle threads stay on their CPU */
+PRIVATE void idle_loop ( void )
+{
+    runqueue_t* rq;
+    uint32_t cpu;
+
+    cpu = smp_processor_id ();
+    rq = &runqueues[cpu];
+    for ( ;; ) {
+        __asm volatile ( "cli" );
+        if ( !cpu_has_work ( rq, cpu ) ) {
+            /* Tell wakers we're free, then look again: they may have been
+             * and gone in between */
+            atomic_or ( &idle_cpus, 1U << cpu );
+            if ( !cpu_has_work ( rq, cpu ) )
+                cpu_idle ();
+            atomic_and ( &idle_cpus, ~( 1U << cpu ) );
+        }
+        __asm volatile ( "sti" );
+        if ( cpu_has_work ( rq, cpu ) )
+            schedule ();
+    }
+}
+
+PRIVATE void idle_thread ( uint32_t arg )
+{
+    UNUSED ( arg );
+    idle_loop ();
+}
+
+void init_sched ( void )
+{
+    runqueue_t* rq;
+    thread_t* self;
+    uint32_t i, prio, flags;
+
+    for ( i = 0; i < MAX_CPUS; i++ ) {
+        for ( prio = 0; prio < SCHED_PRIORITIES; prio++ ) {
+            wsdeque_init ( &runqueues[i].queues[prio] );
+            list_init ( &runqueues[i].expired[prio] );
+        }
+    }
+
+    timeslice_ticks = THREAD_TIMESLICE_MS * timer_get_frequency () / 1000;
+    if ( !timeslice_ticks )
+        timeslice_ticks = 1;
+    balance_ticks = SCHED_BALANCE_MS * timer_get_frequency () / 1000;
+    if ( !balance_ticks )
+        balance_ticks = 1;
+
+    flags = irq_save ();
+    rq = this_rq ();
+
+    /* We're main. Our stack is the boot stack */
+    self = thread_alloc ( "main", THREAD_PRIO_NORMAL );
+    self->state = THREAD_RUNNING;
+    self->on_cpu = 1;
+    self->slice = timeslice_ticks;
+    this_cpu_write ( current, self );
+
+    /* The idle thread is never queued: it runs when there's nothing to
+     * take off one */
+    rq->idle = thread_alloc ( "idle", THREAD_PRIO_LOWEST );
+    rq->idle->stack = pmm_alloc_blocks ( THREAD_STACK_PAGES );
+    rq->idle->func = &idle_thread;
+    rq->idle->arg = 0;
+    setup_stack ( rq->idle );
+    rq->idle->state = THREAD_RUNNABLE;
+
+    atomic_or ( &sched_online, 1 );
+    running = true;
+    irq_restore ( flags );
+}
+
+void sched_init_cpu ( void )
+{
+    runqueue_t* rq;
+    thread_t* self;
+    uint32_t cpu;
+
+    cpu = smp_processor_id ();
+    rq = &runqueues[cpu];
+
+    /* We keep the stack the AP came up on */
+    self = thread_alloc ( "idle", THREAD_PRIO_LOWEST );
+    if ( !self )
+        kpanic ( "sched: no thread for an idle CPU" );
+    self->state = THREAD_RUNNING;
+    self->on_cpu = 1;
+    rq->idle = self;
+    this_cpu_write ( current, self );
+
+    atomic_or ( &sched_online, 1U << cpu );
+    idle_loop ();
+}
@@ -0,0 +1,173 @@
+#ifndef SCHED_H
+#define SCHED_H
+#include <stdinc.h>
+#include <list.h>
+#include <ktimer.h>
+#include <fpu.h>
+#include <mem/pmm.h>
+/*
+ * Kernel threads, and the scheduler that shares the CPU between them.
+ *
+ * A thread is a function with a stack of its own. thread_create() sets one
+ * up so that the first time the scheduler switches to it, it "returns" into
+ * the function. From then on, switching threads is switch_context() (in
+ * sched_s.s): push the callee-saved registers on the old thread's stack, save
+ * its stack pointer, load the new one's, and pop its registers. Everything
+ * else a thread had going (the C caller-saved registers, an interrupt frame)
+ * is already on its stack. The FPU registers are saved separately, and only
+ * if the thread used them (see fpu.h).
+ *
+ * kernel_main becomes a thread too ("main"), keeping the boot stack. Each
+ * CPU has an idle thread that runs when nobody else can: the other CPUs'
+ * are what they were doing when they came up (see sched_init_cpu).
+ *
+ * The scheduler is round-robin with priorities. There are SCHED_PRIORITIES
+ * levels, 0 being the most important. A thread runs for a timeslice
+ * (THREAD_TIMESLICE_MS), and a less important thread only runs when every
+ * more important one on its CPU is blocked or asleep.
+ *
+ * Each CPU has run queues of its own, one per priority, so that CPUs don't
+ * fight over them. Each is a work-stealing deque (see wsdeque.h): the CPU
+ * pushes and pops threads at the bottom, without locking anything, and an
+ * idle CPU steals them from the top. Popping from the bottom runs whoever
+ * was queued last, which is the one most likely to still be in the cache.
+ * To keep that from starving the others, threads that have used up their
+ * timeslice go on a list of expired threads instead, and only go back in
+ * the deque when it's empty: everyone gets a turn before anyone gets a
+ * second one.
+ *
+ * Threads woken up go to the CPU they last ran on if it's idle (its cache is
+ * still warm with them), or else to the CPU that woke them. Other CPUs can't
+ * push onto a deque, so they leave them in its wakeup list, and interrupt it
+ * (IPI_RESCHED_VECTOR, see smp.h) if it's idle or running something less
+ * important. Every SCHED_BALANCE_MS, each CPU's tick checks whether it has
+ * threads waiting while another CPU is idle, and if so kicks that CPU into
+ * stealing them.
+ *
+ * Threads are preempted: the timer tick (sched_tick) counts down the
+ * timeslice, and waking a thread more important than the one running asks
+ * for a reschedule. Either way, the switch happens on the way out of the
+ * interrupt (sched_preempt, called by irq_handler), or when the running
+ * thread calls schedule() itself. There are never switches while softirqs
+ * are running, while interrupts are disabled, or while preemption is (see
+ * preempt.h): disabling interrupts is what keeps the current thread on its
+ * CPU.
+ *
+ * A thread may be picked by another CPU as soon as it's in a run queue, so
+ * it only goes in one once it's completely off its old CPU: the CPU that
+ * switches away from a thread puts it back in its queue after the switch
+ * (on_cpu tells whoever wakes it when that is).
+ *
+ * There's no heap, so there's a fixed number of threads (MAX_THREADS). A
+ * thread's stack stays with its slot when it exits, to be reused by the next
+ * thread created in it (the PMM can't take blocks back anyway).
+ */
+
+#define MAX_THREADS          64
+#define THREAD_STACK_PAGES   2
+#define THREAD_STACK_SIZE    ( THREAD_STACK_PAGES * PAGE_SIZE )
+#define THREAD_NAME_LEN      16
+
+#define SCHED_PRIORITIES     8
+#define THREAD_PRIO_HIGHEST  0
+#define THREAD_PRIO_NORMAL   4
+#define THREAD_PRIO_LOWEST   ( SCHED_PRIORITIES - 1 )
+
+#define THREAD_TIMESLICE_MS  10
+#define SCHED_BALANCE_MS     20
+
+/* Thread states */
+#define THREAD_UNUSED        0 /* A free slot */
+#define THREAD_RUNNING       1
+#define THREAD_RUNNABLE      2 /* In a run queue */
+#define THREAD_SLEEPING      3 /* Until its sleep_timer goes off */
+#define THREAD_BLOCKED       4 /* Until someone calls thread_wake */
+#define THREAD_DEAD          5 /* Exited, its slot not yet free */
+
+typedef void ( *thread_func_t ) ( uint32_t arg );
+
+typedef struct thread {
+    uint32_t esp;              /* Saved by switch_context */
+    uint32_t id;
+    volatile uint32_t state;
+    uint32_t priority;
+    uint32_t slice;            /* Ticks left of its timeslice */
+    uint64_t runtime;          /* Ticks it has been running for */
+    uint32_t cpu;              /* The CPU it runs, or last ran, on */
+    volatile uint32_t on_cpu;  /* Until it's switched away from for good */
+    volatile uint32_t wake_pending; /* Woken while running (see thread_block) */
+    list_node_t run_node;      /* In its CPU's expired list */
+    struct thread* wake_next;  /* In a CPU's wakeup list */
+    ktimer_t sleep_timer;
+    thread_func_t func;
+    uint32_t arg;
+    uint32_t stack;            /* The lowest address. 0 for main's */
+    uint32_t esp0;             /* Its kernel stack while it's in ring 3, 0 if
+                                * it isn't (see syscall.h) */
+    char name[THREAD_NAME_LEN];
+    bool fpu_used;             /* Its FPU state isn't the clean one */
+    uint32_t fpu_cpu;          /* Whose registers last held its FPU state */
+    fpu_state_t fpu;           /* Saved when it's switched away from */
+} thread_t;
+
+/* Turn kernel_main into the main thread, and start scheduling. Must be
+ * called after init_vmm (for the stacks) and init_timer */
+void init_sched ( void );
+
+/* For the other CPUs, once they're up, with interrupts disabled: become
+ * this CPU's idle thread, and start running threads. Never returns */
+void sched_init_cpu ( void );
+
+/* Whether init_sched has been called */
+bool sched_running ( void );
+
+/* Only let the first n online CPUs run threads (at least the boot CPU). The
+ * others finish what they have queued and stay idle. For measuring how
+ * things scale with the number of CPUs */
+void sched_set_cpus ( uint32_t n );
+
+/* Create a thread that runs func(arg), and make it runnable. When func
+ * returns, the thread exits. Returns NULL if there are no free slots, or if
+ * the scheduler isn't running yet */
+thread_t* thread_create ( const char* name, thread_func_t func, uint32_t arg,
+                          uint32_t priority );
+
+thread_t* thread_current ( void );
+
+/* Give the CPU to the next thread of the same priority, if there is one */
+void thread_yield ( void );
+
+/* Sleep for at least ms milliseconds */
+void thread_sleep ( uint32_t ms );
+
+/* Stop the current thread for good */
+void thread_exit ( void );
+
+/* Sleep until thread_wake. Must be called with interrupts disabled, after
+ * checking whatever the thread is waiting for: that way, the wakeup can't
+ * come in between the check and the sleep, at least not from this CPU. One
+ * from another CPU that comes in between leaves wake_pending set, and then
+ * thread_block returns straight away. Wakeups can be spurious, so the check
+ * should be in a loop. Before init_sched, it's the same as cpu_idle. Most
+ * code wants wait_event instead, which does all that (see wait.h) */
+void thread_block ( void );
+
+/* Make t runnable, if it's blocked or sleeping. Safe to call from interrupt
+ * handlers, and from any CPU */
+void thread_wake ( thread_t* t );
+
+/* Switch to whichever thread should be running. Safe to call with interrupts
+ * disabled or enabled, but not from interrupt handlers */
+void schedule ( void );
+
+/* For the timer tick, on every CPU that has one: account for the current
+ * thread's time, and balance the load now and then */
+void sched_tick ( void );
+
+/* Whether schedule() has something to do */
+bool sched_need_resched ( void );
+
+/* For the end of irq_handler: switch threads if one is due */
+void sched_preempt ( void );
+
+#endif
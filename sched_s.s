@@ -0,0 +1,35 @@
+; sched_s.s -- Switching between threads (see sched.h)
+
+; void switch_context(uint32_t* old_esp, uint32_t new_esp)
+;
+; Saves the callee-saved registers on the current stack and the stack
+; pointer in *old_esp, then does the opposite with new_esp. It returns to
+; whoever called switch_context on the new thread's stack, or, for a new
+; thread, to thread_entry (see thread_create).
+global switch_context:function switch_context.end-switch_context
+switch_context:
+    mov eax, [esp+4]
+    mov edx, [esp+8]
+
+    push ebp
+    push ebx
+    push esi
+    push edi
+    mov [eax], esp
+
+    mov esp, edx
+    pop edi
+    pop esi
+    pop ebx
+    pop ebp
+    ret
+.end:
+
+; C function in sched.c
+extern thread_start
+
+; Where new threads start. thread_start never returns
+global thread_entry:function thread_entry.end-thread_entry
+thread_entry:
+    call thread_start
+.end:
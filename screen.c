@@ -1,15 +1,28 @@
 #include <screen.h>
+#include <fbcon.h>
+#include <spinlock.h>
 
 #define FG_COLOR FG_WHITE
 #define BG_COLOR BG_BLACK
-#define SCREEN_W 80
-#define SCREEN_H 25
+#define VGA_TEXT_W 80
+#define VGA_TEXT_H 25
 #define TAB_WIDTH 8
 
 /* The VGA framebuffer starts at 0xB8000. */
 uint16_t* vmem = (uint16_t*) /*0xB8000*/ 0xC00B8000;
 uint8_t cursor_x = 0, cursor_y = 0;
 
+/* The console's size. It's VGA text mode's until screen_use_buffer() */
+PRIVATE uint32_t screen_w = VGA_TEXT_W;
+PRIVATE uint32_t screen_h = VGA_TEXT_H;
+
+/* Whether vmem is the framebuffer console's shadow buffer (see fbcon.h) */
+PRIVATE bool on_fbcon = false;
+
+/* Keeps lines from different CPUs (or from an interrupt handler) from
+ * getting mixed up, and the cursor consistent */
+PRIVATE spinlock_t screen_lock = SPINLOCK_INIT("screen");
+
 uint16_t fg_mask = FG_COLOR;
 uint16_t bg_mask = BG_COLOR;
 #define BLANK (' ' | fg_mask | bg_mask)
@@ -26,11 +39,25 @@ void set_bg_color(uint8_t c)
   bg_mask = BG_FROM_COLOR(c);
 }
 
-#define VIDEO_XY(x,y) vmem[ (x) + (y)*SCREEN_W ]
+void screen_use_buffer(uint16_t* buffer, uint32_t w, uint32_t h)
+{
+  vmem = buffer;
+  screen_w = w;
+  screen_h = h;
+  cursor_x = cursor_y = 0;
+  on_fbcon = true;
+}
+
+#define VIDEO_XY(x,y) vmem[ (x) + (y)*screen_w ]
 
 PRIVATE void update_cursor_pos()
 {
-  uint16_t pos = cursor_y * SCREEN_W + cursor_x;
+  uint16_t pos = cursor_y * screen_w + cursor_x;
+
+  /* There's no hardware cursor on a framebuffer */
+  if (on_fbcon)
+    return;
+
   outb(0x3D4, 14);                  /* Tell the VGA board we are setting the high cursor byte. */
   outb(0x3D5, pos >> 8);            /* Send the high cursor byte. */
   outb(0x3D4, 15);                  /* Tell the VGA board we are setting the low cursor byte. */
@@ -41,32 +68,41 @@ PRIVATE void update_cursor_pos()
 PRIVATE void scroll()
 { 
   /* Row 25 is the end, this means we need to scroll up */
-  if(cursor_y >= SCREEN_H)
+  if(cursor_y >= screen_h)
   {
-    int last_line_offset = SCREEN_W*(SCREEN_H-1);
+    int last_line_offset = screen_w*(screen_h-1);
     /* Move the current text chunk that makes up the screen
        back in the buffer by a line */
     int i;
     for (i = 0; i < last_line_offset; i++)
-      vmem[i] = vmem[i+SCREEN_W];
+      vmem[i] = vmem[i+screen_w];
 
     /* The last line should now be blank. Clear it */
-    for (i = last_line_offset; i < SCREEN_W*SCREEN_H; i++)
+    for (i = last_line_offset; i < (int)(screen_w*screen_h); i++)
       vmem[i] = BLANK;
 
     /* The cursor should now be on the last line. */
-    cursor_y = SCREEN_H-1;
+    cursor_y = screen_h-1;
+
+    if (on_fbcon)
+      fbcon_refresh();
   }
 }
 
 void screen_clear(void)
 {
-  int i;
-  for ( i = 0 ; i < SCREEN_W*SCREEN_H; i++)
+  uint32_t i, flags;
+
+  flags = spin_lock_irqsave(&screen_lock);
+  for ( i = 0 ; i < screen_w*screen_h; i++)
     vmem[i] = BLANK;
+
+  if (on_fbcon)
+    fbcon_refresh();
+  spin_unlock_irqrestore(&screen_lock, flags);
 }
 
-void screen_putc(char c)
+PRIVATE void putc_locked(char c)
 {
 
   /* Handle a backspace, by moving the cursor back one space */
@@ -93,12 +129,14 @@ void screen_putc(char c)
   else if(c >= ' ')
   {
       VIDEO_XY(cursor_x,cursor_y) = c | fg_mask | bg_mask;
+      if (on_fbcon)
+        fbcon_update_cell(cursor_x, cursor_y);
       cursor_x++;
   }
 
   /* Check if we need to insert a new line because we have reached the end
     of the screen. */
-  if (cursor_x >= SCREEN_W)
+  if (cursor_x >= screen_w)
   {
       cursor_x = 0;
       cursor_y ++;
@@ -110,10 +148,28 @@ void screen_putc(char c)
   update_cursor_pos();
 }
 
+void screen_putc(char c)
+{
+  uint32_t flags;
+
+  flags = spin_lock_irqsave(&screen_lock);
+  putc_locked(c);
+  spin_unlock_irqrestore(&screen_lock, flags);
+}
+
 void screen_puts(const char* c)
 {
+    uint32_t flags;
+
+    flags = spin_lock_irqsave(&screen_lock);
     while (*c)
-      screen_putc(*c++);
+      putc_locked(*c++);
+    spin_unlock_irqrestore(&screen_lock, flags);
+}
+
+void screen_bust_lock(void)
+{
+  spin_lock_init(&screen_lock, "screen");
 }
 
 PRIVATE void fast_string_reverse (char* s, uint32_t len) {
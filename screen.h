@@ -18,10 +18,19 @@ void screen_put_hex(uint32_t n);
 /* Print decimal number */
 void screen_put_int(int32_t n);
 
+/* Forget whoever holds the console's lock. Only for kpanic, which must get
+ * its message out even if it interrupted a print */
+void screen_bust_lock(void);
+
 /* Set fg and bg colors */
 void set_fg_color(uint8_t c);
 void set_bg_color(uint8_t c);
 
+/* Make the console a w x h grid of cells kept in buffer (in the same format
+ * as VGA text memory) instead of VGA text mode. Used by the framebuffer
+ * console, which draws that buffer (see fbcon.h) */
+void screen_use_buffer(uint16_t* buffer, uint32_t w, uint32_t h);
+
 #define VGA_BLACK           0
 #define VGA_BLUE            1
 #define VGA_GREEN           2
@@ -0,0 +1,87 @@
+#ifndef SEQLOCK_H
+#define SEQLOCK_H
+#include <stdinc.h>
+#include <spinlock.h>
+#include <x86/x86.h>
+/*
+ * Sequence counters and seqlocks: for data that's read often and written
+ * seldom, by someone who can't wait for the readers (an interrupt handler,
+ * say).
+ *
+ * The writer increments the sequence before and after each update, so it's
+ * odd while an update is in progress. Readers read the sequence, then the
+ * data, then the sequence again. If it changed, or was odd to begin with,
+ * the data may be torn, and they read it all again:
+ *
+ *      do {
+ *          seq = read_seqcount_begin ( &s );
+ *          copy = data;
+ *      } while ( read_seqcount_retry ( &s, seq ) );
+ *
+ * Readers don't write anything, so they don't take a lock, disable
+ * interrupts or bounce cache lines between CPUs: when nobody's writing, it's
+ * two loads of the sequence on top of the data. x86 doesn't reorder loads
+ * with loads, or stores with stores, so only the compiler needs holding back.
+ *
+ * A seqcount_t leaves keeping writers apart to its user: there must be only
+ * one at a time, and it must not be interrupted by a reader on the same CPU,
+ * which would spin forever waiting for the sequence to be even again. So
+ * writers disable interrupts (or are an interrupt handler). A seqlock_t adds
+ * a spinlock for when there can be several writers, and its write functions
+ * take care of interrupts too.
+ *
+ * Readers can't follow pointers in the data they read, since the writer may
+ * change or free what they point to mid-read. Copy out plain values only.
+ */
+
+typedef struct {
+    volatile uint32_t sequence;
+} seqcount_t;
+
+#define SEQCOUNT_INIT { 0 }
+
+/* Returns the sequence to pass to read_seqcount_retry */
+#define read_seqcount_begin(s) __extension__ ( {                              \
+    uint32_t seq__;                                                           \
+    while ( ( seq__ = ( s )->sequence ) & 1 )                                 \
+        cpu_relax ();                                                         \
+    barrier ();                                                               \
+    seq__; } )
+
+/* Whether what was read since read_seqcount_begin must be read again */
+#define read_seqcount_retry(s, start) __extension__ ( {                       \
+    barrier ();                                                               \
+    ( s )->sequence != ( start ); } )
+
+#define write_seqcount_begin(s) do {                                          \
+    ( s )->sequence++;                                                        \
+    barrier ();                                                               \
+} while ( 0 )
+
+#define write_seqcount_end(s) do {                                            \
+    barrier ();                                                               \
+    ( s )->sequence++;                                                        \
+} while ( 0 )
+
+typedef struct {
+    seqcount_t seq;
+    spinlock_t lock;
+} seqlock_t;
+
+#define SEQLOCK_INIT(name) { SEQCOUNT_INIT, SPINLOCK_INIT ( name ) }
+
+#define read_seqbegin(sl)         read_seqcount_begin ( &( sl )->seq )
+#define read_seqretry(sl, start)  read_seqcount_retry ( &( sl )->seq, start )
+
+/* Returns the flags for write_sequnlock_irqrestore */
+#define write_seqlock_irqsave(sl) __extension__ ( {                           \
+    uint32_t flags__ = spin_lock_irqsave ( &( sl )->lock );                   \
+    write_seqcount_begin ( &( sl )->seq );                                    \
+    flags__; } )
+
+#define write_sequnlock_irqrestore(sl, flags) do {                            \
+    write_seqcount_end ( &( sl )->seq );                                      \
+    spin_unlock_irqrestore ( &( sl )->lock, flags );                          \
+} while ( 0 )
+
+#endif
@@ -0,0 +1,179 @@
+#include <smp.h>
+#include <apic.h>
+#include <fpu.h>
+#include <gdt.h>
+#include <idle.h>
+#include <idt.h>
+#include <internal_timer.h>
+#include <mem.h>
+#include <mem/pmm.h>
+#include <mem/vmm.h>
+#include <sched.h>
+#include <syscall.h>
+#include <screen.h>
+#include <x86/x86.h>
+
+/* In smp_s.s */
+extern uint8_t smp_trampoline_start[];
+extern uint8_t smp_trampoline_end[];
+extern uint8_t smp_trampoline_cr3[];
+extern uint8_t smp_trampoline_cr4[];
+extern uint8_t smp_trampoline_stack[];
+
+/* In irq_s.s */
+extern void irq25 ();
+
+PRIVATE volatile uint32_t online_mask = 1; /* The BSP is always up */
+
+/* The AP being started, and the PAT it has to copy from the BSP (see
+ * vmm_init_write_combining) */
+PRIVATE volatile uint32_t booting_cpu;
+PRIVATE bool have_pat = false;
+PRIVATE uint64_t bsp_pat;
+
+/* Where a trampoline variable ended up in the copy */
+PRIVATE uint32_t* trampoline_var ( uint8_t* var )
+{
+    return ( uint32_t* ) KERNEL_PHYS_TO_VIRT ( AP_TRAMPOLINE + ( var - smp_trampoline_start ) );
+}
+
+PRIVATE void cpu_set_online ( uint32_t cpu )
+{
+    __asm volatile ( "lock orl %1, %0" : "+m" ( online_mask ) : "r" ( 1U << cpu ) : "memory" );
+}
+
+void ap_main ( void )
+{
+    uint32_t cpu = booting_cpu;
+
+    gdt_init_cpu ( cpu );
+    idt_load ();
+    fpu_init_cpu ();
+    syscall_init_cpu ();
+    if ( have_pat )
+        wrmsr ( MSR_IA32_PAT, bsp_pat );
+    lapic_init_cpu ();
+
+    idle_init_cpu ();
+    cpu_set_online ( cpu );
+
+    /* Without a tick of our own, nothing would ever preempt the threads we
+     * ran. Then we just handle interrupts */
+    if ( timer_init_cpu () )
+        sched_init_cpu ();
+    for ( ;; )
+        cpu_idle ();
+}
+
+/* Nothing to do here, sched_preempt does it on the way out */
+PRIVATE void resched_ipi ( registers_t* regs )
+{
+    UNUSED ( regs );
+}
+
+void smp_send_resched ( uint32_t cpu )
+{
+    /* One sleeping in mwait only needs a poke */
+    if ( idle_wake_cpu ( cpu ) )
+        return;
+    if ( cpu_online ( cpu ) && apic_enabled () )
+        lapic_send_ipi ( apic_get_config ()->cpu_apic_ids[cpu],
+                         LAPIC_ICR_FIXED | IPI_RESCHED_VECTOR );
+}
+
+PRIVATE bool smp_boot_ap ( uint32_t cpu, uint8_t apic_id )
+{
+    uint32_t stack, i;
+
+    stack = pmm_alloc_blocks ( AP_STACK_PAGES );
+    if ( !stack )
+        return false;
+
+    *trampoline_var ( smp_trampoline_stack ) = stack + AP_STACK_SIZE;
+    booting_cpu = cpu;
+
+    lapic_send_ipi ( apic_id, LAPIC_ICR_INIT | LAPIC_ICR_ASSERT | LAPIC_ICR_LEVEL );
+    pit_busy_wait ( 10 );
+    lapic_send_ipi ( apic_id, LAPIC_ICR_INIT | LAPIC_ICR_LEVEL );
+
+    for ( i = 0; i < 2; i++ ) {
+        lapic_send_ipi ( apic_id, LAPIC_ICR_STARTUP | ( AP_TRAMPOLINE >> 12 ) );
+        pit_busy_wait ( 1 );
+    }
+
+    for ( i = 0; i < AP_BOOT_TIMEOUT_MS && !cpu_online ( cpu ); i++ )
+        pit_busy_wait ( 1 );
+
+    /* The stack is lost if it didn't come up, but so is the CPU */
+    return cpu_online ( cpu );
+}
+
+uint32_t init_smp ( void )
+{
+    const apic_config_t* config;
+    uint32_t cpu, edx, cr3, cr4;
+
+    if ( !apic_enabled () )
+        return 1;
+
+    config = apic_get_config ();
+    if ( config->num_cpus == 1 )
+        return 1;
+
+    idt_set_gate ( IPI_RESCHED_VECTOR, ( uint32_t ) irq25, IDT_SELECTOR,
+                   IDT_32BIT_INTERRUPT_GATE );
+    register_interrupt_handler ( IPI_RESCHED_VECTOR, &resched_ipi );
+
+    /* The trampoline runs at the same address with paging on and off */
+    memcpy ( ( void* ) KERNEL_PHYS_TO_VIRT ( AP_TRAMPOLINE ), smp_trampoline_start,
+             smp_trampoline_end - smp_trampoline_start );
+    vmm_map_page ( AP_TRAMPOLINE, AP_TRAMPOLINE );
+
+    __asm volatile ( "mov %%cr3, %0" : "=r" ( cr3 ) );
+    __asm volatile ( "mov %%cr4, %0" : "=r" ( cr4 ) );
+    *trampoline_var ( smp_trampoline_cr3 ) = cr3;
+    *trampoline_var ( smp_trampoline_cr4 ) = cr4;
+
+    cpuid ( 1, NULL, NULL, NULL, &edx );
+    if ( edx & CPUID_FEAT_EDX_PAT ) {
+        have_pat = true;
+        bsp_pat = rdmsr ( MSR_IA32_PAT );
+    }
+
+    for ( cpu = 1; cpu < config->num_cpus; cpu++ ) {
+        if ( !smp_boot_ap ( cpu, config->cpu_apic_ids[cpu] ) ) {
+            screen_puts ( "SMP: CPU " );
+            screen_put_int ( cpu );
+            screen_puts ( " didn't come up\n" );
+        }
+    }
+
+    screen_puts ( "SMP: " );
+    screen_put_int ( num_online_cpus () );
+    screen_puts ( " of " );
+    screen_put_int ( config->num_cpus );
+    screen_puts ( " CPU(s) online\n" );
+
+    return num_online_cpus ();
+}
+
+uint32_t smp_online_mask ( void )
+{
+    return online_mask;
+}
+
+bool cpu_online ( uint32_t cpu )
+{
+    return cpu < MAX_CPUS && ( online_mask & ( 1U << cpu ) );
+}
+
+uint32_t num_online_cpus ( void )
+{
+    uint32_t mask = online_mask, n = 0;
+
+    while ( mask ) {
+        mask &= mask - 1;
+        n++;
+    }
+    return n;
+}
@@ -0,0 +1,69 @@
+#ifndef SMP_H
+#define SMP_H
+#include <stdinc.h>
+#include <apic.h>
+#include <percpu.h>
+/*
+ * Starting the other CPUs.
+ *
+ * At power on, only the boot CPU (the BSP) runs. The others (the APs) sit
+ * waiting for the BSP to wake them up through their LAPICs: an INIT IPI
+ * resets them, and a STARTUP IPI (SIPI) has them start executing, in real
+ * mode, at the start of the page whose number is the SIPI's vector. That page
+ * must be below 1MB, so we copy a small trampoline (see smp_s.s) down to
+ * AP_TRAMPOLINE. It switches to protected mode with a flat GDT of its own,
+ * turns on paging with the BSP's page directory, and jumps to ap_main in the
+ * higher half, on a stack the BSP allocated for it.
+ *
+ * The BSP sends INIT, waits 10ms, then SIPI twice (the second one is ignored
+ * if the first one worked, as Intel's MP spec says to do), and waits for the
+ * AP to mark itself online before starting the next one: they all share the
+ * trampoline, and its stack pointer.
+ *
+ * An AP then loads its own GDT, TSS and per-CPU area (see gdt.h and
+ * percpu.h), the shared IDT, enables its LAPIC, starts its own tick if the
+ * LAPIC timer is what ticks (see timer_init_cpu), and joins the scheduler as
+ * one more CPU to run threads on (see sched_init_cpu). Device IRQs, the
+ * global tick and the ktimers it runs stay with the BSP.
+ *
+ * CPUs tell each other to look at their run queues with IPI_RESCHED_VECTOR
+ * (smp_send_resched). Its handler does nothing: the work is done on the way
+ * out of the interrupt, like after any other (see sched_preempt).
+ *
+ * CPUs are numbered from 0 (the BSP) in the order the firmware lists them
+ * (see apic_get_config). Try it with qemu -smp 4.
+ */
+
+/* Where the trampoline is copied to. Must be page aligned, and below 1MB.
+ * The same number is in smp_s.s */
+#define AP_TRAMPOLINE      0x8000
+
+#define AP_STACK_PAGES     2
+#define AP_STACK_SIZE      ( AP_STACK_PAGES * 0x1000 )
+
+/* How long to wait for an AP to come up before giving up on it */
+#define AP_BOOT_TIMEOUT_MS 100
+
+/* Right after the LAPIC timer's */
+#define IPI_RESCHED_VECTOR 57
+
+/* Start every AP the APIC tables list. Must be called after init_apic, with
+ * interrupts disabled. Returns how many CPUs are online (at least 1) */
+uint32_t init_smp ( void );
+
+/* The number of the CPU we're running on */
+#define smp_processor_id() this_cpu_read ( cpu )
+
+/* Bit n is set if CPU n is up */
+uint32_t smp_online_mask ( void );
+bool cpu_online ( uint32_t cpu );
+uint32_t num_online_cpus ( void );
+
+/* Interrupt cpu, so that it schedules on its way out (see sched.h). Does
+ * nothing if it's not up */
+void smp_send_resched ( uint32_t cpu );
+
+/* Where each AP goes once the trampoline is done. Never returns */
+void ap_main ( void );
+
+#endif
@@ -0,0 +1,88 @@
+; smp_s.s -- Where the APs start (see smp.h)
+;
+; This is copied to AP_TRAMPOLINE and runs from there, so anything that
+; refers to a label in it has to go through TRAMP(). The APs start in real
+; mode, with CS = AP_TRAMPOLINE >> 4 and IP = 0.
+
+AP_TRAMPOLINE equ 0x8000 ; Same as in smp.h
+
+; CR0, loaded whole rather than OR'd into: INIT leaves CD and NW as they
+; were, and they're set from power-on, which would have the AP run with its
+; caches off. So these leave them clear. NE and MP are as fpu_init_cpu wants
+; them (see fpu.c), and ET is hardwired to 1 on anything recent anyway
+CR0_PE  equ 0x00000001
+CR0_MP  equ 0x00000002
+CR0_ET  equ 0x00000010
+CR0_NE  equ 0x00000020
+CR0_PG  equ 0x80000000
+
+%define TRAMP(x) (AP_TRAMPOLINE + (x) - smp_trampoline_start)
+
+; C function in smp.c
+extern ap_main
+
+section .text
+
+[bits 16]
+global smp_trampoline_start
+smp_trampoline_start:
+    cli
+    cld
+    mov ax, cs
+    mov ds, ax
+    lgdt [tramp_gdtr - smp_trampoline_start]
+
+    mov eax, CR0_PE | CR0_ET | CR0_NE | CR0_MP
+    mov cr0, eax
+    jmp dword 0x08:TRAMP(tramp_32)
+
+[bits 32]
+tramp_32:
+    mov ax, 0x10
+    mov ds, ax
+    mov es, ax
+    mov fs, ax
+    mov gs, ax
+    mov ss, ax
+
+    ; Same paging setup as the BSP. We're identity mapped, so nothing
+    ; changes under our feet
+    mov eax, [TRAMP(smp_trampoline_cr4)]
+    mov cr4, eax
+    mov eax, [TRAMP(smp_trampoline_cr3)]
+    mov cr3, eax
+    mov eax, CR0_PG | CR0_PE | CR0_ET | CR0_NE | CR0_MP
+    mov cr0, eax
+
+    mov esp, [TRAMP(smp_trampoline_stack)]
+    mov eax, ap_main
+    call eax
+.hang:
+    cli
+    hlt
+    jmp .hang
+
+; Flat code and data segments, just to get to the higher half. The AP loads
+; its real GDT there
+align 8
+tramp_gdt:
+    dq 0
+    dq 0x00CF9A000000FFFF
+    dq 0x00CF92000000FFFF
+tramp_gdtr:
+    dw tramp_gdtr - tramp_gdt - 1
+    dd TRAMP(tramp_gdt)
+
+; Filled in by init_smp, in the copy
+global smp_trampoline_cr3
+smp_trampoline_cr3:
+    dd 0
+global smp_trampoline_cr4
+smp_trampoline_cr4:
+    dd 0
+global smp_trampoline_stack
+smp_trampoline_stack:
+    dd 0
+
+global smp_trampoline_end
+smp_trampoline_end:
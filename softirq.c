@@ -0,0 +1,116 @@
+#include <softirq.h>
+#include <percpu.h>
+#include <x86/x86.h>
+
+PRIVATE softirq_handler_t softirq_handlers[MAX_SOFTIRQS];
+
+/* Put t at the end of this CPU's queue. Interrupts must be disabled */
+PRIVATE void tasklet_enqueue ( tasklet_t* t )
+{
+    t->next = NULL;
+    if ( this_cpu_read ( tasklet_tail ) )
+        this_cpu_read ( tasklet_tail )->next = t;
+    else
+        this_cpu_write ( tasklet_head, t );
+    this_cpu_write ( tasklet_tail, t );
+    this_cpu_or ( softirq_pending, 1 << SOFTIRQ_TASKLET );
+}
+
+PRIVATE void tasklet_action ( void )
+{
+    uint32_t flags;
+    tasklet_t* list;
+    tasklet_t* t;
+
+    /* Take this CPU's whole queue at once. Tasklets scheduled from now on
+     * go in a new queue, and get run on the next round */
+    flags = irq_save ();
+    list = this_cpu_read ( tasklet_head );
+    this_cpu_write ( tasklet_head, NULL );
+    this_cpu_write ( tasklet_tail, NULL );
+    irq_restore ( flags );
+
+    while ( list ) {
+        t = list;
+        list = t->next;
+
+        /* Still running on another CPU, which scheduled it again meanwhile:
+         * back it goes, for the next round */
+        if ( atomic_xchg ( &t->running, 1 ) ) {
+            flags = irq_save ();
+            tasklet_enqueue ( t );
+            irq_restore ( flags );
+            continue;
+        }
+
+        /* Clear it before running it, so that it can schedule itself again */
+        atomic_xchg ( &t->scheduled, 0 );
+        t->func ( t->data );
+        atomic_xchg ( &t->running, 0 );
+    }
+}
+
+void init_softirq ( void )
+{
+    open_softirq ( SOFTIRQ_TASKLET, &tasklet_action );
+}
+
+void open_softirq ( uint32_t nr, softirq_handler_t handler )
+{
+    softirq_handlers[nr] = handler;
+}
+
+void raise_softirq ( uint32_t nr )
+{
+    /* A single instruction, so no interrupt can come in halfway */
+    this_cpu_or ( softirq_pending, 1 << nr );
+}
+
+bool softirq_pending ( void )
+{
+    return this_cpu_read ( softirq_pending ) != 0;
+}
+
+bool in_softirq ( void )
+{
+    return this_cpu_read ( in_softirq ) != 0;
+}
+
+bool do_softirq ( void )
+{
+    uint32_t pending, nr, restarts;
+
+    /* Someone further down the stack is already running them */
+    if ( !this_cpu_read ( softirq_pending ) || this_cpu_read ( in_softirq ) )
+        return false;
+    this_cpu_write ( in_softirq, 1 );
+
+    for ( restarts = 0; restarts < MAX_SOFTIRQ_RESTART; restarts++ ) {
+        /* Interrupts are disabled, so nothing gets raised in between */
+        pending = this_cpu_read ( softirq_pending );
+        if ( !pending )
+            break;
+        this_cpu_write ( softirq_pending, 0 );
+
+        __asm volatile ( "sti" );
+        for ( nr = 0; pending; nr++, pending >>= 1 )
+            if ( ( pending & 1 ) && softirq_handlers[nr] )
+                softirq_handlers[nr] ();
+        __asm volatile ( "cli" );
+    }
+    this_cpu_write ( in_softirq, 0 );
+    return true;
+}
+
+void tasklet_schedule ( tasklet_t* t )
+{
+    uint32_t flags;
+
+    /* Whoever sets it queues it, on their own CPU */
+    if ( atomic_xchg ( &t->scheduled, 1 ) )
+        return;
+
+    flags = irq_save ();
+    tasklet_enqueue ( t );
+    irq_restore ( flags );
+}
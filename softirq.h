@@ -0,0 +1,87 @@
+#ifndef SOFTIRQ_H
+#define SOFTIRQ_H
+#include <stdinc.h>
+/*
+ * Deferred work, or "bottom halves".
+ *
+ * Interrupt handlers (the "top halves") run with interrupts disabled, and
+ * the PIC won't give us another interrupt of the same or lower priority until
+ * we've sent it an EOI. Whatever a handler does, it's doing it while the rest
+ * of the machine waits. So handlers should only do what can't wait (talk to
+ * the hardware, grab the data before it's gone) and leave the rest for later.
+ *
+ * "Later" is a softirq. There are a few of them, each with a fixed number
+ * (SOFTIRQ_*) and a handler, set with open_softirq(). A top half calls
+ * raise_softirq() to mark one as pending, and when the outermost interrupt
+ * handler is done and the EOI has been sent, irq_handler() calls do_softirq(),
+ * which runs the pending softirqs with interrupts ENABLED. If another
+ * interrupt comes in meanwhile, it can raise more softirqs, but it won't run
+ * them itself: the do_softirq() that is already running will pick them up.
+ *
+ * To keep a flood of interrupts from starving whatever they interrupted,
+ * do_softirq() only goes around MAX_SOFTIRQ_RESTART times. Whatever is still
+ * pending stays on this CPU, and gets run on its next interrupt exit, or when
+ * it next goes idle (see cpu_idle). The tick doesn't stop while there's any,
+ * so that's a tick away at most.
+ *
+ * Most code doesn't need a softirq of its own, and uses a tasklet instead.
+ * A tasklet is a function and an argument. tasklet_schedule() queues it to
+ * run (once, no matter how many times it's scheduled before it gets to run)
+ * from the SOFTIRQ_TASKLET softirq. A tasklet never runs concurrently with
+ * itself: if it's still running on another CPU when its turn comes, it waits
+ * for the next round.
+ *
+ * Everything is per CPU: each has its own pending softirqs and its own
+ * tasklet queue (in its per_cpu_t, see percpu.h). raise_softirq() and
+ * tasklet_schedule() act on the CPU they're called on, and that CPU runs
+ * the work, on its next interrupt exit. So different softirqs, and the same
+ * softirq, may well be running on several CPUs at once: handlers that share
+ * data between CPUs must lock it.
+ */
+
+/* The softirqs, in the order they are run */
+#define SOFTIRQ_TIMER        0
+#define SOFTIRQ_TASKLET      1
+#define SOFTIRQ_RCU          2
+#define MAX_SOFTIRQS         32
+
+#define MAX_SOFTIRQ_RESTART  10
+
+typedef void ( *softirq_handler_t ) ( void );
+
+typedef struct tasklet {
+    struct tasklet* next;
+    void ( *func ) ( uint32_t data );
+    uint32_t data;
+    volatile uint32_t scheduled; /* Queued on some CPU */
+    volatile uint32_t running;   /* Running on some CPU */
+} tasklet_t;
+
+/* For statically declared tasklets */
+#define TASKLET_INIT(func, data) { NULL, func, data, 0, 0 }
+
+void init_softirq ( void );
+
+/* Set the handler for softirq nr */
+void open_softirq ( uint32_t nr, softirq_handler_t handler );
+
+/* Mark softirq nr as pending on this CPU. Safe to call from interrupt
+ * handlers */
+void raise_softirq ( uint32_t nr );
+
+/* Run the pending softirqs, if we're not already running them. Called with
+ * interrupts disabled, returns with interrupts disabled, but enables them
+ * while running the handlers. Returns whether it ran any */
+bool do_softirq ( void );
+
+/* Whether there are softirqs waiting to run on this CPU */
+bool softirq_pending ( void );
+
+/* Whether this CPU is running softirqs (or tasklets) right now */
+bool in_softirq ( void );
+
+/* Queue t to run from SOFTIRQ_TASKLET on this CPU. Safe to call from
+ * interrupt handlers */
+void tasklet_schedule ( tasklet_t* t );
+
+#endif
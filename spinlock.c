@@ -0,0 +1,311 @@
+#include <spinlock.h>
+#include <mem.h>
+#include <preempt.h>
+#include <x86/x86.h>
+
+/* Who called the lock function, for the statistics */
+#define CALLER() ( ( uint32_t ) __builtin_return_address ( 0 ) )
+
+#ifdef LOCKSTAT
+#define STAT_START(start)                       start = rdtsc ()
+#define STAT_ACQUIRED(l, start, contended, site) lockstat_acquired ( &( l )->stat, start, contended, site )
+#define STAT_RELEASED(l)                        lockstat_released ( &( l )->stat )
+#else
+#define STAT_START(start)                       UNUSED ( start )
+#define STAT_ACQUIRED(l, start, contended, site) do { ( void ) ( contended ); ( void ) ( site ); } while ( 0 )
+#define STAT_RELEASED(l)                        do {} while ( 0 )
+#endif
+
+/* Ticket locks */
+
+void spin_lock_init ( spinlock_t* l, const char* name )
+{
+#ifdef LOCKSTAT
+    memset ( &l->stat, 0, sizeof ( l->stat ) );
+    l->stat.name = name;
+#else
+    UNUSED ( name );
+#endif
+    l->owner = l->next = 0;
+}
+
+PRIVATE void ticket_acquire ( spinlock_t* l, uint32_t site )
+{
+    uint64_t start = 0;
+    uint16_t ticket = 1;
+    bool contended;
+
+    STAT_START ( start );
+    __asm volatile ( "lock xaddw %0, %1" : "+r" ( ticket ), "+m" ( l->next ) : : "memory", "cc" );
+
+    contended = l->owner != ticket;
+    while ( l->owner != ticket )
+        cpu_relax ();
+    STAT_ACQUIRED ( l, start, contended, site );
+}
+
+PRIVATE void ticket_release ( spinlock_t* l )
+{
+    STAT_RELEASED ( l );
+    /* Only the holder writes owner, so no need for an atomic increment. x86
+     * doesn't move stores past stores, so everything we did while holding
+     * the lock is visible before it is */
+    barrier ();
+    l->owner++;
+}
+
+void spin_lock ( spinlock_t* l )
+{
+    preempt_disable ();
+    ticket_acquire ( l, CALLER () );
+}
+
+void spin_unlock ( spinlock_t* l )
+{
+    ticket_release ( l );
+    preempt_enable ();
+}
+
+bool spin_trylock ( spinlock_t* l )
+{
+    uint64_t start = 0;
+    uint16_t owner, prev;
+
+    STAT_START ( start );
+    preempt_disable ();
+    owner = l->owner;
+    if ( l->next != owner ) {
+        preempt_enable ();
+        return false;
+    }
+
+    /* The lock is free if next is still owner, and then the ticket is ours */
+    __asm volatile ( "lock cmpxchgw %2, %1"
+                     : "=a" ( prev ), "+m" ( l->next )
+                     : "r" ( ( uint16_t ) ( owner + 1 ) ), "0" ( owner )
+                     : "memory", "cc" );
+    if ( prev != owner ) {
+        preempt_enable ();
+        return false;
+    }
+
+    STAT_ACQUIRED ( l, start, false, CALLER () );
+    return true;
+}
+
+uint32_t spin_lock_irqsave ( spinlock_t* l )
+{
+    uint32_t flags;
+
+    flags = irq_save ();
+    ticket_acquire ( l, CALLER () );
+    return flags;
+}
+
+void spin_unlock_irqrestore ( spinlock_t* l, uint32_t flags )
+{
+    ticket_release ( l );
+    irq_restore ( flags );
+}
+
+/* MCS locks */
+
+void mcs_lock_init ( mcs_lock_t* l, const char* name )
+{
+#ifdef LOCKSTAT
+    memset ( &l->stat, 0, sizeof ( l->stat ) );
+    l->stat.name = name;
+#else
+    UNUSED ( name );
+#endif
+    l->tail = NULL;
+}
+
+PRIVATE void mcs_acquire ( mcs_lock_t* l, mcs_node_t* node, uint32_t site )
+{
+    uint64_t start = 0;
+    mcs_node_t* prev;
+
+    STAT_START ( start );
+    node->next = NULL;
+    node->locked = true;
+
+    prev = ( mcs_node_t* ) atomic_xchg ( ( volatile uint32_t* ) &l->tail, ( uint32_t ) node );
+    if ( prev ) {
+        /* Get in line behind prev, who'll clear our locked when done */
+        prev->next = node;
+        while ( node->locked )
+            cpu_relax ();
+    }
+    STAT_ACQUIRED ( l, start, prev != NULL, site );
+}
+
+PRIVATE void mcs_release ( mcs_lock_t* l, mcs_node_t* node )
+{
+    STAT_RELEASED ( l );
+
+    if ( !node->next ) {
+        /* Nobody behind us, unless someone just swapped themselves into the
+         * tail and hasn't linked up with us yet */
+        if ( atomic_cmpxchg ( ( volatile uint32_t* ) &l->tail, ( uint32_t ) node, 0 ) ==
+             ( uint32_t ) node )
+            return;
+        while ( !node->next )
+            cpu_relax ();
+    }
+
+    barrier ();
+    node->next->locked = false;
+}
+
+void mcs_lock ( mcs_lock_t* l, mcs_node_t* node )
+{
+    preempt_disable ();
+    mcs_acquire ( l, node, CALLER () );
+}
+
+void mcs_unlock ( mcs_lock_t* l, mcs_node_t* node )
+{
+    mcs_release ( l, node );
+    preempt_enable ();
+}
+
+uint32_t mcs_lock_irqsave ( mcs_lock_t* l, mcs_node_t* node )
+{
+    uint32_t flags;
+
+    flags = irq_save ();
+    mcs_acquire ( l, node, CALLER () );
+    return flags;
+}
+
+void mcs_unlock_irqrestore ( mcs_lock_t* l, mcs_node_t* node, uint32_t flags )
+{
+    mcs_release ( l, node );
+    irq_restore ( flags );
+}
+
+/* Reader-writer locks */
+
+void rwlock_init ( rwlock_t* l, const char* name )
+{
+#ifdef LOCKSTAT
+    memset ( &l->stat, 0, sizeof ( l->stat ) );
+    l->stat.name = name;
+#else
+    UNUSED ( name );
+#endif
+    l->value = 0;
+}
+
+PRIVATE void read_acquire ( rwlock_t* l, uint32_t site )
+{
+    uint32_t v;
+    bool contended = false;
+
+    for ( ;; ) {
+        v = l->value;
+        if ( !( v & ( RW_WRITER_LOCKED | RW_WRITER_WAITING ) ) &&
+             atomic_cmpxchg ( &l->value, v, v + 1 ) == v )
+            break;
+        contended = true;
+        cpu_relax ();
+    }
+
+#ifdef LOCKSTAT
+    lockstat_read_acquired ( &l->stat, contended, site );
+#else
+    UNUSED ( contended );
+    UNUSED ( site );
+#endif
+}
+
+PRIVATE void read_release ( rwlock_t* l )
+{
+    atomic_dec ( &l->value );
+}
+
+PRIVATE void write_acquire ( rwlock_t* l, uint32_t site )
+{
+    uint64_t start = 0;
+    uint32_t v;
+    bool contended = false;
+
+    STAT_START ( start );
+    for ( ;; ) {
+        v = l->value;
+        if ( !( v & ~RW_WRITER_WAITING ) ) {
+            /* No readers and no writer. If some other writer was waiting
+             * too, it'll say so again */
+            if ( atomic_cmpxchg ( &l->value, v, RW_WRITER_LOCKED ) == v )
+                break;
+        } else if ( !( v & RW_WRITER_WAITING ) )
+            atomic_cmpxchg ( &l->value, v, v | RW_WRITER_WAITING );
+        contended = true;
+        cpu_relax ();
+    }
+    STAT_ACQUIRED ( l, start, contended, site );
+}
+
+PRIVATE void write_release ( rwlock_t* l )
+{
+    STAT_RELEASED ( l );
+    /* Clear RW_WRITER_LOCKED, but not RW_WRITER_WAITING, which another
+     * writer may set at any time. Adding the top bit when it's set clears
+     * it */
+    atomic_xadd ( &l->value, RW_WRITER_LOCKED );
+}
+
+void read_lock ( rwlock_t* l )
+{
+    preempt_disable ();
+    read_acquire ( l, CALLER () );
+}
+
+void read_unlock ( rwlock_t* l )
+{
+    read_release ( l );
+    preempt_enable ();
+}
+
+void write_lock ( rwlock_t* l )
+{
+    preempt_disable ();
+    write_acquire ( l, CALLER () );
+}
+
+void write_unlock ( rwlock_t* l )
+{
+    write_release ( l );
+    preempt_enable ();
+}
+
+uint32_t read_lock_irqsave ( rwlock_t* l )
+{
+    uint32_t flags;
+
+    flags = irq_save ();
+    read_acquire ( l, CALLER () );
+    return flags;
+}
+
+void read_unlock_irqrestore ( rwlock_t* l, uint32_t flags )
+{
+    read_release ( l );
+    irq_restore ( flags );
+}
+
+uint32_t write_lock_irqsave ( rwlock_t* l )
+{
+    uint32_t flags;
+
+    flags = irq_save ();
+    write_acquire ( l, CALLER () );
+    return flags;
+}
+
+void write_unlock_irqrestore ( rwlock_t* l, uint32_t flags )
+{
+    write_release ( l );
+    irq_restore ( flags );
+}
@@ -0,0 +1,112 @@
+#ifndef SPINLOCK_H
+#define SPINLOCK_H
+#include <stdinc.h>
+#include <lockstat.h>
+/*
+ * Spinlocks: the CPU that wants a held lock waits for it in a loop.
+ *
+ * They're for short critical sections, that never sleep (no thread_block or
+ * thread_yield while holding one). Three kinds:
+ *
+ *   - spinlock_t, a ticket lock. Whoever wants it takes a ticket (an atomic
+ *     increment of next) and waits for owner, which the holder increments on
+ *     unlock, to get to it. So CPUs get it in the order they asked, and nobody
+ *     starves. Everyone waits on the same cache line, though, which bounces
+ *     between them on every unlock.
+ *
+ *   - mcs_lock_t, a queue lock (Mellor-Crummey and Scott's). Each CPU that
+ *     wants it brings an mcs_node_t (usually on its stack), and appends it to
+ *     a queue. It then spins on its own node, which the CPU ahead of it
+ *     writes when it's done. So unlocking touches the next CPU's cache line
+ *     only. It's still FIFO, and better than a ticket lock for locks that are
+ *     fought over a lot.
+ *
+ *   - rwlock_t, a reader-writer lock. Any number of readers can hold it at
+ *     once, or one writer. Once a writer is waiting, new readers wait too, so
+ *     writers don't starve.
+ *
+ * The plain variants disable preemption (see preempt.h) from lock to unlock,
+ * so the holder can't be switched out halfway through, leaving everyone
+ * else spinning for a whole timeslice, or forever, if they spin on the same
+ * CPU with interrupts disabled. The *_irqsave variants disable interrupts
+ * instead, which keeps the scheduler out just the same, returning the flags
+ * for the matching *_irqrestore. A lock that an interrupt handler (or
+ * softirq) takes must be taken with interrupts disabled everywhere else, or
+ * the handler could interrupt the holder, on the same CPU, and spin forever.
+ *
+ * Either way, the lock and unlock must happen on the same CPU, which they
+ * do as long as nothing in between sleeps. The plain ones don't work before
+ * init_gdt, which sets up the per-CPU data the preemption count lives in.
+ *
+ * With -DLOCKSTAT, every lock keeps statistics (see lockstat.h), and the
+ * name it's declared with is what the report calls it.
+ */
+
+#ifdef LOCKSTAT
+#define LOCK_STAT_FIELD lock_stat_t stat;
+#define LOCK_STAT_ARG(name) , LOCK_STAT_INIT ( name )
+#else
+#define LOCK_STAT_FIELD
+#define LOCK_STAT_ARG(name)
+#endif
+
+typedef struct {
+    volatile uint16_t owner;    /* The ticket being served */
+    volatile uint16_t next;     /* The next ticket to hand out */
+    LOCK_STAT_FIELD
+} spinlock_t;
+
+#define SPINLOCK_INIT(name) { 0, 0 LOCK_STAT_ARG ( name ) }
+
+typedef struct mcs_node {
+    struct mcs_node* volatile next;
+    volatile uint32_t locked;   /* Cleared by the CPU ahead of us */
+} mcs_node_t;
+
+typedef struct {
+    mcs_node_t* volatile tail;  /* The last CPU in the queue, NULL if free */
+    LOCK_STAT_FIELD
+} mcs_lock_t;
+
+#define MCS_LOCK_INIT(name) { NULL LOCK_STAT_ARG ( name ) }
+
+/* The reader count, and two flags for the writers */
+#define RW_READERS_MASK   0x3FFFFFFF
+#define RW_WRITER_WAITING 0x40000000
+#define RW_WRITER_LOCKED  0x80000000
+
+typedef struct {
+    volatile uint32_t value;
+    LOCK_STAT_FIELD
+} rwlock_t;
+
+#define RWLOCK_INIT(name) { 0 LOCK_STAT_ARG ( name ) }
+
+/* For locks that aren't statically initialized */
+void spin_lock_init ( spinlock_t* l, const char* name );
+void mcs_lock_init ( mcs_lock_t* l, const char* name );
+void rwlock_init ( rwlock_t* l, const char* name );
+
+void spin_lock ( spinlock_t* l );
+void spin_unlock ( spinlock_t* l );
+/* Take it only if nobody holds it. Returns whether we got it */
+bool spin_trylock ( spinlock_t* l );
+uint32_t spin_lock_irqsave ( spinlock_t* l );
+void spin_unlock_irqrestore ( spinlock_t* l, uint32_t flags );
+
+/* node must stay around until the matching unlock, which gets the same one */
+void mcs_lock ( mcs_lock_t* l, mcs_node_t* node );
+void mcs_unlock ( mcs_lock_t* l, mcs_node_t* node );
+uint32_t mcs_lock_irqsave ( mcs_lock_t* l, mcs_node_t* node );
+void mcs_unlock_irqrestore ( mcs_lock_t* l, mcs_node_t* node, uint32_t flags );
+
+void read_lock ( rwlock_t* l );
+void read_unlock ( rwlock_t* l );
+void write_lock ( rwlock_t* l );
+void write_unlock ( rwlock_t* l );
+uint32_t read_lock_irqsave ( rwlock_t* l );
+void read_unlock_irqrestore ( rwlock_t* l, uint32_t flags );
+uint32_t write_lock_irqsave ( rwlock_t* l );
+void write_unlock_irqrestore ( rwlock_t* l, uint32_t flags );
+
+#endif
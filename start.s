@@ -107,10 +107,18 @@
 ; Useful Magic macros
 MBOOT_PAGE_ALIGN    equ 1<<0       ; Load kernel and modules on a page boundary
 MBOOT_MEM_INFO      equ 1<<1       ; Provide your kernel with memory info
+MBOOT_VIDEO_MODE    equ 1<<2       ; Have the bootloader set the video mode below
 MBOOT_HEADER_MAGIC  equ 0x1BADB002 ; Multiboot Magic value
 ; NOTE: We do not use MBOOT_AOUT_KLUDGE in  MBOOT_HEADER_FLAGS
 ; It means that GRUB does not pass us a symbol table.
+; NOTE: GRUB legacy doesn't know MBOOT_VIDEO_MODE and refuses to load us if
+; it's set, so we only ask for a graphics mode (for the framebuffer console,
+; see fbcon.h) when told to.
+%ifdef FBCON_REQUEST_MODE
+MBOOT_HEADER_FLAGS  equ MBOOT_PAGE_ALIGN | MBOOT_MEM_INFO | MBOOT_VIDEO_MODE
+%else
 MBOOT_HEADER_FLAGS  equ MBOOT_PAGE_ALIGN | MBOOT_MEM_INFO
+%endif
 MBOOT_CHECKSUM      equ -(MBOOT_HEADER_MAGIC + MBOOT_HEADER_FLAGS)
 ; We start by storing the virtual base address of kernel space.
 ; Note that this is NOT where it assumes it is loaded to! This is where
@@ -181,6 +189,15 @@ MultiBootHeader:
                                  ; 4-byte boundary in the kernel file
    dd  MBOOT_HEADER_FLAGS        ; How GRUB should load your file / settings
    dd  MBOOT_CHECKSUM            ; To ensure that the above values are correct
+%ifdef FBCON_REQUEST_MODE
+   ; The address fields are only used with MBOOT_AOUT_KLUDGE, but they must
+   ; be here so that the video mode fields end up at the right offsets
+   dd  0, 0, 0, 0, 0             ; header, load, load_end, bss_end and entry addresses
+   dd  0                         ; Mode type: 0 = linear graphics
+   dd  1024                      ; Width
+   dd  768                       ; Height
+   dd  32                        ; Depth (bits per pixel)
+%endif
 
 
 ; setting up entry point for linker
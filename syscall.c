@@ -0,0 +1,106 @@
+#include <syscall.h>
+#include <gdt.h>
+#include <idt.h>
+#include <sched.h>
+#include <smp.h>
+#include <screen.h>
+#include <x86/x86.h>
+
+/* In syscall_s.s */
+extern void syscall_int80 ( void );
+extern void syscall_sysenter ( void );
+extern uint32_t user_enter ( uint32_t eip, uint32_t esp, uint32_t* kernel_esp,
+                             uint32_t* tss_esp0 );
+extern void user_return ( uint32_t kernel_esp, uint32_t code );
+
+typedef uint32_t ( *syscall_t ) ( uint32_t arg1, uint32_t arg2, uint32_t arg3 );
+
+PRIVATE bool have_sysenter = false;
+
+PRIVATE uint32_t sys_exit ( uint32_t code, uint32_t arg2, uint32_t arg3 )
+{
+    UNUSED ( arg2 );
+    UNUSED ( arg3 );
+
+    /* Right back into user_run, dropping the system call's frame */
+    user_return ( thread_current ()->esp0, code );
+    return 0;
+}
+
+PRIVATE uint32_t sys_getpid ( uint32_t arg1, uint32_t arg2, uint32_t arg3 )
+{
+    UNUSED ( arg1 );
+    UNUSED ( arg2 );
+    UNUSED ( arg3 );
+    return thread_current ()->id;
+}
+
+PRIVATE uint32_t sys_yield ( uint32_t arg1, uint32_t arg2, uint32_t arg3 )
+{
+    UNUSED ( arg1 );
+    UNUSED ( arg2 );
+    UNUSED ( arg3 );
+    thread_yield ();
+    return 0;
+}
+
+PRIVATE const syscall_t syscalls[NUM_SYSCALLS] = {
+    &sys_exit,
+    &sys_getpid,
+    &sys_yield
+};
+
+uint32_t syscall_dispatch ( uint32_t nr, uint32_t arg1, uint32_t arg2, uint32_t arg3 )
+{
+    if ( nr >= NUM_SYSCALLS )
+        return SYSCALL_ENOSYS;
+    return syscalls[nr] ( arg1, arg2, arg3 );
+}
+
+uint32_t user_run ( uint32_t eip, uint32_t esp )
+{
+    thread_t* self = thread_current ();
+    uint32_t code;
+
+    /* Until the iret, so that we stay on the CPU whose TSS we set */
+    __asm volatile ( "cli" );
+    code = user_enter ( eip, esp, &self->esp0,
+                        gdt_kernel_stack_slot ( smp_processor_id () ) );
+    self->esp0 = 0;
+    return code;
+}
+
+bool syscall_have_sysenter ( void )
+{
+    return have_sysenter;
+}
+
+void syscall_init_cpu ( void )
+{
+    if ( !have_sysenter )
+        return;
+    wrmsr ( MSR_IA32_SYSENTER_CS, GDT_KERNEL_CODE_SELECTOR );
+    wrmsr ( MSR_IA32_SYSENTER_ESP, ( uint32_t ) gdt_kernel_stack_slot ( smp_processor_id () ) );
+    wrmsr ( MSR_IA32_SYSENTER_EIP, ( uint32_t ) &syscall_sysenter );
+}
+
+void init_syscalls ( void )
+{
+    uint32_t eax, edx, family, model, stepping;
+
+    idt_set_gate ( SYSCALL_VECTOR, ( uint32_t ) &syscall_int80, IDT_SELECTOR,
+                   IDT_32BIT_INTERRUPT_GATE | IDT_DPL_USER );
+
+    /* The Pentium Pro says it has sysenter, but doesn't */
+    cpuid ( 1, &eax, NULL, NULL, &edx );
+    family = ( eax >> 8 ) & 0xF;
+    model = ( eax >> 4 ) & 0xF;
+    stepping = eax & 0xF;
+    have_sysenter = ( edx & CPUID_FEAT_EDX_SEP ) &&
+                    ( edx & CPUID_FEAT_EDX_MSR ) &&
+                    !( family == 6 && model < 3 && stepping < 3 );
+    syscall_init_cpu ();
+
+    screen_puts ( have_sysenter ? "System calls: int 0x80, sysenter\n"
+                                : "System calls: int 0x80\n" );
+}
@@ -0,0 +1,62 @@
+#ifndef SYSCALL_H
+#define SYSCALL_H
+#include <stdinc.h>
+/*
+ * Ring 3, and the system calls that get it back to the kernel.
+ *
+ * A kernel thread goes to ring 3 with user_run(), which irets to the given
+ * eip and esp with the user segments (see gdt.h), and returns once the user
+ * code calls SYS_EXIT. Interrupts from ring 3 switch to the kernel stack in
+ * the TSS, esp0: the thread's own, right below user_run's frame. Each thread
+ * that's in ring 3 keeps its esp0, and the scheduler puts it in the TSS when
+ * it runs the thread. There's only the one page directory, so the user code
+ * has to be in pages mapped with PTE_PAGE_USER (see vmm_map_page_flags), and
+ * every thread sees them.
+ *
+ * System calls take their number in eax and up to three arguments in ebx,
+ * esi and edi, and return in eax. There are two ways in:
+ *
+ *  -> int 0x80 (SYSCALL_VECTOR), the only gate ring 3 may use. The CPU
+ *     switches stacks, pushes the return frame and loads the kernel's cs;
+ *     the stub saves the user's segments and loads the kernel's, and iret
+ *     undoes it all.
+ *  -> sysenter, where the CPU has it. It jumps straight to the kernel's
+ *     entry point and stack from the SYSENTER MSRs, saving nothing at all,
+ *     and sysexit goes back to the eip in edx and the esp in ecx, without
+ *     checking or loading anything from memory. So the caller puts where to
+ *     return to in edx and its esp in ecx (they're clobbered), and it takes
+ *     a fraction of what int 0x80 does. SYSENTER_ESP points at esp0 in this
+ *     CPU's TSS, and the stub loads esp from there: the MSR stays the same
+ *     whatever thread is running.
+ *
+ * Both enable interrupts before calling the handler, so system calls can
+ * block and be preempted like any other kernel code.
+ */
+
+#define SYSCALL_VECTOR 0x80
+
+/* The system calls */
+#define SYS_EXIT       0 /* ( code ), back to user_run's caller */
+#define SYS_GETPID     1 /* The thread's id */
+#define SYS_YIELD      2
+#define NUM_SYSCALLS   3
+
+/* What an unknown system call returns */
+#define SYSCALL_ENOSYS 0xFFFFFFFF
+
+void init_syscalls ( void );
+/* Called by every AP */
+void syscall_init_cpu ( void );
+
+/* Whether sysenter is there to be used */
+bool syscall_have_sysenter ( void );
+
+/* Run the current thread in ring 3 from eip, with esp, until it calls
+ * SYS_EXIT. Returns the code it passed. Interrupts must be enabled, and
+ * are again when it returns */
+uint32_t user_run ( uint32_t eip, uint32_t esp );
+
+/* Called by the entry stubs in syscall_s.s */
+uint32_t syscall_dispatch ( uint32_t nr, uint32_t arg1, uint32_t arg2, uint32_t arg3 );
+
+#endif
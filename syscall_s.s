@@ -0,0 +1,130 @@
+; syscall_s.s -- Getting into ring 3, and back (see syscall.h)
+
+; C function in syscall.c
+extern syscall_dispatch
+
+; int 0x80. The CPU has pushed the user's ss, esp, eflags, cs and eip, and
+; disabled interrupts. ebx, esi, edi and ebp are callee-saved in C, so only
+; ecx and edx need saving, and eax is the return value
+global syscall_int80:function syscall_int80.end-syscall_int80
+syscall_int80:
+    push ecx
+    push edx
+    push ds
+    push es
+    push gs
+    mov cx, 0x10             ; The kernel data segment
+    mov ds, cx
+    mov es, cx
+    mov cx, 0x30             ; This CPU's per-CPU segment (see percpu.h)
+    mov gs, cx
+    cld
+    sti
+
+    push edi
+    push esi
+    push ebx
+    push eax
+    call syscall_dispatch
+    add esp, 16
+
+    cli
+    pop gs
+    pop es
+    pop ds
+    pop edx
+    pop ecx
+    iret
+.end:
+
+; sysenter. We're in ring 0, with interrupts disabled, on the stack in
+; SYSENTER_ESP, which is this CPU's TSS's esp0 field: the stack is in there.
+; The user's eip is in edx and its esp in ecx, for sysexit
+global syscall_sysenter:function syscall_sysenter.end-syscall_sysenter
+syscall_sysenter:
+    mov esp, [esp]
+    push ecx
+    push edx
+    push ds
+    push es
+    push gs
+    mov cx, 0x10
+    mov ds, cx
+    mov es, cx
+    mov cx, 0x30
+    mov gs, cx
+    cld
+    sti
+
+    push edi
+    push esi
+    push ebx
+    push eax
+    call syscall_dispatch
+    add esp, 16
+
+    cli
+    pop gs
+    pop es
+    pop ds
+    pop edx
+    pop ecx
+    sti                      ; Only takes effect after sysexit
+    sysexit
+.end:
+
+; uint32_t user_enter(uint32_t eip, uint32_t esp, uint32_t* kernel_esp,
+;                     uint32_t* tss_esp0)
+;
+; Saves the callee-saved registers, and the stack pointer below them in
+; *kernel_esp and *tss_esp0, so that whatever comes in from ring 3 lands
+; below our frame. Then irets to eip and esp in ring 3, with interrupts
+; enabled. Called with them disabled. It returns through user_return
+global user_enter:function user_enter.end-user_enter
+user_enter:
+    push ebp
+    push ebx
+    push esi
+    push edi
+    mov eax, [esp+28]
+    mov [eax], esp
+    mov eax, [esp+32]
+    mov [eax], esp
+
+    mov ecx, [esp+20]        ; eip
+    mov edx, [esp+24]        ; esp
+    mov ax, 0x23             ; The user data segment, RPL 3
+    mov ds, ax
+    mov es, ax
+    mov fs, ax
+    mov gs, ax
+
+    push 0x23                ; ss
+    push edx                 ; esp
+    push 0x202               ; eflags: just IF
+    push 0x1B                ; cs: the user code segment, RPL 3
+    push ecx                 ; eip
+    xor eax, eax             ; Leave nothing of ours in the registers
+    xor ebx, ebx
+    xor ecx, ecx
+    xor edx, edx
+    xor esi, esi
+    xor edi, edi
+    xor ebp, ebp
+    iret
+.end:
+
+; void user_return(uint32_t kernel_esp, uint32_t code)
+;
+; Returns code from the user_enter that saved kernel_esp. The segments are
+; the kernel's already: a system call got us here
+global user_return:function user_return.end-user_return
+user_return:
+    mov eax, [esp+8]
+    mov esp, [esp+4]
+    pop edi
+    pop esi
+    pop ebx
+    pop ebp
+    ret
+.end:
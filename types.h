@@ -8,6 +8,12 @@ typedef          short int16_t;
 typedef unsigned char  uint8_t;
 typedef          char  int8_t;
 
+/* C89 has no 64-bit integer type, but GCC does. __extension__ keeps
+ * -pedantic-errors quiet about it. Be careful: 64-bit divisions need libgcc,
+ * which we don't link against! */
+__extension__ typedef unsigned long long uint64_t;
+__extension__ typedef          long long int64_t;
+
 typedef uint8_t        byte;
 typedef uint16_t       word;
 typedef uint32_t       dword;
@@ -0,0 +1,63 @@
+#include <user/time.h>
+#include <vdso.h>
+
+/* No rdtsc () and mul_u64_u32_shr () from x86.c here: they're in the
+ * kernel's pages, which ring 3 can't reach */
+PRIVATE uint64_t user_rdtsc ( void )
+{
+    uint32_t lo, hi;
+
+    __asm volatile ( "rdtsc" : "=a" ( lo ), "=d" ( hi ) );
+    return ( ( uint64_t ) hi << 32 ) | lo;
+}
+
+/* ( a * mul ) >> shift, keeping the top bits of the 96-bit product */
+PRIVATE uint64_t user_mul_shr ( uint64_t a, uint32_t mul, uint32_t shift )
+{
+    uint32_t lo, hi;
+    uint64_t ret;
+
+    lo = ( uint32_t ) a;
+    hi = ( uint32_t ) ( a >> 32 );
+
+    ret = ( ( uint64_t ) lo * mul ) >> shift;
+    if ( hi )
+        ret += ( ( uint64_t ) hi * mul ) << ( 32 - shift );
+    return ret;
+}
+
+uint64_t user_clock_ns ( void )
+{
+    const vdso_time_t* t = ( const vdso_time_t* ) VDSO_TIME_PAGE;
+    uint32_t seq, mode, mult, shift;
+    uint64_t base_ns, base_cycles, now;
+
+    do {
+        seq = read_seqcount_begin ( &t->seq );
+        mode = t->clock_mode;
+        base_ns = t->base_ns;
+        base_cycles = t->base_cycles;
+        mult = t->mult;
+        shift = t->shift;
+        /* Inside the loop, so that it's no earlier than base_cycles */
+        now = user_rdtsc ();
+    } while ( read_seqcount_retry ( &t->seq, seq ) );
+
+    if ( mode != VDSO_CLOCK_TSC || now < base_cycles )
+        return base_ns;
+    return base_ns + user_mul_shr ( now - base_cycles, mult, shift );
+}
+
+uint64_t user_clock_ticks ( uint32_t* tick_hz )
+{
+    const vdso_time_t* t = ( const vdso_time_t* ) VDSO_TIME_PAGE;
+    uint32_t seq;
+    uint64_t ticks;
+
+    do {
+        seq = read_seqcount_begin ( &t->seq );
+        ticks = t->ticks;
+        *tick_hz = t->tick_hz;
+    } while ( read_seqcount_retry ( &t->seq, seq ) );
+    return ticks;
+}
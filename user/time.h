@@ -0,0 +1,19 @@
+#ifndef USER_TIME_H
+#define USER_TIME_H
+#include <stdinc.h>
+/*
+ * The user library's clock: reads the time page (see vdso.h) from ring 3,
+ * with no system call. Everything in user/ runs in ring 3, from the pages
+ * init_vdso maps at VDSO_TEXT, so it must not call into the kernel or touch
+ * the kernel's data, and has no data of its own. User code calls these at
+ * the addresses vdso_symbol() gives for them.
+ */
+
+/* Nanoseconds since boot, like ktime_get_ns () */
+uint64_t user_clock_ns ( void );
+
+/* Timer ticks since boot, and how many there are a second, as of the last
+ * tick */
+uint64_t user_clock_ticks ( uint32_t* tick_hz );
+
+#endif
@@ -0,0 +1,68 @@
+#include <vdso.h>
+#include <clocksource.h>
+#include <internal_timer.h>
+#include <screen.h>
+#include <mem/pmm.h>
+#include <mem/vmm.h>
+
+/* The user library's bounds (see link.ld) */
+extern uint8_t _user_start[];
+extern uint8_t _user_end[];
+
+/* A page all to itself, since ring 3 can read the whole of it */
+PRIVATE union {
+    vdso_time_t time;
+    uint8_t page[PAGE_SIZE];
+} time_page __attribute__ ( ( aligned ( PAGE_SIZE ) ) );
+
+void vdso_update_time ( uint64_t ticks, uint32_t tick_hz )
+{
+    vdso_time_t* t = &time_page.time;
+    const clocksource_t* cs = clocksource_get ();
+    uint64_t ns, count;
+
+    ns = ktime_get_ns_count ( &count );
+
+    write_seqcount_begin ( &t->seq );
+    t->ticks = ticks;
+    t->tick_hz = tick_hz;
+    t->base_ns = ns;
+    if ( !cs ) {
+        t->clock_mode = VDSO_CLOCK_NONE;
+    } else if ( cs->continuous ) {
+        /* The TSC: the only one that counts on its own */
+        t->clock_mode = VDSO_CLOCK_TSC;
+        t->base_cycles = count;
+        t->mult = cs->mult;
+        t->shift = cs->shift;
+    } else {
+        t->clock_mode = VDSO_CLOCK_COARSE;
+    }
+    write_seqcount_end ( &t->seq );
+}
+
+uint32_t vdso_symbol ( uint32_t fn )
+{
+    return VDSO_TEXT + ( fn - ( uint32_t ) _user_start );
+}
+
+void init_vdso ( void )
+{
+    uint32_t virt;
+
+    vmm_map_page_flags ( ( uint32_t ) &time_page - KERNEL_VIRTUAL_BASE,
+                         VDSO_TIME_PAGE, PTE_PAGE_USER );
+    for ( virt = ( uint32_t ) _user_start; virt < ( uint32_t ) _user_end; virt += PAGE_SIZE )
+        vmm_map_page_flags ( virt - KERNEL_VIRTUAL_BASE,
+                             VDSO_TEXT + ( virt - ( uint32_t ) _user_start ),
+                             PTE_PAGE_USER );
+
+    /* No tick has filled it in yet. Interrupts are still off, so we're the
+     * only writer */
+    vdso_update_time ( timer_get_ticks (), timer_get_frequency () );
+
+    screen_puts ( "vDSO: time page at " );
+    screen_put_hex ( VDSO_TIME_PAGE );
+    screen_puts ( time_page.time.clock_mode == VDSO_CLOCK_TSC ? ", from the TSC\n"
+                                                                : ", coarse\n" );
+}
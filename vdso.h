@@ -0,0 +1,63 @@
+#ifndef VDSO_H
+#define VDSO_H
+#include <stdinc.h>
+#include <seqlock.h>
+#include <mem/pmm.h>
+/*
+ * Telling the time from ring 3 without a system call.
+ *
+ * The kernel keeps a time page, vdso_time_t, which the boot CPU's tick
+ * updates (see timer_callback): the tick count, and a base time, base_ns,
+ * along with the clocksource count it was worked out from, base_cycles, and
+ * the clocksource's mult and shift. With the TSC as the clocksource, user
+ * code reads it and then does what ktime_get_ns does:
+ *
+ *      ns = base_ns + ( ( rdtsc () - base_cycles ) * mult ) >> shift
+ *
+ * which takes a few tens of cycles, against a few hundred just to get into
+ * the kernel and out (see bench/syscall.c). The fields are under a seqcount
+ * (see seqlock.h), with the tick as the only writer, so readers retry rather
+ * than ever see a torn base. Without the TSC, the page is still there, but
+ * the time only moves on with each tick (VDSO_CLOCK_COARSE).
+ *
+ * The code that reads it is in user/, the user library, which the linker
+ * puts in pages of its own (see link.ld). init_vdso() maps those, and the
+ * time page, at VDSO_BASE, both read-only and user-accessible: user code
+ * calls the library at the addresses vdso_symbol() gives. There's only the
+ * one page directory, so that's every address space there is.
+ */
+
+#define VDSO_BASE          0xBFF00000
+#define VDSO_TIME_PAGE     VDSO_BASE                 /* The vdso_time_t */
+#define VDSO_TEXT          ( VDSO_BASE + PAGE_SIZE ) /* The user library */
+
+/* How the time is to be read */
+#define VDSO_CLOCK_NONE    0 /* Not yet: base_ns is 0 */
+#define VDSO_CLOCK_TSC     1 /* From the TSC, as above */
+#define VDSO_CLOCK_COARSE  2 /* base_ns, as of the last tick */
+
+typedef struct {
+    seqcount_t seq;
+    uint32_t clock_mode;
+    uint64_t ticks;       /* timer_get_ticks () */
+    uint32_t tick_hz;
+    uint32_t mult;
+    uint32_t shift;
+    uint64_t base_cycles;
+    uint64_t base_ns;     /* ktime_get_ns () at base_cycles */
+} vdso_time_t;
+
+/* Map the time page and the user library for ring 3, and fill in the time
+ * page. Must be called after init_vmm and init_clocksource, before
+ * interrupts are enabled */
+void init_vdso ( void );
+
+/* Refresh the time page. Called by init_vdso, and then by the boot CPU's
+ * tick, both with interrupts disabled, which makes each the only writer */
+void vdso_update_time ( uint64_t ticks, uint32_t tick_hz );
+
+/* Where user code finds the function at fn (its address in the kernel) in
+ * the user library */
+uint32_t vdso_symbol ( uint32_t fn );
+
+#endif
@@ -0,0 +1,152 @@
+#include <wait.h>
+#include <sched.h>
+#include <x86/x86.h>
+
+void wait_queue_init ( wait_queue_t* q, const char* name )
+{
+    spin_lock_init ( &q->lock, name );
+    list_init ( &q->waiters );
+    q->count = 0;
+}
+
+/* Both need q->lock held. The atomic increment is also what keeps the
+ * waiter's check of the condition from passing its store to the list */
+PRIVATE void enqueue_waiter ( wait_queue_t* q, wait_entry_t* e, bool front )
+{
+    if ( front )
+        list_add_head ( &q->waiters, &e->node );
+    else
+        list_add_tail ( &q->waiters, &e->node );
+    atomic_inc ( &q->count );
+}
+
+PRIVATE void dequeue_waiter ( wait_queue_t* q, wait_entry_t* e )
+{
+    list_del ( &e->node );
+    atomic_dec ( &q->count );
+}
+
+/* Wake the oldest waiter, or all of them. q->lock must be held: the waiters
+ * can't leave wait_event, taking their entries with them, until it's not */
+PRIVATE void wake_waiters ( wait_queue_t* q, bool all )
+{
+    wait_entry_t* e;
+
+    while ( !list_empty ( &q->waiters ) ) {
+        e = LIST_ENTRY ( q->waiters.next, wait_entry_t, node );
+        dequeue_waiter ( q, e );
+
+        /* Nobody to wake before init_sched: they're idling, and will look
+         * again on the next interrupt */
+        if ( e->thread )
+            thread_wake ( e->thread );
+        if ( !all )
+            break;
+    }
+}
+
+PRIVATE void wake ( wait_queue_t* q, bool all )
+{
+    uint32_t flags;
+
+    /* The condition has to be true before we look */
+    mb ();
+    if ( !wait_queue_active ( q ) )
+        return;
+
+    flags = spin_lock_irqsave ( &q->lock );
+    wake_waiters ( q, all );
+    spin_unlock_irqrestore ( &q->lock, flags );
+}
+
+void wake_up ( wait_queue_t* q )
+{
+    wake ( q, true );
+}
+
+void wake_up_one ( wait_queue_t* q )
+{
+    wake ( q, false );
+}
+
+uint32_t wait_prepare ( wait_queue_t* q, wait_entry_t* e )
+{
+    uint32_t flags;
+
+    flags = irq_save ();
+    e->thread = thread_current ();
+    spin_lock ( &q->lock );
+    enqueue_waiter ( q, e, false );
+    spin_unlock ( &q->lock );
+    return flags;
+}
+
+void wait_sleep ( wait_queue_t* q, wait_entry_t* e )
+{
+    thread_block ();
+
+    /* If we were woken, we're off the queue. The condition may be false
+     * again, though, so back in, but first in line */
+    spin_lock ( &q->lock );
+    if ( !list_linked ( &e->node ) )
+        enqueue_waiter ( q, e, true );
+    spin_unlock ( &q->lock );
+}
+
+void wait_finish ( wait_queue_t* q, wait_entry_t* e, uint32_t flags )
+{
+    spin_lock ( &q->lock );
+    if ( list_linked ( &e->node ) )
+        dequeue_waiter ( q, e );
+    spin_unlock ( &q->lock );
+    irq_restore ( flags );
+}
+
+/* Completions */
+
+void completion_init ( completion_t* c, const char* name )
+{
+    c->done = 0;
+    wait_queue_init ( &c->wait, name );
+}
+
+void complete ( completion_t* c )
+{
+    uint32_t flags;
+
+    flags = spin_lock_irqsave ( &c->wait.lock );
+    if ( c->done != COMPLETION_ALL )
+        c->done++;
+    wake_waiters ( &c->wait, false );
+    spin_unlock_irqrestore ( &c->wait.lock, flags );
+}
+
+void complete_all ( completion_t* c )
+{
+    uint32_t flags;
+
+    flags = spin_lock_irqsave ( &c->wait.lock );
+    c->done = COMPLETION_ALL;
+    wake_waiters ( &c->wait, true );
+    spin_unlock_irqrestore ( &c->wait.lock, flags );
+}
+
+/* Let ourselves through, if complete has said so */
+PRIVATE bool completion_take ( completion_t* c )
+{
+    uint32_t done;
+
+    do {
+        done = c->done;
+        if ( !done )
+            return false;
+        if ( done == COMPLETION_ALL )
+            return true;
+    } while ( atomic_cmpxchg ( &c->done, done, done - 1 ) != done );
+    return true;
+}
+
+void wait_for_completion ( completion_t* c )
+{
+    wait_event ( &c->wait, completion_take ( c ) );
+}
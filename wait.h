@@ -0,0 +1,100 @@
+#ifndef WAIT_H
+#define WAIT_H
+#include <stdinc.h>
+#include <list.h>
+#include <spinlock.h>
+/*
+ * Sleeping until something happens.
+ *
+ * A wait queue is the list of threads waiting for something, with a lock to
+ * keep it together. A thread that can't go on until some condition is true
+ * waits for it with
+ *
+ *      wait_event ( &q, condition );
+ *
+ * and whoever makes it true then calls wake_up(&q), or wake_up_one(&q) to
+ * wake only the thread that has waited longest. In between, the waiting
+ * thread is blocked (see thread_block): it takes no CPU time at all.
+ *
+ * wait_event puts the thread in the queue before it checks the condition,
+ * and the waker makes the condition true before it looks at the queue, so
+ * either the waiter sees it true or the waker sees the waiter. The condition
+ * is checked with interrupts disabled, and again after each wakeup, since
+ * someone else may have got there first. A waker takes the threads it wakes
+ * off the queue, so that two wake_up_ones wake two different threads, and
+ * one that finds the condition false again goes back in, at the front.
+ *
+ * wake_up and wake_up_one may be called from interrupt handlers, and only
+ * take the lock if the queue isn't empty. wait_event may not be, nor with a
+ * spinlock held.
+ *
+ * Completions are built on them (see below), and so are semaphores and
+ * mutexes (see mutex.h).
+ */
+
+struct thread;
+
+typedef struct {
+    spinlock_t lock;
+    list_node_t waiters;          /* wait_entry_t's, the oldest first */
+    volatile uint32_t count;      /* How many there are */
+} wait_queue_t;
+
+#define WAIT_QUEUE_INIT(q, name) \
+    { SPINLOCK_INIT ( name ), { &( q ).waiters, &( q ).waiters }, 0 }
+
+/* A waiting thread's place in the queue. On its stack, in wait_event */
+typedef struct {
+    struct thread* thread;
+    list_node_t node;
+} wait_entry_t;
+
+void wait_queue_init ( wait_queue_t* q, const char* name );
+
+/* Whether anyone's waiting. Only meaningful after a full barrier (an atomic
+ * operation, say) following the change to what they're waiting for */
+#define wait_queue_active(q) ( ( q )->count != 0 )
+
+void wake_up ( wait_queue_t* q );
+void wake_up_one ( wait_queue_t* q );
+
+/* What wait_event is made of. wait_prepare disables interrupts, returning the
+ * flags for wait_finish */
+uint32_t wait_prepare ( wait_queue_t* q, wait_entry_t* e );
+void wait_sleep ( wait_queue_t* q, wait_entry_t* e );
+void wait_finish ( wait_queue_t* q, wait_entry_t* e, uint32_t flags );
+
+#define wait_event(q, condition) do {                                         \
+    wait_entry_t wait_entry__;                                                \
+    uint32_t wait_flags__;                                                    \
+    wait_flags__ = wait_prepare ( ( q ), &wait_entry__ );                     \
+    while ( !( condition ) )                                                  \
+        wait_sleep ( ( q ), &wait_entry__ );                                  \
+    wait_finish ( ( q ), &wait_entry__, wait_flags__ );                       \
+} while ( 0 )
+
+/*
+ * A completion: waiting for something to be done, once or a number of times.
+ * Each complete() lets one wait_for_completion() through, whether it comes
+ * before or after, and complete_all() lets every one through from then on.
+ *
+ * Everything happens with the queue's lock held, so the completion can be on
+ * the waiter's stack: once wait_for_completion returns, complete is done
+ * with it.
+ */
+
+#define COMPLETION_ALL 0xFFFFFFFF
+
+typedef struct completion {
+    volatile uint32_t done;       /* How many waiters to let through */
+    wait_queue_t wait;
+} completion_t;
+
+#define COMPLETION_INIT(c, name) { 0, WAIT_QUEUE_INIT ( ( c ).wait, name ) }
+
+void completion_init ( completion_t* c, const char* name );
+void complete ( completion_t* c );
+void complete_all ( completion_t* c );
+void wait_for_completion ( completion_t* c );
+
+#endif
@@ -0,0 +1,79 @@
+#include <wsdeque.h>
+#include <mem.h>
+#include <x86/x86.h>
+
+void wsdeque_init ( wsdeque_t* d )
+{
+    memset ( d, 0, sizeof ( wsdeque_t ) );
+}
+
+bool wsdeque_push ( wsdeque_t* d, void* item )
+{
+    uint32_t b = d->bottom;
+
+    if ( b - d->top >= WSDEQUE_SIZE )
+        return false;
+
+    /* x86 keeps stores in order: the item is there before bottom says so */
+    d->items[b & WSDEQUE_MASK] = item;
+    barrier ();
+    d->bottom = b + 1;
+    return true;
+}
+
+void* wsdeque_pop ( wsdeque_t* d )
+{
+    uint32_t b, t;
+    void* item;
+
+    /* Claim the bottom item, and only then look at top. The exchange keeps
+     * the two from being reordered, so a thief either sees the new bottom
+     * or we see its new top */
+    b = d->bottom - 1;
+    atomic_xchg ( &d->bottom, b );
+    t = d->top;
+
+    if ( ( int32_t ) ( b - t ) < 0 ) {
+        /* It was empty */
+        d->bottom = b + 1;
+        return NULL;
+    }
+
+    item = d->items[b & WSDEQUE_MASK];
+    if ( b != t )
+        return item;
+
+    /* The last one. Thieves may be after it too, and whoever moves top first
+     * gets it */
+    if ( atomic_cmpxchg ( &d->top, t, t + 1 ) != t )
+        item = NULL;
+    d->bottom = b + 1;
+    return item;
+}
+
+void* wsdeque_steal ( wsdeque_t* d )
+{
+    uint32_t b, t;
+    void* item;
+
+    /* top first, then bottom. x86 doesn't reorder loads */
+    t = d->top;
+    barrier ();
+    b = d->bottom;
+    if ( ( int32_t ) ( b - t ) <= 0 )
+        return NULL;
+
+    /* The owner can't have reused the slot yet: it'd have to push
+     * WSDEQUE_SIZE items past top, and the deque would be full */
+    item = d->items[t & WSDEQUE_MASK];
+    if ( atomic_cmpxchg ( &d->top, t, t + 1 ) != t )
+        return NULL;
+    return item;
+}
+
+uint32_t wsdeque_size ( const wsdeque_t* d )
+{
+    int32_t size = ( int32_t ) ( d->bottom - d->top );
+
+    return size > 0 ? ( uint32_t ) size : 0;
+}
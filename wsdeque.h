@@ -0,0 +1,47 @@
+#ifndef WSDEQUE_H
+#define WSDEQUE_H
+#include <stdinc.h>
+/*
+ * A work-stealing deque (Chase and Lev, "Dynamic Circular Work-Stealing
+ * Deque", SPAA 2005), the way the scheduler's per-CPU run queues use it.
+ *
+ * It has an owner, who pushes and pops at the bottom, and any number of
+ * thieves, who steal from the top. The owner's operations are plain loads
+ * and stores, except for one atomic exchange in pop (a store to bottom can't
+ * be allowed to pass the load of top after it) and a compare-and-swap when
+ * it takes the very last item, which a thief may be after too. Thieves
+ * always compare-and-swap top, so each item goes to exactly one of them.
+ *
+ * top and bottom only ever grow, and the slot for index i is i % size. There
+ * are WSDEQUE_SIZE slots, and no growing: the scheduler never has more
+ * threads than that to queue. Pushing onto a full deque fails.
+ *
+ * Only the owner may push or pop, and not from an interrupt handler that may
+ * have interrupted it doing either.
+ */
+
+#define WSDEQUE_SIZE 64 /* A power of two */
+#define WSDEQUE_MASK ( WSDEQUE_SIZE - 1 )
+
+typedef struct {
+    volatile uint32_t top;
+    volatile uint32_t bottom;
+    void* volatile items[WSDEQUE_SIZE];
+} wsdeque_t;
+
+void wsdeque_init ( wsdeque_t* d );
+
+/* The owner's end. pop returns NULL if it's empty, or if a thief beat us to
+ * the last item */
+bool wsdeque_push ( wsdeque_t* d, void* item );
+void* wsdeque_pop ( wsdeque_t* d );
+
+/* The other end, for anyone. Returns NULL if it's empty, or if someone else
+ * took the item first */
+void* wsdeque_steal ( wsdeque_t* d );
+
+/* How many items there are. Only a hint, unless called by the owner with no
+ * thieves around: they may be taking some as we speak */
+uint32_t wsdeque_size ( const wsdeque_t* d );
+
+#endif
@@ -19,3 +19,122 @@ uint16_t inw(uint16_t port)
   __asm volatile ("inw %1, %0" : "=a" (ret) : "dN" (port));
   return ret;
 }
+
+uint32_t atomic_xchg(volatile uint32_t* p, uint32_t v)
+{
+  /* xchg with memory is always locked */
+  __asm volatile ("xchgl %0, %1" : "+r" (v), "+m" (*p) : : "memory");
+  return v;
+}
+
+uint32_t atomic_cmpxchg(volatile uint32_t* p, uint32_t old, uint32_t new)
+{
+  uint32_t prev;
+  __asm volatile ("lock cmpxchgl %2, %1" : "=a" (prev), "+m" (*p) : "r" (new), "0" (old) : "memory", "cc");
+  return prev;
+}
+
+uint32_t atomic_xadd(volatile uint32_t* p, uint32_t v)
+{
+  __asm volatile ("lock xaddl %0, %1" : "+r" (v), "+m" (*p) : : "memory", "cc");
+  return v;
+}
+
+void atomic_inc(volatile uint32_t* p)
+{
+  __asm volatile ("lock incl %0" : "+m" (*p) : : "memory", "cc");
+}
+
+void atomic_dec(volatile uint32_t* p)
+{
+  __asm volatile ("lock decl %0" : "+m" (*p) : : "memory", "cc");
+}
+
+void atomic_or(volatile uint32_t* p, uint32_t v)
+{
+  __asm volatile ("lock orl %1, %0" : "+m" (*p) : "r" (v) : "memory", "cc");
+}
+
+void atomic_and(volatile uint32_t* p, uint32_t v)
+{
+  __asm volatile ("lock andl %1, %0" : "+m" (*p) : "r" (v) : "memory", "cc");
+}
+
+uint32_t irq_save(void)
+{
+  uint32_t flags;
+  __asm volatile ("pushf; pop %0; cli" : "=r" (flags) : : "memory");
+  return flags;
+}
+
+void irq_restore(uint32_t flags)
+{
+  __asm volatile ("push %0; popf" : : "r" (flags) : "memory", "cc");
+}
+
+void cpuid(uint32_t leaf, uint32_t* eax, uint32_t* ebx, uint32_t* ecx, uint32_t* edx)
+{
+  cpuid_count(leaf, 0, eax, ebx, ecx, edx);
+}
+
+void cpuid_count(uint32_t leaf, uint32_t subleaf,
+                 uint32_t* eax, uint32_t* ebx, uint32_t* ecx, uint32_t* edx)
+{
+  uint32_t a, b, c, d;
+  __asm volatile ("cpuid" : "=a" (a), "=b" (b), "=c" (c), "=d" (d) : "a" (leaf), "c" (subleaf));
+  if (eax) *eax = a;
+  if (ebx) *ebx = b;
+  if (ecx) *ecx = c;
+  if (edx) *edx = d;
+}
+
+uint64_t rdmsr(uint32_t msr)
+{
+  uint32_t lo, hi;
+  __asm volatile ("rdmsr" : "=a" (lo), "=d" (hi) : "c" (msr));
+  return ((uint64_t) hi << 32) | lo;
+}
+
+void wrmsr(uint32_t msr, uint64_t value)
+{
+  __asm volatile ("wrmsr" : : "c" (msr), "a" ((uint32_t) value), "d" ((uint32_t) (value >> 32)));
+}
+
+uint64_t rdtsc(void)
+{
+  uint32_t lo, hi;
+  __asm volatile ("rdtsc" : "=a" (lo), "=d" (hi));
+  return ((uint64_t) hi << 32) | lo;
+}
+
+uint64_t div_u64_rem(uint64_t n, uint32_t d, uint32_t* rem)
+{
+  uint32_t hi, lo, q_hi, q_lo, r;
+
+  hi = (uint32_t) (n >> 32);
+  lo = (uint32_t) n;
+
+  /* Long division, 32 bits at a time. The high half of the quotient is a
+   * plain 32-bit division, and its remainder is < d, so divl can't overflow
+   * when dividing it and the low half together. */
+  q_hi = hi / d;
+  hi %= d;
+  __asm ("divl %4" : "=a" (q_lo), "=d" (r) : "a" (lo), "d" (hi), "rm" (d));
+
+  if (rem) *rem = r;
+  return ((uint64_t) q_hi << 32) | q_lo;
+}
+
+uint64_t mul_u64_u32_shr(uint64_t a, uint32_t mul, uint32_t shift)
+{
+  uint32_t hi, lo;
+  uint64_t ret;
+
+  lo = (uint32_t) a;
+  hi = (uint32_t) (a >> 32);
+
+  ret = ((uint64_t) lo * mul) >> shift;
+  if (hi)
+    ret += ((uint64_t) hi * mul) << (32 - shift);
+  return ret;
+}
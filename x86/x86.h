@@ -4,4 +4,87 @@
 void outb(uint16_t port, uint8_t value);
 uint8_t inb(uint16_t port);
 uint16_t inw(uint16_t port);
+
+/* Keeps the compiler from caching memory in registers or moving loads and
+ * stores across this point. The CPU itself never reorders stores with other
+ * stores, or loads with other loads, so this is enough for single-producer,
+ * single-consumer structures. */
+#define barrier() __asm volatile ("" : : : "memory")
+
+/* A full memory barrier, for when there's no atomic operation handy to be
+ * one: x86 lets a load pass an earlier store to somewhere else, and this
+ * doesn't let anything pass it */
+#define mb() __asm volatile ("mfence" : : : "memory")
+
+/* In spin-wait loops: tells the CPU we're spinning, so it doesn't flood the
+ * memory bus and yields to its hyperthread sibling. Also a compiler barrier,
+ * so the variable being waited on is read again each time around. */
+#define cpu_relax() __asm volatile ("pause" : : : "memory")
+
+/* Atomic operations, visible to every CPU at once. Each is a full memory
+ * barrier too: nothing moves across it, not even loads past stores. */
+
+/* Store v in *p, returning what was there */
+uint32_t atomic_xchg(volatile uint32_t* p, uint32_t v);
+
+/* If *p is old, store new in it. Returns what *p was, so it worked if that's
+ * old */
+uint32_t atomic_cmpxchg(volatile uint32_t* p, uint32_t old, uint32_t new);
+
+/* Add v to *p, returning what *p was before */
+uint32_t atomic_xadd(volatile uint32_t* p, uint32_t v);
+
+void atomic_inc(volatile uint32_t* p);
+void atomic_dec(volatile uint32_t* p);
+
+/* Set or clear bits in *p */
+void atomic_or(volatile uint32_t* p, uint32_t v);
+void atomic_and(volatile uint32_t* p, uint32_t v);
+
+/* Disable interrupts, returning the previous EFLAGS so that irq_restore can
+ * put the interrupt flag back the way it was. */
+uint32_t irq_save(void);
+void irq_restore(uint32_t flags);
+
+/* Execute CPUID with the given leaf (EAX). Any of the output pointers may be
+ * NULL if the caller doesn't care about that register. */
+void cpuid(uint32_t leaf, uint32_t* eax, uint32_t* ebx, uint32_t* ecx, uint32_t* edx);
+
+/* The same, for the leaves that have subleaves (ECX) */
+void cpuid_count(uint32_t leaf, uint32_t subleaf,
+                 uint32_t* eax, uint32_t* ebx, uint32_t* ecx, uint32_t* edx);
+
+/* Read and write Model Specific Registers */
+uint64_t rdmsr(uint32_t msr);
+void wrmsr(uint32_t msr, uint64_t value);
+
+/* Read the Time Stamp Counter */
+uint64_t rdtsc(void);
+
+/* 64-bit arithmetic. GCC turns 64-bit divisions into calls to libgcc, which
+ * we don't have, so these do it by hand. */
+
+/* n / d, storing n % d in *rem if rem isn't NULL */
+uint64_t div_u64_rem(uint64_t n, uint32_t d, uint32_t* rem);
+
+/* (a * mul) >> shift, without losing the top bits of the 96-bit product.
+ * shift must be at most 32. */
+uint64_t mul_u64_u32_shr(uint64_t a, uint32_t mul, uint32_t shift);
+
+/* Feature bits reported in EDX by CPUID leaf 1 */
+#define CPUID_FEAT_EDX_TSC    (1 << 4)
+#define CPUID_FEAT_EDX_MSR    (1 << 5)
+#define CPUID_FEAT_EDX_SEP    (1 << 11) /* sysenter/sysexit */
+#define CPUID_FEAT_EDX_PAT    (1 << 16)
+
+/* CPUID leaf 0x80000007 reports in EDX whether the TSC runs at a constant
+ * rate, no matter the power state */
+#define CPUID_LEAF_POWER_MGMT     0x80000007
+#define CPUID_PM_EDX_INVARIANT_TSC (1 << 8)
+
+/* MSRs we know about */
+#define MSR_IA32_SYSENTER_CS  0x174
+#define MSR_IA32_SYSENTER_ESP 0x175
+#define MSR_IA32_SYSENTER_EIP 0x176
+#define MSR_IA32_PAT          0x277
 #endif